@@ -2,6 +2,7 @@
 #define _VLOG_LAUNCHER_H
 
 #include <unordered_map>
+#include <mutex>
 
 #include <vlog/edb.h>
 #include <vlog/reasoner.h>
@@ -16,11 +17,18 @@ class VLogLayer : public DBLayer {
         Reasoner reasoner;
         const Predicate predQueries;
         const Predicate edbPredName;
-        char tmpText[MAX_TERM_SIZE];
+        //The web interface runs several SPARQL queries on the same layer at
+        //the same time. The caches of the estimates are shared by them
+        std::mutex cardinalitiesMutex;
         unordered_map<VTuple, double, hash_VTuple> edbCardinalities;
         unordered_map<VTuple, double, hash_VTuple> idbCardinalities;
+        //Number of distinct values in each position of an EDB pattern
+        unordered_map<VTuple, double, hash_VTuple> edbColumnCardinalities[3];
         VLIBEXP void init();
 
+        double getDistinctValues(uint64_t c1, uint64_t c2, uint64_t c3,
+                uint8_t pos, uint64_t card);
+
     public:
         VLogLayer(EDBLayer &edb, Program &p, uint64_t threshold,
                 std::string predname, std::string edbpredname) : edb(edb), p(p),
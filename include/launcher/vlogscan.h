@@ -7,6 +7,11 @@
 #include <vlog/concepts.h>
 #include <vlog/reasoner.h>
 
+// Maximum number of hint bindings pushed into the reasoner at once.
+#define VLOGSCAN_HINT_BATCH 1000
+// Number of rows after which the deadline of the query is checked.
+#define VLOGSCAN_DEADLINE_CHECK 4096
+
 class VLogScan : public DBLayer::Scan {
 private:
     const DBLayer::DataOrder order;
@@ -22,6 +27,25 @@ private:
 
     std::unique_ptr<TupleIterator> iterator;
 
+    //Sideways information passing: the (sorted) bindings from the hint that
+    //still have to be pushed into the reasoner, and the query they belong to.
+    std::unique_ptr<Literal> currentQuery;
+    std::vector<uint8_t> keypos;
+    std::vector<uint64_t> hintKeys;
+    size_t nextHintKey;
+    size_t hintBatchSize;
+    bool moreBatches;
+    bool freshIterator;
+    std::vector<uint8_t> sortByFields;
+    bool skipLastColumn;
+    size_t nreads;
+
+    bool nextBatch();
+
+    bool start(uint64_t first, bool constrained1, uint64_t second,
+               bool constrained2, uint64_t third, bool constrained3,
+               bool skipLast);
+
     Literal getLiteral(DBLayer::DataOrder order, uint64_t first, bool constrained1,
                        uint64_t second, bool constrained2, uint64_t third,
                        bool constrained3);
@@ -35,7 +59,9 @@ public:
              Program &p,
              Reasoner *r) : order(order), aggr(aggr),
         hint(hint), layer(layer),
-        p(p), r(r), predQuery(predQuery) {
+        p(p), r(r), predQuery(predQuery), nextHintKey(0),
+        hintBatchSize(VLOGSCAN_HINT_BATCH), moreBatches(false),
+        freshIterator(false), skipLastColumn(false), nreads(0) {
         switch (order) {
         case DBLayer::Order_No_Order_SPO:
         case DBLayer::Order_Subject_Predicate_Object:
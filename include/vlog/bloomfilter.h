@@ -0,0 +1,62 @@
+#ifndef _BLOOMFILTER_H
+#define _BLOOMFILTER_H
+
+#include <vector>
+#include <inttypes.h>
+
+#define BLOOM_BITS_PER_KEY 8
+#define BLOOM_NHASHES 3
+
+//Set of 64-bit hashes without false negatives. With BLOOM_BITS_PER_KEY
+//bits per key, about 3% of the hashes that were never added are
+//reported as contained.
+class BloomFilter {
+    private:
+        std::vector<uint64_t> bits;
+        uint64_t mask;
+
+    public:
+        BloomFilter(const size_t nkeys) {
+            uint64_t nbits = 64;
+            while (nbits < (uint64_t) nkeys * BLOOM_BITS_PER_KEY) {
+                nbits <<= 1;
+            }
+            bits.resize(nbits / 64);
+            mask = nbits - 1;
+        }
+
+        //Combines the hash of the fields seen so far with the next value
+        static uint64_t hash(const uint64_t h, const uint64_t value) {
+            uint64_t x = (h ^ value) * 0x9E3779B97F4A7C15ull;
+            return x ^ (x >> 29);
+        }
+
+        void add(const uint64_t h) {
+            const uint64_t step = (h >> 32) | 1;
+            uint64_t pos = h;
+            for (int i = 0; i < BLOOM_NHASHES; ++i) {
+                const uint64_t bit = pos & mask;
+                bits[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+                pos += step;
+            }
+        }
+
+        bool mayContain(const uint64_t h) const {
+            const uint64_t step = (h >> 32) | 1;
+            uint64_t pos = h;
+            for (int i = 0; i < BLOOM_NHASHES; ++i) {
+                const uint64_t bit = pos & mask;
+                if (!(bits[bit >> 6] & ((uint64_t) 1 << (bit & 63)))) {
+                    return false;
+                }
+                pos += step;
+            }
+            return true;
+        }
+
+        size_t getSizeBytes() const {
+            return bits.size() * sizeof(uint64_t);
+        }
+};
+
+#endif
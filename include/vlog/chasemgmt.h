@@ -3,13 +3,21 @@
 
 #include <vlog/column.h>
 #include <vlog/ruleexecdetails.h>
+#include <vlog/termoverflow.h>
 
 #include <vector>
 #include <map>
 #include <set>
 #include <unordered_map>
+#include <istream>
+#include <ostream>
 
 #define SIZE_BLOCK 1000
+//Number of partitions of the map from the frontier to the fresh IDs. It must
+//not depend on the number of threads, since the IDs depend on it.
+#define CHASE_SHARDS 64
+//Batches smaller than this are processed by a single thread
+#define CHASE_PARALLEL_THRESHOLD 100000
 
 #define RULE_MASK INT64_C(0xffffff0000000000)
 #define RULE_SHIFT(x) (((uint64_t) ((x) + 1)) << 40)
@@ -19,6 +27,10 @@
 #define GET_VAR(v) (((v) & VAR_MASK) >> 32)
 #define RULEVARMASK (RULE_MASK|VAR_MASK)
 #define COUNTER(v) (v & 0xFFFFFFFF)
+//The macros above work on the 64-bit values. Terms read from the tables
+//must first be decoded, since with 32-bit terms they might be in the
+//overflow table.
+#define IS_FUNCTION_TERM(t) ((TermOverflow::decode(t) & RULEVARMASK) != 0)
 
 typedef enum TypeChase {RESTRICTED_CHASE, SKOLEM_CHASE, SUM_CHASE, SUM_RESTRICTED_CHASE } TypeChase;
 
@@ -51,6 +63,8 @@ struct hash_ChaseRow {
     }
 };
 
+typedef std::unordered_map<ChaseRow, uint64_t, hash_ChaseRow> ChaseRowMap;
+
 class ChaseMgmt {
     private:
         class Rows {
@@ -60,21 +74,31 @@ class ChaseMgmt {
                 std::vector<Var_t> nameArgVars;
                 uint64_t currentcounter;
                 std::vector<std::unique_ptr<uint64_t[]>> blocks;
-                uint32_t blockCounter;
-                uint64_t *currentblock;
-                std::unordered_map<ChaseRow, uint64_t, hash_ChaseRow> rows;
+                uint64_t nstoredrows;
+                //The rows are partitioned by hash, so that a batch can be
+                //processed by several threads at the same time
+                std::vector<ChaseRowMap> shards;
                 TypeChase typeChase;
                 std::set<uint64_t> deps;    // For SUM chases.
 
+                static uint32_t getShard(const ChaseRow &row);
+
+                void reserveRows(uint64_t nrows);
+
+                uint64_t *storeRow(uint64_t idx, const uint64_t *row);
+
+                struct ProbeShards;
+                struct InsertShards;
+
             public:
                 Rows(uint64_t startCounter, uint8_t sizerow,
                         std::vector<Var_t> nameArgVars,
                         TypeChase typeChase) :
                     startCounter(startCounter), sizerow(sizerow),
                     nameArgVars(nameArgVars) {
-                        blockCounter = 0;
-                        currentblock = NULL;
+                        nstoredrows = 0;
                         currentcounter = startCounter;
+                        shards.resize(CHASE_SHARDS);
                         this->typeChase = typeChase;
                     }
 
@@ -92,8 +116,24 @@ class ChaseMgmt {
 
                 bool existingRow(uint64_t *row, uint64_t &value);
 
+                //Same as existingRow + addRow for every row in the columns,
+                //but the rows are looked up and added per shard, in
+                //parallel. Every shard receives a consecutive range of new
+                //IDs, so the result does not depend on nthreads.
+                void getOrAddRows(
+                        const std::vector<const std::vector<Term_t> *> &columns,
+                        uint64_t nrows,
+                        std::vector<uint64_t> &output,
+                        int nthreads);
+
                 bool checkRecursive(uint64_t target, uint64_t value,
                         std::set<uint64_t> &toCheck);
+
+                //The rows, their IDs and the counter, for a checkpoint.
+                //load() must be called on an empty object
+                void store(std::ostream &out);
+
+                void load(std::istream &in);
         };
 
         class RuleContainer {
@@ -120,6 +160,10 @@ class ChaseMgmt {
                 }
 
                 ChaseMgmt::Rows *getRows(Var_t var);
+
+                void store(std::ostream &out);
+
+                void load(std::istream &in);
         };
 
         std::vector<std::unique_ptr<ChaseMgmt::RuleContainer>> rules;
@@ -129,17 +173,25 @@ class ChaseMgmt {
         const int ruleToCheck;
         bool cyclic;
         PredId_t predIgnoreBlock;
+        const int nthreads;
 
         bool checkSingle(uint64_t target, uint64_t rv, std::set<uint64_t> &toCheck);
 
         bool checkRecursive(uint64_t target, uint64_t rv);
 
+        uint64_t newFunctionTerm(uint64_t term, uint64_t &freshIDs);
+
+        uint64_t functionTerm(uint64_t term, uint64_t id);
+
     public:
         ChaseMgmt(std::vector<RuleExecutionDetails> &rules,
                 const TypeChase typeChase, const bool checkCyclic,
                 const int ruleToCheck = -1,
-                const PredId_t predIgnoreBlocking = -1);
+                const PredId_t predIgnoreBlocking = -1,
+                const int nthreads = 1);
 
+        //The methods below take and return terms as they are stored in the
+        //tables (see TermOverflow)
         uint64_t getNewFunctionTerm(uint64_t term, uint64_t &freshIDs);
 
         uint64_t getFunctionTerm(uint64_t term, uint64_t id);
@@ -154,6 +206,12 @@ class ChaseMgmt {
 
         bool checkCyclicTerms(uint32_t ruleid);
 
+        //Writes the fresh IDs assigned so far, so that load() can restore
+        //them in a ChaseMgmt created for the same rules
+        void store(std::ostream &out);
+
+        void load(std::istream &in);
+
         bool checkRecursive(uint64_t rv);
 
         uint64_t countDepth(uint64_t id, uint64_t depth = 0);
@@ -0,0 +1,38 @@
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <vlog/column.h>
+
+#include <istream>
+#include <ostream>
+#include <memory>
+#include <string>
+#include <inttypes.h>
+
+//First bytes of every checkpoint file. The last character is the version
+//of the format
+#define CHECKPOINT_MAGIC "VLOGCKP1"
+#define CHECKPOINT_MAGIC_SIZE 8
+
+//Primitives of the binary format of the checkpoints written by
+//SemiNaiver::storeCheckpoint. Integers are written in LEB128 format, and
+//columns as the differences between consecutive values (see
+//SpilledColumn::write), so sorted columns take a few bytes per row. The
+//read methods throw if the input ends too early.
+class Checkpoint {
+    public:
+        static void writeInt(std::ostream &out, uint64_t v);
+
+        static uint64_t readInt(std::istream &in);
+
+        static void writeString(std::ostream &out, const std::string &s);
+
+        static std::string readString(std::istream &in);
+
+        static void writeColumn(std::ostream &out,
+                std::shared_ptr<Column> column);
+
+        static std::shared_ptr<Column> readColumn(std::istream &in);
+};
+
+#endif
@@ -194,6 +194,135 @@ class CompressedColumn final : public Column {
 };
 //----- END COMPRESSED COLUMN ----------
 
+//----- PACKED COLUMN ----------
+
+// Enable(1) or disable(0) bit-packed columns for large unsorted columns
+#define PACKED_COLUMNS 1
+// Number of values in a chunk of a PackedColumn
+#define PACKED_CHUNK_SIZE 1024
+// Columns with fewer values are never packed
+#define PACKED_MIN_SIZE 4096
+
+//Encoding of a chunk of a PackedColumn. Every value takes "bits" bits. With
+//frame-of-reference (dictSize == 0) it is the difference with "base",
+//otherwise it is the index in the (sorted) dictionary of the chunk.
+struct PackedChunk {
+    Term_t base;
+    size_t offset;  //First word of the chunk in the packed data
+    size_t dictOffset;
+    uint16_t dictSize;
+    uint8_t bits;
+};
+
+class PackedColumn final : public Column {
+    private:
+        std::vector<PackedChunk> chunks;
+        std::vector<uint64_t> data;
+        std::vector<Term_t> dicts;
+        size_t _size;
+        bool constant;
+
+        PackedColumn() : _size(0), constant(false) {
+        }
+
+    public:
+        //Returns NULL if the packed column would not take at most half of
+        //the memory of the plain one
+        static std::shared_ptr<Column> pack(const std::vector<Term_t> &values);
+
+        //Decodes the values of a chunk in out
+        void unpack(const size_t chunk, Term_t *out) const;
+
+        size_t getNChunks() const {
+            return chunks.size();
+        }
+
+        size_t size() const {
+            return _size;
+        }
+
+        size_t getRepresentationSize() const {
+            return data.size() + dicts.size() + chunks.size() * 3;
+        }
+
+        size_t estimateSize() const {
+            return _size;
+        }
+
+        Term_t getValue(const size_t pos) const;
+
+        bool supportsDirectAccess() const {
+            return true;
+        }
+
+        bool isEmpty() const {
+            return _size == 0;
+        }
+
+        std::unique_ptr<ColumnReader> getReader() const;
+
+        bool isEDB() const {
+            return false;
+        }
+
+        std::shared_ptr<Column> sort() const;
+
+        std::shared_ptr<Column> sort(const int nthreads) const;
+
+        std::shared_ptr<Column> unique() const;
+
+        bool isIn(const Term_t t) const;
+
+        bool isConstant() const {
+            return constant;
+        }
+};
+
+class PackedColumnReader final : public ColumnReader {
+    private:
+        const PackedColumn &col;
+        std::vector<Term_t> buffer;
+        size_t currentChunk;
+        size_t posInChunk;
+        size_t position;
+
+    public:
+        PackedColumnReader(const PackedColumn &col) : col(col),
+            currentChunk(0), posInChunk(0), position(0) {
+        }
+
+        Term_t first() {
+            return col.getValue(0);
+        }
+
+        Term_t last() {
+            return col.getValue(col.size() - 1);
+        }
+
+        std::vector<Term_t> asVector();
+
+        bool hasNext() {
+            return position < col.size();
+        }
+
+        Term_t next() {
+            if (position == 0 || posInChunk == PACKED_CHUNK_SIZE) {
+                if (position != 0) {
+                    currentChunk++;
+                }
+                buffer.resize(PACKED_CHUNK_SIZE);
+                col.unpack(currentChunk, buffer.data());
+                posInChunk = 0;
+            }
+            position++;
+            return buffer[posInChunk++];
+        }
+
+        void clear() {
+        }
+};
+//----- END PACKED COLUMN ----------
+
 class ColumnWriter {
     private:
         bool cached;
@@ -264,6 +393,11 @@ class ColumnWriter {
         std::shared_ptr<Column> getColumn();
 
         static std::shared_ptr<Column> getColumn(std::vector<Term_t> &values, bool isSorted);
+
+        //Column for values that run/delta compression does not handle
+        //well: a bit-packed column if it saves enough memory, or a plain
+        //one. After, "values" is empty
+        static std::shared_ptr<Column> getUncompressedColumn(std::vector<Term_t> &values);
 };
 
 //----- END GENERIC INTERFACES -------
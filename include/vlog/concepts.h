@@ -14,6 +14,8 @@
 #include <set>
 #include <map>
 #include <unordered_map>
+#include <memory>
+#include <atomic>
 
 /*** PREDICATES ***/
 #define EDB 0
@@ -70,17 +72,24 @@ class VTerm {
 };
 
 /*** TUPLES ***/
+//Tuples with at most this number of terms are stored inside the VTuple
+//itself, so that copying the literals of a rule does not allocate
+#define VTUPLE_INLINE_TERMS 4
+
 class VTuple {
     private:
         const uint8_t sizetuple;
         VTerm *terms;
+        VTerm inlineTerms[VTUPLE_INLINE_TERMS];
     public:
         VTuple(const uint8_t sizetuple) : sizetuple(sizetuple) {
-            terms = new VTerm[sizetuple];
+            terms = sizetuple <= VTUPLE_INLINE_TERMS ? inlineTerms :
+                new VTerm[sizetuple];
         }
 
         VTuple(const VTuple &v) : sizetuple(v.sizetuple) {
-            terms = new VTerm[sizetuple];
+            terms = sizetuple <= VTUPLE_INLINE_TERMS ? inlineTerms :
+                new VTerm[sizetuple];
             for (int i = 0; i < sizetuple; i++) {
                 terms[i] = v.terms[i];
             }
@@ -161,7 +170,9 @@ class VTuple {
         //L. Can I create an iterator on it? begin, end etc?
 
         ~VTuple() {
-            delete[] terms;
+            if (terms != inlineTerms) {
+                delete[] terms;
+            }
         }
 };
 
@@ -353,8 +364,12 @@ class Literal {
 class Rule {
     private:
         const uint32_t ruleId;
-        const std::vector<Literal> heads;
-        const std::vector<Literal> body;
+        //Heads and body never change after the rule is created, so the
+        //copies of a rule share them
+        const std::shared_ptr<const std::vector<Literal>> sharedHeads;
+        const std::shared_ptr<const std::vector<Literal>> sharedBody;
+        const std::vector<Literal> &heads;
+        const std::vector<Literal> &body;
         const bool _isRecursive;
         const bool existential;
         const bool egd;
@@ -368,8 +383,10 @@ class Rule {
         Rule(uint32_t ruleId, const std::vector<Literal> heads,
                 std::vector<Literal> body, bool egd) :
             ruleId(ruleId),
-            heads(heads),
-            body(body),
+            sharedHeads(std::make_shared<const std::vector<Literal>>(heads)),
+            sharedBody(std::make_shared<const std::vector<Literal>>(body)),
+            heads(*sharedHeads),
+            body(*sharedBody),
             _isRecursive(checkRecursion(heads, body)),
             existential(!getExistentialVariables().empty()),
             egd(egd) {
@@ -377,7 +394,14 @@ class Rule {
             }
 
         Rule(uint32_t ruleId, Rule &r) : ruleId(ruleId),
-        heads(r.heads), body(r.body), _isRecursive(r._isRecursive),
+        sharedHeads(r.sharedHeads), sharedBody(r.sharedBody),
+        heads(*sharedHeads), body(*sharedBody), _isRecursive(r._isRecursive),
+        existential(r.existential), egd(r.egd) {
+        }
+
+        Rule(const Rule &r) : ruleId(r.ruleId),
+        sharedHeads(r.sharedHeads), sharedBody(r.sharedBody),
+        heads(*sharedHeads), body(*sharedBody), _isRecursive(r._isRecursive),
         existential(r.existential), egd(r.egd) {
         }
 
@@ -399,13 +423,13 @@ class Rule {
             return heads;
         }
 
-        Literal getFirstHead() const {
+        const Literal &getFirstHead() const {
             // if (heads.size() > 1)
             //     LOG(WARNL) << "This method should be called only if we handle multiple heads properly...";
             return heads[0];
         }
 
-        Literal getHead(unsigned pos) const {
+        const Literal &getHead(unsigned pos) const {
             return heads[pos];
         }
 
@@ -485,6 +509,10 @@ class Program {
         std::vector<std::vector<uint32_t>> rules; // [head_predicate_id (idx) : [rule_ids]]
         std::vector<Rule> allrules;
         int rewriteCounter;
+        //Changes every time the rules change. Values are never reused, not
+        //even by different programs
+        uint64_t version;
+        static std::atomic<uint64_t> versionCounter;
 
         Dictionary dictPredicates;
         std::unordered_map<PredId_t, uint8_t> cardPredicates;
@@ -549,10 +577,14 @@ class Program {
 
         VLIBEXP void sortRulesByIDBPredicates();
 
-        VLIBEXP std::vector<Rule> getAllRules() const;
+        VLIBEXP const std::vector<Rule> &getAllRules() const;
 
         VLIBEXP int getNRules() const;
 
+        uint64_t getVersion() const {
+            return version;
+        }
+
         Program clone() const;
 
         std::shared_ptr<Program> cloneNew() const;
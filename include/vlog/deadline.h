@@ -0,0 +1,32 @@
+#ifndef _DEADLINE_H
+#define _DEADLINE_H
+
+#include <vlog/consts.h>
+
+#include <inttypes.h>
+
+//Deadline of the query that runs on the current thread (see
+//VLogUtils::execSPARQLQuery). The parts of a query that may run for long
+//(the reasoner, the scans and the iterators over the materialization)
+//call check(), which throws once the deadline has passed. A query that
+//times out thus fails, instead of returning partial results. The other
+//threads (e.g., the materialization) are not affected.
+class QueryDeadline {
+    private:
+        bool prevActive;
+        int64_t prevDeadline;
+
+    public:
+        //Sets the deadline of the current thread until the object is
+        //destroyed. 0 means no deadline
+        VLIBEXP QueryDeadline(const uint64_t timeoutMillis);
+
+        VLIBEXP ~QueryDeadline();
+
+        VLIBEXP static bool isExpired();
+
+        //Throws 10 if the deadline of the current thread has passed
+        VLIBEXP static void check();
+};
+
+#endif
@@ -17,6 +17,7 @@
 
 #include <vector>
 #include <map>
+#include <atomic>
 
 //Datatype is set in the most significant three bits
 #define IS_NUMBER(x) ((x) >> 61)
@@ -180,8 +181,17 @@ class EDBLayer {
         // need to import the mapping predid -> Predicate from prevSemiNaiver
         VLIBEXP void handlePrevSemiNaiver();
 
+        //With 32-bit terms, the IDs of the terms must fit in 31 bits (see
+        //TermOverflow). Throws if id does not
+        VLIBEXP void checkTermID(const uint64_t id) const;
+
         std::string name;
 
+        //Identity of the layer, never reused by other layers (unlike its
+        //address). See getId
+        static std::atomic<uint64_t> idCounter;
+        const uint64_t id = ++idCounter;
+
     public:
         EDBLayer(EDBLayer &db, bool copyTables = false);
 
@@ -236,6 +246,9 @@ class EDBLayer {
                         throw 10;
                     }
                 }
+                if (getNTerms() > 0) {
+                    checkTermID(getNTerms() - 1);
+                }
             }
 
         EDBLayer(const EDBConf &conf, bool multithreaded, bool loadAllData = true) :
@@ -353,6 +366,15 @@ class EDBLayer {
         VLIBEXP bool getOrAddDictNumber(const char *text,
                 const size_t sizeText, uint64_t &id);
 
+        //The terms added with getOrAddDictNumber, to store them in a
+        //checkpoint
+        VLIBEXP std::vector<std::pair<std::string, Term_t>> getAddedTerms() const;
+
+        //Adds the terms of a checkpoint. Terms that the layer already has
+        //must have the same number
+        VLIBEXP void restoreAddedTerms(
+                const std::vector<std::pair<std::string, Term_t>> &terms);
+
         VLIBEXP bool getDictText(const uint64_t id, char *text) const;
 
         VLIBEXP std::string getDictText(const uint64_t id) const;
@@ -428,6 +450,11 @@ class EDBLayer {
             return name;
         }
 
+        //Used to key caches of objects that depend on this layer
+        uint64_t getId() const {
+            return id;
+        }
+
         ~EDBLayer() {
             for (int i = 0; i < tmpRelations.size(); ++i) {
                 if (tmpRelations[i] != NULL) {
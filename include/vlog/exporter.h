@@ -1,8 +1,40 @@
+#ifndef _EXPORTER_H
+#define _EXPORTER_H
+
 #include <vlog/seminaiver.h>
 #include <vlog/consts.h>
 
 #include <trident/tree/root.h>
 
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Number of rows that an export worker formats in one go
+#define EXPORT_CHUNK_ROWS (1 << 20)
+//Number of triples in every output file of the N-Triples export
+#define EXPORT_TRIPLES_PER_FILE 10000000
+
+//Direct-mapped cache in front of the dictionary. Every export worker has its
+//own, so that only the misses go to the (shared) dictionary.
+class TermTextCache {
+    private:
+        const EDBLayer &layer;
+        std::mutex *dictMutex;
+        const uint64_t mask;
+        std::vector<uint64_t> ids;
+        std::vector<bool> found;
+        std::vector<std::string> texts;
+        char buffer[MAX_TERM_SIZE];
+
+    public:
+        TermTextCache(const EDBLayer &layer, std::mutex *dictMutex,
+                uint8_t bits = 16);
+
+        //Returns NULL if the term is not in the dictionary
+        const std::string *lookup(const uint64_t id);
+};
+
 struct _EDBPredicates {
     PredId_t id;
     size_t ruleid;
@@ -34,5 +66,8 @@ public:
 
     //void generateTridentDiffIndexTabByTab(std::string outputdir);
 
-    VLIBEXP void generateNTTriples(std::string outputdir, bool decompress);
+    VLIBEXP void generateNTTriples(std::string outputdir, bool decompress,
+            int nthreads = 1);
 };
+
+#endif
@@ -4,6 +4,8 @@
 #include <vlog/finalresultjoinproc.h>
 #include <vlog/resultjoinproc.h>
 
+class MiniChase;
+
 class ExistentialRuleProcessor : public FinalRuleProcessor {
     private:
         std::shared_ptr<ChaseMgmt> chaseMgmt;
@@ -50,7 +52,15 @@ class ExistentialRuleProcessor : public FinalRuleProcessor {
                 uint64_t &sizecolumns,
                 std::vector<std::shared_ptr<Column>> &c);
 
-        bool blocked_check(uint64_t *row, size_t sizeRow, PredId_t headPredicateToIgnore = -1);
+        bool blocked_check(uint64_t *row, size_t sizeRow, MiniChase *chase,
+                PredId_t headPredicateToIgnore = -1);
+
+        //Runs blocked_check on the first nrows rows of the columns, reusing
+        //the same saturation context for all of them. Returns the number of
+        //blocked rows.
+        size_t blocked_check(std::vector<std::shared_ptr<Column>> &columns,
+                size_t nrows, std::vector<bool> &blocked,
+                PredId_t headPredicateToIgnore = -1);
 
         std::vector<uint64_t> blocked_check_computeBodyAtoms(std::vector<Literal> &output,
                 uint64_t *row, PredId_t headPredicateToIgnore = -1); // returns row to match for the generated predicate
@@ -60,11 +70,6 @@ class ExistentialRuleProcessor : public FinalRuleProcessor {
                 uint64_t &startFreshIDs,
                 bool rmfa);
 
-        std::unique_ptr<SemiNaiver> saturateInput(
-                std::vector<Literal> &input,
-                Program *p,
-                EDBLayer *l);
-
     public:
         ExistentialRuleProcessor(
                 std::vector<std::pair<uint8_t, uint8_t>> &posFromFirst,
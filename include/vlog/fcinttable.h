@@ -10,9 +10,15 @@
 #include <string>
 #include <unordered_map>
 #include <set>
+#include <map>
+#include <atomic>
 
 // Enable(1) or disable(0) a cache for sorted InmemoryFCInternalTable.
 #define INMEMINTERNALCACHE 1
+// Memory (in bytes) that the cached sort orders of all tables together may use
+#define INMEMINTERNALCACHE_BUDGET ((size_t)512 * 1024 * 1024)
+
+class SpillManager;
 
 class FCInternalTableItr {
     public:
@@ -498,6 +504,49 @@ struct InmemoryFCInternalTableUnmergedSegment {
             }
 };
 
+#if INMEMINTERNALCACHE
+//Secondary sort order of a segment. It stores the row ids in sorted order
+//(32 bits per row whenever possible). The sorted copy of the columns is
+//also kept after the first apply, if it fits in the budget, so that the
+//next ones do not materialize it again.
+class SortPermutation {
+    private:
+        std::vector<uint32_t> idxs32;
+        std::vector<uint64_t> idxs64;
+        size_t reservedBytes;
+        mutable std::shared_ptr<const Segment> applied;
+        mutable size_t appliedBytes;
+
+        //Bytes taken by all the permutations alive, and by their sorted
+        //copies
+        static std::atomic<size_t> usedBytes;
+
+        SortPermutation() : reservedBytes(0), appliedBytes(0) {
+        }
+
+        static bool reserve(const size_t bytes);
+
+    public:
+        //Returns NULL if the permutation does not fit in the budget
+        static std::shared_ptr<const SortPermutation> create(
+                const Segment &segment,
+                const std::vector<uint8_t> &fields,
+                const int nthreads);
+
+        size_t size() const {
+            return idxs32.empty() ? idxs64.size() : idxs32.size();
+        }
+
+        //Materializes the segment in the order of the permutation. It must
+        //always be called with the same segment and firstField
+        std::shared_ptr<const Segment> apply(const Segment &segment,
+                const uint8_t firstField,
+                const int nthreads) const;
+
+        ~SortPermutation();
+};
+#endif
+
 class InmemoryFCInternalTable final : public FCInternalTable {
     private:
         const uint8_t nfields;
@@ -506,7 +555,15 @@ class InmemoryFCInternalTable final : public FCInternalTable {
         mutable std::shared_ptr<const Segment> values;
         mutable std::vector<InmemoryFCInternalTableUnmergedSegment> unmergedSegments;
 #if INMEMINTERNALCACHE
-        mutable std::map<uint32_t, std::shared_ptr<const Segment>> cachedSorted;
+        //Secondary sort orders of values, indexed by the sorting fields.
+        //They are dropped as soon as values changes (see cachedBase).
+        mutable std::map<std::vector<uint8_t>,
+                std::shared_ptr<const SortPermutation>> cachedSorted;
+        mutable std::shared_ptr<const Segment> cachedBase;
+
+        std::shared_ptr<const Segment> sortByCached(
+                const std::vector<uint8_t> &fields,
+                const int nthreads) const;
 #endif
 
         //size_t nrows;
@@ -648,6 +705,14 @@ class InmemoryFCInternalTable final : public FCInternalTable {
             return values;
         }
 
+        //Bytes taken by the columns kept in memory. Constant, EDB and
+        //spilled columns are not counted
+        size_t getResidentBytes() const;
+
+        //Sorts the rows and moves the columns that are not constant to a
+        //file of mgr. Returns the number of bytes that were freed
+        size_t spill(SpillManager &mgr) const;
+
         ~InmemoryFCInternalTable();
 };
 
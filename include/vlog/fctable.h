@@ -84,6 +84,9 @@ class FCTable {
         const uint8_t sizeRow;
 
         std::vector<FCBlock> blocks;
+        //Incremented when collapseBlocks merges blocks, which moves rows to
+        //later iterations
+        size_t nCollapses;
 
         FCCache cache;
         std::string getSignature(const Literal &literal);
@@ -108,6 +111,12 @@ class FCTable {
             }
         }
 
+        //Changes whenever the rows of a range of iterations may change
+        //without new iterations being added
+        size_t getNCollapses() const {
+            return nCollapses;
+        }
+
         size_t getMinIteration() const {
             if (blocks.size() == 0) {
                 return 0;
@@ -124,6 +133,11 @@ class FCTable {
 
         FCIterator read(const size_t mincount, const size_t maxcount) const;
 
+        //Copy of the blocks up to maxIteration. The copy does not change
+        //when blocks are added, merged or replaced afterwards
+        std::shared_ptr<const std::vector<FCBlock>> getBlocks(
+                const size_t maxIteration) const;
+
         size_t estimateCardInRange(const size_t mincount,
                 const size_t maxcount) const;
 
@@ -166,6 +180,11 @@ class FCTable {
 
         void collapseBlocks(size_t iteration, int nThreads);
 
+        //Merges and sorts the blocks, which the tables otherwise do lazily
+        //when they are read. Afterwards, the table can be read by several
+        //threads, as long as no block is added
+        void prepareForReaders(int nthreads);
+
         ~FCTable();
 };
 
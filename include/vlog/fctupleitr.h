@@ -0,0 +1,64 @@
+#ifndef _FCTUPLEITR_H
+#define _FCTUPLEITR_H
+
+#include <vlog/concepts.h>
+#include <vlog/fctable.h>
+
+#include <trident/iterators/tupleiterators.h>
+
+#include <vector>
+#include <memory>
+
+//Number of rows after which the deadline of the query is checked
+#define FCTUPLEITR_CHECK 4096
+
+//Returns the rows of an IDB table that match a query one by one, while the
+//blocks are read, instead of copying them in a TupleTable first. The
+//iterator keeps its own references to the blocks, so it remains valid
+//after the SemiNaiver is reset or deleted.
+class FCTupleItr : public TupleIterator {
+    private:
+        std::vector<std::shared_ptr<const FCInternalTable>> tables;
+        size_t currentTable;
+        FCInternalTableItr *itr;
+
+        const VTuple tuple;
+        std::vector<std::pair<uint8_t, uint8_t>> repeated;
+        std::vector<uint8_t> posToCopy; //Fields of the rows in the output
+
+        const size_t limit; //0 means no limit
+        size_t returned;
+
+        bool nextProcessed;
+        bool nextOutcome;
+
+        bool matches();
+
+        void releaseCurrentTable();
+
+    public:
+        FCTupleItr(FCIterator blocks, const Literal &query,
+                const bool returnOnlyVars, const size_t limit);
+
+        bool hasNext();
+
+        void next();
+
+        size_t getTupleSize();
+
+        uint64_t getElementAt(const int pos);   // No Term_t: overrides method in trident
+
+        const char* getUnderlyingArray(uint8_t column) {
+            return NULL;
+        }
+
+        size_t getCardinality();
+
+        std::pair<uint8_t, std::pair<uint8_t, uint8_t>> getSizeElemUnderlyingArray(uint8_t column);
+
+        void clear();
+
+        ~FCTupleItr();
+};
+
+#endif
@@ -6,6 +6,8 @@
 #include <vlog/edbiterator.h>
 #include <vlog/segment.h>
 
+#include <mutex>
+
 class InmemoryIterator : public EDBIterator {
     private:
         std::shared_ptr<const Segment> segment;
@@ -65,6 +67,9 @@ class InmemoryTable : public EDBTable {
         EDBLayer *layer;
 
         std::shared_ptr<const Segment> segment;
+        //The caches are filled by readers, which may run on several
+        //threads (see SemiNaiver::executeComponents)
+        std::mutex cacheMutex;
         std::map<uint64_t, std::shared_ptr<const Segment>> cachedSortedSegments;
         std::map<uint64_t, std::shared_ptr<HashMapEntry>> cacheHashes;
 
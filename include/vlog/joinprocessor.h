@@ -7,6 +7,7 @@
 #include <vlog/seminaiver.h>
 #include <vlog/filterer.h>
 #include <vlog/resultjoinproc.h>
+#include <vlog/bloomfilter.h>
 
 #include <inttypes.h>
 #include <mutex>
@@ -35,6 +36,28 @@ struct LessTwoTuples {
 
 #define FLUSH_SIZE (1 << 20)
 
+//Relative cost of a step of a binary search, compared to a step of a sort
+#define PROBE_COST_FACTOR 2
+
+//Joins whose estimated cost is lower are not timed (see JoinStrategyStats)
+#define JOIN_STATS_MIN_COST 100000
+
+//One in JOIN_EXPLORE_PERIOD of the timed blocks is joined with the strategy
+//that was not chosen, so that its cost is measured too, unless the static
+//model expects it to be more than JOIN_EXPLORE_MAX_RATIO times slower
+#define JOIN_EXPLORE_PERIOD 16
+#define JOIN_EXPLORE_MAX_RATIO 4
+
+//A block of the literal with at least this number of rows is filtered with
+//a Bloom filter on the join keys of the intermediate results before it is
+//sorted, if more than BLOOM_MAX_PASS_RATE of the first BLOOM_SAMPLE_ROWS
+//rows are dropped. The filter is built only if there are at most
+//BLOOM_MAX_KEYS distinct keys.
+#define BLOOM_MIN_ROWS 65536
+#define BLOOM_SAMPLE_ROWS 4096
+#define BLOOM_MAX_PASS_RATE 0.5
+#define BLOOM_MAX_KEYS (1 << 24)
+
 class Output {
     private:
 
@@ -145,6 +168,7 @@ class Output {
 };
 
 class SemiNaiver;
+class TraceSpan;
 class JoinExecutor {
     private:
 
@@ -268,7 +292,40 @@ class JoinExecutor {
         static void do_mergejoin(const FCInternalTable *filteredT1, std::vector<uint8_t> &fieldsToSortInMap,
                 std::vector<std::shared_ptr<const FCInternalTable>> &tables2,
                 const std::vector<uint8_t> &fields1, const uint8_t *posOtherVars, const std::vector<Term_t> *valuesOtherVars,
-                const std::vector<uint8_t> &fields2, ResultJoinProcessor *output, int nthreads);
+                const std::vector<uint8_t> &fields2, ResultJoinProcessor *output, int nthreads,
+                JoinStrategyStats *stats);
+
+        //Static cost of joining n1 sorted rows with a block of n2 rows,
+        //either sorting the block and merging or probing the sorted rows
+        //with every row of the block
+        static double getMergeCost(const size_t n1, const size_t n2,
+                const bool sortBlock, const int nthreads);
+
+        static double getProbeCost(const size_t n1, const size_t n2,
+                const int nthreads);
+
+        //Returns true if the block should be probed rather than sorted,
+        //according to the costs measured so far or, if there are none
+        //for both strategies, to the static model. Sometimes it returns
+        //the other strategy instead, so that both keep being measured
+        static bool preferProbe(const size_t n1, const size_t n2,
+                const bool sortBlock, const int nthreads,
+                JoinStrategyStats &stats);
+
+        static void updateStats(JoinStrategyStats &stats, const bool probe,
+                const double model, const double elapsedNs);
+
+        //Returns NULL if the rows (sorted on fields) have too many keys
+        static std::unique_ptr<BloomFilter> getKeysFilter(
+                const std::vector<const std::vector<Term_t> *> &vectors,
+                const size_t nrows, const std::vector<uint8_t> &fields);
+
+        //Copies the rows of t whose keys may be in filter to out, sorted on
+        //fields. Returns false (and leaves out empty) if the filter does
+        //not drop enough rows
+        static bool reduceBlock(const FCInternalTable *t,
+                const BloomFilter &filter, const std::vector<uint8_t> &fields,
+                const int nthreads, std::vector<std::vector<Term_t>> &out);
 
     public:
         static void do_merge_join_classicalgo(FCInternalTableItr *sortedItr1,
@@ -279,6 +336,19 @@ class JoinExecutor {
                 const Term_t *valBlocks,
                 Output *output);
 
+        //Joins the rows [l2, u2) of vectors2, in any order, with the
+        //first u1 rows of vectors1, which are sorted on fields1
+        static void do_probe_join(const std::vector<const std::vector<Term_t> *> &vectors1,
+                size_t u1,
+                const std::vector<const std::vector<Term_t> *> &vectors2,
+                size_t l2, size_t u2,
+                const std::vector<uint8_t> &fields1,
+                const std::vector<uint8_t> &fields2,
+                const uint8_t posBlocks,
+                const uint8_t nValBlocks,
+                const Term_t *valBlocks,
+                Output * output);
+
         static void do_merge_join_classicalgo(const std::vector<const std::vector<Term_t> *> &vectors1,
                 size_t l1, size_t u1,
                 const std::vector<const std::vector<Term_t> *> &vectors2,
@@ -289,6 +359,8 @@ class JoinExecutor {
                 const Term_t *valBlocks,
                 Output * output);
 
+        //The span is owned by the caller, which ends it after consolidating
+        //the output, so that it can add the rows that were kept
         static void join(SemiNaiver *naiver, const FCInternalTable * t1,
                 const std::vector<Literal> *outputLiterals, const Literal &literal,
                 const size_t min, const size_t max,
@@ -298,14 +370,16 @@ class JoinExecutor {
                 const RuleExecutionDetails &ruleDetails,
                 const RuleExecutionPlan &hv, int &processedTables,
                 const int currentLiteral,
-                const int nthreads);
+                const int nthreads,
+                TraceSpan &span);
 
         static void mergejoin(const FCInternalTable * t1, SemiNaiver *naiver,
                 const std::vector<Literal> *outputLiterals,
                 const Literal &literalToQuery,
                 const uint32_t min, const uint32_t max,
                 std::vector<std::pair<uint8_t, uint8_t>> joinsCoordinates,
-                ResultJoinProcessor * output, int nthreads);
+                ResultJoinProcessor * output, int nthreads,
+                JoinStrategyStats *stats = NULL);
 
         static void hashjoin(const FCInternalTable * t1,
                 SemiNaiver *naiver, const std::vector<Literal> *outputLiterals,
@@ -0,0 +1,124 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <vlog/consts.h>
+#include <vlog/concepts.h>
+#include <vlog/snapshot.h>
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <inttypes.h>
+
+//Number of predicates for which the derivations are counted separately.
+//The others are summed up under predicate="other".
+#define METRICS_MAX_PREDICATES 4096
+#define METRICS_NBUCKETS 11
+
+class MetricCounter {
+    private:
+        std::atomic<uint64_t> value;
+
+    public:
+        MetricCounter() : value(0) {
+        }
+
+        void add(const uint64_t n) {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void inc() {
+            add(1);
+        }
+
+        uint64_t get() const {
+            return value.load(std::memory_order_relaxed);
+        }
+
+        void reset() {
+            value.store(0, std::memory_order_relaxed);
+        }
+};
+
+//Histogram of durations, with the default buckets of Prometheus (seconds)
+class MetricHistogram {
+    private:
+        static const double bounds[METRICS_NBUCKETS];
+        std::atomic<uint64_t> buckets[METRICS_NBUCKETS + 1];
+        std::atomic<uint64_t> sumUs;
+
+    public:
+        MetricHistogram();
+
+        void observe(const std::chrono::steady_clock::duration d);
+
+        void reset();
+
+        void write(std::ostream &out, const char *name,
+                const char *help) const;
+};
+
+//Adds the time between its construction and destruction to a histogram
+class MetricTimer {
+    private:
+        MetricHistogram &histogram;
+        const std::chrono::steady_clock::time_point start;
+
+    public:
+        MetricTimer(MetricHistogram &histogram) : histogram(histogram),
+        start(std::chrono::steady_clock::now()) {
+        }
+
+        ~MetricTimer() {
+            histogram.observe(std::chrono::steady_clock::now() - start);
+        }
+};
+
+class Program;
+class EDBLayer;
+
+//Process-wide metrics, updated with relaxed atomics from the hot paths
+//and exported in the Prometheus text format (see WebInterface, /metrics).
+class RuntimeMetrics {
+    private:
+        struct PredicateEntry {
+            std::atomic<uint64_t> key; //Predicate ID + 1, 0 if free
+            std::atomic<uint64_t> derivations;
+        };
+        static PredicateEntry predicates[METRICS_MAX_PREDICATES + 1];
+
+        static PredicateEntry &getEntry(const PredId_t pred);
+
+    public:
+        static MetricCounter rulesExecuted;
+        static MetricCounter rulesWithDerivations;
+        static MetricCounter triggers;
+        static MetricCounter derivations;
+        static MetricCounter retainRowsIn;
+        static MetricCounter retainRowsOut;
+        static MetricCounter sortCacheHits;
+        static MetricCounter sortCacheMisses;
+        static MetricCounter magicCacheHits;
+        static MetricCounter magicCacheMisses;
+
+        static MetricHistogram ruleTime;
+        static MetricHistogram joinTime;
+        static MetricHistogram sortTime;
+        static MetricHistogram retainTime;
+
+        //Records a new block of rows derived for pred
+        static void addDerivations(const PredId_t pred, const uint64_t rows);
+
+        //Sets all the metrics back to zero. The predicates are numbered per
+        //program, hence it is called before a new materialization starts
+        VLIBEXP static void reset();
+
+        //Writes all metrics. program and layer (which may be NULL) are
+        //used to name the predicates and count the terms of the dictionary.
+        //The memory taken by the derivations is computed from snapshots
+        //(which may be NULL too), so it only counts the live tables
+        VLIBEXP static void write(std::ostream &out, Program *program,
+                EDBLayer *layer, const MaterializationSnapshots *snapshots);
+};
+
+#endif
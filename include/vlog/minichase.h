@@ -0,0 +1,49 @@
+#ifndef _MINI_CHASE_H
+#define _MINI_CHASE_H
+
+#include <vlog/concepts.h>
+#include <vlog/edb.h>
+#include <vlog/seminaiver.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+//Small materialization used by the blocked checks of the restricted chase
+//(RMFA/RMFC/RMSA). Every check saturates a handful of facts with the
+//program. Creating the EDB layer and the SemiNaiver for each of them is
+//what dominates the cost, so a MiniChase keeps them around and is reset
+//between checks. Instances are pooled by the SemiNaiver that runs the
+//checks (see SemiNaiver::acquireMiniChase).
+class MiniChase {
+    private:
+        Program *program;
+        std::unique_ptr<EDBLayer> layer;
+        std::unique_ptr<SemiNaiver> sn;
+
+        //EDB predicates of the outer materialization, with their arity.
+        //They all get an in-memory table, which is empty unless the input
+        //of the check contains facts for them.
+        std::map<PredId_t, uint8_t> edbPredicates;
+        //Tables filled by the previous check, which must be emptied
+        std::set<PredId_t> filledTables;
+
+    public:
+        //kb is the EDB layer that the program refers to. If copyTables is
+        //true, its tables are visible in the mini chase, unless the outer
+        //layer has a predicate with the same ID.
+        MiniChase(EDBLayer &outerLayer, EDBLayer &kb, bool copyTables,
+                Program *program);
+
+        Program *getProgram() const {
+            return program;
+        }
+
+        //Replaces the content of the mini chase with the facts in input and
+        //saturates them. The returned SemiNaiver stays valid until the next
+        //call.
+        SemiNaiver *saturate(std::vector<Literal> &input);
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef _QUERYINDEX_H
+#define _QUERYINDEX_H
+
+#include <vlog/concepts.h>
+#include <vlog/column.h>
+#include <vlog/fctable.h>
+
+#include <trident/model/table.h>
+
+#include <vector>
+#include <memory>
+#include <inttypes.h>
+
+//Sorted, duplicate-free copy of all the derivations of an IDB predicate,
+//kept in every rotation of its columns (for a binary predicate 01 and 10,
+//like the SPO/OPS permutations of a triple store). A query uses the
+//rotation that starts with the longest sequence of bound arguments, and
+//finds the matching rows with binary searches. Each rotation is a full
+//copy of the rows, except for its first column, which only keeps the
+//distinct values: the index takes about arity * arity * nrows terms.
+//While it is built, a row-major copy of all the rows of the blocks
+//(duplicates included) is also kept, and freed at the end.
+class QueryIndex {
+    private:
+        friend struct BuildPermutations;
+
+        struct Permutation {
+            std::vector<uint8_t> fields; //Columns of the predicate, in sort order
+            std::vector<Term_t> keys;    //Distinct values of the first field
+            std::vector<size_t> offsets; //First row of every key, plus nrows
+            std::vector<std::shared_ptr<Column>> columns; //The other fields
+        };
+
+        const uint8_t arity;
+        size_t nrows;
+        std::vector<Permutation> permutations;
+
+        //Builds permutation p from the rows in data (arity values per row),
+        //taken in the order given by rowIds
+        void fill(Permutation &p, const std::vector<Term_t> &data,
+                const std::vector<size_t> &rowIds) const;
+
+        //Sorts rowIds on the fields of permutation p
+        void sortRows(const Permutation &p, const std::vector<Term_t> &data,
+                std::vector<size_t> &rowIds) const;
+
+        //Number of bound arguments of query at the beginning of p
+        static size_t getNBoundPrefix(const Permutation &p,
+                const VTuple &tuple);
+
+        //Returns true if the rows returned from p are sorted on the fields
+        //of the output in sortByFields
+        static bool isSortedBy(const Permutation &p, const VTuple &tuple,
+                const bool returnOnlyVars,
+                const std::vector<uint8_t> &sortByFields);
+
+        //Restricts [start, end) to the rows where the column has value v.
+        //The column must be sorted within the range.
+        static void narrow(const Column &column, const Term_t v,
+                size_t &start, size_t &end);
+
+    public:
+        //Reads all blocks of itr, which contain rows with arity fields.
+        //The permutations are sorted with (at most) nthreads threads
+        QueryIndex(FCIterator itr, const uint8_t arity, const int nthreads);
+
+        size_t getNRows() const {
+            return nrows;
+        }
+
+        uint8_t getArity() const {
+            return arity;
+        }
+
+        //Number of Term_t that the index takes
+        size_t getRepresentationSize() const;
+
+        //Adds the rows that match query to out, in the same layout as
+        //Reasoner::getIteratorWithMaterialization. Returns true if they
+        //are already sorted on sortByFields (which may be NULL). If they
+        //are, at most limit rows are added (0 means no limit)
+        bool query(const Literal &query, const bool returnOnlyVars,
+                const std::vector<uint8_t> *sortByFields,
+                TupleTable *out, const size_t limit = 0) const;
+};
+
+#endif
@@ -13,6 +13,9 @@
 
 #include <trident/sparql/query.h>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 #define QUERY_MAT 0
 #define QUERY_ONDEM 1
@@ -32,9 +35,32 @@ struct Metrics {
 
 class Reasoner {
     private:
+        //Magic-set rewriting of a program for a (predicate, adornment)
+        //pair, with the SemiNaiver that evaluates it. Queries with the
+        //same shape only differ in the seed tuples of the input relation,
+        //so they all reuse the rewritten program and its execution plans.
+        struct MagicProgram {
+            std::shared_ptr<Program> program;
+            std::pair<PredId_t, PredId_t> inputOutputRelIDs;
+            std::unique_ptr<SemiNaiver> sn;
+            //Only one evaluation at the time can use sn
+            std::mutex mutex;
+        };
+        //Version of the original program (see Program::getVersion), id of
+        //the EDB layer (see EDBLayer::getId), predicate and adornment. The
+        //versions and the ids are never reused, so a program or a layer
+        //that was changed or deleted cannot match an old entry
+        typedef std::tuple<uint64_t, uint64_t, PredId_t, uint8_t>
+            MagicProgramKey;
 
         const uint64_t threshold;
 
+        std::map<MagicProgramKey, std::shared_ptr<MagicProgram>> magicPrograms;
+        std::mutex magicProgramsMutex;
+
+        std::shared_ptr<MagicProgram> getMagicProgram(Literal &adornedQuery,
+                EDBLayer &layer, Program &program);
+
         void cleanBindings(std::vector<Term_t> &bindings, std::vector<uint8_t> * posJoins,
                 TupleTable *input);
 
@@ -44,6 +70,10 @@ class Reasoner {
           EDBLayer &layer, Program &program, DictMgmt *dict,
           bool returnOnlyVars);*/
 
+        //Iterator on the first limit rows of table (all if limit is 0)
+        static TupleIterator *getLimitedIterator(std::shared_ptr<TupleTable> table,
+                const size_t limit);
+
         FCBlock getBlockFromQuery(Literal constantsQuery, Literal &boundQuery,
                 std::vector<uint8_t> *posJoins,
                 std::vector<Term_t> *possibleValuesJoins);
@@ -99,10 +129,15 @@ class Reasoner {
                 bool returnOnlyVars,
                 std::vector<uint8_t> *sortByFields);
 
+        //Without sortByFields (and without query indexes, see
+        //SemiNaiver::buildQueryIndexes), the answers are streamed from the
+        //derivations while they are read. At most limit answers are
+        //returned (0 means no limit)
         VLIBEXP TupleIterator *getIteratorWithMaterialization(SemiNaiver *sn,
                 Literal &query,
                 bool returnOnlyVars,
-                std::vector<uint8_t> *sortByFields);
+                std::vector<uint8_t> *sortByFields,
+                size_t limit = 0);
 
         VLIBEXP TupleIterator *getEDBIterator(Literal &query,
                 std::vector<uint8_t> * posJoins,
@@ -111,12 +146,15 @@ class Reasoner {
                 bool returnOnlyVars,
                 std::vector<uint8_t> *sortByFields);
 
+        //At most limit answers are copied out of the evaluation (0 means
+        //no limit)
         VLIBEXP TupleIterator *getMagicIterator(Literal &query,
                 std::vector<uint8_t> * posJoins,
                 std::vector<Term_t> *possibleValuesJoins,
                 EDBLayer &layer, Program &program,
                 bool returnOnlyVars,
-                std::vector<uint8_t> *sortByFields);
+                std::vector<uint8_t> *sortByFields,
+                size_t limit = 0);
 
         VLIBEXP static std::shared_ptr<SemiNaiver> getSemiNaiver(EDBLayer &layer,
                 Program *p, bool opt_intersect, bool opt_filtering, bool opt_threaded,
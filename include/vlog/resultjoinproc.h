@@ -292,6 +292,9 @@ class InterTableJoinProcessor: public ResultJoinProcessor {
 
         std::shared_ptr<const FCInternalTable> getTable();
 
+        //Rows added since the last consolidation
+        size_t getNBufferedRows() const;
+
         ~InterTableJoinProcessor();
 };
 
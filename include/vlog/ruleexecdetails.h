@@ -15,6 +15,19 @@ struct RuleExecutionDetails {
 
     uint32_t nIDBs = 0;
     std::vector<RuleExecutionPlan> orderExecutions;
+    //The plans only depend on the rule, so they are kept between runs.
+    //They point to bodyLiterals, hence a copy must create them again: the
+    //flag is reset when the details are copied or moved.
+    struct PlansFlag {
+        bool valid = false;
+        PlansFlag() {}
+        PlansFlag(const PlansFlag &) {}
+        PlansFlag &operator=(const PlansFlag &) {
+            valid = false;
+            return *this;
+        }
+    } plansValid;
+    bool plansCopyAllVars = false;
 
     std::vector<uint8_t> posEDBVarsInHead;
     std::vector<std::vector<std::pair<int, uint8_t>>> occEDBVarsInHead;
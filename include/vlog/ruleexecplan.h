@@ -6,15 +6,6 @@
 #include <map>
 
 struct RuleExecutionPlan {
-    //The two functions above were written for a full materialization. As TODO
-    //I need to remove them and replace them with the datastructurs below. They
-    //do the roughly the same thing
-    struct MatchVariables {
-        uint8_t posLiteralInOrder;
-        std::vector<std::pair<uint8_t, uint8_t>> matches;
-    };
-    std::vector<MatchVariables> matches;
-
     //When I execute the joins, the following variables contain the size of the
     //intermediate tuples, and all the positions to join and copy the results
     std::vector<uint8_t> sizeOutputRelation;
@@ -4,6 +4,7 @@
 #include <vlog/concepts.h>
 #include <vlog/edb.h>
 #include <vlog/fctable.h>
+#include <vlog/snapshot.h>
 #include <vlog/ruleexecplan.h>
 #include <vlog/ruleexecdetails.h>
 #include <vlog/chasemgmt.h>
@@ -12,7 +13,14 @@
 #include <trident/model/table.h>
 
 #include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
 #include <unordered_map>
+#include <unordered_set>
+
+//Maximum number of rows of the shared intermediate results kept at once
+#define SHARED_PREFIX_MAX_ROWS 10000000
 
 struct StatIteration {
     size_t iteration;
@@ -34,6 +42,20 @@ struct StatsRule {
     StatsRule() : idRule(-1) {}
 };
 
+//Observed cost of the two ways in which JoinExecutor::mergejoin can join
+//the intermediate results with a block of a literal: sorting the block and
+//merging, or probing the (already sorted) intermediate results with every
+//row of the block. Every factor is the measured time divided by the cost
+//that the static model predicted, 0 if the strategy was never measured
+struct JoinStrategyStats {
+    double mergeFactor;
+    double probeFactor;
+    //Blocks large enough to be measured, used to run now and then the
+    //strategy that was not chosen (see JoinExecutor::preferProbe)
+    uint64_t nMeasured;
+    JoinStrategyStats() : mergeFactor(0), probeFactor(0), nMeasured(0) {}
+};
+
 struct StatsSizeIDB {
     size_t iteration;
     int idRule;
@@ -42,6 +64,9 @@ struct StatsSizeIDB {
 
 typedef std::unordered_map<std::string, FCTable*> EDBCache;
 class ResultJoinProcessor;
+class MiniChase;
+class SpillManager;
+class QueryIndex;
 class SemiNaiver {
     private:
         std::vector<RuleExecutionDetails> allEDBRules;
@@ -70,6 +95,103 @@ class SemiNaiver {
 
         std::string name;
 
+        //Pool of contexts for the blocked checks, per program
+        std::mutex miniChasesMutex;
+        std::map<Program *, std::vector<std::unique_ptr<MiniChase>>> miniChases;
+
+        //If set, the derivations that exceed its budget are spilled to disk
+        std::shared_ptr<SpillManager> spillMgr;
+
+        //Body prefixes (see getPrefixSignature) that occur in the plans of
+        //more than one rule. Their intermediate results are computed once
+        //per range of iterations and then shared
+        std::unordered_set<std::string> sharedPrefixSignatures;
+        struct SharedPrefix {
+            //Ranges of iterations read (see getSharedPrefixKey)
+            std::string key;
+            std::shared_ptr<const FCInternalTable> table;
+            bool nonEmptyZeroRowsize;
+            size_t nrows;
+            size_t bytes;
+        };
+        std::mutex sharedPrefixesMutex;
+        //Indexed by signature: only the result of the last range is kept
+        std::unordered_map<std::string, SharedPrefix> sharedPrefixes;
+        size_t sharedPrefixesRows = 0;
+        //Memory taken by the cached results, charged to the spill budget
+        size_t sharedPrefixesBytes = 0;
+
+        //Built on request after the materialization (buildQueryIndexes),
+        //dropped as soon as the derivations change. Queries may run on
+        //other threads, so the map is never modified: a new one is
+        //published with atomic_store
+        typedef std::unordered_map<PredId_t,
+                std::shared_ptr<const QueryIndex>> QueryIndexes;
+        std::shared_ptr<const QueryIndexes> queryIndexes;
+
+        void dropQueryIndexes();
+
+        void dropQueryIndex(const PredId_t pred);
+
+        //Per rule and body predicate, see JoinStrategyStats
+        std::mutex joinStatsMutex;
+        std::unordered_map<uint64_t, JoinStrategyStats> joinStats;
+
+        //If set, the components of the program that do not depend on each
+        //other are evaluated at the same time (see executeComponents).
+        //parallelComponents is true while they run
+        bool parallelStrata = false;
+        bool parallelComponents = false;
+        std::mutex iterationMutex;
+        std::mutex listDerivationsMutex;
+        //Serializes the lookups in the dictionary of all the exports that
+        //run at the same time (see storeTable)
+        std::mutex dictMutex;
+
+        //Where the sequential evaluation of the strata is. It is stored in
+        //the checkpoints, and read back to resume the evaluation
+        struct EvaluationPoint {
+            size_t stratum = 0;
+            bool firstDone = false; //The EDB rules of the stratum were run
+            bool inExtRules = false; //In the existential rules of the stratum
+            size_t limitView = 0;
+            size_t rule = 0; //Next rule in the current ruleset
+            uint32_t rulesWithoutDerivation = 0;
+        };
+        EvaluationPoint evaluationPoint;
+        bool resuming = false; //evaluationPoint comes from a checkpoint
+        //The rules that executeRules is running
+        std::vector<std::vector<RuleExecutionDetails>> *executingIDBRules = NULL;
+        std::vector<std::vector<RuleExecutionDetails>> *executingExtIDBRules = NULL;
+
+        std::string checkpointPath;
+        uint64_t checkpointInterval = 0; //Seconds, 0 disables the checkpoints
+        std::chrono::system_clock::time_point lastCheckpoint;
+        std::string resumePath;
+
+        //EDB predicates with facts from addFacts that runIncremental has
+        //not processed yet. Their blocks start at newFactsIteration
+        std::unordered_set<PredId_t> newFactsPredicates;
+        size_t newFactsIteration = 0;
+        //Set when run completes, so that facts can be added
+        bool materialized = false;
+        //With the restricted chase, run executes copies of the rules split
+        //in the ones without and with existential variables. The blocks
+        //point to these copies, so they are kept after run
+        std::vector<RuleExecutionDetails> restrictedEDBRules;
+        std::vector<RuleExecutionDetails> restrictedExtEDBRules;
+        std::vector<std::vector<RuleExecutionDetails>> restrictedIDBRules;
+        std::vector<std::vector<RuleExecutionDetails>> restrictedExtIDBRules;
+
+        //If set, new snapshots are published after every rule execution
+        //that derives something (see getSnapshots). Readers load
+        //snapshotTables atomically, and only the writers take
+        //snapshotMutex. snapshotTables is NULL until enableSnapshots
+        std::atomic<bool> snapshots;
+        std::mutex snapshotMutex;
+        uint64_t snapshotEpoch = 0;
+        std::shared_ptr<const MaterializationSnapshots> snapshotTables;
+
     private:
         FCIterator getTableFromIDBLayer(const Literal & literal,
                 const size_t minIteration,
@@ -100,7 +222,8 @@ class SemiNaiver {
                 const RuleExecutionDetails &ruleDetails,
                 const int orderExecution,
                 std::vector<std::pair<uint8_t, uint8_t>> *filterValueVars,
-                ResultJoinProcessor *joinOutput);
+                ResultJoinProcessor *joinOutput,
+                uint64_t &ruleTriggers);
 
         void reorderPlan(RuleExecutionPlan &plan,
                 const std::vector<size_t> &cards,
@@ -118,19 +241,95 @@ class SemiNaiver {
                 std::vector<StatIteration> &costRules,
                 unsigned long *timeout = NULL);
 
+        //Executes the rule once for every body atom over a predicate of
+        //newFactsPredicates, with that atom restricted to the new facts
+        bool executeOnNewFacts(RuleExecutionDetails &ruleDetails);
+
         bool executeRule(RuleExecutionDetails &ruleDetails,
                 std::vector<Literal> &heads,
                 const size_t iteration,
                 const size_t limitView,
                 std::vector<ResultJoinProcessor*> *finalResultContainer);
 
+        //Returns the iteration in which the next rule is executed
+        size_t claimIteration();
+
+        //Returns false if the rules cannot be split in components that run
+        //concurrently
+        bool canExecuteComponents(
+                const std::vector<std::vector<RuleExecutionDetails>> &IDBRules);
+
+        //Evaluates the IDB rules of all strata, grouped by the strongly
+        //connected components of the predicate dependency graph. A component
+        //starts as soon as all components it reads (also through negated
+        //atoms) are saturated, on one of at most nthreads threads
+        void executeComponents(
+                std::vector<std::vector<RuleExecutionDetails>> &IDBRules,
+                std::vector<StatIteration> &costRules,
+                unsigned long *timeout);
+
+        void enforceMemoryBudget(
+                const std::vector<RuleExecutionDetails> &ruleset);
+
+        //Writes the derivations, the iteration, the state of the rules and
+        //of the chase and the added terms to path, in the format of
+        //Checkpoint. The file is replaced only once it is complete
+        void storeCheckpoint(const std::string &path);
+
+        //Restores a checkpoint written by storeCheckpoint for the same
+        //program and EDB layer. The tables must be empty
+        void loadCheckpoint(const std::string &path);
+
+        void checkpointIfDue();
+
+        //Publishes new snapshots where the predicates in preds have their
+        //blocks up to maxIteration, and the others are unchanged. With
+        //preds == NULL, all the predicates are taken again
+        void publishSnapshot(const std::vector<PredId_t> *preds = NULL,
+                const size_t maxIteration = ~0lu);
+
+        static std::string getPrefixSignature(const RuleExecutionPlan &plan,
+                const int idx);
+
+        void detectSharedPrefixes();
+
+        //Returns false if the result of the prefix cannot be shared. The
+        //key is computed from the bounds of the iterations, without reading
+        //the blocks
+        bool getSharedPrefixKey(const RuleExecutionDetails &ruleDetails,
+                const RuleExecutionPlan &plan, const int idx,
+                const size_t iteration, std::string &signature,
+                std::string &key);
+
+        bool getSharedPrefix(const std::string &signature,
+                const std::string &key, SharedPrefix &prefix);
+
+        void addSharedPrefix(const std::string &signature,
+                const std::string &key,
+                std::shared_ptr<const FCInternalTable> table,
+                const bool nonEmptyZeroRowsize);
+
+        void clearSharedPrefixes();
+
+        size_t getSharedPrefixesBytes();
+
+        //Rows that the heads received in the given iteration
+        size_t getRowsOfIteration(const std::vector<Literal> &heads,
+                const size_t iteration);
+
         size_t estimateCardTable(const Literal &literal,
                 const size_t minIteration,
                 const size_t maxIteration);
 
 	bool checkEmpty(const Literal *lit);
 
+        void storeTable(std::ostream &streamout, const PredId_t pred,
+                const bool decompress, const bool csv, const bool binary,
+                const int workers);
+
     protected:
+        //Keeps the overflow terms of this materialization
+        TermOverflow::User overflowUser;
         TypeChase typeChase;
         bool checkCyclicTerms;
         bool foundCyclicTerms;
@@ -145,7 +344,7 @@ class SemiNaiver {
         // one entry for each stratification class
         size_t iteration;
         int nthreads;
-        uint64_t triggers;
+        std::atomic<uint64_t> triggers;
 
         bool executeRule(RuleExecutionDetails &ruleDetails,
                 const size_t iteration,
@@ -216,6 +415,45 @@ class SemiNaiver {
 
         virtual FCTable *getTable(const PredId_t pred, const int card);
 
+        //Removes all derived (and cached EDB) tables, so that the program
+        //can be run again from scratch on a modified EDB layer
+        VLIBEXP void reset();
+
+        //Returns a context to run blocked checks with program p, which is
+        //either the program of this materialization or the RMFC program.
+        //It must be given back with releaseMiniChase.
+        std::unique_ptr<MiniChase> acquireMiniChase(Program *p);
+
+        void releaseMiniChase(std::unique_ptr<MiniChase> chase);
+
+        //Blocks derived before the current semi-naive window are spilled to
+        //disk when the derivations take more memory than the budget of mgr
+        void setSpillManager(std::shared_ptr<SpillManager> mgr) {
+            spillMgr = mgr;
+        }
+
+        //Evaluates the independent parts of the program concurrently. It
+        //has no effect if nthreads < 2, or if the program has existential
+        //rules or EGDs
+        void setParallelStrata(bool value) {
+            parallelStrata = value;
+        }
+
+        //Every intervalSeconds, the state of the materialization is written
+        //to path, between the executions of two rules. Checkpoints are not
+        //taken while the strata run in parallel
+        void setCheckpoint(const std::string &path,
+                const uint64_t intervalSeconds) {
+            checkpointPath = path;
+            checkpointInterval = intervalSeconds;
+        }
+
+        //The next run continues the materialization stored in the
+        //checkpoint in path, instead of starting from scratch
+        void setResume(const std::string &path) {
+            resumePath = path;
+        }
+
         VLIBEXP void run(size_t lastIteration,
                 size_t iteration,
                 unsigned long *timeout = NULL,
@@ -223,11 +461,31 @@ class SemiNaiver {
                 int singleRule = -1,
                 PredId_t predIgnoreBlock = -1);
 
+        //Appends the facts to the EDB predicate pred, as a block of a new
+        //iteration in the materialization (the EDB layer is not modified).
+        //Their consequences are derived by runIncremental. It fails if the
+        //facts could invalidate a derivation, i.e., if some rule negates
+        //a predicate that depends on pred. Returns the number of distinct
+        //facts in the block
+        VLIBEXP size_t addFacts(const PredId_t pred,
+                const std::vector<std::vector<Term_t>> &facts);
+
+        VLIBEXP size_t addFacts(const PredId_t pred,
+                const std::vector<std::vector<std::string>> &facts);
+
+        //Continues the semi-naive evaluation from the current iteration,
+        //deriving only what follows from the facts added since the last
+        //run or runIncremental
+        VLIBEXP void runIncremental(unsigned long *timeout = NULL);
+
+        //If binary is set, the rows are written as raw Term_t values.
+        //workers <= 0 means that all nthreads workers are used.
         VLIBEXP void storeOnFile(std::string path, const PredId_t pred, const bool decompress,
-                const int minLevel, const bool csv);
+                const int minLevel, const bool csv, const bool binary = false,
+                int workers = -1);
 
         VLIBEXP void storeOnFiles(std::string path, const bool decompress,
-                const int minLevel, const bool csv);
+                const int minLevel, const bool csv, const bool binary = false);
 
         std::ostream& dumpTables(std::ostream &os) {
             for (PredId_t i = 0; i < MAX_NPREDS; ++i) {
@@ -268,6 +526,41 @@ class SemiNaiver {
 
         VLIBEXP size_t getSizeTable(const PredId_t predid) const;
 
+        //Consolidates the derivations of every IDB predicate in sorted
+        //permutations (see QueryIndex), which
+        //Reasoner::getIteratorWithMaterialization uses to answer queries
+        //with bound arguments without scanning all blocks. It must not run
+        //concurrently with the materialization, but queries can run while
+        //it does (they use the previous indexes, or none). Each index takes
+        //about arity times the memory of the deduplicated rows, in addition
+        //to the blocks, which are kept (see QueryIndex)
+        VLIBEXP void buildQueryIndexes();
+
+        //Returns NULL if pred has no index. It can be called from any
+        //thread
+        std::shared_ptr<const QueryIndex> getQueryIndex(const PredId_t pred) const;
+
+        //Lets getSnapshot follow the materialization, so that the tables
+        //can be queried while it runs
+        VLIBEXP void enableSnapshots();
+
+        //The last published snapshots of all the predicates (NULL if
+        //snapshots are disabled). It can be read from any thread. To read
+        //several predicates in the same epoch, load them once
+        VLIBEXP std::shared_ptr<const MaterializationSnapshots> getSnapshots() const;
+
+        //The snapshot of pred in getSnapshots() (an empty one if
+        //snapshots are disabled)
+        VLIBEXP std::shared_ptr<const MaterializationSnapshot> getSnapshot(
+                const PredId_t pred) const;
+
+        //The costs observed in the previous joins of rule with pred
+        JoinStrategyStats getJoinStats(const size_t ruleid,
+                const PredId_t pred);
+
+        void setJoinStats(const size_t ruleid, const PredId_t pred,
+                const JoinStrategyStats &stats);
+
         bool isEmpty(const PredId_t predid) const;
 
         std::vector<FCBlock> &getDerivationsSoFar() {
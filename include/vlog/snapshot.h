@@ -0,0 +1,73 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <vlog/concepts.h>
+#include <vlog/segment.h>
+
+#include <vector>
+#include <memory>
+#include <inttypes.h>
+
+class FCInternalTable;
+
+//Immutable view of the derivations of one predicate of a SemiNaiver (see
+//SemiNaiver::enableSnapshots). A reader pins a snapshot by holding the
+//pointer returned by SemiNaiver::getSnapshot, and can read it while the
+//materialization continues without taking any lock. The snapshot does not
+//point to the tables of the materialization, which merge and sort their
+//rows lazily even in their const methods, but to segments that were
+//finalized by the writer. The blocks of EDB tables are not copied: these
+//tables are immutable and are read directly. The segments that newer
+//snapshots no longer contain are freed when the last snapshot of an older
+//epoch is released.
+class MaterializationSnapshot {
+    public:
+        struct Block {
+            size_t iteration;
+            //-1 if the rows were not derived by a rule
+            int ruleid;
+            //NULL if source is an EDB table
+            std::shared_ptr<const Segment> rows;
+            //Table of the materialization the rows were taken from. Only
+            //the EDB tables are read, the others are only compared to reuse
+            //the rows in the next snapshot
+            std::shared_ptr<const FCInternalTable> source;
+            size_t nrows;
+        };
+
+    private:
+        const uint64_t epoch;
+        const std::vector<Block> blocks;
+        size_t nrows;
+
+    public:
+        MaterializationSnapshot(const uint64_t epoch,
+                std::vector<Block> &&blocks) :
+            epoch(epoch), blocks(std::move(blocks)), nrows(0) {
+            for (const auto &block : this->blocks) {
+                nrows += block.nrows;
+            }
+        }
+
+        //Epoch of the SemiNaiver when the rows of the predicate last
+        //changed
+        uint64_t getEpoch() const {
+            return epoch;
+        }
+
+        //The segments are valid as long as the snapshot is
+        const std::vector<Block> &getBlocks() const {
+            return blocks;
+        }
+
+        size_t getNRows() const {
+            return nrows;
+        }
+};
+
+//The snapshots of all the predicates, indexed by PredId_t. A SemiNaiver
+//publishes them together, so that a reader sees one consistent epoch
+typedef std::vector<std::shared_ptr<const MaterializationSnapshot>>
+    MaterializationSnapshots;
+
+#endif
@@ -11,6 +11,18 @@
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
+#include <list>
+#include <mutex>
+
+// Number of results requested at once (LIMIT/OFFSET pagination)
+#define SPARQL_PAGE_SIZE 10000
+// Maximum number of bindings sent in a single VALUES clause
+#define SPARQL_VALUES_BATCH 500
+// Maximum number of concurrent requests to the endpoint
+#define SPARQL_MAX_CONNECTIONS 4
+// Maximum number of query results kept in the cache
+#define SPARQL_CACHE_SIZE 64
+
 class SparqlTable : public EDBTable {
     private:
 	PredId_t predid;
@@ -19,13 +31,30 @@ class SparqlTable : public EDBTable {
 	EDBLayer *layer;
 	std::vector<std::string> fieldVars;
 	std::string whereBody;
+	//Serializes the use of curl and of the caches, since the table may
+	//be read by several threads (see SemiNaiver::executeComponents)
+	std::recursive_mutex mutex;
 	std::unordered_map<uint64_t, std::shared_ptr<const Segment>> cachedSegments;
-	std::unordered_map<std::string, json> cachedTables;
+	//LRU cache of the results of the queries
+	std::list<std::string> cacheLRU;
+	std::unordered_map<std::string, std::pair<json,
+	    std::list<std::string>::iterator>> cachedTables;
+
+        std::string termToSparql(uint64_t value);
 
-        std::string generateQuery(const Literal &query);
+        std::string generateQuery(const Literal &query,
+                const std::string &values = "");
 
 	json launchQuery(std::string sparqlQuery);
 
+	std::vector<json> launchQueries(const std::vector<std::string> &queries);
+
+	json launchPaginatedQuery(const Literal &query);
+
+	std::vector<json> launchValuesQueries(const Literal &query,
+		const std::vector<uint8_t> &posToFilter,
+		const std::vector<Term_t> &valuesToFilter);
+
     public:
         virtual uint8_t getArity() const {
             return fieldVars.size();
@@ -56,6 +85,13 @@ class SparqlTable : public EDBTable {
         EDBIterator *getSortedIterator(const Literal &query,
                 const std::vector<uint8_t> &fields);
 
+        using EDBTable::checkNewIn;
+
+        std::vector<std::shared_ptr<Column>> checkNewIn(
+                std::vector<std::shared_ptr<Column>> &checkValues,
+                const Literal &l2,
+                std::vector<uint8_t> &posInL2);
+
         bool getDictNumber(const char *text, const size_t sizeText,
                 uint64_t &id);
 
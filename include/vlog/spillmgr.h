@@ -0,0 +1,243 @@
+#ifndef _SPILL_MGR_H
+#define _SPILL_MGR_H
+
+#include <vlog/column.h>
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Size of the buffers used to read back spilled columns
+#define SPILL_READ_BUFFER (64 * 1024)
+
+class FCTable;
+class SpillManager;
+
+//File that contains the spilled columns of one table. It is removed from
+//disk as soon as no column refers to it anymore.
+class SpillFile {
+    private:
+        const std::string path;
+
+    public:
+        SpillFile(std::string path) : path(path) {
+        }
+
+        const std::string &getPath() const {
+            return path;
+        }
+
+        ~SpillFile();
+};
+
+//Column whose values are stored on disk. Every value is written as the
+//zigzag-encoded difference with the previous one, in LEB128 format, so
+//sorted columns take a few bytes per row. Readers stream the values from
+//the file. Random accesses load the whole column in memory, where it stays
+//until the SpillManager unloads it.
+class SpilledColumn final : public Column {
+    private:
+        std::shared_ptr<const SpillFile> file;
+        const uint64_t offset;
+        const uint64_t length;
+        const size_t _size;
+        const Term_t firstValue;
+        const Term_t lastValue;
+
+        mutable std::mutex mutex;
+        mutable std::shared_ptr<const std::vector<Term_t>> loaded;
+        //Same vector as loaded, read by getValue without locking. unload()
+        //is never called while values are being read
+        mutable std::atomic<const std::vector<Term_t>*> loadedValues;
+
+    public:
+        SpilledColumn(std::shared_ptr<const SpillFile> file,
+                const uint64_t offset, const uint64_t length, const size_t size,
+                const Term_t firstValue, const Term_t lastValue) :
+            file(file), offset(offset), length(length), _size(size),
+            firstValue(firstValue), lastValue(lastValue), loadedValues(NULL) {
+            }
+
+        //Appends the encoding of the values read from r to out. Returns the
+        //number of bytes that were written.
+        static uint64_t write(ColumnReader &r, std::ostream &out,
+                Term_t &first, Term_t &last, size_t &count);
+
+        std::shared_ptr<const std::vector<Term_t>> load() const;
+
+        //Frees the values loaded by getValue() and the like. Must be called
+        //only when no reader or vector reference is in use
+        void unload();
+
+        size_t getLoadedBytes() const;
+
+        const SpillFile &getFile() const {
+            return *file;
+        }
+
+        uint64_t getOffset() const {
+            return offset;
+        }
+
+        uint64_t getLength() const {
+            return length;
+        }
+
+        size_t size() const {
+            return _size;
+        }
+
+        size_t getRepresentationSize() const {
+            return _size;
+        }
+
+        size_t estimateSize() const {
+            return _size;
+        }
+
+        bool isEmpty() const {
+            return _size == 0;
+        }
+
+        bool isEDB() const {
+            return false;
+        }
+
+        Term_t getValue(const size_t pos) const {
+            const std::vector<Term_t> *values =
+                loadedValues.load(std::memory_order_acquire);
+            if (values == NULL) {
+                values = load().get();
+            }
+            return (*values)[pos];
+        }
+
+        Term_t first() const {
+            return firstValue;
+        }
+
+        Term_t last() const {
+            return lastValue;
+        }
+
+        bool supportsDirectAccess() const {
+            return true;
+        }
+
+        std::unique_ptr<ColumnReader> getReader() const;
+
+        std::shared_ptr<Column> sort() const;
+
+        std::shared_ptr<Column> sort(const int nthreads) const;
+
+        std::shared_ptr<Column> unique() const;
+
+        bool isIn(const Term_t t) const;
+
+        //Constant columns are never spilled
+        bool isConstant() const {
+            return _size < 2;
+        }
+};
+
+class SpilledColumnReader final : public ColumnReader {
+    private:
+        const SpilledColumn &col;
+        //Set if the column was loaded when the reader was created
+        std::shared_ptr<const std::vector<Term_t>> values;
+
+        std::ifstream in;
+        std::vector<char> buffer;
+        size_t posBuffer;
+        size_t endBuffer;
+        uint64_t toRead;
+
+        size_t position;
+        Term_t prev;
+
+        void fillBuffer();
+
+        uint8_t nextByte() {
+            if (posBuffer == endBuffer) {
+                fillBuffer();
+            }
+            return (uint8_t) buffer[posBuffer++];
+        }
+
+    public:
+        SpilledColumnReader(const SpilledColumn &col,
+                std::shared_ptr<const std::vector<Term_t>> values);
+
+        Term_t first() {
+            return col.first();
+        }
+
+        Term_t last() {
+            return col.last();
+        }
+
+        std::vector<Term_t> asVector() {
+            return *col.load();
+        }
+
+        bool hasNext() {
+            return position < col.size();
+        }
+
+        Term_t next();
+
+        void clear() {
+            if (in.is_open()) {
+                in.close();
+            }
+        }
+};
+
+//Keeps the memory taken by the derivations of a materialization within a
+//budget. When enforce() finds that the blocks of the IDB tables take more
+//than that, it writes the oldest ones to disk (see
+//InmemoryFCInternalTable::spill), sorted, so that duplicate elimination can
+//still merge against them sequentially.
+class SpillManager {
+    private:
+        const std::string dir;
+        const size_t budget;
+        std::atomic<uint64_t> counter;
+
+        //Spilled columns, to unload them when the budget is exceeded
+        std::mutex mutex;
+        std::vector<std::weak_ptr<SpilledColumn>> columns;
+
+        //Bytes taken by the spilled columns that are loaded in memory
+        size_t getLoadedBytes();
+
+        void unloadColumns();
+
+    public:
+        SpillManager(std::string dir, size_t budgetBytes);
+
+        size_t getBudget() const {
+            return budget;
+        }
+
+        //Returns a fresh file to spill a table
+        std::shared_ptr<const SpillFile> newFile();
+
+        void registerColumn(std::shared_ptr<SpilledColumn> column);
+
+        //Spills the blocks of tables derived before iteration minIteration
+        //(oldest first) until the memory they take is within the budget.
+        //cacheBytes is the memory taken by caches of intermediate results,
+        //which count against the budget too: dropCaches is called to free
+        //them before anything is spilled. It must be called when no rule is
+        //being executed.
+        void enforce(const std::vector<FCTable*> &tables,
+                const size_t minIteration, const size_t cacheBytes,
+                std::function<void()> dropCaches);
+};
+
+#endif
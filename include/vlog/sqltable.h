@@ -5,9 +5,46 @@
 #include <vlog/segment.h>
 #include <vlog/edbiterator.h>
 
+#include <mutex>
+#include <unordered_map>
+#include <list>
+
+// Results with more rows than this are not cached.
+#define SQL_CACHE_MAXROWS (1 << 22)
+// Memory taken by the cached results of a table. The least recently used
+// ones are evicted first.
+#define SQL_CACHE_MAXBYTES (((size_t) 1) << 30)
+
 class SQLTable : public EDBTable {
 private:
-    SegmentInserter *getInserter(const Literal &query);
+    //The EDB does not change, so the results of the queries (one per
+    //pattern of constants and, if sorted, per sorting order) can be cached.
+    //cacheLRU contains the keys, the most recently used first.
+    struct CachedSegment {
+        std::shared_ptr<const Segment> segment;
+        size_t bytes;
+        std::list<std::string>::iterator lru;
+    };
+    std::mutex cacheMutex;
+    std::unordered_map<std::string, CachedSegment> cachedSegments;
+    std::list<std::string> cacheLRU;
+    size_t cachedBytes = 0;
+
+    std::string getSQLQuery(const Literal &query);
+
+    std::shared_ptr<const Segment> getSegment(const Literal &query);
+
+    std::shared_ptr<const Segment> getSortedSegment(const Literal &query,
+            const std::vector<uint8_t> &fields);
+
+    std::shared_ptr<const Segment> getCachedSegment(const std::string &key);
+
+    void cacheSegment(const std::string &key,
+            std::shared_ptr<const Segment> segment);
+
+    std::string filterToSQLCondition(std::vector<uint8_t> *posToFilter,
+            std::vector<Term_t>::const_iterator begin,
+            std::vector<Term_t>::const_iterator end);
 public:
     PredId_t predid;
     std::string tablename;
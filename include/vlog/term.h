@@ -5,11 +5,19 @@
 
 // The three defines below are settable.
 
+#ifdef VLOG_TERM32
+// 32-bit terms (cmake -DTERM32=1). Values that do not fit, such as the
+// terms introduced by the chase, go through a side table (see
+// vlog/termoverflow.h).
+#define __TERM_TYPE uint32_t
+#define __TERM_TYPE_IS_UINT64_T 0
+#else
 // Set this to the unsigned integer type that will contain the values.
 #define __TERM_TYPE uint64_t
 
 // Set this to 1 if __TERM_TYPE is uint64_t, 0 otherwise.
 #define __TERM_TYPE_IS_UINT64_T 1
+#endif
 
 // Set this to 1 if the Term_t type should be a struct, or 0 if it should be the unsigned
 // integer type itself.
@@ -0,0 +1,94 @@
+#ifndef _TERM_OVERFLOW_H
+#define _TERM_OVERFLOW_H
+
+#include <vlog/term.h>
+
+#include <inttypes.h>
+#include <vector>
+
+//Conversion between 64-bit values and Term_t. With 64-bit terms it does
+//nothing. With 32-bit terms, the values that do not fit in 31 bits (e.g.,
+//the function terms created by ChaseMgmt) are stored in a side table, and
+//the term is their index in the table with the highest bit set. The table
+//is append-only: decoding does not lock, only adding a value does.
+class TermOverflow {
+    public:
+        //Every materialization holds one (see SemiNaiver). When the last
+        //one is destroyed the side table is emptied, so that the values of
+        //a program do not stay in the table for the next ones
+        class User {
+            public:
+#if TERM_IS_UINT64
+                User() {
+                }
+#else
+                User();
+
+                ~User();
+#endif
+                User(const User&) = delete;
+                User &operator=(const User&) = delete;
+        };
+
+#if TERM_IS_UINT64
+        static Term_t encode(const uint64_t v) {
+            return v;
+        }
+
+        static uint64_t decode(const uint64_t t) {
+            return t;
+        }
+
+        static void encode(std::vector<uint64_t> &values,
+                std::vector<Term_t> &terms) {
+            terms.swap(values);
+        }
+
+        static uint64_t size() {
+            return 0;
+        }
+
+        static std::vector<uint64_t> getValues() {
+            return std::vector<uint64_t>();
+        }
+
+        static void restore(const std::vector<uint64_t> &values);
+#else
+        static const uint64_t FLAG = ((uint64_t) 1) << 31;
+
+        static Term_t encode(const uint64_t v) {
+            if (v < FLAG) {
+                return (Term_t) v;
+            }
+            return add(v);
+        }
+
+        //Decoding an already decoded value returns it unchanged
+        static uint64_t decode(const uint64_t t) {
+            if (t < FLAG || t >= (FLAG << 1)) {
+                return t;
+            }
+            return get(t);
+        }
+
+        static void encode(std::vector<uint64_t> &values,
+                std::vector<Term_t> &terms);
+
+        //Number of values in the side table
+        static uint64_t size();
+
+        //The side table, to store it in a checkpoint
+        static std::vector<uint64_t> getValues();
+
+        //Replaces the side table with values (from a checkpoint). It must
+        //be called before any value is encoded
+        static void restore(const std::vector<uint64_t> &values);
+
+    private:
+        static Term_t add(const uint64_t v);
+
+        static uint64_t get(const uint64_t t);
+#endif
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <vlog/consts.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+struct TraceEvent {
+    const char *category;
+    std::string name;
+    uint64_t ts;    //Microseconds since Tracer::start()
+    uint64_t dur;
+    int tid;
+    std::string args;   //JSON members, without the braces
+};
+
+//Collects the spans recorded with TraceSpan and writes them in the Chrome
+//trace event format, which can be loaded in chrome://tracing or Perfetto.
+//When tracing is not enabled, a span costs a single atomic load.
+class Tracer {
+    private:
+        static std::atomic<bool> enabled;
+        static std::chrono::steady_clock::time_point origin;
+        static std::mutex mutex;
+        static std::vector<TraceEvent> events;
+
+    public:
+        static bool isEnabled() {
+            return enabled.load(std::memory_order_relaxed);
+        }
+
+        VLIBEXP static void start();
+
+        VLIBEXP static void stop();
+
+        //Writes the events recorded so far to path, and discards them
+        VLIBEXP static void write(const std::string &path);
+
+        static uint64_t now();
+
+        //Small sequential id of the calling thread
+        static int getThreadId();
+
+        static void add(TraceEvent &event);
+
+        static std::string escape(const std::string &s);
+};
+
+//Records the time between its construction and destruction as a complete
+//("X") event, with the arguments given with set().
+class TraceSpan {
+    private:
+        const bool active;
+        const char *category;
+        std::string name;
+        uint64_t start;
+        std::string args;
+
+        void addKey(const char *key) {
+            if (!args.empty()) {
+                args += ",";
+            }
+            args += "\"";
+            args += key;
+            args += "\":";
+        }
+
+    public:
+        TraceSpan(const char *category, const char *name) :
+            active(Tracer::isEnabled()), category(category), start(0) {
+                if (active) {
+                    this->name = name;
+                    start = Tracer::now();
+                }
+            }
+
+        bool isActive() const {
+            return active;
+        }
+
+        void setName(const std::string &name) {
+            if (active) {
+                this->name = name;
+            }
+        }
+
+        void set(const char *key, const uint64_t value) {
+            if (active) {
+                addKey(key);
+                args += std::to_string(value);
+            }
+        }
+
+        void set(const char *key, const double value) {
+            if (active) {
+                addKey(key);
+                args += std::to_string(value);
+            }
+        }
+
+        void set(const char *key, const std::string &value) {
+            if (active) {
+                addKey(key);
+                args += "\"" + Tracer::escape(value) + "\"";
+            }
+        }
+
+        //Sets the input and output row counts, and the fraction of input
+        //rows that did not make it to the output
+        void setRows(const uint64_t in, const uint64_t out) {
+            if (active) {
+                set("rowsIn", in);
+                setOutput(in, out);
+            }
+        }
+
+        //Sets the rows produced, and the fraction of them that were
+        //dropped as duplicates (kept is the number of the others)
+        void setOutput(const uint64_t produced, const uint64_t kept) {
+            if (active) {
+                set("rowsOut", produced);
+                set("dupRatio", produced > 0 && kept <= produced ?
+                        (double) (produced - kept) / produced : 0.0);
+            }
+        }
+
+        ~TraceSpan();
+};
+
+#endif
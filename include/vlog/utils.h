@@ -19,7 +19,10 @@ class VLogUtils {
                 DBLayer &db);
     public:
         VLIBEXP static std::string csvString(std::string);
-        VLIBEXP static void execSPARQLQuery(std::string sparqlquery,
+        //Returns false if the query did not finish within timeoutMillis.
+        //The results that were already added to jsonresults (or printed)
+        //are incomplete and must be discarded
+        VLIBEXP static bool execSPARQLQuery(std::string sparqlquery,
                 bool explain,
                 long nterms,
                 DBLayer &db,
@@ -27,7 +30,10 @@ class VLogUtils {
                 bool jsonoutput,
                 JSON *jsonvars,
                 JSON *jsonresults,
-                JSON *jsonstats);
+                JSON *jsonstats,
+                //Milliseconds after which the query is stopped. 0 means no
+                //limit
+                const uint64_t timeoutMillis = 0);
 
 };
 #endif
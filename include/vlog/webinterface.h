@@ -22,6 +22,7 @@
 #include <rts/runtime/QueryDict.hpp>
 
 #include <map>
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 
@@ -29,15 +30,31 @@ class VLogLayer;
 class WebInterface {
     protected:
         ProgramArgs &vm;
-        std::unique_ptr<Program> program;
-        std::unique_ptr<EDBLayer> edb;
-        std::unique_ptr<VLogLayer> vloglayer;
-        std::unique_ptr<TridentLayer> tridentlayer;
-
-        void setupTridentLayer();
+        //The KB that the requests use. /setup replaces it as a whole, and
+        //the requests that are running keep the previous one (see
+        //processRequest). Guarded by mtxKB, together with mat
+        std::shared_ptr<Program> program;
+        std::shared_ptr<EDBLayer> edb;
+        std::shared_ptr<VLogLayer> vloglayer;
+        std::shared_ptr<TridentLayer> tridentlayer;
+        std::mutex mtxKB;
+
+        //Returns NULL if the EDB layer is not a single RDF graph
+        static std::shared_ptr<TridentLayer> setupTridentLayer(EDBLayer &edb);
+
+        //A materialization with the KB it was created on, which it needs
+        //as long as anybody uses it. The KB of the materialization passed
+        //to the constructor belongs to the caller, so edb and program are
+        //NULL in that case
+        struct Materialization {
+            std::shared_ptr<EDBLayer> edb;
+            std::shared_ptr<Program> program;
+            std::shared_ptr<SemiNaiver> sn;
+        };
 
     private:
-        std::shared_ptr<SemiNaiver> sn;
+        //Replaced as a whole by /launchMat. Guarded by mtxKB
+        std::shared_ptr<const Materialization> mat;
         std::thread t;
         std::thread matRunner;
         std::mutex mtxMatRunner;
@@ -47,11 +64,13 @@ class WebInterface {
 
         std::shared_ptr<HttpServer> server;
 
-        bool isActive;
+        std::atomic<int> nActiveRequests;
         std::string edbFile;
         int webport;
-        int nthreads;
+        int nthreads; //Of the server
+        uint64_t sparqlTimeout; //Milliseconds, 0 means no limit
 
+        std::mutex mtxCache;
         map<std::string, std::string> cachehtml;
 
         void startThread(int port);
@@ -60,7 +79,9 @@ class WebInterface {
 
         void processRequest(std::string req, std::string &resp);
 
-        void getResultsQueryLiteral(std::string predicate, long limit, JSON &out);
+        void getResultsQueryLiteral(std::string predicate, long limit,
+                Program *program, EDBLayer &edb,
+                std::shared_ptr<SemiNaiver> sn, JSON &out);
 
     public:
         WebInterface(ProgramArgs &vm, std::shared_ptr<SemiNaiver> sn, std::string htmlfiles,
@@ -79,19 +100,21 @@ class WebInterface {
         long getDurationExecMs();
 
         void setActive() {
-            isActive = true;
+            nActiveRequests++;
         }
 
         void setInactive() {
-            isActive = false;
+            nActiveRequests--;
         }
 
         void join() {
             t.join();
         }
 
-        std::shared_ptr<SemiNaiver> getSemiNaiver() {
-            return sn;
+        //Holding the pointer keeps the KB of the materialization alive
+        std::shared_ptr<const Materialization> getMaterialization() {
+            std::lock_guard<std::mutex> lock(mtxKB);
+            return mat;
         }
 
         std::string getCommandLineArgs() {
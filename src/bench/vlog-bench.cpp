@@ -0,0 +1,454 @@
+#include <vlog/column.h>
+#include <vlog/segment.h>
+#include <vlog/fctable.h>
+#include <vlog/fcinttable.h>
+#include <vlog/joinprocessor.h>
+#include <vlog/seminaiver.h>
+#include <vlog/reasoner.h>
+#include <vlog/edbconf.h>
+#include <vlog/edb.h>
+#include <vlog/support.h>
+
+#include <kognac/logs.h>
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+//Micro-benchmarks for the kernels that dominate the materialization. The
+//input is synthetic: every column is drawn from a Zipf distribution over
+//[0, domain), so that the skew can be controlled (skew = 0 is uniform).
+
+struct BenchParams {
+    size_t rows;
+    uint8_t arity;
+    double skew;
+    size_t domain;
+    unsigned seed;
+    int nthreads;
+    int repeat;
+    std::string filter;
+    std::string output;
+
+    BenchParams() : rows(1000000), arity(2), skew(0.0), domain(100000),
+    seed(42), nthreads(1), repeat(5) {
+    }
+};
+
+class ZipfGenerator {
+    private:
+        std::mt19937_64 gen;
+        std::discrete_distribution<size_t> zipf;
+        std::uniform_int_distribution<size_t> uniform;
+        bool isUniform;
+
+        static std::vector<double> weights(size_t domain, double skew) {
+            std::vector<double> w(domain);
+            for (size_t i = 0; i < domain; ++i) {
+                w[i] = 1.0 / std::pow((double) (i + 1), skew);
+            }
+            return w;
+        }
+
+    public:
+        ZipfGenerator(size_t domain, double skew, unsigned seed) : gen(seed),
+        uniform(0, domain - 1), isUniform(skew == 0) {
+            if (!isUniform) {
+                std::vector<double> w = weights(domain, skew);
+                zipf = std::discrete_distribution<size_t>(w.begin(), w.end());
+            }
+        }
+
+        Term_t next() {
+            return isUniform ? uniform(gen) : zipf(gen);
+        }
+};
+
+//Row-major table of random values
+static std::vector<Term_t> generateRows(const BenchParams &p, uint8_t arity,
+        unsigned seed) {
+    ZipfGenerator g(p.domain, p.skew, seed);
+    std::vector<Term_t> rows(p.rows * arity);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        rows[i] = g.next();
+    }
+    return rows;
+}
+
+static std::shared_ptr<const Segment> toSegment(const std::vector<Term_t> &rows,
+        uint8_t arity) {
+    SegmentInserter ins(arity);
+    for (size_t i = 0; i < rows.size(); i += arity) {
+        ins.addRow(&rows[i], (int) arity);
+    }
+    return ins.getSegment();
+}
+
+class BenchRunner {
+    private:
+        const BenchParams &p;
+        json results;
+
+    public:
+        BenchRunner(const BenchParams &p) : p(p), results(json::array()) {
+        }
+
+        //Runs the benchmark p.repeat times (after one warm-up run) and
+        //records the timings. The body returns the number of output rows,
+        //which is also used to check that all the runs agree.
+        void run(std::string name, std::function<size_t()> setup,
+                std::function<size_t()> body) {
+            if (p.filter != "" && name.find(p.filter) == std::string::npos) {
+                return;
+            }
+            LOG(INFOL) << "Running " << name << " ...";
+            std::vector<double> times;
+            size_t outputRows = 0;
+            for (int i = 0; i <= p.repeat; ++i) {
+                setup();
+                std::chrono::steady_clock::time_point start =
+                    std::chrono::steady_clock::now();
+                size_t out = body();
+                std::chrono::duration<double> sec =
+                    std::chrono::steady_clock::now() - start;
+                if (i == 0) {
+                    outputRows = out;
+                    continue;
+                }
+                if (out != outputRows) {
+                    LOG(ERRORL) << "Benchmark " << name <<
+                        " is not deterministic: " << out << " != " << outputRows;
+                    throw 10;
+                }
+                times.push_back(sec.count() * 1000);
+            }
+            std::sort(times.begin(), times.end());
+            double sum = 0;
+            for (auto t : times) {
+                sum += t;
+            }
+
+            json r;
+            r["name"] = name;
+            r["rows"] = p.rows;
+            r["arity"] = p.arity;
+            r["skew"] = p.skew;
+            r["domain"] = p.domain;
+            r["threads"] = p.nthreads;
+            r["repeat"] = p.repeat;
+            r["output_rows"] = outputRows;
+            r["min_ms"] = times.front();
+            r["median_ms"] = times[times.size() / 2];
+            r["max_ms"] = times.back();
+            r["mean_ms"] = sum / times.size();
+            r["rows_per_sec"] = times.front() > 0 ? p.rows / (times.front() / 1000) : 0;
+            LOG(INFOL) << name << ": median " << times[times.size() / 2] << "ms";
+            results.push_back(r);
+        }
+
+        json getResults() {
+            json out;
+            out["benchmarks"] = results;
+            return out;
+        }
+};
+
+static size_t nothing() {
+    return 0;
+}
+
+static void benchColumns(BenchRunner &runner, const BenchParams &p) {
+    std::vector<Term_t> values = generateRows(p, 1, p.seed);
+    std::vector<Term_t> sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+
+    //Sorted input is where the compressed columns shine (runs), random
+    //input is the worst case
+    for (int s = 0; s < 2; ++s) {
+        const std::vector<Term_t> &input = s == 0 ? values : sorted;
+        std::string suffix = s == 0 ? "/random" : "/sorted";
+        std::shared_ptr<Column> column;
+        auto encode = [&]() {
+            ColumnWriter writer;
+            for (auto v : input) {
+                writer.add(v);
+            }
+            column = writer.getColumn();
+            return column->size();
+        };
+        runner.run("column_encode" + suffix, nothing, encode);
+        runner.run("column_decode" + suffix, [&]() {
+                return column ? column->size() : encode();
+                }, [&]() {
+                std::unique_ptr<ColumnReader> reader = column->getReader();
+                size_t n = 0;
+                Term_t checksum = 0;
+                while (reader->hasNext()) {
+                    checksum ^= reader->next();
+                    n++;
+                }
+                if (checksum == (Term_t) -1) {
+                    LOG(DEBUGL) << "Unlikely checksum";
+                }
+                return n;
+                });
+    }
+}
+
+static void benchSort(BenchRunner &runner, const BenchParams &p) {
+    std::vector<Term_t> rows = generateRows(p, p.arity, p.seed);
+    std::shared_ptr<const Segment> segment = toSegment(rows, p.arity);
+
+    std::vector<uint8_t> reversed;
+    for (int i = p.arity - 1; i >= 0; --i) {
+        reversed.push_back((uint8_t) i);
+    }
+
+    runner.run("segment_sortBy", nothing, [&]() {
+            return segment->sortBy(NULL, p.nthreads, false)->getNRows();
+            });
+    runner.run("segment_sortBy/reversed", nothing, [&]() {
+            return segment->sortBy(&reversed, p.nthreads, false)->getNRows();
+            });
+    runner.run("segment_sortBy/unique", nothing, [&]() {
+            return segment->sortBy(NULL, p.nthreads, true)->getNRows();
+            });
+}
+
+static void benchRetain(BenchRunner &runner, const BenchParams &p) {
+    //The new derivations overlap with the existing ones for about half
+    //of the rows
+    std::vector<Term_t> existingRows = generateRows(p, p.arity, p.seed);
+    std::vector<Term_t> newRows = generateRows(p, p.arity, p.seed + 1);
+    std::copy(existingRows.begin(), existingRows.begin() + newRows.size() / 2,
+            newRows.begin());
+
+    std::shared_ptr<const Segment> existing = toSegment(existingRows, p.arity)->
+        sortBy(NULL, p.nthreads, true);
+    std::shared_ptr<const Segment> derived = toSegment(newRows, p.arity)->
+        sortBy(NULL, p.nthreads, true);
+    std::shared_ptr<const FCInternalTable> existingTable(
+            new InmemoryFCInternalTable(p.arity, 0, true, existing));
+
+    std::shared_ptr<const Segment> input;
+    auto copyInput = [&]() {
+        input = derived;
+        return (size_t) 0;
+    };
+    runner.run("segmentinserter_retain", copyInput, [&]() {
+            return SegmentInserter::retain(input, existingTable, false,
+                    p.nthreads)->getNRows();
+            });
+
+    //FCTable::retainFrom checks against all the blocks of a table. Split
+    //the existing rows over several blocks, as after a few iterations.
+    const int nblocks = 4;
+    FCTable table(NULL, p.arity);
+    size_t rowsPerBlock = (p.rows + nblocks - 1) / nblocks;
+    VTuple tuple(p.arity);
+    for (uint8_t i = 0; i < p.arity; ++i) {
+        tuple.set(VTerm(i + 1, 0), i);
+    }
+    Literal query(Predicate(0, 0, IDB, p.arity), tuple);
+    for (int b = 0; b < nblocks; ++b) {
+        size_t begin = b * rowsPerBlock * p.arity;
+        size_t end = std::min((size_t) (b + 1) * rowsPerBlock, p.rows) * p.arity;
+        if (begin >= end) {
+            break;
+        }
+        std::vector<Term_t> blockRows(existingRows.begin() + begin,
+                existingRows.begin() + end);
+        std::shared_ptr<const FCInternalTable> blockTable(
+                new InmemoryFCInternalTable(p.arity, b, true,
+                    toSegment(blockRows, p.arity)->sortBy(NULL, p.nthreads, true)));
+        table.addBlock(FCBlock(b, blockTable, query, 0, NULL, 0, true));
+    }
+    runner.run("fctable_retainFrom", nothing, [&]() {
+            return table.retainFrom(derived, false, p.nthreads)->getNRows();
+            });
+}
+
+static void benchHashMap(BenchRunner &runner, const BenchParams &p) {
+    //Build and probe side of the hash join: the map goes from a join key to
+    //the range of rows of the (sorted) build side with that key, as in
+    //JoinExecutor::hashjoin.
+    std::vector<Term_t> build = generateRows(p, 1, p.seed);
+    std::vector<Term_t> probe = generateRows(p, 1, p.seed + 1);
+    std::sort(build.begin(), build.end());
+
+    JoinHashMap map;
+    //clear keeps the empty key, which can be set only once
+    map.set_empty_key(std::numeric_limits<Term_t>::max());
+    auto clearMap = [&]() {
+        map.clear();
+        return (size_t) 0;
+    };
+    auto fillMap = [&]() {
+        size_t start = 0;
+        for (size_t i = 1; i <= build.size(); ++i) {
+            if (i == build.size() || build[i] != build[start]) {
+                map.insert(std::make_pair(build[start],
+                            std::make_pair(start, i - start)));
+                start = i;
+            }
+        }
+        return map.size();
+    };
+    runner.run("hashjoin_build", clearMap, fillMap);
+    runner.run("hashjoin_probe", [&]() {
+            clearMap();
+            return fillMap();
+            }, [&]() {
+            size_t out = 0;
+            for (auto v : probe) {
+                JoinHashMap::iterator itr = map.find(v);
+                if (itr != map.end()) {
+                    out += itr->second.second;
+                }
+            }
+            return out;
+            });
+}
+
+static void benchJoins(BenchRunner &runner, const BenchParams &p) {
+    //The joins need a whole rule execution around them (plans, output
+    //processors, ...), so they are measured with a tiny program on
+    //in-memory EDB relations.
+    EDBConf conf("", false);
+    EDBLayer layer(conf, false);
+    Program program(&layer);
+
+    ZipfGenerator g(p.domain, p.skew, p.seed);
+    const char *relations[] = { "A", "B" };
+    for (int r = 0; r < 2; ++r) {
+        std::vector<std::vector<std::string>> rows(p.rows);
+        for (size_t i = 0; i < p.rows; ++i) {
+            rows[i].push_back(std::to_string(g.next()));
+            rows[i].push_back(std::to_string(g.next()));
+        }
+        PredId_t id = program.getOrAddPredicate(relations[r], 2);
+        layer.addInmemoryTable(relations[r], id, rows);
+    }
+    program.parseRule("J(X,Z) :- A(X,Y),B(Y,Z)", false);
+    program.parseRule("K(X,Y) :- A(X,Y),B(X,Y)", false);
+    PredId_t joinPred = program.getPredicate("J").getId();
+    PredId_t semiJoinPred = program.getPredicate("K").getId();
+
+    size_t joinRows = 0;
+    size_t semiJoinRows = 0;
+    runner.run("join_program", nothing, [&]() {
+            std::shared_ptr<SemiNaiver> sn = Reasoner::getSemiNaiver(layer,
+                    &program, true, true, false, TypeChase::SKOLEM_CHASE,
+                    p.nthreads, 0, false);
+            sn->run();
+            joinRows = sn->getSizeTable(joinPred);
+            semiJoinRows = sn->getSizeTable(semiJoinPred);
+            return joinRows + semiJoinRows;
+            });
+    LOG(INFOL) << "join_program: " << joinRows << " rows from the join, " <<
+        semiJoinRows << " from the verificative join";
+}
+
+static void benchDictionary(BenchRunner &runner, const BenchParams &p) {
+    std::vector<Term_t> ids = generateRows(p, 1, p.seed);
+    std::vector<std::string> terms;
+    terms.reserve(ids.size());
+    for (auto id : ids) {
+        terms.push_back("<http://example.org/resource/" + std::to_string(id) + ">");
+    }
+    std::unique_ptr<Dictionary> dict;
+    runner.run("dictionary_getOrAdd", [&]() {
+            dict = std::unique_ptr<Dictionary>(new Dictionary());
+            return (size_t) 0;
+            }, [&]() {
+            for (const auto &t : terms) {
+                dict->getOrAdd(t);
+            }
+            return (size_t) dict->size();
+            });
+}
+
+static void printHelp(const char *prog) {
+    std::cout << "Usage: " << prog << " [options]" << std::endl;
+    std::cout << "  --rows N      number of rows per generated table (default 1000000)" << std::endl;
+    std::cout << "  --arity N     number of columns of the generated tables (default 2)" << std::endl;
+    std::cout << "  --skew S      Zipf exponent of the values, 0 is uniform (default 0)" << std::endl;
+    std::cout << "  --domain N    number of distinct values (default 100000)" << std::endl;
+    std::cout << "  --seed N      seed of the generators (default 42)" << std::endl;
+    std::cout << "  --nthreads N  threads used by the kernels (default 1)" << std::endl;
+    std::cout << "  --repeat N    measured runs per benchmark (default 5)" << std::endl;
+    std::cout << "  --filter S    only run benchmarks whose name contains S" << std::endl;
+    std::cout << "  --out FILE    write the JSON report to FILE instead of stdout" << std::endl;
+}
+
+int main(int argc, const char **argv) {
+    BenchParams p;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printHelp(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            printHelp(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--rows") {
+            p.rows = std::stoull(value);
+        } else if (arg == "--arity") {
+            p.arity = (uint8_t) std::stoi(value);
+        } else if (arg == "--skew") {
+            p.skew = std::stod(value);
+        } else if (arg == "--domain") {
+            p.domain = std::stoull(value);
+        } else if (arg == "--seed") {
+            p.seed = (unsigned) std::stoul(value);
+        } else if (arg == "--nthreads") {
+            p.nthreads = std::stoi(value);
+        } else if (arg == "--repeat") {
+            p.repeat = std::stoi(value);
+        } else if (arg == "--filter") {
+            p.filter = value;
+        } else if (arg == "--out") {
+            p.output = value;
+        } else {
+            printHelp(argv[0]);
+            return 1;
+        }
+    }
+    if (p.rows == 0 || p.arity == 0 || p.domain == 0 || p.repeat <= 0) {
+        LOG(ERRORL) << "rows, arity, domain and repeat must be positive";
+        return 1;
+    }
+    Logger::setMinLevel(INFOL);
+
+    BenchRunner runner(p);
+    benchColumns(runner, p);
+    benchSort(runner, p);
+    benchRetain(runner, p);
+    benchHashMap(runner, p);
+    benchJoins(runner, p);
+    benchDictionary(runner, p);
+
+    json out = runner.getResults();
+    if (p.output != "") {
+        std::ofstream f(p.output);
+        f << out.dump(2) << std::endl;
+    } else {
+        std::cout << out.dump(2) << std::endl;
+    }
+    return 0;
+}
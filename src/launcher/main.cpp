@@ -6,6 +6,8 @@
 #include <vlog/edb.h>
 #include <vlog/webinterface.h>
 #include <vlog/fcinttable.h>
+#include <vlog/spillmgr.h>
+#include <vlog/trace.h>
 #include <vlog/exporter.h>
 #include <vlog/utils.h>
 #include <vlog/ml/training.h>
@@ -311,10 +313,26 @@ bool initParams(int argc, const char** argv, ProgramArgs &vm) {
             "shuffle rules randomly instead of using heuristics (only for <mat>, and only when running multithreaded).", false);
     query_options.add<int>("r", "repeatQuery", 1,
             "Repeat the query <arg> times. If the argument is not specified, then the query will not be repeated.", false);
+    query_options.add<string>("","trace", "",
+            "File where to write a trace of the rule executions, joins, sorts and duplicate eliminations, in the Chrome trace format (only for <mat>). Default is '' (disable).",false);
+    query_options.add<string>("","spillDir", "",
+            "Directory where to spill old derivations when they exceed spillBudget (only for <mat>). Default is '' (disable).",false);
+    query_options.add<int64_t>("","spillBudget", 4096,
+            "Memory (in MB) that the derivations can take before they are spilled to spillDir. Default is 4096.",false);
+    query_options.add<bool>("","parallelStrata", false,
+            "Evaluate the parts of the program that do not depend on each other at the same time, with nthreads threads (only for <mat>, and only when running multithreaded). Default is false.",false);
+    query_options.add<string>("","checkpoint", "",
+            "File where to periodically store the state of the materialization, so that it can be resumed with --resume (only for <mat>). Default is '' (disable).",false);
+    query_options.add<int64_t>("","checkpointInterval", 3600,
+            "Seconds between two checkpoints. Default is 3600.",false);
+    query_options.add<string>("","resume", "",
+            "Checkpoint from which to resume the materialization. The EDB and the rules must be the same as when it was written (only for <mat>). Default is '' (disable).",false);
+    query_options.add<bool>("","queryIndexes", false,
+            "Index the IDB predicates after the materialization, so that queries with bound arguments do not scan the whole tables (only for <mat> and the web interface). Default is false.",false);
     query_options.add<string>("","storemat_path", "",
             "Directory where to store all results of the materialization. Default is '' (disable).",false);
     query_options.add<string>("","storemat_format", "files",
-            "Format in which to dump the materialization. 'files' simply dumps the IDBs in files. 'csv' creates comma-separated files. 'db' creates a new RDF database. Default is 'files'.",false);
+            "Format in which to dump the materialization. 'files' simply dumps the IDBs in files. 'csv' creates comma-separated files. 'bin' dumps the IDBs as raw (binary) term IDs. 'nt' creates gzipped N-Triples files. 'db' creates a new RDF database. Default is 'files'.",false);
     query_options.add<bool>("","explain", false,
             "Explain the query instead of executing it. Default is false.",false);
     query_options.add<bool>("","decompressmat", false,
@@ -328,6 +346,10 @@ bool initParams(int argc, const char** argv, ProgramArgs &vm) {
     query_options.add<bool>("","webinterface", false,
             "Start a web interface to monitor the execution. Default is false.",false);
     query_options.add<int>("","port", 8080, "Port to use for the web interface. Default is 8080",false);
+    query_options.add<int>("","webthreads", Utils::getNumberPhysicalCores(),
+            "Number of threads that serve the requests to the web interface. Default is the number of physical cores",false);
+    query_options.add<int64_t>("","webtimeout", 0,
+            "Milliseconds after which the web interface stops reading the results of a SPARQL query. Default is 0 (no limit)",false);
 #endif
 
     query_options.add<bool>("","no-filtering", true, "Disable filter optimization.",false);
@@ -500,11 +522,14 @@ static void store_mat(const std::string &path, ProgramArgs &vm,
     if (storemat_format == "files" || storemat_format == "csv") {
         sn->storeOnFiles(path,
                 vm["decompressmat"].as<bool>(), 0, storemat_format == "csv");
+    } else if (storemat_format == "bin") {
+        sn->storeOnFiles(path, false, 0, false, true);
     } else if (storemat_format == "db") {
         //I will store the details on a Trident index
         exp.generateTridentDiffIndex(path);
     } else if (storemat_format == "nt") {
-        exp.generateNTTriples(path, vm["decompressmat"].as<bool>());
+        exp.generateNTTriples(path, vm["decompressmat"].as<bool>(),
+                vm["nthreads"].as<int>());
     } else {
         LOG(ERRORL) << "Option 'storemat_format' not recognized";
         throw 10;
@@ -612,11 +637,14 @@ void launchTriggeredMat(int argc,
         if (storemat_format == "files" || storemat_format == "csv") {
             sn->storeOnFiles(vm["storemat_path"].as<string>(),
                     vm["decompressmat"].as<bool>(), 0, storemat_format == "csv");
+        } else if (storemat_format == "bin") {
+            sn->storeOnFiles(vm["storemat_path"].as<string>(), false, 0, false, true);
         } else if (storemat_format == "db") {
             //I will store the details on a Trident index
             exp.generateTridentDiffIndex(vm["storemat_path"].as<string>());
         } else if (storemat_format == "nt") {
-            exp.generateNTTriples(vm["storemat_path"].as<string>(), vm["decompressmat"].as<bool>());
+            exp.generateNTTriples(vm["storemat_path"].as<string>(), vm["decompressmat"].as<bool>(),
+                    vm["nthreads"].as<int>());
         } else {
             LOG(ERRORL) << "Option 'storemat_format' not recognized";
             throw 10;
@@ -746,6 +774,20 @@ void launchFullMat(int argc,
                         1, &cv, &mtx, &isFinished));
         }
 #endif
+        if (!vm["spillDir"].as<string>().empty()) {
+            sn->setSpillManager(std::shared_ptr<SpillManager>(new SpillManager(
+                            vm["spillDir"].as<string>(),
+                            (size_t) vm["spillBudget"].as<int64_t>() * 1024 * 1024)));
+        }
+        sn->setParallelStrata(vm["parallelStrata"].as<bool>());
+        if (!vm["checkpoint"].as<string>().empty()) {
+            int64_t interval = vm["checkpointInterval"].as<int64_t>();
+            sn->setCheckpoint(vm["checkpoint"].as<string>(),
+                    interval > 0 ? interval : 1);
+        }
+        if (!vm["resume"].as<string>().empty()) {
+            sn->setResume(vm["resume"].as<string>());
+        }
         if (vm["printRepresentationSize"].as<bool>()) {
             printRepresentationSize(sn);
         }
@@ -756,9 +798,16 @@ void launchFullMat(int argc,
 
         LOG(INFOL) << "Starting full materialization";
         std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+        if (!vm["trace"].as<string>().empty()) {
+            Tracer::start();
+        }
         sn->run();
         std::chrono::duration<double> sec = std::chrono::system_clock::now() - start;
         LOG(INFOL) << "Runtime materialization = " << sec.count() * 1000 << " milliseconds";
+        if (!vm["trace"].as<string>().empty()) {
+            Tracer::stop();
+            Tracer::write(vm["trace"].as<string>());
+        }
         sn->printCountAllIDBs("");
 
         if (! vm["dred"].empty()) {
@@ -841,6 +890,10 @@ void launchFullMat(int argc,
             }
         }
 
+        if (vm["queryIndexes"].as<bool>()) {
+            sn->buildQueryIndexes();
+        }
+
 #if defined(__linux__) || defined(__linux) || defined(linux) || defined(__gnu_linux__)
         if (vm["monitorThread"].as<bool>()) {
             isFinished = true;
@@ -2,6 +2,7 @@
 #include <launcher/vlogscan.h>
 
 #include <cmath>
+#include <algorithm>
 
 // #define TEST_LUBM
 
@@ -57,6 +58,8 @@ bool VLogLayer::lookupById(uint64_t id,
         const char*& stop,
         ::Type::ID& type,
         unsigned& subType) {
+    //The text stays valid until the next lookup of the same thread
+    static thread_local char tmpText[MAX_TERM_SIZE];
     if (edb.getDictText(id, tmpText)) {
         start = tmpText;
         stop = tmpText + strlen(tmpText);
@@ -289,62 +292,69 @@ double VLogLayer::getJoinSelectivity(bool value1L,
     uint64_t v3r = value3R ? value3CR : ~0ul;
     uint64_t cardl = getCardinality(v1l, v2l, v3l);
     uint64_t cardr = getCardinality(v1r, v2r, v3r);
-    double max = (double) cardl * (double) cardr;
-    if (max == 0) {
+    if (cardl == 0 || cardr == 0) {
         return 0;
     }
-    std::vector<uint64_t> varsl;
-    std::vector<uint64_t> varsr;
-    if (! value1L) varsl.push_back(value1CL);
-    if (! value2L) varsl.push_back(value2CL);
-    if (! value3L) varsl.push_back(value3CL);
-    if (! value1R) varsr.push_back(value1CR);
-    if (! value2R) varsr.push_back(value2CR);
-    if (! value3R) varsr.push_back(value3CR);
-    if (varsl.size() == 1 && varsr.size() == 1) {
-        double retval = cardl < cardr ? cardl/max : cardr/max;
-        return retval;
-    }
-    if (varsl.size() == 1) {
-        double retval = cardr/max;
-        return retval;
-    }
-    if (varsr.size() == 1) {
-        double retval = cardl/max;
-        return retval;
-    }
 
-    // Now check if join is over same variables ...
-    if (varsl.size() == varsr.size()) {
-        for (int i = 0; i < varsl.size(); i++) {
-            bool found = false;
-            for (int j = 0; j < varsr.size(); j++) {
-                if (varsl[i] == varsr[j]) {
-                    found = true;
-                    break;
-                }
-            }
-            if (! found) {
-                if (cardl == cardr && cardl > 10) {
-                    // Assume it is the same ...
-                    double retval = cardl/max;
-                    return retval;
-                }
-                return 1;
+    //Estimate as in System R: for every variable shared by the two patterns,
+    //two tuples agree with probability 1 / max(#distinct left, #distinct right).
+    //The number of distinct values comes from the statistics of the EDB
+    //layer rather than from the reasoner.
+    const bool boundL[3] = { value1L, value2L, value3L };
+    const uint64_t valuesL[3] = { value1CL, value2CL, value3CL };
+    const bool boundR[3] = { value1R, value2R, value3R };
+    const uint64_t valuesR[3] = { value1CR, value2CR, value3CR };
+    double retval = 1;
+    bool sharedVars = false;
+    for (uint8_t i = 0; i < 3; ++i) {
+        if (boundL[i]) {
+            continue;
+        }
+        for (uint8_t j = 0; j < 3; ++j) {
+            if (!boundR[j] && valuesL[i] == valuesR[j]) {
+                double distinctl = getDistinctValues(v1l, v2l, v3l, i, cardl);
+                double distinctr = getDistinctValues(v1r, v2r, v3r, j, cardr);
+                retval /= std::max(1.0, std::max(distinctl, distinctr));
+                sharedVars = true;
+                break;
             }
         }
-        // Same variables, so resulting cardinality not higher than smallest one.
-        double retval = cardl < cardr ? cardl/max : cardr/max;
-        LOG(DEBUGL) << "joinselectivity = " << retval;
-        return retval;
     }
+    if (!sharedVars) {
+        //Cartesian product
+        return 1;
+    }
+    LOG(DEBUGL) << "joinselectivity = " << retval;
+    return retval;
+}
 
-    if (cardl == cardr && cardl > 10) {
-        // Assume it is the same ...
-        double retval = cardl/max;
-        return retval;
+double VLogLayer::getDistinctValues(uint64_t c1, uint64_t c2, uint64_t c3,
+        uint8_t pos, uint64_t card) {
+    VTuple tuple(3);
+    tuple.set(~c1 ? VTerm(0, c1) : VTerm(1, 0), 0);
+    tuple.set(~c2 ? VTerm(0, c2) : VTerm(2, 0), 1);
+    tuple.set(~c3 ? VTerm(0, c3) : VTerm(3, 0), 2);
+
+    double distinct;
+    std::unique_lock<std::mutex> lock(cardinalitiesMutex);
+    auto got = edbColumnCardinalities[pos].find(tuple);
+    if (got == edbColumnCardinalities[pos].end()) {
+        //Other queries can use the cache while this one is estimated
+        lock.unlock();
+        Literal edbquery(Predicate(edbPredName,
+                    Predicate::calculateAdornment(tuple)), tuple);
+        distinct = edb.getCardinalityColumn(edbquery, pos);
+        lock.lock();
+        edbColumnCardinalities[pos][tuple] = distinct;
+    } else {
+        distinct = got->second;
+    }
+    lock.unlock();
+    //If there are no explicit facts, I assume the column is a key
+    if (distinct == 0 || distinct > card) {
+        distinct = card;
     }
-    return 1;
+    return distinct;
 }
 
 uint64_t VLogLayer::getCardinality(uint64_t c1,
@@ -358,13 +368,17 @@ uint64_t VLogLayer::getCardinality(uint64_t c1,
 }
 
 uint64_t VLogLayer::getCardinality(VTuple tuple) {
+    std::unique_lock<std::mutex> lock(cardinalitiesMutex);
     auto got = idbCardinalities.find(tuple);
     double costImplicit;
     Literal idbquery(Predicate(predQueries,
                 Predicate::calculateAdornment(tuple)), tuple);
 
     if (got == idbCardinalities.end()) {
+        //Other queries can use the cache while this one is estimated
+        lock.unlock();
         costImplicit = reasoner.estimate(idbquery, NULL, NULL, edb, this->p);
+        lock.lock();
         idbCardinalities[tuple] = costImplicit;
     } else {
         costImplicit = got->second;
@@ -379,7 +393,7 @@ uint64_t VLogLayer::getCardinality() {
 std::unique_ptr<DBLayer::Scan> VLogLayer::getScan(const DBLayer::DataOrder order,
         const DBLayer::Aggr_t aggr,
         DBLayer::Hint *hint) {
-    //DataOrder is ignored
+    //The scan sorts the results according to the DataOrder
     return std::unique_ptr<DBLayer::Scan>(new VLogScan(order, aggr, hint,
                 predQueries,
                 edb, p, &reasoner));
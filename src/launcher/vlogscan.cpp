@@ -1,4 +1,10 @@
 #include <launcher/vlogscan.h>
+#include <vlog/deadline.h>
+#include <vlog/termoverflow.h>
+
+#include <trident/model/table.h>
+
+#include <algorithm>
 
 
 uint64_t VLogScan::getValue1() {
@@ -16,15 +22,35 @@ uint64_t VLogScan::getValue3() {
 }
 
 uint64_t VLogScan::getCount() {
-    TupleTableItr *it = (TupleTableItr *) (iterator.get());
-    return it->count();
+    TupleTableItr *it = dynamic_cast<TupleTableItr *>(iterator.get());
+    //Only a TupleTableItr groups rows (see nextBatch), the others return
+    //every row once
+    return it != NULL ? it->count() : 1;
 }
 
 bool VLogScan::next() {
-    if (iterator->hasNext()) {
-        iterator->next();
-        // LOG(DEBUGL) << "Iterator = " << iterator.get() << ", value3 = " << getValue3();
-        return true;
+    //The operators of the query read the scans, so the deadline of the
+    //query is checked here as well
+    if ((++nreads % VLOGSCAN_DEADLINE_CHECK) == 0) {
+        QueryDeadline::check();
+    }
+    while (iterator) {
+        if (iterator->hasNext()) {
+            iterator->next();
+            if (freshIterator) {
+                //I must instruct the tupletableitr to exclude the last column
+                if (skipLastColumn) {
+                    static_cast<TupleTableItr*>(iterator.get())->skipLastColumn();
+                }
+                freshIterator = false;
+            }
+            // LOG(DEBUGL) << "Iterator = " << iterator.get() << ", value3 = " << getValue3();
+            return true;
+        }
+        //The current batch of hint bindings is exhausted. Continue with the next one
+        if (!nextBatch()) {
+            break;
+        }
     }
     return false;
 }
@@ -42,37 +68,50 @@ bool VLogScan::first(uint64_t first, bool constrained) {
 }
 
 bool VLogScan::first(uint64_t first, bool constrained1, uint64_t second, bool constrained2) {
-    bool resp = VLogScan::first(first, constrained1, second, constrained2, 0, false);
-
-    //I must instruct the tupletableitr to exclude the last column
-    if (resp && aggr != DBLayer::Aggr_t::AGGR_NO) {
-        ((TupleTableItr*)iterator.get())->skipLastColumn();
-    }
-    return resp;
+    return start(first, constrained1, second, constrained2, 0, false,
+                 aggr != DBLayer::Aggr_t::AGGR_NO);
 }
 
 bool VLogScan::first(uint64_t first, bool constrained1, uint64_t second, bool constrained2,
                      uint64_t third, bool constrained3) {
+    return start(first, constrained1, second, constrained2, third,
+                 constrained3, false);
+}
 
-    Literal query = getLiteral(order, first, constrained1, second, constrained2,
-                               third, constrained3);
-    std::vector<uint8_t> *keypos = NULL;
-    std::vector<uint64_t> *keys = NULL;
+bool VLogScan::start(uint64_t first, bool constrained1, uint64_t second,
+                     bool constrained2, uint64_t third, bool constrained3,
+                     bool skipLast) {
+
+    currentQuery = std::unique_ptr<Literal>(new Literal(getLiteral(order,
+                   first, constrained1, second, constrained2, third,
+                   constrained3)));
+    const Literal &query = *currentQuery;
+    skipLastColumn = skipLast;
+    keypos.clear();
+    hintKeys.clear();
+    nextHintKey = 0;
+    hintBatchSize = VLOGSCAN_HINT_BATCH;
+    moreBatches = true;
+    iterator.reset();
+
+    //Position in the triple of the join variable, if there is a hint
+    int keyPosInTriple = -1;
     int bitset = 0;
+    std::vector<uint64_t> *keys = NULL;
     if (hint != NULL) {
 	keys = hint->getKeys(&bitset);
 	if (keys != NULL) {
 	    LOG(DEBUGL) << "I have some keys: size = " << keys->size() << ", bitset = " << bitset;
 	    LOG(DEBUGL) << "Literal = " << query.tostring();
 	    // Assumes a single join variable.
-	    keypos = new std::vector<uint8_t>();
 	    uint8_t varNo = 0;
 	    int flag = 1;
 	    for (int i = 0; i < 3; i++) {
 		VTerm t = query.getTermAtPos(i);
 		if (t.isVariable()) {
 		    if (bitset & flag) {
-			keypos->push_back(varNo);
+			keypos.push_back(varNo);
+			keyPosInTriple = i;
 			LOG(DEBUGL) << "Variable number = " << (int) varNo;
 			break;
 		    }
@@ -84,7 +123,7 @@ bool VLogScan::first(uint64_t first, bool constrained1, uint64_t second, bool co
     }
 
     //If the order requires sorted data, then I must sort it
-    std::vector<uint8_t> sortByFields;
+    sortByFields.clear();
     switch (order) {
     case DBLayer::DataOrder::Order_Object_Predicate_Subject:
         sortByFields.push_back(2);
@@ -125,24 +164,80 @@ bool VLogScan::first(uint64_t first, bool constrained1, uint64_t second, bool co
         break;
     }
 
-    if (keypos != NULL) {
+    if (!keypos.empty()) {
 	assert(keys != NULL);
 	if (keys->size() == 0) {
 	    return false;
 	}
+	//The reasoner modifies the bindings, so I work on a sorted copy
+	hintKeys.assign(keys->begin(), keys->end());
+	std::sort(hintKeys.begin(), hintKeys.end());
+	hintKeys.erase(std::unique(hintKeys.begin(), hintKeys.end()),
+		       hintKeys.end());
+	//The results of consecutive batches can only be concatenated if they
+	//do not overlap in the requested order, i.e., if the data is not
+	//sorted or it is sorted on the join variable first. Otherwise, all
+	//bindings must go in one batch so that the reasoner sorts all of them.
+	bool canSplit = sortByFields.empty() || sortByFields[0] == keyPosInTriple;
+	if (!canSplit) {
+	    LOG(DEBUGL) << "Order is not on the join variable: single batch";
+	    hintBatchSize = hintKeys.size();
+	}
     }
+    return nextBatch() && next();
+}
 
-    TupleIterator *tmpitr = r->getIterator(
-                                    query, keypos, keys, layer, p,
-                                    false, &sortByFields);
-    iterator = std::unique_ptr<TupleIterator>(tmpitr);
+bool VLogScan::nextBatch() {
+    iterator.reset();
+    if (!moreBatches) {
+        return false;
+    }
 
-    if (iterator && iterator->hasNext()) {
-        iterator->next();
-        return true;
+    std::vector<uint8_t> *posJoins = NULL;
+    std::vector<Term_t> batch;
+    if (!keypos.empty()) {
+        const size_t end = std::min(hintKeys.size(), nextHintKey + hintBatchSize);
+        batch.reserve(end - nextHintKey);
+        for (size_t i = nextHintKey; i < end; ++i) {
+            batch.push_back(TermOverflow::encode(hintKeys[i]));
+        }
+        nextHintKey = end;
+        moreBatches = nextHintKey < hintKeys.size();
+        posJoins = &keypos;
+        LOG(DEBUGL) << "Pushing " << batch.size() << " bindings, "
+            << (hintKeys.size() - nextHintKey) << " left";
+    } else {
+        moreBatches = false;
+    }
 
+    TupleIterator *tmpitr = r->getIterator(
+                                    *currentQuery, posJoins,
+                                    posJoins != NULL ? &batch : NULL,
+                                    layer, p, false, &sortByFields);
+    if (skipLastColumn && tmpitr != NULL &&
+            dynamic_cast<TupleTableItr*>(tmpitr) == NULL) {
+        //Only a TupleTableItr can skip the last column, so the rows (which
+        //are already in the requested order) are copied into a table
+        std::unique_ptr<TupleIterator> rows(tmpitr);
+        const size_t sz = rows->getTupleSize();
+        std::shared_ptr<TupleTable> table(new TupleTable(sz));
+        std::vector<uint64_t> row(sz);
+        size_t nrows = 0;
+        while (rows->hasNext()) {
+            if ((++nrows % VLOGSCAN_DEADLINE_CHECK) == 0) {
+                QueryDeadline::check();
+            }
+            rows->next();
+            for (size_t i = 0; i < sz; ++i) {
+                row[i] = rows->getElementAt(i);
+            }
+            table->addRow(row.data());
+        }
+        tmpitr = new TupleTableItr(table);
     }
-    return false;
+    iterator = std::unique_ptr<TupleIterator>(tmpitr);
+    freshIterator = true;
+    return iterator != NULL;
 }
 
 Literal VLogScan::getLiteral(DBLayer::DataOrder order, uint64_t first,
@@ -199,7 +199,7 @@ void QSQR::estimateQuery(Metrics &metrics, int depth, Literal &l, std::vector<ui
 
     for (std::vector<Rule>::iterator itr =
 	    r.begin(); itr != r.end(); ++itr) {
-	Literal head = itr->getHead(0);
+	const Literal &head = itr->getHead(0);
     PredId_t temp = head.getPredicate().getId();
     idbIds.push_back(temp);
 	vector<Substitution> substitutions;
@@ -243,7 +243,7 @@ void QSQR::estimateRule(Metrics &metrics, int depth, Rule &rule, vector<Substitu
     }
     metrics.countRules++;
     bool noAnswers = false;
-    std::vector<Literal> body = rule.getBody();
+    const std::vector<Literal> &body = rule.getBody();
     if (depth > 0) {
         Literal substitutedHead = rule.getHead(0).substitutes(subs);
         std::vector<Var_t> headVars = substitutedHead.getAllVars();
@@ -307,7 +307,7 @@ void QSQR::evaluate(Predicate &pred, BindingsTable *inputTable,
     do {
         //Create rules
         createRules(pred);
-        for (int i = 0; i < program->getAllRulesByPredicate(pred.getId()).size(); ++i) {
+        for (int i = 0; i < program->getNRulesByPredicate(pred.getId()); ++i) {
             RuleExecutor *exec = rules[pred.getId()][pred.getAdorment()][i];
             exec->evaluate(inputTable, offsetInput, this, layer);
         }
@@ -966,8 +966,11 @@ const std::vector<uint32_t> &Program::getRulesIDsByPredicate(PredId_t predid) co
     return rules[predid];
 }
 
+std::atomic<uint64_t> Program::versionCounter(0);
+
 Program::Program(EDBLayer *kb) : kb(kb),
     rewriteCounter(0),
+    version(++versionCounter),
     dictPredicates(kb->getPredDictionary()),
     cardPredicates(kb->getPredicateCardUnorderedMap()) {
 }
@@ -975,6 +978,7 @@ Program::Program(EDBLayer *kb) : kb(kb),
 // Note: this constructor does not copy the rules! Is that intentional?
 Program::Program(Program *p, EDBLayer *kb) : kb(kb),
     rewriteCounter(0),
+    version(++versionCounter),
     dictPredicates(p->dictPredicates),
     cardPredicates(p->cardPredicates) {
 
@@ -1306,6 +1310,7 @@ std::shared_ptr<Program> Program::cloneNew() const {
 void Program::cleanAllRules() {
     rules.clear();
     allrules.clear();
+    version = ++versionCounter;
 }
 
 void Program::addRule(Rule &rule) {
@@ -1317,6 +1322,7 @@ void Program::addRule(Rule &rule) {
         rules[head.getPredicate().getId()].push_back(allrules.size());
     }
     allrules.push_back(rule);
+    version = ++versionCounter;
 }
 
 void Program::addRule(std::vector<Literal> heads, std::vector<Literal> body,
@@ -1492,7 +1498,7 @@ std::vector<Rule> Program::getAllRulesByPredicate(PredId_t predid) const {
     return out;
 }
 
-std::vector<Rule> Program::getAllRules() const {
+const std::vector<Rule> &Program::getAllRules() const {
     return allrules;
 }
 
@@ -1513,6 +1519,7 @@ void Program::sortRulesByIDBPredicates() {
             rules[i] = tmpC;
         }
     }
+    version = ++versionCounter;
 }
 
 Predicate Program::getPredicate(const std::string & p) {
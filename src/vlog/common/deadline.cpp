@@ -0,0 +1,42 @@
+#include <vlog/deadline.h>
+
+#include <kognac/logs.h>
+
+#include <chrono>
+
+static thread_local bool deadlineActive = false;
+//Microseconds on the steady clock
+static thread_local int64_t deadlineTime = 0;
+
+static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+QueryDeadline::QueryDeadline(const uint64_t timeoutMillis) :
+    prevActive(deadlineActive), prevDeadline(deadlineTime) {
+        if (timeoutMillis > 0) {
+            const int64_t d = now() + (int64_t) timeoutMillis * 1000;
+            //A nested deadline cannot extend the outer one
+            if (!deadlineActive || d < deadlineTime) {
+                deadlineTime = d;
+            }
+            deadlineActive = true;
+        }
+    }
+
+QueryDeadline::~QueryDeadline() {
+    deadlineActive = prevActive;
+    deadlineTime = prevDeadline;
+}
+
+bool QueryDeadline::isExpired() {
+    return deadlineActive && now() > deadlineTime;
+}
+
+void QueryDeadline::check() {
+    if (isExpired()) {
+        LOG(DEBUGL) << "The deadline of the query has passed";
+        throw 10;
+    }
+}
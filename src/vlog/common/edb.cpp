@@ -2,6 +2,7 @@
 #include <vlog/concepts.h>
 #include <vlog/idxtupletable.h>
 #include <vlog/column.h>
+#include <vlog/termoverflow.h>
 
 #include <vlog/trident/tridenttable.h>
 #ifdef MYSQL
@@ -28,6 +29,8 @@
 #include <climits>
 #include <inttypes.h>
 
+std::atomic<uint64_t> EDBLayer::idCounter(0);
+
 EDBLayer::EDBLayer(EDBLayer &db, bool copyTables) : conf(db.conf) {
     this->predDictionary = db.predDictionary;
     this->termsDictionary = db.termsDictionary;
@@ -1055,10 +1058,24 @@ bool EDBLayer::getOrAddDictNumber(const char *text, const size_t sizeText,
         LOG(TRACEL) << "getOrAddDictNumber \"" << t << "\" returns " << id;
         resp = true;
     }
+    checkTermID(id);
     return resp;
 }
 
-bool EDBLayer::getDictText(const uint64_t id, char *text) const {
+void EDBLayer::checkTermID(const uint64_t id) const {
+#if !TERM_IS_UINT64
+    //Larger values would be read as indexes in the overflow table
+    if (id >= TermOverflow::FLAG) {
+        LOG(ERRORL) << "Term ID " << id << " does not fit in 31 bits."
+            " Build VLog without TERM32 to use this database";
+        throw 10;
+    }
+#endif
+}
+
+bool EDBLayer::getDictText(const uint64_t term, char *text) const {
+    //The terms of the tables may be in the overflow table
+    const uint64_t id = TermOverflow::decode(term);
     if (IS_NUMBER(id)) {
         if (IS_UINT(id)) {
             uint64_t value = GET_UINT(id);
@@ -1088,7 +1105,8 @@ bool EDBLayer::getDictText(const uint64_t id, char *text) const {
     return resp;
 }
 
-std::string EDBLayer::getDictText(const uint64_t id) const {
+std::string EDBLayer::getDictText(const uint64_t term) const {
+   const uint64_t id = TermOverflow::decode(term);
    if (IS_NUMBER(id)) {
         if (IS_UINT(id)) {
             uint64_t value = GET_UINT(id);
@@ -1113,6 +1131,41 @@ std::string EDBLayer::getDictText(const uint64_t id) const {
     return t;
 }
 
+std::vector<std::pair<std::string, Term_t>> EDBLayer::getAddedTerms() const {
+    std::vector<std::pair<std::string, Term_t>> terms;
+    if (termsDictionary.get()) {
+        for (const auto &el : termsDictionary->getMap()) {
+            terms.push_back(std::make_pair(el.first, el.second));
+        }
+    }
+    return terms;
+}
+
+void EDBLayer::restoreAddedTerms(
+        const std::vector<std::pair<std::string, Term_t>> &terms) {
+    for (const auto &t : terms) {
+        uint64_t id;
+        if (getDictNumber(t.first.c_str(), t.first.size(), id)) {
+            if (id != t.second) {
+                LOG(ERRORL) << "Term " << t.first << " has number " << id
+                    << " instead of " << t.second << " in the checkpoint";
+                throw 10;
+            }
+            continue;
+        }
+        if (!termsDictionary.get()) {
+            termsDictionary = std::shared_ptr<Dictionary>(
+                    new Dictionary(getNTerms()));
+        }
+        if (termsDictionary->getRawValue(t.second) != "") {
+            LOG(ERRORL) << "Number " << t.second << " of term " << t.first
+                << " in the checkpoint is already taken";
+            throw 10;
+        }
+        termsDictionary->add(t.first, t.second);
+    }
+}
+
 uint64_t EDBLayer::getNTerms() const {
     uint64_t size = 0;
     if (dbPredicates.size() > 0) {
@@ -1,6 +1,7 @@
 #include <vlog/exporter.h>
 #include <vlog/seminaiver.h>
 #include <vlog/trident/tridenttable.h>
+#include <vlog/termoverflow.h>
 
 #include <kognac/utils.h>
 #include <trident/tree/root.h>
@@ -12,6 +13,31 @@
 #include <fstream>
 #include <zstr/zstr.hpp>
 
+TermTextCache::TermTextCache(const EDBLayer &layer, std::mutex *dictMutex,
+        uint8_t bits) : layer(layer), dictMutex(dictMutex),
+    mask((((uint64_t) 1) << bits) - 1), ids(((size_t) 1) << bits, ~0ul),
+    found(((size_t) 1) << bits, false), texts(((size_t) 1) << bits) {
+}
+
+const std::string *TermTextCache::lookup(const uint64_t id) {
+    const uint64_t slot = (id ^ (id >> 20)) & mask;
+    if (ids[slot] != id) {
+        bool resp;
+        if (dictMutex != NULL) {
+            std::lock_guard<std::mutex> lock(*dictMutex);
+            resp = layer.getDictText(id, buffer);
+        } else {
+            resp = layer.getDictText(id, buffer);
+        }
+        ids[slot] = id;
+        found[slot] = resp;
+        if (resp) {
+            texts[slot].assign(buffer);
+        }
+    }
+    return found[slot] ? &texts[slot] : NULL;
+}
+
 struct AggrIndex {
     uint64_t first, second;
     size_t begin, end;
@@ -117,10 +143,13 @@ void Exporter::extractTriples(std::vector <uint64_t> &all_s,
                         if (column->isBackedByVector()) {
                             //std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
                             const std::vector<Term_t> &vec = column->getVectorRef();
-                            assert(sizeof(Term_t) == sizeof(uint64_t));
                             assert(vec.size() == nrows);
-                            out->resize(out->size() + nrows);
-                            memcpy(&(out->at(out->size() - nrows)), &(vec[0]), sizeof(Term_t) * nrows);
+                            //Term_t may be narrower than the output, and
+                            //its values may be in the overflow table
+                            out->reserve(out->size() + nrows);
+                            for (const Term_t value : vec) {
+                                out->push_back(TermOverflow::decode(value));
+                            }
                             //std::chrono::duration<double> sec = std::chrono::system_clock::now()
                             //                                      - start;
                             //LOG(INFOL) << "Runtime memcpy = " << sec.count() * 1000 << "-" << nrows;
@@ -174,7 +203,7 @@ void Exporter::extractTriples(std::vector <uint64_t> &all_s,
                                 auto r = column->getReader();
                                 while (r->hasNext()) {
                                     auto value = r->next();
-                                    out->push_back(value);
+                                    out->push_back(TermOverflow::decode(value));
                                 }
                             }
                             //std::chrono::duration<double> sec = std::chrono::system_clock::now()
@@ -350,14 +379,17 @@ void Exporter::copyTable(std::vector<uint64_t> &all_s,
                 auto column = intTable->getColumn(currentPosToCopy);
                 if (column->isBackedByVector()) {
                     const std::vector<Term_t> &vec = column->getVectorRef();
-                    assert(sizeof(Term_t) == sizeof(uint64_t));
-                    out->resize(out->size() + nrows);
-                    memcpy(&(out->at(out->size() - nrows)), &(vec[0]), sizeof(Term_t) * nrows);
+                    //Term_t may be narrower than the output, and its values
+                    //may be in the overflow table
+                    out->reserve(out->size() + nrows);
+                    for (const Term_t value : vec) {
+                        out->push_back(TermOverflow::decode(value));
+                    }
                 } else {
                     auto r = column->getReader();
                     while (r->hasNext()) {
                         auto value = r->next();
-                        out->push_back(value);
+                        out->push_back(TermOverflow::decode(value));
                     }
                 }
 
@@ -400,7 +432,75 @@ void Exporter::generateTridentDiffIndex(std::string outputdir) {
     ofs.close();
 }
 
-void Exporter::generateNTTriples(std::string outputdir, bool decompress) {
+static void appendTerm(std::string &out, TermTextCache &cache,
+        const uint64_t id, bool decompress) {
+    if (decompress) {
+        const std::string *text = cache.lookup(id);
+        if (text != NULL) {
+            out += *text;
+            return;
+        }
+    }
+    out += std::to_string(id);
+}
+
+struct ExportNTFiles {
+    const std::vector<uint64_t> &all_s;
+    const std::vector<uint64_t> &all_p;
+    const std::vector<uint64_t> &all_o;
+    const std::string &outputdir;
+    const EDBLayer &edb;
+    std::mutex *dictMutex;
+    const bool decompress;
+
+    ExportNTFiles(const std::vector<uint64_t> &all_s,
+            const std::vector<uint64_t> &all_p,
+            const std::vector<uint64_t> &all_o,
+            const std::string &outputdir, const EDBLayer &edb,
+            std::mutex *dictMutex, bool decompress) :
+        all_s(all_s), all_p(all_p), all_o(all_o), outputdir(outputdir),
+        edb(edb), dictMutex(dictMutex), decompress(decompress) {
+        }
+
+    void operator()(const ParallelRange& r) const {
+        TermTextCache cache(edb, dictMutex);
+        std::string buffer;
+        for (size_t idx = r.begin(); idx != r.end(); ++idx) {
+            //Every worker writes (and compresses) its own files
+            std::string filename = outputdir + DIR_SEP + "out-" + to_string(idx) + ".nt.gz";
+            LOG(DEBUGL) << "Creating file " << filename;
+            zstr::ofstream out(filename);
+            const size_t begin = idx * EXPORT_TRIPLES_PER_FILE;
+            const size_t end = std::min(all_s.size(), begin + EXPORT_TRIPLES_PER_FILE);
+            for (size_t i = begin; i < end; ++i) {
+                if (decompress) {
+                    appendTerm(buffer, cache, all_s[i], true);
+                    buffer += ' ';
+                    appendTerm(buffer, cache, all_p[i], true);
+                    buffer += ' ';
+                    appendTerm(buffer, cache, all_o[i], true);
+                    buffer += " .\n";
+                } else {
+                    buffer += std::to_string(all_s[i]);
+                    buffer += ' ';
+                    buffer += std::to_string(all_p[i]);
+                    buffer += ' ';
+                    buffer += std::to_string(all_o[i]);
+                    buffer += '\n';
+                }
+                if (buffer.size() >= (1 << 22)) {
+                    out.write(buffer.c_str(), buffer.size());
+                    buffer.clear();
+                }
+            }
+            out.write(buffer.c_str(), buffer.size());
+            buffer.clear();
+        }
+    }
+};
+
+void Exporter::generateNTTriples(std::string outputdir, bool decompress,
+        int nthreads) {
     std::vector<uint64_t> all_s;
     std::vector<uint64_t> all_p;
     std::vector<uint64_t> all_o;
@@ -411,46 +511,17 @@ void Exporter::generateNTTriples(std::string outputdir, bool decompress) {
 
     //Store the raw dataset in a text file for debug purposes
     Utils::create_directories(outputdir);
-    std::unique_ptr<zstr::ofstream> out;
-
-    char supportBuffer[MAX_TERM_SIZE];
-    size_t idx = 0;
-    for (int i = 0; i < all_s.size(); ++i) {
-        if (i % 10000000 == 0) {
-            if (i > 0) {
-                LOG(INFOL) << "So far exported " << i << " triples ...";
-            }
-            //Create the file. Close the previous one
-            std::string filename = outputdir + DIR_SEP + "out-" + to_string(idx++) + ".nt.gz";
-            LOG(DEBUGL) << "Creating file " << filename;
-            out = std::unique_ptr<zstr::ofstream>(new zstr::ofstream(filename));
-        }
-        if (decompress) {
-            if (edb.getDictText(all_s[i], supportBuffer)) {
-                *out << supportBuffer << " ";
-            } else {
-                std::string t = std::to_string(all_s[i]);
-                *out << t << " ";
-            }
-            if (edb.getDictText(all_p[i], supportBuffer)) {
-                *out << supportBuffer << " ";
-            } else {
-                std::string t = std::to_string(all_p[i]);
-                *out << t << " ";
-            }
-            if (edb.getDictText(all_o[i], supportBuffer)) {
-                *out << supportBuffer << " ." << endl;
-            } else {
-                std::string t = std::to_string(all_o[i]);
-                *out << t << " ." << endl;
-            }
-        } else {
-            *out << all_s[i];
-            *out << " ";
-            *out << all_p[i];
-            *out << " ";
-            *out << all_o[i];
-            *out << endl;
-        }
+
+    //Every file is produced by one worker. The dictionary is shared, so it
+    //is protected by a lock, but each worker caches the terms it has seen.
+    const size_t nfiles = (all_s.size() + EXPORT_TRIPLES_PER_FILE - 1) /
+        EXPORT_TRIPLES_PER_FILE;
+    std::mutex dictMutex;
+    ExportNTFiles exporter(all_s, all_p, all_o, outputdir, edb, &dictMutex,
+            decompress);
+    if (nfiles > 0) {
+        ParallelTasks::parallel_for(0, nfiles, nthreads > 1 ? 1 : nfiles,
+                exporter);
     }
+    LOG(INFOL) << "Exported " << all_s.size() << " triples in " << nfiles << " files";
 }
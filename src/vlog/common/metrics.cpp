@@ -0,0 +1,223 @@
+#include <vlog/metrics.h>
+#include <vlog/concepts.h>
+#include <vlog/edb.h>
+
+const double MetricHistogram::bounds[METRICS_NBUCKETS] = {
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+MetricHistogram::MetricHistogram() : sumUs(0) {
+    for (int i = 0; i <= METRICS_NBUCKETS; ++i) {
+        buckets[i] = 0;
+    }
+}
+
+void MetricHistogram::observe(const std::chrono::steady_clock::duration d) {
+    const uint64_t us = std::chrono::duration_cast<
+        std::chrono::microseconds>(d).count();
+    const double sec = us / 1000000.0;
+    int i = 0;
+    while (i < METRICS_NBUCKETS && sec > bounds[i]) {
+        i++;
+    }
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    sumUs.fetch_add(us, std::memory_order_relaxed);
+}
+
+void MetricHistogram::reset() {
+    for (int i = 0; i <= METRICS_NBUCKETS; ++i) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    sumUs.store(0, std::memory_order_relaxed);
+}
+
+void MetricHistogram::write(std::ostream &out, const char *name,
+        const char *help) const {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " histogram\n";
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_NBUCKETS; ++i) {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        out << name << "_bucket{le=\"" << bounds[i] << "\"} " << cumulative
+            << "\n";
+    }
+    cumulative += buckets[METRICS_NBUCKETS].load(std::memory_order_relaxed);
+    out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+    out << name << "_sum " << sumUs.load(std::memory_order_relaxed) /
+        1000000.0 << "\n";
+    out << name << "_count " << cumulative << "\n";
+}
+
+RuntimeMetrics::PredicateEntry RuntimeMetrics::predicates[METRICS_MAX_PREDICATES + 1];
+
+MetricCounter RuntimeMetrics::rulesExecuted;
+MetricCounter RuntimeMetrics::rulesWithDerivations;
+MetricCounter RuntimeMetrics::triggers;
+MetricCounter RuntimeMetrics::derivations;
+MetricCounter RuntimeMetrics::retainRowsIn;
+MetricCounter RuntimeMetrics::retainRowsOut;
+MetricCounter RuntimeMetrics::sortCacheHits;
+MetricCounter RuntimeMetrics::sortCacheMisses;
+MetricCounter RuntimeMetrics::magicCacheHits;
+MetricCounter RuntimeMetrics::magicCacheMisses;
+
+MetricHistogram RuntimeMetrics::ruleTime;
+MetricHistogram RuntimeMetrics::joinTime;
+MetricHistogram RuntimeMetrics::sortTime;
+MetricHistogram RuntimeMetrics::retainTime;
+
+RuntimeMetrics::PredicateEntry &RuntimeMetrics::getEntry(const PredId_t pred) {
+    //Open addressing, the slots are claimed with a CAS and never released
+    const uint64_t key = (uint64_t) pred + 1;
+    size_t slot = (key * 2654435761u) % METRICS_MAX_PREDICATES;
+    for (size_t i = 0; i < METRICS_MAX_PREDICATES; ++i) {
+        PredicateEntry &e = predicates[slot];
+        uint64_t current = e.key.load(std::memory_order_acquire);
+        if (current == key) {
+            return e;
+        }
+        if (current == 0) {
+            if (e.key.compare_exchange_strong(current, key) ||
+                    current == key) {
+                return e;
+            }
+        }
+        slot = (slot + 1) % METRICS_MAX_PREDICATES;
+    }
+    //The table is full
+    return predicates[METRICS_MAX_PREDICATES];
+}
+
+void RuntimeMetrics::addDerivations(const PredId_t pred, const uint64_t rows) {
+    derivations.add(rows);
+    PredicateEntry &e = getEntry(pred);
+    e.derivations.fetch_add(rows, std::memory_order_relaxed);
+}
+
+void RuntimeMetrics::reset() {
+    rulesExecuted.reset();
+    rulesWithDerivations.reset();
+    triggers.reset();
+    derivations.reset();
+    retainRowsIn.reset();
+    retainRowsOut.reset();
+    sortCacheHits.reset();
+    sortCacheMisses.reset();
+    magicCacheHits.reset();
+    magicCacheMisses.reset();
+    ruleTime.reset();
+    joinTime.reset();
+    sortTime.reset();
+    retainTime.reset();
+    for (size_t i = 0; i <= METRICS_MAX_PREDICATES; ++i) {
+        predicates[i].derivations.store(0, std::memory_order_relaxed);
+        predicates[i].key.store(0, std::memory_order_release);
+    }
+}
+
+static void writeCounter(std::ostream &out, const char *name,
+        const char *help, const MetricCounter &counter) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " counter\n";
+    out << name << " " << counter.get() << "\n";
+}
+
+static std::string escapeLabel(const std::string &s) {
+    std::string out;
+    for (const char c : s) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+void RuntimeMetrics::write(std::ostream &out, Program *program, EDBLayer *layer,
+        const MaterializationSnapshots *snapshots) {
+    writeCounter(out, "vlog_rules_executed_total",
+            "Rule executions.", rulesExecuted);
+    writeCounter(out, "vlog_rules_with_derivations_total",
+            "Rule executions that derived new facts.", rulesWithDerivations);
+    writeCounter(out, "vlog_triggers_total",
+            "Rows produced by the rule bodies, before duplicate elimination.",
+            triggers);
+    writeCounter(out, "vlog_derivations_total",
+            "New facts added to the IDB tables.", derivations);
+    writeCounter(out, "vlog_retain_rows_in_total",
+            "Rows checked for duplicates against the existing derivations.",
+            retainRowsIn);
+    writeCounter(out, "vlog_retain_rows_out_total",
+            "Rows that survived the duplicate elimination.", retainRowsOut);
+    writeCounter(out, "vlog_sort_cache_hits_total",
+            "Secondary sort orders served from the cache.", sortCacheHits);
+    writeCounter(out, "vlog_sort_cache_misses_total",
+            "Secondary sort orders that had to be computed.", sortCacheMisses);
+    writeCounter(out, "vlog_magic_cache_hits_total",
+            "Queries that reused a cached magic-set program.", magicCacheHits);
+    writeCounter(out, "vlog_magic_cache_misses_total",
+            "Queries that required a new magic-set rewriting.",
+            magicCacheMisses);
+
+    ruleTime.write(out, "vlog_rule_duration_seconds",
+            "Time spent executing a rule.");
+    joinTime.write(out, "vlog_join_duration_seconds",
+            "Time spent in a join between two atoms.");
+    sortTime.write(out, "vlog_sort_duration_seconds",
+            "Time spent sorting segments.");
+    retainTime.write(out, "vlog_retain_duration_seconds",
+            "Time spent removing duplicates against the existing derivations.");
+
+    if (layer != NULL) {
+        out << "# HELP vlog_dictionary_terms Terms in the dictionary of the EDB layer.\n";
+        out << "# TYPE vlog_dictionary_terms gauge\n";
+        out << "vlog_dictionary_terms " << layer->getNTerms() << "\n";
+    }
+
+    out << "# HELP vlog_predicate_derivations_total New facts per IDB predicate.\n";
+    out << "# TYPE vlog_predicate_derivations_total counter\n";
+    for (size_t i = 0; i <= METRICS_MAX_PREDICATES; ++i) {
+        const PredicateEntry &e = predicates[i];
+        const uint64_t key = e.key.load(std::memory_order_acquire);
+        const uint64_t n = e.derivations.load(std::memory_order_relaxed);
+        if (n == 0 || (key == 0 && i < METRICS_MAX_PREDICATES)) {
+            continue;
+        }
+        std::string name = "other";
+        if (i < METRICS_MAX_PREDICATES) {
+            name = program != NULL ? program->getPredicateName(key - 1) :
+                std::to_string(key - 1);
+        }
+        out << "vlog_predicate_derivations_total{predicate=\"" <<
+            escapeLabel(name) << "\"} " << n << "\n";
+    }
+
+    if (snapshots != NULL) {
+        out << "# HELP vlog_table_memory_bytes Estimated memory of the derivations per IDB predicate.\n";
+        out << "# TYPE vlog_table_memory_bytes gauge\n";
+        for (size_t i = 0; i < snapshots->size(); ++i) {
+            const MaterializationSnapshot *snapshot = (*snapshots)[i].get();
+            if (snapshot == NULL) {
+                continue;
+            }
+            uint64_t bytes = 0;
+            for (const auto &block : snapshot->getBlocks()) {
+                //The blocks of EDB tables are not derivations
+                if (block.rows) {
+                    bytes += block.nrows * block.rows->getNColumns() *
+                        sizeof(Term_t);
+                }
+            }
+            if (bytes == 0) {
+                continue;
+            }
+            std::string name = program != NULL ?
+                program->getPredicateName(i) : std::to_string(i);
+            out << "vlog_table_memory_bytes{predicate=\"" <<
+                escapeLabel(name) << "\"} " << bytes << "\n";
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #include <sstream>
 #include <string>
+#include <algorithm>
 
 #include <vlog/sqltable.h>
 #include <vlog/inmemory/inmemorytable.h>
@@ -134,7 +135,7 @@ bool SQLTable::isEmpty(const Literal &q, std::vector<uint8_t> *posToFilter,
     return result == 0;
 }
 
-SegmentInserter *SQLTable::getInserter(const Literal &q) {
+std::string SQLTable::getSQLQuery(const Literal &q) {
     std::string cond = literalConstraintsToSQLQuery(q);
     std::string cond1 = repeatedToSQLQuery(q);
     if (cond.empty()) {
@@ -146,27 +147,86 @@ SegmentInserter *SQLTable::getInserter(const Literal &q) {
     if (!cond.empty()) {
 	query += " WHERE " + cond;
     }
-    SegmentInserter *inserter = new SegmentInserter(arity);
-    executeQuery(query, inserter);
-    return inserter;
+    return query;
+}
+
+std::shared_ptr<const Segment> SQLTable::getCachedSegment(const std::string &key) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto itr = cachedSegments.find(key);
+    if (itr != cachedSegments.end()) {
+	LOG(DEBUGL) << "Cached result for " << key;
+	cacheLRU.splice(cacheLRU.begin(), cacheLRU, itr->second.lru);
+	return itr->second.segment;
+    }
+    return std::shared_ptr<const Segment>();
+}
+
+void SQLTable::cacheSegment(const std::string &key,
+	std::shared_ptr<const Segment> segment) {
+    const size_t bytes = segment->getNRows() * arity * sizeof(Term_t);
+    if (segment->getNRows() > SQL_CACHE_MAXROWS || bytes > SQL_CACHE_MAXBYTES) {
+	return;
+    }
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (cachedSegments.count(key)) {
+	//Another thread ran the same query
+	return;
+    }
+    while (!cacheLRU.empty() && cachedBytes + bytes > SQL_CACHE_MAXBYTES) {
+	auto itr = cachedSegments.find(cacheLRU.back());
+	cachedBytes -= itr->second.bytes;
+	cachedSegments.erase(itr);
+	cacheLRU.pop_back();
+    }
+    cacheLRU.push_front(key);
+    CachedSegment &el = cachedSegments[key];
+    el.segment = segment;
+    el.bytes = bytes;
+    el.lru = cacheLRU.begin();
+    cachedBytes += bytes;
+}
+
+std::shared_ptr<const Segment> SQLTable::getSegment(const Literal &q) {
+    std::string query = getSQLQuery(q);
+    std::shared_ptr<const Segment> segment = getCachedSegment(query);
+    if (!segment) {
+	SegmentInserter inserter(arity);
+	executeQuery(query, &inserter);
+	segment = inserter.getSegment();
+	cacheSegment(query, segment);
+    }
+    return segment;
+}
+
+std::shared_ptr<const Segment> SQLTable::getSortedSegment(const Literal &q,
+	const std::vector<uint8_t> &fields) {
+    // The order of the DB is not the order of the IDs in the dictionary, so
+    // the sorting cannot be pushed into the query. Instead, the sorted
+    // segment is cached as well.
+    std::string key = getSQLQuery(q) + " -- sorted on";
+    for (auto f : fields) {
+	key += " " + std::to_string(f);
+    }
+    std::shared_ptr<const Segment> segment = getCachedSegment(key);
+    if (!segment) {
+	std::vector<uint8_t> sortFields = fields;
+	segment = getSegment(q)->sortBy(&sortFields);
+	cacheSegment(key, segment);
+    }
+    return segment;
 }
 
 EDBIterator *SQLTable::getIterator(const Literal &q) {
     std::vector<uint8_t> sortFields;
-    // TODO: caching
     if (q.getTupleSize() != arity) {
         return new InmemoryIterator(NULL, predid, sortFields);
     }
     LOG(DEBUGL) << "getIterator: query = " << q.tostring(NULL, layer);
-    SegmentInserter *inserter = getInserter(q);
-    std::shared_ptr<const Segment> segment = inserter->getSegment();
-    delete inserter;
-    return new InmemoryIterator(segment, predid, sortFields);
+    return new InmemoryIterator(getSegment(q), predid, sortFields);
 }
 
 EDBIterator *SQLTable::getSortedIterator(const Literal &q,
         const std::vector<uint8_t> &fields) {
-    // TODO: caching
     // Awful semantics: "fields" counts the variable numbers, not the actual fields of the literal...
     std::vector<uint8_t> offsets;
     int nConstantsSeen = 0;
@@ -188,16 +248,48 @@ EDBIterator *SQLTable::getSortedIterator(const Literal &q,
         return new InmemoryIterator(NULL, predid, newFields);
     }
     LOG(DEBUGL) << "getSortedIterator: query = " << q.tostring(NULL, layer);
-    SegmentInserter *inserter = getInserter(q);
-    std::shared_ptr<const Segment> segment = inserter->getSegment();
-    delete inserter;
-    segment = segment->sortBy(&newFields);
-    return new InmemoryIterator(segment, predid, newFields);
+    return new InmemoryIterator(getSortedSegment(q, newFields), predid, newFields);
 }
 
-// If valuesToFilter is larger than this, we should filter ourselves. TODO.
+// Maximum number of values to filter that are sent in a single query.
+// Larger filters are split in multiple queries.
 #define TEMP_TABLE_THRESHOLD (2*3*4*5*7*11)
 
+std::string SQLTable::filterToSQLCondition(std::vector<uint8_t> *posToFilter,
+	std::vector<Term_t>::const_iterator begin,
+	std::vector<Term_t>::const_iterator end) {
+    std::string cond = "(";
+    if (posToFilter->size() == 1) {
+	//A single column: use an IN list, which is much shorter
+	uint8_t pos = posToFilter->at(0);
+	cond += fieldTables[pos] + " IN (";
+	for (auto itr = begin; itr != end; ++itr) {
+	    if (itr != begin) {
+		cond += ", ";
+	    }
+	    cond += mapToField(*itr, pos);
+	}
+	cond += ")";
+    } else {
+	bool first = true;
+	for (auto itr = begin; itr != end;) {
+	    if (! first) {
+		cond += " OR ";
+	    }
+	    cond += "(";
+	    for (int i = 0; i < posToFilter->size(); i++, itr++) {
+		std::string pref = i > 0 ? " AND " : "";
+		uint8_t pos = posToFilter->at(i);
+		cond += pref + fieldTables[pos] + " = " + mapToField(*itr, pos);
+	    }
+	    cond += ")";
+	    first = false;
+	}
+    }
+    cond += ")";
+    return cond;
+}
+
 void SQLTable::query(QSQQuery *query, TupleTable *outputTable,
                        std::vector<uint8_t> *posToFilter,
                        std::vector<Term_t> *valuesToFilter) {
@@ -212,11 +304,6 @@ void SQLTable::query(QSQQuery *query, TupleTable *outputTable,
     } else {
 	//Create first part of query.
 	std::string sqlQuery = "SELECT DISTINCT * FROM " + tablename;
-	if (valuesToFilter->size() > TEMP_TABLE_THRESHOLD) {
-	    // TODO
-	    LOG(ERRORL) << "Not implemented: SQLTable::query with many values to filter.";
-	    throw 10;
-	}
 	sqlQuery += " WHERE ";
 	std::string cond = literalConstraintsToSQLQuery(*l);
 	if (!cond.empty()) {
@@ -235,25 +322,34 @@ void SQLTable::query(QSQQuery *query, TupleTable *outputTable,
 	    sqlQuery += " AND ";
 	}
 
-	bool first = true;
-	sqlQuery += "(";
-	for (std::vector<Term_t>::iterator itr = valuesToFilter->begin();
-		itr != valuesToFilter->end();) {
-	    if (! first) {
-		sqlQuery += " OR ";
-	    }
-	    sqlQuery += "(";
-	    for (int i = 0; i < posToFilter->size(); i++, itr++) {
-		std::string pref = i > 0 ? " AND " : "";
-		uint8_t pos = posToFilter->at(i);
-		sqlQuery += pref + fieldTables[pos] + " = " + mapToField(*itr, pos);
-	    }
-	    sqlQuery += ")";
-	    first = false;
+	//The values may contain duplicates. They are removed first, so that
+	//every batch filters on different values and the results of the
+	//batches are disjoint.
+	const size_t rowSize = posToFilter->size();
+	std::vector<std::vector<Term_t>> rows;
+	for (size_t i = 0; i + rowSize <= valuesToFilter->size(); i += rowSize) {
+	    rows.push_back(std::vector<Term_t>(valuesToFilter->begin() + i,
+			valuesToFilter->begin() + i + rowSize));
+	}
+	std::sort(rows.begin(), rows.end());
+	rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+	std::vector<Term_t> values;
+	values.reserve(rows.size() * rowSize);
+	for (const auto &r : rows) {
+	    values.insert(values.end(), r.begin(), r.end());
 	}
-	sqlQuery += ")";
+
+	//Too many values do not fit in a single query, so send them in
+	//batches
+	const size_t batchSize = std::max((size_t) 1,
+		(size_t) TEMP_TABLE_THRESHOLD / rowSize) * rowSize;
 	SegmentInserter *inserter = new SegmentInserter(arity);
-	executeQuery(sqlQuery, inserter);
+	for (size_t start = 0; start < values.size(); start += batchSize) {
+	    size_t end = std::min(values.size(), start + batchSize);
+	    executeQuery(sqlQuery + filterToSQLCondition(posToFilter,
+			values.begin() + start,
+			values.begin() + end), inserter);
+	}
 	std::shared_ptr<const Segment> segment = inserter->getSegment();
 	delete inserter;
 	std::vector<uint8_t> sortFields;
@@ -0,0 +1,141 @@
+#include <vlog/termoverflow.h>
+
+#include <kognac/logs.h>
+
+#if !TERM_IS_UINT64
+
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+
+//The values are stored in chunks that are never moved nor freed, so that
+//they can be read without locking while other values are added. Chunk k
+//contains OVERFLOW_CHUNK0 << k values, so 22 chunks cover the 2^31 indexes
+#define OVERFLOW_CHUNK0_BITS 10
+#define OVERFLOW_CHUNK0 (((uint64_t) 1) << OVERFLOW_CHUNK0_BITS)
+#define OVERFLOW_NCHUNKS 22
+
+//Only the writers take overflowMutex
+static std::mutex overflowMutex;
+static std::atomic<uint64_t*> overflowChunks[OVERFLOW_NCHUNKS];
+static std::atomic<uint64_t> overflowSize(0);
+static std::unordered_map<uint64_t, Term_t> overflowIndex;
+static size_t overflowUsers = 0;
+
+static void getPosition(const uint64_t idx, int &chunk, uint64_t &offset) {
+    //Index idx is at offset idx - OVERFLOW_CHUNK0 * (2^k - 1) of chunk k
+    uint64_t n = (idx >> OVERFLOW_CHUNK0_BITS) + 1;
+    chunk = 0;
+    while (n > 1) {
+        n >>= 1;
+        chunk++;
+    }
+    offset = idx - OVERFLOW_CHUNK0 * ((((uint64_t) 1) << chunk) - 1);
+}
+
+//Called with overflowMutex
+static void append(const uint64_t v) {
+    const uint64_t idx = overflowSize.load(std::memory_order_relaxed);
+    int chunk;
+    uint64_t offset;
+    getPosition(idx, chunk, offset);
+    uint64_t *values = overflowChunks[chunk].load(std::memory_order_relaxed);
+    if (values == NULL) {
+        values = new uint64_t[OVERFLOW_CHUNK0 << chunk];
+        overflowChunks[chunk].store(values, std::memory_order_release);
+    }
+    values[offset] = v;
+    //The value is visible to the readers that see the new size
+    overflowSize.store(idx + 1, std::memory_order_release);
+}
+
+//Called with overflowMutex
+static void clear() {
+    //The chunks stay allocated, because a reader may still use them
+    overflowSize.store(0, std::memory_order_release);
+    overflowIndex.clear();
+}
+
+TermOverflow::User::User() {
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    overflowUsers++;
+}
+
+TermOverflow::User::~User() {
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    if (--overflowUsers == 0) {
+        clear();
+    }
+}
+
+Term_t TermOverflow::add(const uint64_t v) {
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    auto el = overflowIndex.find(v);
+    if (el != overflowIndex.end()) {
+        return el->second;
+    }
+    const uint64_t idx = overflowSize.load(std::memory_order_relaxed);
+    if (idx >= FLAG) {
+        LOG(ERRORL) << "Too many values for 32-bit terms. Build without TERM32";
+        throw 10;
+    }
+    Term_t t = (Term_t) (FLAG | idx);
+    append(v);
+    overflowIndex.insert(std::make_pair(v, t));
+    return t;
+}
+
+uint64_t TermOverflow::get(const uint64_t t) {
+    const uint64_t idx = t & ~FLAG;
+    if (idx >= overflowSize.load(std::memory_order_acquire)) {
+        LOG(ERRORL) << "Term " << t << " is not in the overflow table";
+        throw 10;
+    }
+    int chunk;
+    uint64_t offset;
+    getPosition(idx, chunk, offset);
+    return overflowChunks[chunk].load(std::memory_order_acquire)[offset];
+}
+
+void TermOverflow::encode(std::vector<uint64_t> &values,
+        std::vector<Term_t> &terms) {
+    terms.resize(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        terms[i] = encode(values[i]);
+    }
+    std::vector<uint64_t>().swap(values);
+}
+
+uint64_t TermOverflow::size() {
+    return overflowSize.load(std::memory_order_acquire);
+}
+
+std::vector<uint64_t> TermOverflow::getValues() {
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    const uint64_t n = overflowSize.load(std::memory_order_relaxed);
+    std::vector<uint64_t> values(n);
+    for (uint64_t i = 0; i < n; ++i) {
+        values[i] = get(FLAG | i);
+    }
+    return values;
+}
+
+void TermOverflow::restore(const std::vector<uint64_t> &values) {
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    clear();
+    for (size_t i = 0; i < values.size(); ++i) {
+        append(values[i]);
+        overflowIndex.insert(std::make_pair(values[i], (Term_t) (FLAG | i)));
+    }
+}
+
+#else
+
+void TermOverflow::restore(const std::vector<uint64_t> &values) {
+    if (!values.empty()) {
+        LOG(ERRORL) << "The values were stored with 32-bit terms";
+        throw 10;
+    }
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include <vlog/trace.h>
+
+#include <kognac/logs.h>
+
+#include <fstream>
+#include <cstdio>
+
+std::atomic<bool> Tracer::enabled(false);
+std::chrono::steady_clock::time_point Tracer::origin;
+std::mutex Tracer::mutex;
+std::vector<TraceEvent> Tracer::events;
+
+static std::atomic<int> nextThreadId(1);
+
+void Tracer::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled) {
+        origin = std::chrono::steady_clock::now();
+        enabled = true;
+    }
+}
+
+void Tracer::stop() {
+    enabled = false;
+}
+
+uint64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - origin).count();
+}
+
+int Tracer::getThreadId() {
+    static thread_local int tid = nextThreadId++;
+    return tid;
+}
+
+void Tracer::add(TraceEvent &event) {
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back(std::move(event));
+}
+
+std::string Tracer::escape(const std::string &s) {
+    std::string out;
+    out.reserve(s.size());
+    for (const char c : s) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    out += buffer;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+void Tracer::write(const std::string &path) {
+    std::vector<TraceEvent> toWrite;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        toWrite.swap(events);
+    }
+    std::ofstream out(path);
+    if (!out) {
+        LOG(ERRORL) << "Cannot write the trace to " << path;
+        throw 10;
+    }
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto &e : toWrite) {
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+        out << "{\"name\":\"" << escape(e.name) << "\",\"cat\":\"" <<
+            e.category << "\",\"ph\":\"X\",\"ts\":" << e.ts << ",\"dur\":" <<
+            e.dur << ",\"pid\":1,\"tid\":" << e.tid << ",\"args\":{" <<
+            e.args << "}}";
+    }
+    out << "]}" << std::endl;
+    LOG(INFOL) << "Written " << toWrite.size() << " trace events to " << path;
+}
+
+TraceSpan::~TraceSpan() {
+    if (active) {
+        TraceEvent event;
+        event.category = category;
+        event.name = std::move(name);
+        event.ts = start;
+        event.dur = Tracer::now() - start;
+        event.tid = Tracer::getThreadId();
+        event.args = std::move(args);
+        Tracer::add(event);
+    }
+}
@@ -1,24 +1,39 @@
 #include <vlog/chasemgmt.h>
+#include <vlog/segment.h>
+#include <vlog/checkpoint.h>
 
 //************** ROWS ***************
-uint64_t ChaseMgmt::Rows::addRow(uint64_t* row) {
-    // LOG(TRACEL) << "Addrow: " << row[0];
-    if (!currentblock || blockCounter >= SIZE_BLOCK) {
-        //Create a new block
-        std::unique_ptr<uint64_t[]> n =
-            std::unique_ptr<uint64_t[]>(
-                    new uint64_t[sizerow * SIZE_BLOCK]);
-        currentblock = n.get();
-        blocks.push_back(std::move(n));
-        blockCounter = 0;
+uint32_t ChaseMgmt::Rows::getShard(const ChaseRow &row) {
+    //The hash of ChaseRow is not well distributed in the high bits. Mix it
+    //before selecting the shard.
+    uint64_t h = hash_ChaseRow()(row);
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    return (uint32_t) (h % CHASE_SHARDS);
+}
+
+void ChaseMgmt::Rows::reserveRows(uint64_t nrows) {
+    while (blocks.size() * SIZE_BLOCK < nrows) {
+        blocks.push_back(std::unique_ptr<uint64_t[]>(
+                    new uint64_t[sizerow * SIZE_BLOCK]));
     }
+}
+
+uint64_t *ChaseMgmt::Rows::storeRow(uint64_t idx, const uint64_t *row) {
+    uint64_t *dest = getRow(idx);
     for(uint8_t i = 0; i < sizerow; ++i) {
-        currentblock[i] = row[i];
+        dest[i] = row[i];
     }
-    ChaseRow r(sizerow, currentblock);
-    rows[r] = currentcounter;
-    currentblock += sizerow;
-    blockCounter++;
+    return dest;
+}
+
+uint64_t ChaseMgmt::Rows::addRow(uint64_t* row) {
+    // LOG(TRACEL) << "Addrow: " << row[0];
+    reserveRows(nstoredrows + 1);
+    ChaseRow r(sizerow, storeRow(nstoredrows, row));
+    shards[getShard(r)][r] = currentcounter;
+    nstoredrows++;
     if (((uint32_t)currentcounter) == UINT32_MAX) {
         LOG(ERRORL) << "I can assign at most 2^32 new IDs to an ext. variable... Stop!";
         throw 10;
@@ -40,14 +55,179 @@ uint64_t ChaseMgmt::Rows::addRow(uint64_t* row) {
 
 bool ChaseMgmt::Rows::existingRow(uint64_t *row, uint64_t &value) {
     ChaseRow r(sizerow, row);
-    auto search = rows.find(r);
-    if (search != rows.end()) {
+    auto &shard = shards[getShard(r)];
+    auto search = shard.find(r);
+    if (search != shard.end()) {
         value = search->second;
         return true;
     }
     return false;
 }
 
+//First pass: look up every row in its shard. Rows that are not there yet
+//are collected (once) in newRows, their duplicates in dupRows.
+struct ChaseMgmt::Rows::ProbeShards {
+    const std::vector<ChaseRowMap> &shards;
+    const std::vector<uint64_t> &batch;
+    const std::vector<uint64_t> &rowsPerShard;
+    const std::vector<uint64_t> &shardBegin;
+    const uint8_t sizerow;
+    std::vector<uint64_t> &output;
+    std::vector<std::vector<uint64_t>> &newRows;
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> &dupRows;
+
+    ProbeShards(const std::vector<ChaseRowMap> &shards,
+            const std::vector<uint64_t> &batch,
+            const std::vector<uint64_t> &rowsPerShard,
+            const std::vector<uint64_t> &shardBegin,
+            const uint8_t sizerow,
+            std::vector<uint64_t> &output,
+            std::vector<std::vector<uint64_t>> &newRows,
+            std::vector<std::vector<std::pair<uint64_t, uint64_t>>> &dupRows) :
+        shards(shards), batch(batch), rowsPerShard(rowsPerShard),
+        shardBegin(shardBegin), sizerow(sizerow), output(output),
+        newRows(newRows), dupRows(dupRows) {
+        }
+
+    void operator()(const ParallelRange& r) const {
+        for (int s = r.begin(); s != r.end(); ++s) {
+            const ChaseRowMap &shard = shards[s];
+            std::unordered_map<ChaseRow, uint64_t, hash_ChaseRow> batchRows;
+            for (uint64_t j = shardBegin[s]; j < shardBegin[s + 1]; ++j) {
+                const uint64_t i = rowsPerShard[j];
+                ChaseRow row(sizerow, (uint64_t*) batch.data() + i * sizerow);
+                auto search = shard.find(row);
+                if (search != shard.end()) {
+                    output[i] = search->second;
+                    continue;
+                }
+                auto first = batchRows.find(row);
+                if (first != batchRows.end()) {
+                    dupRows[s].push_back(std::make_pair(i, first->second));
+                } else {
+                    batchRows.insert(std::make_pair(row, i));
+                    newRows[s].push_back(i);
+                }
+            }
+        }
+    }
+};
+
+//Second pass: every shard stores its new rows and assigns them the IDs of
+//its own range.
+struct ChaseMgmt::Rows::InsertShards {
+    ChaseMgmt::Rows *rows;
+    const std::vector<uint64_t> &batch;
+    const std::vector<uint64_t> &firstID;
+    const std::vector<std::vector<uint64_t>> &newRows;
+    const std::vector<std::vector<std::pair<uint64_t, uint64_t>>> &dupRows;
+    std::vector<uint64_t> &output;
+
+    InsertShards(ChaseMgmt::Rows *rows,
+            const std::vector<uint64_t> &batch,
+            const std::vector<uint64_t> &firstID,
+            const std::vector<std::vector<uint64_t>> &newRows,
+            const std::vector<std::vector<std::pair<uint64_t, uint64_t>>> &dupRows,
+            std::vector<uint64_t> &output) : rows(rows), batch(batch),
+    firstID(firstID), newRows(newRows), dupRows(dupRows), output(output) {
+    }
+
+    void operator()(const ParallelRange& r) const {
+        const uint8_t sizerow = rows->sizerow;
+        for (int s = r.begin(); s != r.end(); ++s) {
+            ChaseRowMap &shard = rows->shards[s];
+            shard.reserve(shard.size() + newRows[s].size());
+            uint64_t id = firstID[s];
+            for (auto i : newRows[s]) {
+                uint64_t *stored = rows->storeRow(id - rows->startCounter,
+                        batch.data() + i * sizerow);
+                shard.insert(std::make_pair(ChaseRow(sizerow, stored), id));
+                output[i] = id;
+                id++;
+            }
+            for (auto &dup : dupRows[s]) {
+                output[dup.first] = output[dup.second];
+            }
+        }
+    }
+};
+
+void ChaseMgmt::Rows::getOrAddRows(
+        const std::vector<const std::vector<Term_t> *> &columns,
+        uint64_t nrows,
+        std::vector<uint64_t> &output,
+        int nthreads) {
+    output.resize(nrows);
+    if (typeChase == TypeChase::SUM_CHASE ||
+            typeChase == TypeChase::SUM_RESTRICTED_CHASE) {
+        //All the rows get the same ID and the dependencies must be
+        //recorded: do it one row at the time
+        uint64_t row[256];
+        for(uint64_t i = 0; i < nrows; ++i) {
+            for(uint8_t j = 0; j < sizerow; ++j) {
+                row[j] = TermOverflow::decode((*columns[j])[i]);
+            }
+            uint64_t value = 0;
+            if (!existingRow(row, value)) {
+                value = addRow(row);
+            }
+            output[i] = value;
+        }
+        return;
+    }
+
+    //Copy the batch row by row, and group the rows per shard (in the order
+    //in which they appear)
+    std::vector<uint64_t> batch(nrows * sizerow);
+    for(uint8_t j = 0; j < sizerow; ++j) {
+        const std::vector<Term_t> &col = *columns[j];
+        for(uint64_t i = 0; i < nrows; ++i) {
+            batch[i * sizerow + j] = TermOverflow::decode(col[i]);
+        }
+    }
+    std::vector<uint32_t> shardOfRow(nrows);
+    std::vector<uint64_t> shardBegin(CHASE_SHARDS + 1, 0);
+    for(uint64_t i = 0; i < nrows; ++i) {
+        shardOfRow[i] = getShard(ChaseRow(sizerow, batch.data() + i * sizerow));
+        shardBegin[shardOfRow[i] + 1]++;
+    }
+    for(int s = 0; s < CHASE_SHARDS; ++s) {
+        shardBegin[s + 1] += shardBegin[s];
+    }
+    std::vector<uint64_t> rowsPerShard(nrows);
+    {
+        std::vector<uint64_t> pos(shardBegin.begin(), shardBegin.end() - 1);
+        for(uint64_t i = 0; i < nrows; ++i) {
+            rowsPerShard[pos[shardOfRow[i]]++] = i;
+        }
+    }
+
+    const int chunk = (nthreads > 1 && nrows >= CHASE_PARALLEL_THRESHOLD) ?
+        1 : CHASE_SHARDS;
+    std::vector<std::vector<uint64_t>> newRows(CHASE_SHARDS);
+    std::vector<std::vector<std::pair<uint64_t, uint64_t>>> dupRows(CHASE_SHARDS);
+    ParallelTasks::parallel_for(0, CHASE_SHARDS, chunk,
+            ProbeShards(shards, batch, rowsPerShard, shardBegin, sizerow,
+                output, newRows, dupRows));
+
+    //Hand out a consecutive range of IDs to every shard
+    std::vector<uint64_t> firstID(CHASE_SHARDS);
+    uint64_t nnew = 0;
+    for(int s = 0; s < CHASE_SHARDS; ++s) {
+        firstID[s] = currentcounter + nnew;
+        nnew += newRows[s].size();
+    }
+    if (nnew > 0 && COUNTER(currentcounter) + nnew - 1 >= UINT32_MAX) {
+        LOG(ERRORL) << "I can assign at most 2^32 new IDs to an ext. variable... Stop!";
+        throw 10;
+    }
+    reserveRows(nstoredrows + nnew);
+    ParallelTasks::parallel_for(0, CHASE_SHARDS, chunk,
+            InsertShards(this, batch, firstID, newRows, dupRows, output));
+    nstoredrows += nnew;
+    currentcounter += nnew;
+}
+
 uint64_t *ChaseMgmt::Rows::getRow(size_t id) {
     uint64_t blocknr = id / SIZE_BLOCK;
     uint64_t offset = id % SIZE_BLOCK;
@@ -55,6 +235,48 @@ uint64_t *ChaseMgmt::Rows::getRow(size_t id) {
     return block_content.get() + offset * sizerow;
 }
 
+void ChaseMgmt::Rows::store(std::ostream &out) {
+    Checkpoint::writeInt(out, sizerow);
+    Checkpoint::writeInt(out, currentcounter);
+    Checkpoint::writeInt(out, nstoredrows);
+    for (uint64_t i = 0; i < nstoredrows; ++i) {
+        uint64_t *row = getRow(i);
+        uint64_t value = 0;
+        existingRow(row, value);
+        for (uint8_t j = 0; j < sizerow; ++j) {
+            Checkpoint::writeInt(out, row[j]);
+        }
+        Checkpoint::writeInt(out, value);
+    }
+    Checkpoint::writeInt(out, deps.size());
+    for (const auto d : deps) {
+        Checkpoint::writeInt(out, d);
+    }
+}
+
+void ChaseMgmt::Rows::load(std::istream &in) {
+    if (Checkpoint::readInt(in) != sizerow || nstoredrows != 0) {
+        LOG(ERRORL) << "The checkpoint does not match the rules";
+        throw 10;
+    }
+    currentcounter = Checkpoint::readInt(in);
+    const uint64_t nrows = Checkpoint::readInt(in);
+    reserveRows(nrows);
+    std::vector<uint64_t> row(sizerow);
+    for (uint64_t i = 0; i < nrows; ++i) {
+        for (uint8_t j = 0; j < sizerow; ++j) {
+            row[j] = Checkpoint::readInt(in);
+        }
+        ChaseRow r(sizerow, storeRow(i, row.data()));
+        shards[getShard(r)][r] = Checkpoint::readInt(in);
+    }
+    nstoredrows = nrows;
+    const uint64_t ndeps = Checkpoint::readInt(in);
+    for (uint64_t i = 0; i < ndeps; ++i) {
+        deps.insert(Checkpoint::readInt(in));
+    }
+}
+
 static bool checkValue(uint64_t target, uint64_t v, std::set<uint64_t> &toCheck) {
     LOG(TRACEL) << "checkValue: target = " << target << ", v = " << v;
     if ((v & RULEVARMASK) == target) {
@@ -84,15 +306,32 @@ ChaseMgmt::Rows *ChaseMgmt::RuleContainer::getRows(Var_t var) {
     return &vars2rows.find(var)->second;
 }
 
+void ChaseMgmt::RuleContainer::store(std::ostream &out) {
+    Checkpoint::writeInt(out, vars2rows.size());
+    for (auto &el : vars2rows) {
+        Checkpoint::writeInt(out, el.first);
+        el.second.store(out);
+    }
+}
+
+void ChaseMgmt::RuleContainer::load(std::istream &in) {
+    const uint64_t nvars = Checkpoint::readInt(in);
+    for (uint64_t i = 0; i < nvars; ++i) {
+        const Var_t var = (Var_t) Checkpoint::readInt(in);
+        getRows(var)->load(in);
+    }
+}
+
 //************** END RULE CONTAINER *************
 
 //************** CHASE MGMT ***************
 ChaseMgmt::ChaseMgmt(std::vector<RuleExecutionDetails> &rules,
         const TypeChase typeChase, const bool checkCyclic,
-        const int ruleToCheck, const PredId_t predIgnoreBlock) :
+        const int ruleToCheck, const PredId_t predIgnoreBlock,
+        const int nthreads) :
     typeChase(typeChase), checkCyclic(checkCyclic),
     ruleToCheck(ruleToCheck), cyclic(false),
-    predIgnoreBlock(predIgnoreBlock) {
+    predIgnoreBlock(predIgnoreBlock), nthreads(nthreads) {
         this->rules.resize(rules.size());
         for(const auto &r : rules) {
             if (r.rule.getId() >= rules.size()) {
@@ -173,6 +412,7 @@ bool ChaseMgmt::checkRecursive(uint64_t target, uint64_t rv) {
 
 // Check if rv is recursive.
 bool ChaseMgmt::checkRecursive(uint64_t rv) {
+    rv = TermOverflow::decode(rv);
     uint64_t mask = rv & RULEVARMASK;
     if (mask == 0) {
         return false;
@@ -181,6 +421,7 @@ bool ChaseMgmt::checkRecursive(uint64_t rv) {
 }
 
 std::string ChaseMgmt::getString(uint64_t term) {
+    term = TermOverflow::decode(term);
     if (term == COUNTER(term)) {
         return std::to_string(term);
     }
@@ -204,6 +445,15 @@ std::string ChaseMgmt::getString(uint64_t term) {
 }
 
 uint64_t ChaseMgmt::getNewFunctionTerm(uint64_t term, uint64_t &freshIDs) {
+    return TermOverflow::encode(newFunctionTerm(TermOverflow::decode(term),
+                freshIDs));
+}
+
+uint64_t ChaseMgmt::getFunctionTerm(uint64_t term, uint64_t id) {
+    return TermOverflow::encode(functionTerm(TermOverflow::decode(term), id));
+}
+
+uint64_t ChaseMgmt::newFunctionTerm(uint64_t term, uint64_t &freshIDs) {
     const uint64_t ruleID = GET_RULE(term);
     auto *ruleContainer = getRuleContainer(ruleID);
     const uint64_t varID = GET_VAR(term);
@@ -218,7 +468,7 @@ uint64_t ChaseMgmt::getNewFunctionTerm(uint64_t term, uint64_t &freshIDs) {
         if (values[i] == COUNTER(values[i])) {
             newrow[i] = freshIDs++;
         } else {
-            newrow[i] = getNewFunctionTerm(values[i], freshIDs);
+            newrow[i] = newFunctionTerm(values[i], freshIDs);
         }
         LOG(DEBUGL) << "value was: " << getString(values[i]) << ", becomes " << getString(newrow[i]);
     }
@@ -230,7 +480,7 @@ uint64_t ChaseMgmt::getNewFunctionTerm(uint64_t term, uint64_t &freshIDs) {
     return value;
 }
 
-uint64_t ChaseMgmt::getFunctionTerm(uint64_t term, uint64_t id) {
+uint64_t ChaseMgmt::functionTerm(uint64_t term, uint64_t id) {
     const uint64_t ruleID = GET_RULE(term);
     auto *ruleContainer = getRuleContainer(ruleID);
     const uint64_t varID = GET_VAR(term);
@@ -245,7 +495,7 @@ uint64_t ChaseMgmt::getFunctionTerm(uint64_t term, uint64_t id) {
         if (values[i] == COUNTER(values[i])) {
             newrow[i] = id;
         } else {
-            newrow[i] = getFunctionTerm(values[i], id);
+            newrow[i] = functionTerm(values[i], id);
         }
         LOG(DEBUGL) << "value was: " << getString(values[i]) << ", becomes " << getString(newrow[i]);
     }
@@ -267,42 +517,47 @@ std::shared_ptr<Column> ChaseMgmt::getNewOrExistingIDs(
     auto rows = ruleContainer->getRows(var);
     const uint8_t sizerow = rows->getSizeRow();
     assert(sizerow == columns.size());
-    std::vector<Term_t> functerms;
-    uint64_t row[256];
 
-    std::vector<std::unique_ptr<ColumnReader>> readers;
+    std::vector<const std::vector<Term_t> *> vectors(sizerow);
+    if (sizerow > 0) {
+        ParallelTasks::parallel_for(0, sizerow, nthreads > 1 ? 1 : sizerow,
+                GetVectors(columns, vectors));
+    }
     for(uint8_t j = 0; j < sizerow; ++j) {
-        readers.push_back(columns[j]->getReader());
+        if (vectors[j]->size() < sizecolumns) {
+            LOG(ERRORL) << "Should not happen ...";
+            throw 10;
+        }
     }
-    uint64_t rulevar = RULE_SHIFT(ruleid) + VAR_SHIFT(var);
-    for(uint64_t i = 0; i < sizecolumns; ++i) {
-        for(uint8_t j = 0; j < sizerow; ++j) {
-            if (!readers[j]->hasNext()) {
-                LOG(ERRORL) << "Should not happen ...";
-                throw 10;
-            }
-            row[j] = readers[j]->next();
-            if (checkCyclic) {
-                if ((ruleToCheck < 0 || ruleToCheck == ruleid) && ! cyclic) {
-                    // Check if we are about to introduce a cyclic term ...
-                    if ((row[j] & RULEVARMASK) != 0) {
-                        LOG(TRACEL) << "to check: ruleid = " << ruleid << ", varID = " << var << ", read value " << getString(row[j]);
-                        if ((row[j] & RULEVARMASK) == rulevar) {
-                            cyclic = true;
-                        } else {
-                            cyclic = checkRecursive(rulevar, row[j]);
-                        }
-                        LOG(TRACEL) << "cyclic = " << cyclic;
+
+    if (checkCyclic && (ruleToCheck < 0 || ruleToCheck == ruleid)) {
+        // Check if we are about to introduce a cyclic term ...
+        uint64_t rulevar = RULE_SHIFT(ruleid) + VAR_SHIFT(var);
+        for(uint64_t i = 0; i < sizecolumns && !cyclic; ++i) {
+            for(uint8_t j = 0; j < sizerow && !cyclic; ++j) {
+                uint64_t value = TermOverflow::decode((*vectors[j])[i]);
+                if ((value & RULEVARMASK) != 0) {
+                    LOG(TRACEL) << "to check: ruleid = " << ruleid << ", varID = " << var << ", read value " << getString(value);
+                    if ((value & RULEVARMASK) == rulevar) {
+                        cyclic = true;
+                    } else {
+                        cyclic = checkRecursive(rulevar, value);
                     }
+                    LOG(TRACEL) << "cyclic = " << cyclic;
                 }
             }
         }
-        // LOG(TRACEL) << "check: ruleid = " << ruleid << ", row[0] = " << row[0];
-        uint64_t value = 0;
-        if (!rows->existingRow(row, value)) {
-            value = rows->addRow(row);
+    }
+
+    std::vector<uint64_t> ids;
+    rows->getOrAddRows(vectors, sizecolumns, ids, nthreads);
+    std::vector<Term_t> functerms;
+    TermOverflow::encode(ids, functerms);
+
+    for(uint8_t j = 0; j < sizerow; ++j) {
+        if (!columns[j]->isBackedByVector()) {
+            delete vectors[j];
         }
-        functerms.push_back(value);
     }
     return ColumnWriter::getColumn(functerms, false);
 }
@@ -311,7 +566,39 @@ bool ChaseMgmt::checkCyclicTerms(uint32_t ruleid) {
     return cyclic;
 }
 
+void ChaseMgmt::store(std::ostream &out) {
+    Checkpoint::writeInt(out, rules.size());
+    for (const auto &r : rules) {
+        if (r) {
+            Checkpoint::writeInt(out, 1);
+            r->store(out);
+        } else {
+            Checkpoint::writeInt(out, 0);
+        }
+    }
+    Checkpoint::writeInt(out, cyclic);
+}
+
+void ChaseMgmt::load(std::istream &in) {
+    if (Checkpoint::readInt(in) != rules.size()) {
+        LOG(ERRORL) << "The checkpoint does not match the rules";
+        throw 10;
+    }
+    for (const auto &r : rules) {
+        const bool present = Checkpoint::readInt(in) != 0;
+        if (present != (bool) r) {
+            LOG(ERRORL) << "The checkpoint does not match the rules";
+            throw 10;
+        }
+        if (present) {
+            r->load(in);
+        }
+    }
+    cyclic = Checkpoint::readInt(in) != 0;
+}
+
 uint64_t ChaseMgmt::countDepth(uint64_t id, uint64_t depth) {
+    id = TermOverflow::decode(id);
     if ((id & RULEVARMASK) != 0) {
         auto &ruleContainer = rules[GET_RULE(id)];
         uint8_t var = GET_VAR(id);
@@ -0,0 +1,83 @@
+#include <vlog/checkpoint.h>
+#include <vlog/spillmgr.h>
+
+#include <kognac/logs.h>
+
+#include <vector>
+
+static void checkInput(std::istream &in) {
+    if (!in) {
+        LOG(ERRORL) << "The checkpoint is truncated or corrupted";
+        throw 10;
+    }
+}
+
+void Checkpoint::writeInt(std::ostream &out, uint64_t v) {
+    char buffer[10];
+    int n = 0;
+    while (v >= 128) {
+        buffer[n++] = (char) ((v & 127) | 128);
+        v >>= 7;
+    }
+    buffer[n++] = (char) v;
+    out.write(buffer, n);
+}
+
+uint64_t Checkpoint::readInt(std::istream &in) {
+    uint64_t v = 0;
+    int shift = 0;
+    int b;
+    do {
+        b = in.get();
+        if (b == EOF || shift > 63) {
+            LOG(ERRORL) << "The checkpoint is truncated or corrupted";
+            throw 10;
+        }
+        v |= (uint64_t) (b & 127) << shift;
+        shift += 7;
+    } while (b & 128);
+    return v;
+}
+
+void Checkpoint::writeString(std::ostream &out, const std::string &s) {
+    writeInt(out, s.size());
+    out.write(s.data(), s.size());
+}
+
+std::string Checkpoint::readString(std::istream &in) {
+    const uint64_t size = readInt(in);
+    std::string s(size, '\0');
+    if (size > 0) {
+        in.read(&s[0], size);
+        checkInput(in);
+    }
+    return s;
+}
+
+void Checkpoint::writeColumn(std::ostream &out,
+        std::shared_ptr<Column> column) {
+    writeInt(out, column->size());
+    std::unique_ptr<ColumnReader> reader = column->getReader();
+    Term_t first = 0, last = 0;
+    size_t count = 0;
+    SpilledColumn::write(*reader, out, first, last, count);
+    if (count != column->size()) {
+        LOG(ERRORL) << "Column of " << column->size() << " rows returned "
+            << count << " values";
+        throw 10;
+    }
+}
+
+std::shared_ptr<Column> Checkpoint::readColumn(std::istream &in) {
+    const uint64_t size = readInt(in);
+    std::vector<Term_t> values(size);
+    Term_t prev = 0;
+    for (uint64_t i = 0; i < size; ++i) {
+        const uint64_t delta = readInt(in);
+        //Inverse of the zigzag encoding, modulo 2^64
+        prev = (Term_t) ((uint64_t) prev +
+                ((delta >> 1) ^ (0 - (delta & 1))));
+        values[i] = prev;
+    }
+    return ColumnWriter::getColumn(values, false);
+}
@@ -133,6 +133,244 @@ std::unique_ptr<ColumnReader> CompressedColumn::getReader() const {
                 blocks, _size));
 }
 
+//----- PACKED COLUMN ----------
+
+static uint8_t bitsNeeded(uint64_t v) {
+    uint8_t bits = 0;
+    while (v != 0) {
+        bits++;
+        v >>= 1;
+    }
+    return bits;
+}
+
+static size_t packedWords(const size_t n, const uint8_t bits) {
+    return (n * bits + 63) / 64;
+}
+
+static void packBits(const uint64_t *in, const size_t n, const uint8_t bits,
+        uint64_t *out) {
+    for (size_t i = 0; i < n; ++i) {
+        const size_t bit = i * bits;
+        const size_t w = bit >> 6;
+        const unsigned s = bit & 63;
+        out[w] |= in[i] << s;
+        if (s + bits > 64) {
+            out[w + 1] |= in[i] >> (64 - s);
+        }
+    }
+}
+
+//Plain scalar loop. The width is a template parameter so that the mask
+//and the shifts are constants for each width
+template<int BITS>
+static void unpackBits(const uint64_t *in, const size_t n, const Term_t base,
+        Term_t *out) {
+    const uint64_t mask = BITS == 64 ? ~((uint64_t) 0) : ((((uint64_t) 1) << (BITS & 63)) - 1);
+    for (size_t i = 0; i < n; ++i) {
+        const size_t bit = i * BITS;
+        const size_t w = bit >> 6;
+        const unsigned s = bit & 63;
+        uint64_t v = in[w] >> s;
+        if (s + BITS > 64) {
+            v |= in[w + 1] << ((64 - s) & 63);
+        }
+        out[i] = base + (Term_t) (v & mask);
+    }
+}
+
+#define UNPACK_CASE(b) case b: unpackBits<b>(in, n, base, out); break;
+
+static void unpackBits(const uint64_t *in, const size_t n, const uint8_t bits,
+        const Term_t base, Term_t *out) {
+    switch (bits) {
+        case 0:
+            std::fill(out, out + n, base);
+            break;
+        UNPACK_CASE(1) UNPACK_CASE(2) UNPACK_CASE(3) UNPACK_CASE(4)
+        UNPACK_CASE(5) UNPACK_CASE(6) UNPACK_CASE(7) UNPACK_CASE(8)
+        UNPACK_CASE(9) UNPACK_CASE(10) UNPACK_CASE(11) UNPACK_CASE(12)
+        UNPACK_CASE(13) UNPACK_CASE(14) UNPACK_CASE(15) UNPACK_CASE(16)
+        UNPACK_CASE(17) UNPACK_CASE(18) UNPACK_CASE(19) UNPACK_CASE(20)
+        UNPACK_CASE(21) UNPACK_CASE(22) UNPACK_CASE(23) UNPACK_CASE(24)
+        UNPACK_CASE(25) UNPACK_CASE(26) UNPACK_CASE(27) UNPACK_CASE(28)
+        UNPACK_CASE(29) UNPACK_CASE(30) UNPACK_CASE(31) UNPACK_CASE(32)
+        UNPACK_CASE(33) UNPACK_CASE(34) UNPACK_CASE(35) UNPACK_CASE(36)
+        UNPACK_CASE(37) UNPACK_CASE(38) UNPACK_CASE(39) UNPACK_CASE(40)
+        UNPACK_CASE(41) UNPACK_CASE(42) UNPACK_CASE(43) UNPACK_CASE(44)
+        UNPACK_CASE(45) UNPACK_CASE(46) UNPACK_CASE(47) UNPACK_CASE(48)
+        UNPACK_CASE(49) UNPACK_CASE(50) UNPACK_CASE(51) UNPACK_CASE(52)
+        UNPACK_CASE(53) UNPACK_CASE(54) UNPACK_CASE(55) UNPACK_CASE(56)
+        UNPACK_CASE(57) UNPACK_CASE(58) UNPACK_CASE(59) UNPACK_CASE(60)
+        UNPACK_CASE(61) UNPACK_CASE(62) UNPACK_CASE(63) UNPACK_CASE(64)
+        default:
+            LOG(ERRORL) << "Wrong width " << (int) bits << " in a packed column";
+            throw 10;
+    }
+}
+
+std::shared_ptr<Column> PackedColumn::pack(const std::vector<Term_t> &values) {
+    std::shared_ptr<PackedColumn> col(new PackedColumn());
+    col->_size = values.size();
+    const size_t nchunks = (values.size() + PACKED_CHUNK_SIZE - 1) / PACKED_CHUNK_SIZE;
+    col->chunks.reserve(nchunks);
+
+    std::vector<uint64_t> codes(PACKED_CHUNK_SIZE);
+    std::vector<Term_t> dict;
+    bool constant = true;
+    for (size_t c = 0; c < nchunks; ++c) {
+        const size_t begin = c * PACKED_CHUNK_SIZE;
+        const size_t n = std::min((size_t) PACKED_CHUNK_SIZE, values.size() - begin);
+        const Term_t *in = values.data() + begin;
+        Term_t min = in[0];
+        Term_t max = in[0];
+        for (size_t i = 1; i < n; ++i) {
+            min = std::min(min, in[i]);
+            max = std::max(max, in[i]);
+        }
+        if (min != max || min != values[0]) {
+            constant = false;
+        }
+
+        PackedChunk chunk;
+        chunk.base = min;
+        chunk.offset = col->data.size();
+        chunk.dictOffset = col->dicts.size();
+        chunk.dictSize = 0;
+        chunk.bits = bitsNeeded((uint64_t) (max - min));
+
+        //With a wide range, a dictionary can be smaller if there are few
+        //distinct values
+        if (chunk.bits > 12) {
+            dict.assign(in, in + n);
+            std::sort(dict.begin(), dict.end());
+            dict.erase(std::unique(dict.begin(), dict.end()), dict.end());
+            const uint8_t dictBits = bitsNeeded(dict.size() - 1);
+            if (n * dictBits + dict.size() * 64 < n * chunk.bits) {
+                chunk.dictSize = (uint16_t) dict.size();
+                chunk.bits = dictBits;
+                chunk.base = 0;
+                col->dicts.insert(col->dicts.end(), dict.begin(), dict.end());
+                for (size_t i = 0; i < n; ++i) {
+                    codes[i] = std::lower_bound(dict.begin(), dict.end(), in[i]) - dict.begin();
+                }
+            }
+        }
+        if (chunk.dictSize == 0) {
+            for (size_t i = 0; i < n; ++i) {
+                codes[i] = (uint64_t) (in[i] - min);
+            }
+        }
+        //One word more, so that the decoder can always read the next word
+        col->data.resize(col->data.size() + packedWords(n, chunk.bits) + 1, 0);
+        packBits(codes.data(), n, chunk.bits, col->data.data() + chunk.offset);
+        col->chunks.push_back(chunk);
+    }
+    col->constant = constant;
+    col->data.shrink_to_fit();
+    col->dicts.shrink_to_fit();
+
+    const size_t packedSize = col->data.size() * sizeof(uint64_t) +
+        col->dicts.size() * sizeof(Term_t) +
+        col->chunks.size() * sizeof(PackedChunk);
+    if (packedSize * 2 > values.size() * sizeof(Term_t)) {
+        return std::shared_ptr<Column>();
+    }
+    return col;
+}
+
+void PackedColumn::unpack(const size_t c, Term_t *out) const {
+    const PackedChunk &chunk = chunks[c];
+    const size_t n = std::min((size_t) PACKED_CHUNK_SIZE, _size - c * PACKED_CHUNK_SIZE);
+    unpackBits(data.data() + chunk.offset, n, chunk.bits, chunk.base, out);
+    if (chunk.dictSize > 0) {
+        const Term_t *dict = dicts.data() + chunk.dictOffset;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = dict[out[i]];
+        }
+    }
+}
+
+Term_t PackedColumn::getValue(const size_t pos) const {
+    const PackedChunk &chunk = chunks[pos / PACKED_CHUNK_SIZE];
+    const size_t bit = (pos % PACKED_CHUNK_SIZE) * chunk.bits;
+    const uint64_t *in = data.data() + chunk.offset + (bit >> 6);
+    const unsigned s = bit & 63;
+    uint64_t v = 0;
+    if (chunk.bits > 0) {
+        v = in[0] >> s;
+        if (s + chunk.bits > 64) {
+            v |= in[1] << (64 - s);
+        }
+        if (chunk.bits < 64) {
+            v &= (((uint64_t) 1) << chunk.bits) - 1;
+        }
+    }
+    if (chunk.dictSize > 0) {
+        return dicts[chunk.dictOffset + v];
+    }
+    return chunk.base + (Term_t) v;
+}
+
+std::unique_ptr<ColumnReader> PackedColumn::getReader() const {
+    return std::unique_ptr<ColumnReader>(new PackedColumnReader(*this));
+}
+
+bool PackedColumn::isIn(const Term_t t) const {
+    //Like InmemoryColumn, assume the column is sorted
+    size_t low = 0;
+    size_t high = _size;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        Term_t v = getValue(mid);
+        if (v == t) {
+            return true;
+        } else if (v < t) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return false;
+}
+
+std::shared_ptr<Column> PackedColumn::sort() const {
+    std::vector<Term_t> newValues = getReader()->asVector();
+    std::sort(newValues.begin(), newValues.end());
+    return ColumnWriter::getColumn(newValues, true);
+}
+
+std::shared_ptr<Column> PackedColumn::sort(const int nthreads) const {
+    if (nthreads <= 1) {
+        return sort();
+    }
+    std::vector<Term_t> newValues = getReader()->asVector();
+    if (newValues.size() > 4096) {
+        ParallelTasks::sort_int(newValues.begin(), newValues.end());
+    } else {
+        std::sort(newValues.begin(), newValues.end());
+    }
+    return ColumnWriter::getColumn(newValues, true);
+}
+
+std::shared_ptr<Column> PackedColumn::unique() const {
+    //This method assumes the vector is already sorted
+    std::vector<Term_t> newValues = getReader()->asVector();
+    auto last = std::unique(newValues.begin(), newValues.end());
+    newValues.erase(last, newValues.end());
+    newValues.shrink_to_fit();
+    return ColumnWriter::getColumn(newValues, true);
+}
+
+std::vector<Term_t> PackedColumnReader::asVector() {
+    std::vector<Term_t> output(col.size());
+    for (size_t c = 0; c < col.getNChunks(); ++c) {
+        col.unpack(c, output.data() + c * PACKED_CHUNK_SIZE);
+    }
+    return output;
+}
+//----- END PACKED COLUMN ----------
+
 Term_t CompressedColumn::getValue(const size_t pos) const {
     //Linear search -- inefficient. I can improve it with binary search
     size_t p = 0;
@@ -581,6 +819,23 @@ void ColumnWriter::concatenate(Column * c) {
     }
 }
 
+std::shared_ptr<Column> ColumnWriter::getUncompressedColumn(
+        std::vector<Term_t> &values) {
+#if PACKED_COLUMNS
+    //Large columns that do not compress with runs are often unsorted
+    //columns with a small range of values, which can be bit-packed
+    if (values.size() >= PACKED_MIN_SIZE) {
+        std::shared_ptr<Column> packed = PackedColumn::pack(values);
+        if (packed) {
+            std::vector<Term_t>().swap(values);
+            return packed;
+        }
+    }
+#endif
+    //swap the values. After, "values" is empty
+    return std::shared_ptr<Column>(new InmemoryColumn(values, true));
+}
+
 std::shared_ptr<Column> ColumnWriter::getColumn() {
     if (cached) {
         //The column was already being requested
@@ -598,10 +853,10 @@ std::shared_ptr<Column> ColumnWriter::getColumn() {
         } else {
             CompressedColumn col(blocks, /*offsetsize, deltas,*/ _size);
             std::vector<Term_t> values = col.getReader()->asVector();
-            cachedColumn = std::shared_ptr<Column>(new InmemoryColumn(values, true));
+            cachedColumn = getUncompressedColumn(values);
         }
     } else {
-        cachedColumn = std::shared_ptr<Column>(new InmemoryColumn(values, true));
+        cachedColumn = getUncompressedColumn(values);
     }
 #else
     cachedColumn = std::shared_ptr<Column>(new InmemoryColumn(values, true));
@@ -663,8 +918,8 @@ std::shared_ptr<Column> ColumnWriter::getColumn(std::vector<Term_t> &values, boo
         return std::shared_ptr<Column>(new CompressedColumn(blocks, offsetsize,
         deltas, values.size()));*/
     } else {
-        //swap the values. After, "values" is empty
-        return std::shared_ptr<Column>(new InmemoryColumn(values, true));
+        //After, "values" is empty
+        return getUncompressedColumn(values);
     }
 #else
     return std::shared_ptr<Column>(new InmemoryColumn(values, true));
@@ -190,7 +190,7 @@ bool EGDRuleProcessor::consolidate(const bool isFinished) {
             if (key == value)
                 continue;
 
-            if (UNA && ((key & RULEVARMASK) == 0) && ((value & RULEVARMASK) == 0)) {
+            if (UNA && !IS_FUNCTION_TERM(key) && !IS_FUNCTION_TERM(value)) {
                 LOG(ERRORL) << "Due to UNA, the chase does not exist (" <<
                     key << "," << value << ")";
                 throw 10;
@@ -198,11 +198,11 @@ bool EGDRuleProcessor::consolidate(const bool isFinished) {
 
             //The swap depends on the depth of the terms
             uint64_t depthKey = 0;
-            if ((key & RULEVARMASK) != 0) {
+            if (IS_FUNCTION_TERM(key)) {
                 depthKey = sn->getChaseManager()->countDepth(key);
             }
             uint64_t depthValue = 0;
-            if ((value & RULEVARMASK) != 0) {
+            if (IS_FUNCTION_TERM(value)) {
                 depthValue = sn->getChaseManager()->countDepth(value);
             }
             bool keySmallerThanValue = true;
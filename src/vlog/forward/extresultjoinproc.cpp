@@ -1,6 +1,7 @@
 #include <vlog/extresultjoinproc.h>
 #include <vlog/ruleexecdetails.h>
 #include <vlog/seminaiver.h>
+#include <vlog/minichase.h>
 
 static bool isPresent(Var_t el, std::vector<Var_t> &v) {
     for (int i = 0; i < v.size(); i++) {
@@ -386,28 +387,9 @@ void ExistentialRuleProcessor::addColumns(const int blockid,
         std::vector<uint64_t> filterRows; //The restricted chase might remove some IDs
         int count = 0;
         if (chaseMgmt->isCheckCyclicMode()) {
-            std::vector<bool> blocked(sizecolumns);
-            size_t blockedCount = 0;
-            uint64_t tmprow[256];
-            std::vector<std::unique_ptr<ColumnReader>> columnReaders;
-            for(uint8_t i = 0; i < c.size(); ++i) {
-                columnReaders.push_back(c[i]->getReader());
-            }
-
-            for (size_t i = 0; i < sizecolumns; ++i) {
-                //Fill the row
-                for (int j = 0; j < c.size(); ++j) {
-                    if (!columnReaders[j]->hasNext()) {
-                        LOG(ERRORL) << "This should not happen";
-                    }
-                    tmprow[j] = columnReaders[j]->next();
-                }
-
-                if (blocked_check(tmprow, c.size(), headPredicateToIgnore)) {
-                    blocked[i] = true;
-                    blockedCount++;
-                }
-            }
+            std::vector<bool> blocked;
+            size_t blockedCount = blocked_check(c, sizecolumns, blocked,
+                    headPredicateToIgnore);
 
             if (blockedCount == sizecolumns) {
                 return;
@@ -585,29 +567,9 @@ void ExistentialRuleProcessor::addColumns(const int blockid,
         std::vector<uint64_t> filterRows; //The restricted chase might remove some IDs
         int count = 0;
         if (chaseMgmt->isCheckCyclicMode()) {
-            std::vector<bool> blocked(sizecolumns);
-            size_t blockedCount = 0;
-            uint64_t tmprow[256];
-            std::vector<std::unique_ptr<ColumnReader>> columnReaders;
-            for(uint8_t i = 0; i < c.size(); ++i) {
-                columnReaders.push_back(c[i]->getReader());
-            }
-
-            for (size_t i = 0; i < sizecolumns; ++i) {
-                //Fill the row
-                for (int j = 0; j < c.size(); ++j) {
-                    if (!columnReaders[j]->hasNext()) {
-                        LOG(ERRORL) << "This should not happen";
-                    }
-                    tmprow[j] = columnReaders[j]->next();
-                }
-
-                if (blocked_check(tmprow, c.size(), headPredicateToIgnore)) {
-                    //It is blocked
-                    blocked[i] = true;
-                    blockedCount++;
-                }
-            }
+            std::vector<bool> blocked;
+            size_t blockedCount = blocked_check(c, sizecolumns, blocked,
+                    headPredicateToIgnore);
 
             if (blockedCount == sizecolumns) {
                 return;
@@ -812,89 +774,6 @@ std::vector<uint64_t> ExistentialRuleProcessor::blocked_check_computeBodyAtoms(
     return toMatch;
 }
 
-std::unique_ptr<SemiNaiver> ExistentialRuleProcessor::saturateInput(
-        std::vector<Literal> &input, Program *program, EDBLayer *layer) {
-
-    int level = Logger::getMinLevel();
-    Logger::setMinLevel(WARNL);
-    std::map<PredId_t, std::vector<uint64_t>> edbPredicates;
-    std::map<PredId_t, std::vector<uint64_t>> idbPredicates;
-
-    for(const auto &literal : input) {
-#if DEBUG
-        LOG(TRACEL) << "literal: " << literal.tostring(program, program->getKB());
-#endif
-
-        auto predid = literal.getPredicate().getId();
-        if (literal.getPredicate().getType() != EDB) {
-            if (!idbPredicates.count(predid)) {
-                idbPredicates.insert(std::make_pair(predid, std::vector<uint64_t>()));
-            }
-            for(uint8_t i = 0; i < literal.getTupleSize(); ++i) {
-                auto t = literal.getTermAtPos(i);
-                idbPredicates[predid].push_back(t.getValue());
-            }
-        } else {
-            if (!edbPredicates.count(predid)) {
-                edbPredicates.insert(std::make_pair(predid, std::vector<uint64_t>()));
-            }
-            for(uint8_t i = 0; i < literal.getTupleSize(); ++i) {
-                auto t = literal.getTermAtPos(i);
-                edbPredicates[predid].push_back(t.getValue());
-            }
-        }
-    }
-
-    std::vector<PredId_t> predicates = sn->getEDBLayer().getAllPredicateIDs();
-    for (auto pred : predicates) {
-        if (!edbPredicates.count(pred)) {
-            edbPredicates.insert(std::make_pair(pred, std::vector<uint64_t>()));
-        }
-    }
-    for(auto &pair : edbPredicates) {
-        uint8_t arity = sn->getEDBLayer().getPredArity(pair.first);
-        layer->addInmemoryTable(pair.first, arity, pair.second);
-    }
-
-    //Launch the semi-naive evaluation
-    std::unique_ptr<SemiNaiver> lsn(new SemiNaiver(
-                *layer, program, true, true, false, 1, false, true));
-
-    //Populate the IDB layer
-    for(auto &pair : idbPredicates) {
-        Predicate pred = program->getPredicate(pair.first);
-        const uint8_t card = pred.getCardinality();
-
-        //Construct the table
-        SegmentInserter inserter(card);
-        auto els = pair.second.data();
-        for(uint64_t i = 0; i < pair.second.size(); i += card) {
-            inserter.addRow(els + i);
-        }
-
-        //Populate the table
-        std::shared_ptr<const FCInternalTable> ltable(
-                new InmemoryFCInternalTable(card,
-                    0, true, inserter.getSortedAndUniqueSegment()));
-
-        //Define a generic query
-        VTuple tuple(card);
-        for(uint8_t i = 0; i < card; ++i) {
-            // tuple.set(VTerm(i, 0), i);
-            tuple.set(VTerm(i+1, 0), i);    // I suppose these should all be variables ... --Ceriel
-        }
-        Literal query(pred, tuple);
-        FCBlock block(0, ltable, query, 0, NULL, 0, true);
-        FCTable *table = lsn->getTable(pair.first, card);
-        table->addBlock(block);
-    }
-
-    //Launch the materialization
-    lsn->run();
-    Logger::setMinLevel(level);
-    return lsn;
-}
-
 void _addIfNotExists(std::vector<uint64_t> &list, uint64_t v) {
     for (const auto val : list) {
         if (val == v) {
@@ -941,8 +820,8 @@ void ExistentialRuleProcessor::enhanceFunctionTerms(
             const auto &term = literal.getTermAtPos(j);
             const auto termValue = term.getValue();
             LOG(TRACEL) << "  Processing term " << chaseMgmt->getString(termValue);
-            if (termValue != COUNTER(termValue)) {
-                _addIfNotExists(functionTerms, termValue);
+            if (IS_FUNCTION_TERM(termValue)) {
+                _addIfNotExists(functionTerms, TermOverflow::decode(termValue));
             }
         }
     }
@@ -964,7 +843,8 @@ void ExistentialRuleProcessor::enhanceFunctionTerms(
         const auto &nameVars = rows->getNameArgVars();
         std::map<Var_t, uint64_t> mappings;
         for(int i = 0; i < nvalues; ++i) {
-            mappings.insert(std::make_pair(nameVars[i], values[i]));
+            mappings.insert(std::make_pair(nameVars[i],
+                        (uint64_t) TermOverflow::encode(values[i])));
             if (values[i] != COUNTER(values[i])) {
                 //possibly a new function term.
                 _addIfNotExists(functionTerms, values[i]);
@@ -1002,7 +882,8 @@ void ExistentialRuleProcessor::enhanceFunctionTerms(
         }
         //Also add the original variable, and consider other head atoms
         assert(!mappings.count(varID));
-        mappings.insert(std::make_pair(varID, termValue));
+        mappings.insert(std::make_pair(varID,
+                    (uint64_t) TermOverflow::encode(termValue)));
 
         for(const auto &hLiteral : rule->getHeads()) {
             /*
@@ -1022,7 +903,8 @@ void ExistentialRuleProcessor::enhanceFunctionTerms(
                         uint64_t value;
                         bool v = vrows->existingRow(values, value);
                         assert(v);
-                        mappings.insert(std::make_pair(varID, value));
+                        mappings.insert(std::make_pair(varID,
+                                    (uint64_t) TermOverflow::encode(value)));
                         // LOG(ERRORL) << "There are existential variables not defined. Must implement their retrievals";
                         // throw 10;
                     }
@@ -1036,8 +918,41 @@ void ExistentialRuleProcessor::enhanceFunctionTerms(
     }
 }
 
+size_t ExistentialRuleProcessor::blocked_check(
+        std::vector<std::shared_ptr<Column>> &columns,
+        size_t nrows, std::vector<bool> &blocked,
+        PredId_t headPredicateToIgnore) {
+    blocked.resize(nrows);
+    size_t blockedCount = 0;
+    uint64_t tmprow[256];
+    std::vector<std::unique_ptr<ColumnReader>> readers;
+    for(uint8_t i = 0; i < columns.size(); ++i) {
+        readers.push_back(columns[i]->getReader());
+    }
+
+    Program *p = sn->get_RMFC_program();
+    std::unique_ptr<MiniChase> chase = sn->acquireMiniChase(
+            p != NULL ? p : sn->getProgram());
+    for (size_t i = 0; i < nrows; ++i) {
+        //Fill the row
+        for (int j = 0; j < columns.size(); ++j) {
+            if (!readers[j]->hasNext()) {
+                LOG(ERRORL) << "This should not happen";
+            }
+            tmprow[j] = readers[j]->next();
+        }
+        if (blocked_check(tmprow, columns.size(), chase.get(),
+                    headPredicateToIgnore)) {
+            blocked[i] = true;
+            blockedCount++;
+        }
+    }
+    sn->releaseMiniChase(std::move(chase));
+    return blockedCount;
+}
+
 bool ExistentialRuleProcessor::blocked_check(uint64_t *row,
-        size_t sizeRow, PredId_t headPredicateToIgnore) {
+        size_t sizeRow, MiniChase *chase, PredId_t headPredicateToIgnore) {
     //For RMFC, we need to replace all non-skolem constants with *.
     uint64_t newrow[256];
     //Get a starting value for the fresh IDs
@@ -1068,13 +983,13 @@ bool ExistentialRuleProcessor::blocked_check(uint64_t *row,
         uint64_t id = 0;
         rmfc->getKB()->getOrAddDictNumber("*", 1, id);
         for (int i = 0; i < sizeRow; i++) {
-            newrow[i] = (row[i] == COUNTER(row[i])) ? id : chaseMgmt->getFunctionTerm(row[i], id);
+            newrow[i] = !IS_FUNCTION_TERM(row[i]) ? id : chaseMgmt->getFunctionTerm(row[i], id);
         }
     } else {
         // row represents the sigma map (or rather: Img(sigma)).
         // Make it represent sigma prime.
         for (int i = 0; i < sizeRow; i++) {
-            if (row[i] == COUNTER(row[i])) {
+            if (!IS_FUNCTION_TERM(row[i])) {
                 // Not a function term
                 newrow[i] = freshIDs++;
             } else {
@@ -1100,15 +1015,17 @@ bool ExistentialRuleProcessor::blocked_check(uint64_t *row,
     
     std::vector<uint64_t> toMatch = blocked_check_computeBodyAtoms(input, row, headPredicateToIgnore);
 
-    std::unique_ptr<SemiNaiver> saturation;
+    SemiNaiver *saturation;
 
     //Then I need to add all facts relevant to produce the function terms
     enhanceFunctionTerms(input, freshIDs, sn->get_RMFC_program() == NULL);
     if (rmfc == NULL) {
         //Finally I need to saturate "input" with the datalog rules
-        saturation = saturateInput(input, sn->getProgram(), new EDBLayer(sn->getEDBLayer(), false));
+        saturation = chase->saturate(input);
     } else {
-        EDBLayer *layer = new EDBLayer(*(rmfc->getKB()), true);
+#if DEBUG
+        EDBLayer *layer = rmfc->getKB();
+#endif
         // Exclusion of rule ρ⋆ under substitution σ⋆
         // we have to provide a binding for the added __EXCLUDE_DUMMY__.
         const Rule &rule = rmfc->getRule(ruleDetails->rule.getId());
@@ -1123,7 +1040,7 @@ bool ExistentialRuleProcessor::blocked_check(uint64_t *row,
         LOG(DEBUGL) << "Adding exclusion info for rule " << rule.tostring(rmfc, layer) << ": " << input.back().tostring(rmfc, layer);
 #endif
 
-        saturation = saturateInput(input, rmfc, layer);
+        saturation = chase->saturate(input);
     }
 
     // Now, check our special rule (see cycles/checker.cpp).
@@ -1176,9 +1093,6 @@ bool ExistentialRuleProcessor::blocked_check(uint64_t *row,
         itr.moveNextCount();
     }
 
-    EDBLayer &l = saturation->getEDBLayer();
-    delete &l;
-
     LOG(DEBUGL) << "blocked_check returns " << found;
 
     return found;
@@ -1216,30 +1130,14 @@ bool ExistentialRuleProcessor::consolidate(const bool isFinished) {
             std::vector<uint64_t> filterRows;
             int count = 0;
             if (chaseMgmt->isCheckCyclicMode()) {
-                size_t blockedCount = 0;
                 const uint8_t segmentSize = unfilterdSegment->getNColumns();
-                std::vector<bool> blocked(nrows);
-                uint64_t tmprow[256];
+                std::vector<bool> blocked;
                 std::vector<std::shared_ptr<Column>> segmentColumns;
-                std::vector<std::unique_ptr<ColumnReader>> segmentReaders;
                 for(uint8_t i = 0; i < segmentSize; ++i) {
                     segmentColumns.push_back(unfilterdSegment->getColumn(i));
-                    segmentReaders.push_back(segmentColumns.back()->getReader());
-                }
-
-                for (size_t i = 0; i < nrows; ++i) {
-                    //Fill the row
-                    for(uint8_t j = 0; j < segmentSize; ++j) {
-                        if (!segmentReaders[j]->hasNext()) {
-                            LOG(ERRORL) << "This should not happen";
-                        }
-                        tmprow[j] = segmentReaders[j]->next();
-                    }
-                    if (blocked_check(tmprow, segmentSize, headPredicateToIgnore)) { //Is it blocked?
-                        blocked[i] = true;
-                        blockedCount++;
-                    }
                 }
+                size_t blockedCount = blocked_check(segmentColumns, nrows,
+                        blocked, headPredicateToIgnore);
 
                 if (blockedCount == nrows) {
                     tmpRelation = std::unique_ptr<SegmentInserter>();
@@ -1,8 +1,13 @@
 #include <vlog/fcinttable.h>
 #include <vlog/column.h>
+#include <vlog/spillmgr.h>
+#include <vlog/metrics.h>
 
 #include <string>
 #include <random>
+#include <algorithm>
+#include <functional>
+#include <mutex>
 
 FCInternalTable::~FCInternalTable() {
 }
@@ -782,6 +787,7 @@ FCInternalTableItr *InmemoryFCInternalTable::getSortedIterator(int nthreads) con
     }
     if (!isSorted()) {
         values = values->sortBy(NULL, nthreads, false);
+        sorted = true;
     }
 
     InmemoryFCInternalTableItr *itr = new InmemoryFCInternalTableItr();
@@ -790,13 +796,218 @@ FCInternalTableItr *InmemoryFCInternalTable::getSortedIterator(int nthreads) con
 }
 
 #if INMEMINTERNALCACHE
-static uint32_t __getKeyFromFields(const std::vector<uint8_t> &fields, uint8_t sz) {
-    uint32_t key = 0;
-    for(uint8_t i = 0; i < sz; ++i) {
-        uint8_t field = fields[i];
-        key = (key << 8) + (uint32_t)(field+1);
+std::atomic<size_t> SortPermutation::usedBytes(0);
+
+//Guards the secondary sort orders of all the tables. Complete tables are
+//read by several threads when the components of a program run in
+//parallel (see FCTable::prepareForReaders)
+static std::mutex sortCacheMutex;
+
+template<typename K>
+static void sortRowIds(std::vector<K> &idxs, const SegmentSorter &sorter,
+        const int nthreads) {
+    for (size_t i = 0; i < idxs.size(); ++i) {
+        idxs[i] = i;
+    }
+    if (nthreads > 1 && idxs.size() > 1000) {
+        ParallelTasks::sort_int(idxs.begin(), idxs.end(), std::ref(sorter), nthreads);
+    } else {
+        std::sort(idxs.begin(), idxs.end(), std::ref(sorter));
     }
-    return key;
+}
+
+template<typename K>
+struct GatherRows {
+    const std::vector<K> &idxs;
+    const std::vector<const std::vector<Term_t> *> &vectors;
+    std::vector<std::vector<Term_t>> &out;
+
+    GatherRows(const std::vector<K> &idxs,
+            const std::vector<const std::vector<Term_t> *> &vectors,
+            std::vector<std::vector<Term_t>> &out) : idxs(idxs), vectors(vectors), out(out) {
+    }
+
+    void gather(const size_t begin, const size_t end) const {
+        for (int j = 0; j < out.size(); j++) {
+            const std::vector<Term_t> &in = *vectors[j];
+            std::vector<Term_t> &o = out[j];
+            for (size_t i = begin; i < end; ++i) {
+                o[i] = in[idxs[i]];
+            }
+        }
+    }
+
+    void operator()(const ParallelRange& r) const {
+        gather(r.begin(), r.end());
+    }
+};
+
+template<typename K>
+static void gatherRows(const std::vector<K> &idxs,
+        const std::vector<const std::vector<Term_t> *> &vectors,
+        std::vector<std::vector<Term_t>> &out,
+        const int nthreads) {
+    GatherRows<K> g(idxs, vectors, out);
+    if (nthreads > 1 && idxs.size() >= 10000) {
+        size_t chunks = (idxs.size() + nthreads - 1) / nthreads;
+        ParallelTasks::parallel_for(0, idxs.size(), chunks, g);
+    } else {
+        g.gather(0, idxs.size());
+    }
+}
+
+std::shared_ptr<const SortPermutation> SortPermutation::create(
+        const Segment &segment,
+        const std::vector<uint8_t> &fields,
+        const int nthreads) {
+    const size_t nrows = segment.getNRows();
+
+    //Same order as Segment::sortBy: first the fields, then the other
+    //columns. Constant columns do not affect the order.
+    std::vector<uint8_t> order(fields);
+    for (uint8_t i = 0; i < segment.getNColumns(); ++i) {
+        if (std::find(fields.begin(), fields.end(), i) == fields.end()) {
+            order.push_back(i);
+        }
+    }
+    std::vector<std::shared_ptr<Column>> cols;
+    for (auto f : order) {
+        if (!segment.isConstantField(f)) {
+            cols.push_back(segment.getColumn(f));
+        }
+    }
+    if (nrows < 2 || cols.empty()) {
+        return std::shared_ptr<const SortPermutation>();
+    }
+
+    const bool use32 = nrows <= UINT32_MAX;
+    const size_t bytes = nrows * (use32 ? sizeof(uint32_t) : sizeof(uint64_t));
+    if (!reserve(bytes)) {
+        LOG(DEBUGL) << "No budget left to cache a sort order of " << nrows << " rows";
+        return std::shared_ptr<const SortPermutation>();
+    }
+    std::shared_ptr<SortPermutation> perm(new SortPermutation());
+    perm->reservedBytes = bytes;
+
+    std::vector<const std::vector<Term_t> *> vectors = Segment::getAllVectors(cols, nthreads);
+    SegmentSorter sorter(vectors);
+    if (use32) {
+        perm->idxs32.resize(nrows);
+        sortRowIds(perm->idxs32, sorter, nthreads);
+    } else {
+        perm->idxs64.resize(nrows);
+        sortRowIds(perm->idxs64, sorter, nthreads);
+    }
+    Segment::deleteAllVectors(cols, vectors);
+    return perm;
+}
+
+bool SortPermutation::reserve(const size_t bytes) {
+    if (usedBytes.fetch_add(bytes) + bytes > INMEMINTERNALCACHE_BUDGET) {
+        usedBytes -= bytes;
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const Segment> SortPermutation::apply(const Segment &segment,
+        const uint8_t firstField,
+        const int nthreads) const {
+    {
+        std::lock_guard<std::mutex> lock(sortCacheMutex);
+        if (applied) {
+            return applied;
+        }
+    }
+    const uint8_t nfields = segment.getNColumns();
+    std::vector<std::shared_ptr<Column>> varColumns;
+    for (uint8_t i = 0; i < nfields; ++i) {
+        if (!segment.isConstantField(i)) {
+            varColumns.push_back(segment.getColumn(i));
+        }
+    }
+    std::vector<const std::vector<Term_t> *> vectors = Segment::getAllVectors(varColumns, nthreads);
+    std::vector<std::vector<Term_t>> out(varColumns.size());
+    for (auto &o : out) {
+        o.resize(size());
+    }
+    if (idxs32.empty()) {
+        gatherRows(idxs64, vectors, out, nthreads);
+    } else {
+        gatherRows(idxs32, vectors, out, nthreads);
+    }
+    Segment::deleteAllVectors(varColumns, vectors);
+
+    //Constant columns are shared with the original segment
+    std::vector<std::shared_ptr<Column>> columns;
+    int j = 0;
+    for (uint8_t i = 0; i < nfields; ++i) {
+        if (segment.isConstantField(i)) {
+            columns.push_back(segment.getColumn(i));
+        } else {
+            columns.push_back(ColumnWriter::getColumn(out[j++], i == firstField));
+        }
+    }
+    std::shared_ptr<const Segment> sorted(new Segment(nfields, columns));
+    //Counted as uncompressed, to stay within the budget
+    const size_t bytes = size() * varColumns.size() * sizeof(Term_t);
+    std::lock_guard<std::mutex> lock(sortCacheMutex);
+    if (!applied && reserve(bytes)) {
+        applied = sorted;
+        appliedBytes = bytes;
+    }
+    return sorted;
+}
+
+SortPermutation::~SortPermutation() {
+    usedBytes -= reservedBytes + appliedBytes;
+}
+
+std::shared_ptr<const Segment> InmemoryFCInternalTable::sortByCached(
+        const std::vector<uint8_t> &fields,
+        const int nthreads) const {
+    std::shared_ptr<const SortPermutation> cached;
+    {
+        std::lock_guard<std::mutex> lock(sortCacheMutex);
+        if (cachedBase != values) {
+            //values was merged or sorted again: the row ids are no longer valid
+            cachedSorted.clear();
+            cachedBase = values;
+        }
+        auto el = cachedSorted.find(fields);
+        if (el != cachedSorted.end()) {
+            cached = el->second;
+        }
+    }
+    if (cached) {
+        RuntimeMetrics::sortCacheHits.inc();
+        return cached->apply(*values, fields[0], nthreads);
+    }
+    RuntimeMetrics::sortCacheMisses.inc();
+
+    HiResTimer t_sort2("InmemoryFCInternalTable::sorting2");
+    t_sort2.start();
+    std::shared_ptr<const Segment> sortedValues;
+    auto perm = SortPermutation::create(*values, fields, nthreads);
+    if (perm) {
+        sortedValues = perm->apply(*values, fields[0], nthreads);
+        std::lock_guard<std::mutex> lock(sortCacheMutex);
+        cachedSorted[fields] = perm;
+        //If we are adding one in the cache that is say, sorted on fields 1, 2, 3,
+        //this one is also sorted on fields 1, 2, and also sorted on field 1.
+        //So, we add those to the cache as well.
+        for (size_t i = 1; i < fields.size(); i++) {
+            std::vector<uint8_t> prefix(fields.begin(), fields.begin() + i);
+            cachedSorted.insert(std::make_pair(prefix, perm));
+        }
+    } else if (nthreads > 1) {
+        sortedValues = values->sortBy(&fields, nthreads, false);
+    } else {
+        sortedValues = values->sortBy(&fields);
+    }
+    t_sort2.stop();
+    LOG(TRACEL) << t_sort2.tostring();
+    return sortedValues;
 }
 #endif
 
@@ -825,34 +1036,11 @@ FCInternalTableItr *InmemoryFCInternalTable::sortBy(const std::vector<uint8_t> &
         sortedValues = values;
     } else {
 #if INMEMINTERNALCACHE
-        if (fields.size() <= 3) {
-            uint64_t filterByKey = __getKeyFromFields(fields, fields.size());
-            if (cachedSorted.count(filterByKey)) {
-                sortedValues = cachedSorted[filterByKey];
-            } else {
-                LOG(TRACEL) << "InmemoryFCInternalTable::sorting2";
-                sortedValues = values->sortBy(&fields);
-                cachedSorted[filterByKey] = sortedValues;
-                //If we are adding one in the cache that is say, sorted on fields 1, 2, 3,
-                //this one is also sorted on fields 1, 2, and also sorted on field 1.
-                //So, we add those to the hashtable as well.
-                for (int i = 1; i < fields.size(); i++) {
-                    filterByKey = __getKeyFromFields(fields, i);
-                    cachedSorted[filterByKey] = sortedValues;
-                }
-            }
-        } else {
-            // Too many fields for the hash.
-            HiResTimer t_sort2("InmemoryFCInternalTable::sorting2");
-            t_sort2.start();
-            sortedValues = values->sortBy(&fields);
-            t_sort2.stop();
-            LOG(TRACEL) << t_sort2.tostring();
-        }
+        sortedValues = sortByCached(fields, 1);
 #else
         HiResTimer t_sort2("InmemoryFCInternalTable::sorting2");
         t_sort2.start();
-        sortedValues = sortedValues->sortBy(&fields);
+        sortedValues = values->sortBy(&fields);
         t_sort2.stop();
         LOG(TRACEL) << t_sort2.tostring();
 #endif
@@ -890,30 +1078,10 @@ FCInternalTableItr *InmemoryFCInternalTable::sortBy(
         sortedValues = values;
     } else {
 #if INMEMINTERNALCACHE
-        if (fields.size() <= 3) {
-            uint64_t filterByKey = __getKeyFromFields(fields, fields.size());
-            if (cachedSorted.count(filterByKey)) {
-                sortedValues = cachedSorted[filterByKey];
-            } else {
-                LOG(TRACEL) << "InmemoryFCInternalTable::sorting2";
-                sortedValues = values->sortBy(&fields, nthreads, false);
-                cachedSorted[filterByKey] = sortedValues;
-                //If we are adding one in the cache that is say, sorted on fields 1, 2, 3,
-                //this one is also sorted on fields 1, 2, and also sorted on field 1.
-                //So, we add those to the hashtable as well.
-                for (int i = 1; i < fields.size(); i++) {
-                    filterByKey = __getKeyFromFields(fields, i);
-                    cachedSorted[filterByKey] = sortedValues;
-                }
-            }
-        } else {
-            // Too many fields for the hash.
-            LOG(TRACEL) << "InmemoryFCInternalTable::sorting2";
-            sortedValues = values->sortBy(&fields, nthreads, false);
-        }
+        sortedValues = sortByCached(fields, nthreads);
 #else
-        // Too many fields for the hash.
         LOG(TRACEL) << "InmemoryFCInternalTable::sorting2";
+        sortedValues = values->sortBy(&fields, nthreads, false);
 #endif
     }
 
@@ -927,6 +1095,91 @@ void InmemoryFCInternalTable::releaseIterator(FCInternalTableItr * itr) const {
     delete itr;
 }
 
+static bool isResident(const Column *col) {
+    return !col->isEDB() && !col->isConstant() &&
+        dynamic_cast<const SpilledColumn*>(col) == NULL;
+}
+
+static size_t residentBytes(const Segment *segment) {
+    size_t bytes = 0;
+    for (uint8_t i = 0; i < segment->getNColumns(); ++i) {
+        std::shared_ptr<Column> col = segment->getColumn(i);
+        if (isResident(col.get())) {
+            bytes += col->getRepresentationSize() * sizeof(Term_t);
+        }
+    }
+    return bytes;
+}
+
+size_t InmemoryFCInternalTable::getResidentBytes() const {
+    size_t bytes = residentBytes(values.get());
+    for (const auto &el : unmergedSegments) {
+        bytes += residentBytes(el.values.get());
+    }
+    return bytes;
+}
+
+size_t InmemoryFCInternalTable::spill(SpillManager &mgr) const {
+    const size_t before = getResidentBytes();
+    if (before == 0) {
+        return 0;
+    }
+
+    //Spilled runs are sorted, so that retain() can merge against them
+    //sequentially
+    if (unmergedSegments.size() > 0) {
+        values = mergeUnmergedSegments(1);
+    }
+    if (!isSorted()) {
+        values = values->sortBy(NULL);
+        sorted = true;
+    }
+
+    std::shared_ptr<const SpillFile> file = mgr.newFile();
+    std::ofstream out(file->getPath(), std::ios_base::out |
+            std::ios_base::binary | std::ios_base::trunc);
+    if (!out) {
+        LOG(ERRORL) << "Cannot create the spill file " << file->getPath();
+        throw 10;
+    }
+    std::vector<std::shared_ptr<Column>> columns;
+    std::vector<std::shared_ptr<SpilledColumn>> spilled;
+    uint64_t offset = 0;
+    for (uint8_t i = 0; i < nfields; ++i) {
+        std::shared_ptr<Column> col = values->getColumn(i);
+        if (!isResident(col.get())) {
+            columns.push_back(col);
+            continue;
+        }
+        Term_t first = 0, last = 0;
+        size_t count = 0;
+        std::unique_ptr<ColumnReader> reader = col->getReader();
+        const uint64_t len = SpilledColumn::write(*reader, out, first, last,
+                count);
+        reader->clear();
+        std::shared_ptr<SpilledColumn> s(new SpilledColumn(file, offset,
+                    len, count, first, last));
+        offset += len;
+        columns.push_back(s);
+        spilled.push_back(s);
+    }
+    out.close();
+    if (!out) {
+        LOG(ERRORL) << "Failed writing the spill file " << file->getPath();
+        throw 10;
+    }
+    for (auto &s : spilled) {
+        mgr.registerColumn(s);
+    }
+
+    values = std::shared_ptr<const Segment>(new Segment(nfields, columns));
+#if INMEMINTERNALCACHE
+    cachedSorted.clear();
+    cachedBase.reset();
+#endif
+    return before - std::min(before, getResidentBytes());
+}
+
 InmemoryFCInternalTable::~InmemoryFCInternalTable() {
 }
 
@@ -2,13 +2,15 @@
 #include <vlog/fctable.h>
 #include <vlog/joinprocessor.h>
 #include <vlog/concepts.h>
+#include <vlog/trace.h>
+#include <vlog/metrics.h>
 
 #include <trident/model/table.h>
 
 // Note: When running multithreaded, mutex != NULL.
 
 FCTable::FCTable(std::mutex *mutex, const uint8_t sizeRow) :
-    sizeRow(sizeRow), mutex(mutex) {
+    sizeRow(sizeRow), nCollapses(0), mutex(mutex) {
     }
 
 std::string FCTable::getSignature(const Literal &literal) {
@@ -71,6 +73,18 @@ FCIterator FCTable::read(const size_t mincount, const size_t maxcount) const {
     return i;
 }
 
+std::shared_ptr<const std::vector<FCBlock>> FCTable::getBlocks(
+        const size_t maxIteration) const {
+    std::shared_ptr<std::vector<FCBlock>> out(new std::vector<FCBlock>());
+    out->reserve(blocks.size());
+    for (const auto &block : blocks) {
+        if (block.iteration <= maxIteration) {
+            out->push_back(block);
+        }
+    }
+    return out;
+}
+
 void FCTable::collapseBlocks(size_t maxIter, int nThreads) {
     std::vector<FCBlock>::iterator last = blocks.begin();
     std::vector<std::vector<FCBlock *>> splitBlocks;
@@ -141,6 +155,7 @@ void FCTable::collapseBlocks(size_t maxIter, int nThreads) {
         blocks.push_back(*itr);
         itr++;
     }
+    nCollapses++;
 }
 
 FCBlock &FCTable::getLastBlock() {
@@ -347,6 +362,9 @@ std::shared_ptr<const Segment> FCTable::retainFrom(
     bool duplicates = dupl;
 
     std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+    TraceSpan span("dedup", "retainFrom");
+    MetricTimer timer(RuntimeMetrics::retainTime);
+    const uint64_t rowsIn = t->getNRows();
 
 #if DEBUG
     size_t sz = 0;
@@ -377,6 +395,15 @@ std::shared_ptr<const Segment> FCTable::retainFrom(
     std::chrono::duration<double> sec = std::chrono::system_clock::now() - start;
     LOG(DEBUGL) << "Time retainFrom = " << sec.count() * 1000;
 
+    const uint64_t rowsOut = t->getNRows();
+    RuntimeMetrics::retainRowsIn.add(rowsIn);
+    RuntimeMetrics::retainRowsOut.add(rowsOut);
+    if (span.isActive()) {
+        span.setRows(rowsIn, rowsOut);
+        span.set("blocks", (uint64_t) blocks.size());
+        span.set("duplicates", std::string(dupl ? "true" : "false"));
+    }
+
     return t;
 }
 
@@ -474,6 +501,15 @@ size_t FCTable::getNAllRows() const {
     return output;
 }
 
+void FCTable::prepareForReaders(int nthreads) {
+    for (const auto &block : blocks) {
+        if (!block.table->isEDB()) {
+            block.table->releaseIterator(
+                    block.table->getSortedIterator(nthreads));
+        }
+    }
+}
+
 FCTable::~FCTable() {
 }
 
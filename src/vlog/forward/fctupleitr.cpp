@@ -0,0 +1,114 @@
+#include <vlog/fctupleitr.h>
+#include <vlog/deadline.h>
+
+#include <kognac/logs.h>
+
+FCTupleItr::FCTupleItr(FCIterator blocks, const Literal &query,
+        const bool returnOnlyVars, const size_t limit) : currentTable(0),
+    itr(NULL), tuple(query.getTuple()),
+    repeated(query.getRepeatedVars()), limit(limit), returned(0),
+    nextProcessed(false), nextOutcome(false) {
+        while (!blocks.isEmpty()) {
+            tables.push_back(blocks.getCurrentTable());
+            blocks.moveNextCount();
+        }
+        for (uint8_t i = 0; i < tuple.getSize(); ++i) {
+            if (!returnOnlyVars || tuple.get(i).isVariable()) {
+                posToCopy.push_back(i);
+            }
+        }
+    }
+
+bool FCTupleItr::matches() {
+    for (uint8_t i = 0; i < tuple.getSize(); ++i) {
+        const VTerm t = tuple.get(i);
+        if (!t.isVariable() && itr->getCurrentValue(i) != t.getValue()) {
+            return false;
+        }
+    }
+    for (const auto &r : repeated) {
+        if (itr->getCurrentValue(r.first) != itr->getCurrentValue(r.second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FCTupleItr::releaseCurrentTable() {
+    if (itr != NULL) {
+        tables[currentTable]->releaseIterator(itr);
+        itr = NULL;
+        //Do not keep the blocks that were already read
+        tables[currentTable].reset();
+        currentTable++;
+    }
+}
+
+bool FCTupleItr::hasNext() {
+    if (nextProcessed) {
+        return nextOutcome;
+    }
+    nextProcessed = true;
+    nextOutcome = false;
+    if (limit != 0 && returned >= limit) {
+        return false;
+    }
+    //The rows that do not match are also counted, to check the deadline
+    //of the query every FCTUPLEITR_CHECK rows
+    size_t scanned = 0;
+    while (true) {
+        if (itr == NULL) {
+            if (currentTable >= tables.size()) {
+                return false;
+            }
+            itr = tables[currentTable]->getIterator();
+        }
+        while (itr->hasNext()) {
+            itr->next();
+            if (((returned + scanned++) % FCTUPLEITR_CHECK) == 0) {
+                QueryDeadline::check();
+            }
+            if (matches()) {
+                nextOutcome = true;
+                return true;
+            }
+        }
+        releaseCurrentTable();
+    }
+}
+
+void FCTupleItr::next() {
+    if (!hasNext()) {
+        LOG(ERRORL) << "FCTupleItr::next() called on an exhausted iterator";
+        throw 10;
+    }
+    nextProcessed = false;
+    returned++;
+}
+
+size_t FCTupleItr::getTupleSize() {
+    return posToCopy.size();
+}
+
+uint64_t FCTupleItr::getElementAt(const int pos) {
+    return itr->getCurrentValue(posToCopy[pos]);
+}
+
+size_t FCTupleItr::getCardinality() {
+    LOG(ERRORL) << "FCTupleItr::getCardinality() is not supported";
+    throw 10;
+}
+
+std::pair<uint8_t, std::pair<uint8_t, uint8_t>> FCTupleItr::getSizeElemUnderlyingArray(uint8_t column) {
+    LOG(ERRORL) << "FCTupleItr::getSizeElemUnderlyingArray() is not supported";
+    throw 10;
+}
+
+void FCTupleItr::clear() {
+    releaseCurrentTable();
+    tables.clear();
+}
+
+FCTupleItr::~FCTupleItr() {
+    clear();
+}
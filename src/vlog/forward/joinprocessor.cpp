@@ -3,12 +3,16 @@
 #include <vlog/seminaiver.h>
 #include <vlog/filterhashjoin.h>
 #include <vlog/finalresultjoinproc.h>
+#include <vlog/trace.h>
+#include <vlog/metrics.h>
 #include <trident/model/table.h>
 
 #include <google/dense_hash_map>
 #include <limits.h>
 #include <vector>
 #include <inttypes.h>
+#include <cmath>
+#include <algorithm>
 
 bool JoinExecutor::isJoinTwoToOneJoin(const RuleExecutionPlan &hv,
         const int currentLiteral) {
@@ -559,7 +563,8 @@ void JoinExecutor::join(SemiNaiver * naiver, const FCInternalTable * t1,
         const RuleExecutionPlan &hv,
         int &processedTables,
         const int currentLiteral,
-        const int nthreads) {
+        const int nthreads,
+        TraceSpan &span) {
 
 #ifdef DEBUG
     LOG(TRACEL) << "joinsCoordinates.size() = " << joinsCoordinates.size();
@@ -575,21 +580,32 @@ void JoinExecutor::join(SemiNaiver * naiver, const FCInternalTable * t1,
         LOG(TRACEL) << "i = " << i << ", first = " << (int) output->getPosFromSecond()[i].first << ", second = " << (int) output->getPosFromSecond()[i].second;
     }
 #endif
+    MetricTimer timer(RuntimeMetrics::joinTime);
+    if (span.isActive()) {
+        span.set("rowsIn", (uint64_t) t1->getNRows());
+        span.set("literal", literal.tostring());
+        span.set("min", (uint64_t) min);
+        span.set("max", (uint64_t) max);
+    }
+
     // Input Negation. We check if the literal is negated before calling
     // isJoinVerificative and isJoinTwoToOneJoin. Check performance issues.
     if (literal.isNegated()) {
         LOG(TRACEL) << "Calling leftjoin";
+        span.setName("leftjoin");
         leftjoin(t1, naiver, outputLiterals, literal, min, max,
                 joinsCoordinates, output, nthreads);
     }
     //First I calculate whether the join is verificative or explorative.
     else if (JoinExecutor::isJoinVerificative(t1, hv, currentLiteral)) {
         LOG(TRACEL) << "Executing verificativeJoin";
+        span.setName("verificativeJoin");
         verificativeJoin(naiver, t1, literal, min, max, output, hv,
                 currentLiteral, nthreads);
     } else if (JoinExecutor::isJoinTwoToOneJoin(hv, currentLiteral)) {
         //Is the join of the like (A),(A,B)=>(A|B). Then we can speed up the merge join
         LOG(TRACEL) << "Executing joinTwoToOne";
+        span.setName("joinTwoToOne");
         joinTwoToOne(naiver, t1, literal, min, max, output, hv,
                 currentLiteral, nthreads);
     } else {
@@ -611,8 +627,15 @@ void JoinExecutor::join(SemiNaiver * naiver, const FCInternalTable * t1,
 #endif
         } else {*/
             LOG(TRACEL) << "Executing mergejoin.";
+            span.setName("mergejoin");
+            //What was observed in the previous executions of the rule
+            //decides, block by block, whether to sort or to probe
+            JoinStrategyStats stats = naiver->getJoinStats(ruleDetails.ruleid,
+                    literal.getPredicate().getId());
             mergejoin(t1, naiver, outputLiterals, literal, min, max,
-                    joinsCoordinates, output, nthreads);
+                    joinsCoordinates, output, nthreads, &stats);
+            naiver->setJoinStats(ruleDetails.ruleid,
+                    literal.getPredicate().getId(), stats);
 #ifdef DEBUG
             output->checkSizes();
 #endif
@@ -1147,7 +1170,8 @@ void JoinExecutor::mergejoin(const FCInternalTable * t1, SemiNaiver * naiver,
         const uint32_t min, const uint32_t max,
         std::vector<std::pair<uint8_t, uint8_t>> joinsCoordinates,
         ResultJoinProcessor * output,
-        int nthreads) {
+        int nthreads,
+        JoinStrategyStats *stats) {
     //Find whether some of the join fields have a very low cardinality. We can group them.
     std::vector<uint8_t> idxColumnsLowCardInMap;
     std::vector<uint8_t> idxColumnsLowCardInLiteral;
@@ -1253,7 +1277,7 @@ void JoinExecutor::mergejoin(const FCInternalTable * t1, SemiNaiver * naiver,
 
         if (tablesToMergeJoin.size() > 0)
             do_mergejoin(t1, fields1, tablesToMergeJoin, fields1, NULL, NULL,
-                    fields2, output, nthreads);
+                    fields2, output, nthreads, stats);
     } else {
         //Positions to return when filtering the input query
         std::vector<uint8_t> posToCopy;
@@ -1369,10 +1393,11 @@ void JoinExecutor::mergejoin(const FCInternalTable * t1, SemiNaiver * naiver,
                 //std::chrono::system_clock::time_point startJ = std::chrono::system_clock::now();
                 if (idxOtherPos.size() > 0 && valueOtherPos[0].size() > 1) {
                     do_mergejoin(filteredT1.get(), fieldsToSortInMap, tablesToMergeJoin,
-                            fields1, &(idxOtherPos[0]), &(valueOtherPos[0]), fields2, output, nthreads);
+                            fields1, &(idxOtherPos[0]), &(valueOtherPos[0]), fields2, output, nthreads,
+                            stats);
                 } else {
                     do_mergejoin(filteredT1.get(), fieldsToSortInMap, tablesToMergeJoin,
-                            fields1, NULL, NULL, fields2, output, nthreads);
+                            fields1, NULL, NULL, fields2, output, nthreads, stats);
                 }
                 //std::chrono::duration<double> secJ = std::chrono::system_clock::now() - startJ;
 
@@ -1975,13 +2000,238 @@ struct CreateParallelMergeJoinerVectors {
     }
 };
 
+struct CreateParallelProbeJoiner {
+    const std::vector<const std::vector<Term_t> *> vectors;
+    const size_t size1;
+    const std::vector<const std::vector<Term_t> *> vectors2;
+    const std::vector<uint8_t> &fields1;
+    const std::vector<uint8_t> &fields2;
+    const uint8_t posBlocks;
+    const uint8_t nValBlocks;
+    const Term_t *valBlocks;
+    ResultJoinProcessor *output;
+    std::mutex *m;
+
+    CreateParallelProbeJoiner(const std::vector<const std::vector<Term_t> *> &vectors,
+            const size_t size1,
+            const std::vector<const std::vector<Term_t> *> vectors2,
+            const std::vector<uint8_t> &fields1,
+            const std::vector<uint8_t> &fields2,
+            const uint8_t posBlocks,
+            const uint8_t nValBlocks,
+            const Term_t *valBlocks,
+            ResultJoinProcessor *output,
+            std::mutex *m) :
+        vectors(vectors), size1(size1), vectors2(vectors2),
+        fields1(fields1), fields2(fields2), posBlocks(posBlocks),
+        nValBlocks(nValBlocks), valBlocks(valBlocks), output(output), m(m) {
+        }
+
+    void operator()(const ParallelRange& r) const {
+        Output out(output, m);
+        JoinExecutor::do_probe_join(vectors, size1, vectors2, r.begin(),
+                r.end(), fields1, fields2, posBlocks, nValBlocks, valBlocks,
+                &out);
+        out.flush();
+    }
+};
+
+void JoinExecutor::do_probe_join(
+        const std::vector<const std::vector<Term_t> *> &vectors1, size_t u1,
+        const std::vector<const std::vector<Term_t> *> &vectors2,
+        size_t l2, size_t u2,
+        const std::vector<uint8_t> &fields1,
+        const std::vector<uint8_t> &fields2,
+        const uint8_t posBlocks,
+        const uint8_t nValBlocks,
+        const Term_t *valBlocks,
+        Output * output) {
+    for (size_t i2 = l2; i2 < u2; ++i2) {
+        //First row of vectors1 that is not smaller than row i2
+        size_t lo = 0;
+        size_t hi = u1;
+        while (lo < hi) {
+            const size_t m = lo + (hi - lo) / 2;
+            if (cmp(vectors1, m, vectors2, i2, fields1, fields2) < 0) {
+                lo = m + 1;
+            } else {
+                hi = m;
+            }
+        }
+        for (size_t i1 = lo; i1 < u1 &&
+                cmp(vectors1, i1, vectors2, i2, fields1, fields2) == 0; ++i1) {
+            uint8_t idxBlock = 0;
+            if (valBlocks != NULL) {
+                idxBlock = std::lower_bound(valBlocks, valBlocks + nValBlocks,
+                        (*vectors1[posBlocks])[i1]) - valBlocks;
+            }
+            output->processResults(idxBlock, vectors1, i1, vectors2, i2, false);
+        }
+    }
+}
+
+double JoinExecutor::getMergeCost(const size_t n1, const size_t n2,
+        const bool sortBlock, const int nthreads) {
+    double cost = sortBlock ? n2 * std::log2(n2 + 1.0) : 0;
+    if (nthreads > 1) {
+        cost /= nthreads;
+    }
+    if (nthreads > 1 && n1 > 1 && (n1 + n2) > 4096) {
+        return cost + (double) (n1 + n2) / nthreads;
+    }
+    return cost + n1 + n2;
+}
+
+double JoinExecutor::getProbeCost(const size_t n1, const size_t n2,
+        const int nthreads) {
+    //A binary search does not access the memory sequentially like the sort
+    double cost = n2 * (PROBE_COST_FACTOR * std::log2(n1 + 1.0) + 1);
+    if (nthreads > 1 && n2 > 4096) {
+        cost /= nthreads;
+    }
+    return cost;
+}
+
+bool JoinExecutor::preferProbe(const size_t n1, const size_t n2,
+        const bool sortBlock, const int nthreads,
+        JoinStrategyStats &stats) {
+    const double merge = getMergeCost(n1, n2, sortBlock, nthreads);
+    const double probe = getProbeCost(n1, n2, nthreads);
+    bool choice = probe < merge;
+    if (stats.mergeFactor > 0 && stats.probeFactor > 0) {
+        choice = probe * stats.probeFactor < merge * stats.mergeFactor;
+    }
+
+    //Otherwise the factor of a strategy that is never chosen would never
+    //be corrected
+    const double chosenCost = choice ? probe : merge;
+    const double otherCost = choice ? merge : probe;
+    if (chosenCost < JOIN_STATS_MIN_COST || otherCost < JOIN_STATS_MIN_COST) {
+        return choice;
+    }
+    stats.nMeasured++;
+    const double chosenFactor = choice ? stats.probeFactor : stats.mergeFactor;
+    const double otherFactor = choice ? stats.mergeFactor : stats.probeFactor;
+    const bool explore = (otherFactor == 0 && chosenFactor > 0) ||
+        stats.nMeasured % JOIN_EXPLORE_PERIOD == 0;
+    if (explore && otherCost <= chosenCost * JOIN_EXPLORE_MAX_RATIO) {
+        LOG(DEBUGL) << "Measuring the " << (choice ? "merge" : "probe") <<
+            " strategy on a block";
+        return !choice;
+    }
+    return choice;
+}
+
+void JoinExecutor::updateStats(JoinStrategyStats &stats, const bool probe,
+        const double model, const double elapsedNs) {
+    if (model < JOIN_STATS_MIN_COST) {
+        //Too small to measure anything
+        return;
+    }
+    double &factor = probe ? stats.probeFactor : stats.mergeFactor;
+    const double observed = elapsedNs / model;
+    factor = factor == 0 ? observed : (factor + observed) / 2;
+}
+
+std::unique_ptr<BloomFilter> JoinExecutor::getKeysFilter(
+        const std::vector<const std::vector<Term_t> *> &vectors,
+        const size_t nrows, const std::vector<uint8_t> &fields) {
+    //The rows are sorted on the keys, so the distinct keys are adjacent
+    size_t nkeys = nrows > 0 ? 1 : 0;
+    for (size_t i = 1; i < nrows; ++i) {
+        if (!sameAs(vectors, i - 1, i, fields)) {
+            nkeys++;
+        }
+    }
+    if (nkeys > BLOOM_MAX_KEYS) {
+        return std::unique_ptr<BloomFilter>();
+    }
+    std::unique_ptr<BloomFilter> filter(new BloomFilter(nkeys));
+    for (size_t i = 0; i < nrows; ++i) {
+        if (i > 0 && sameAs(vectors, i - 1, i, fields)) {
+            continue;
+        }
+        uint64_t h = 0;
+        for (const uint8_t f : fields) {
+            h = BloomFilter::hash(h, (*vectors[f])[i]);
+        }
+        filter->add(h);
+    }
+    LOG(DEBUGL) << "Bloom filter on " << nkeys << " keys, " <<
+        filter->getSizeBytes() << " bytes";
+    return filter;
+}
+
+bool JoinExecutor::reduceBlock(const FCInternalTable *t,
+        const BloomFilter &filter, const std::vector<uint8_t> &fields,
+        const int nthreads, std::vector<std::vector<Term_t>> &out) {
+    const size_t nrows = t->getNRows();
+    if (nrows == 0) {
+        return false;
+    }
+
+    //The first BLOOM_SAMPLE_ROWS rows decide whether it is worth to
+    //continue. They are read with an iterator, so that the columns of the
+    //block are not materialized if the filter does not reduce it
+    const size_t nsample = std::min(nrows, (size_t) BLOOM_SAMPLE_ROWS);
+    size_t npassed = 0;
+    FCInternalTableItr *itr = t->getIterator();
+    for (size_t i = 0; i < nsample && itr->hasNext(); ++i) {
+        itr->next();
+        uint64_t h = 0;
+        for (const uint8_t f : fields) {
+            h = BloomFilter::hash(h, itr->getCurrentValue(f));
+        }
+        if (filter.mayContain(h)) {
+            npassed++;
+        }
+    }
+    t->releaseIterator(itr);
+    if (npassed > nsample * BLOOM_MAX_PASS_RATE) {
+        return false;
+    }
+
+    //Rows that may join
+    itr = t->getIterator();
+    std::vector<const std::vector<Term_t> *> vectors =
+        itr->getAllVectors(nthreads);
+    std::vector<size_t> rows;
+    const size_t nvalues = vectors.empty() ? 0 : vectors[0]->size();
+    for (size_t i = 0; i < nvalues; ++i) {
+        uint64_t h = 0;
+        for (const uint8_t f : fields) {
+            h = BloomFilter::hash(h, (*vectors[f])[i]);
+        }
+        if (filter.mayContain(h)) {
+            rows.push_back(i);
+        }
+    }
+    LOG(DEBUGL) << "Bloom filter kept " << rows.size() << " of " <<
+        nrows << " rows";
+    std::sort(rows.begin(), rows.end(),
+            [&vectors, &fields](const size_t a, const size_t b) {
+            return JoinExecutor::cmp(vectors, a, vectors, b, fields,
+                    fields) < 0;
+            });
+    out.resize(vectors.size());
+    for (size_t j = 0; j < vectors.size(); ++j) {
+        out[j].reserve(rows.size());
+        for (const size_t r : rows) {
+            out[j].push_back((*vectors[j])[r]);
+        }
+    }
+    itr->deleteAllVectors(vectors);
+    t->releaseIterator(itr);
+    return true;
+}
+
 void JoinExecutor::do_mergejoin(const FCInternalTable * filteredT1,
         std::vector<uint8_t> &fieldsToSortInMap,
         std::vector<std::shared_ptr<const FCInternalTable>> &tables2,
         const std::vector<uint8_t> &fields1, const uint8_t *posOtherVars,
         const std::vector<Term_t> *valuesOtherVars,
         const std::vector<uint8_t> &fields2, ResultJoinProcessor * output,
-        int nthreads) {
+        int nthreads, JoinStrategyStats *stats) {
 
     //Only one additional variable is allowed to have low cardinality
     const uint8_t posBlocks = posOtherVars == NULL ? 0 : posOtherVars[0];
@@ -2062,6 +2312,10 @@ void JoinExecutor::do_mergejoin(const FCInternalTable * filteredT1,
 
     Output *out = new Output(output, NULL);
 
+    //Built when the first large block is found
+    std::unique_ptr<BloomFilter> keysFilter;
+    bool triedKeysFilter = false;
+
     for (auto t2 : tables2) {
         if (! first) {
             itr1->reset();
@@ -2070,18 +2324,48 @@ void JoinExecutor::do_mergejoin(const FCInternalTable * filteredT1,
         LOG(TRACEL) << "Main loop of do_mergejoin";
         processedTables++;
 
-        //Sort t2
-        startS = std::chrono::system_clock::now();
+        //Sort t2, unless it is cheaper to look up each of its rows in t1.
+        //The choice is made again for every block, with the costs
+        //observed in the blocks (and joins) before
+        const bool adaptive = stats != NULL && !faster && fields1.size() > 0;
+        const bool probe = adaptive && preferProbe(totalsize1, t2->getNRows(),
+                true, nthreads, *stats);
+        const std::chrono::system_clock::time_point startBlock =
+            std::chrono::system_clock::now();
+        startS = startBlock;
+
+        //Large blocks are first reduced to the rows that can join
+        std::vector<std::vector<Term_t>> reducedBlock;
+        bool reduced = false;
+        if (!probe && !faster && fields2.size() > 0 &&
+                t2->getNRows() >= BLOOM_MIN_ROWS) {
+            if (!triedKeysFilter) {
+                keysFilter = getKeysFilter(vectors, totalsize1, fields1);
+                triedKeysFilter = true;
+            }
+            if (keysFilter) {
+                reduced = reduceBlock(t2.get(), *keysFilter, fields2,
+                        nthreads, reducedBlock);
+            }
+        }
+
         //Also in this case, there might be no join fields
         FCInternalTableItr *sortedItr2 = NULL;
-        if (fields2.size() > 0) {
-            LOG(TRACEL) << "t2->sortBy";
-            sortedItr2 = t2->sortBy(fields2, nthreads);
+        std::vector<const std::vector<Term_t> *> vectors2;
+        if (reduced) {
+            for (const auto &column : reducedBlock) {
+                vectors2.push_back(&column);
+            }
         } else {
-            sortedItr2 = t2->getIterator();
+            if (fields2.size() > 0 && !probe) {
+                LOG(TRACEL) << "t2->sortBy";
+                sortedItr2 = t2->sortBy(fields2, nthreads);
+            } else {
+                sortedItr2 = t2->getIterator();
+            }
+            vectors2 = sortedItr2->getAllVectors(nthreads);
         }
         bool vector2Supported = true;
-        std::vector<const std::vector<Term_t> *> vectors2 = sortedItr2->getAllVectors(nthreads);
         /*
            std::vector<std::shared_ptr<Column>> cols = sortedItr2->getAllColumns();
            int ncols = (int) sortedItr2->getNColumns();
@@ -2108,7 +2392,7 @@ void JoinExecutor::do_mergejoin(const FCInternalTable * filteredT1,
         } else {
             t2Size = vectors2[0]->size();
         }
-        assert(t2->getNRows() == t2Size);
+        assert(reduced || t2->getNRows() == t2Size);
         if (faster) {
             sortedItr2 = new VectorFCInternalTableItr(vectors2, 0, t2Size);
             LOG(TRACEL) << "Faster algo";
@@ -2119,6 +2403,19 @@ void JoinExecutor::do_mergejoin(const FCInternalTable * filteredT1,
 #if DEBUG
             output->checkSizes();
 #endif
+        } else if (probe) {
+            LOG(TRACEL) << "Probe algo, totalsize1 = " << totalsize1 << ", t2Size = " << t2Size;
+            if (nthreads > 1 && t2Size > 4096) {
+                ParallelTasks::parallel_for(0, t2Size,
+                        (t2Size + 2 * nthreads - 1) / (2 * nthreads),
+                        CreateParallelProbeJoiner(vectors, totalsize1, vectors2,
+                            fields1, fields2, posBlocks, nValBlocks,
+                            valBlocks, output, &m));
+            } else {
+                JoinExecutor::do_probe_join(vectors, totalsize1, vectors2, 0,
+                        t2Size, fields1, fields2, posBlocks, nValBlocks,
+                        valBlocks, out);
+            }
         } else {
             LOG(TRACEL) << "Classical algo";
             LOG(TRACEL) << "totalsize1 = " << totalsize1 << ", t2Size = " << t2Size;
@@ -2149,8 +2446,18 @@ void JoinExecutor::do_mergejoin(const FCInternalTable * filteredT1,
             output->checkSizes();
 #endif
         }
-        itr2->deleteAllVectors(vectors2);
-        t2->releaseIterator(itr2);
+        if (adaptive && !reduced) {
+            const double elapsed = std::chrono::duration<double, std::nano>(
+                    std::chrono::system_clock::now() - startBlock).count();
+            updateStats(*stats, probe, probe ?
+                    getProbeCost(totalsize1, t2Size, nthreads) :
+                    getMergeCost(totalsize1, t2Size, fields2.size() > 0,
+                        nthreads), elapsed);
+        }
+        if (itr2 != NULL) {
+            itr2->deleteAllVectors(vectors2);
+            t2->releaseIterator(itr2);
+        }
     }
     delete itr1;
     sortedItr1->deleteAllVectors(vectors);
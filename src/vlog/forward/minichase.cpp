@@ -0,0 +1,92 @@
+#include <vlog/minichase.h>
+#include <vlog/fcinttable.h>
+
+#include <kognac/logs.h>
+
+MiniChase::MiniChase(EDBLayer &outerLayer, EDBLayer &kb, bool copyTables,
+        Program *program) : program(program) {
+    layer = std::unique_ptr<EDBLayer>(new EDBLayer(kb, copyTables));
+    std::vector<uint64_t> empty;
+    for (auto pred : outerLayer.getAllPredicateIDs()) {
+        uint8_t arity = outerLayer.getPredArity(pred);
+        edbPredicates.insert(std::make_pair(pred, arity));
+        layer->addInmemoryTable(pred, arity, empty);
+    }
+    sn = std::unique_ptr<SemiNaiver>(new SemiNaiver(
+                *layer, program, true, true, false, 1, false, true));
+}
+
+SemiNaiver *MiniChase::saturate(std::vector<Literal> &input) {
+    int level = Logger::getMinLevel();
+    Logger::setMinLevel(WARNL);
+    std::map<PredId_t, std::vector<uint64_t>> edbFacts;
+    std::map<PredId_t, std::vector<uint64_t>> idbFacts;
+
+    for(const auto &literal : input) {
+#if DEBUG
+        LOG(TRACEL) << "literal: " << literal.tostring(program, program->getKB());
+#endif
+        auto predid = literal.getPredicate().getId();
+        auto &facts = literal.getPredicate().getType() != EDB ?
+            idbFacts[predid] : edbFacts[predid];
+        for(uint8_t i = 0; i < literal.getTupleSize(); ++i) {
+            auto t = literal.getTermAtPos(i);
+            facts.push_back(t.getValue());
+        }
+    }
+
+    //Remove the derivations of the previous check
+    sn->reset();
+
+    //Replace only the EDB tables that change w.r.t. the previous check
+    std::vector<uint64_t> empty;
+    for (auto pred : filledTables) {
+        if (!edbFacts.count(pred)) {
+            layer->addInmemoryTable(pred, edbPredicates[pred], empty);
+        }
+    }
+    filledTables.clear();
+    for(auto &pair : edbFacts) {
+        auto arity = edbPredicates.find(pair.first);
+        if (arity == edbPredicates.end()) {
+            LOG(ERRORL) << "EDB predicate " << pair.first <<
+                " is not known in the outer materialization";
+            throw 10;
+        }
+        layer->addInmemoryTable(pair.first, arity->second, pair.second);
+        filledTables.insert(pair.first);
+    }
+
+    //Populate the IDB layer
+    for(auto &pair : idbFacts) {
+        Predicate pred = program->getPredicate(pair.first);
+        const uint8_t card = pred.getCardinality();
+
+        //Construct the table
+        SegmentInserter inserter(card);
+        auto els = pair.second.data();
+        for(uint64_t i = 0; i < pair.second.size(); i += card) {
+            inserter.addRow(els + i);
+        }
+
+        //Populate the table
+        std::shared_ptr<const FCInternalTable> ltable(
+                new InmemoryFCInternalTable(card,
+                    0, true, inserter.getSortedAndUniqueSegment()));
+
+        //Define a generic query
+        VTuple tuple(card);
+        for(uint8_t i = 0; i < card; ++i) {
+            tuple.set(VTerm(i+1, 0), i);
+        }
+        Literal query(pred, tuple);
+        FCBlock block(0, ltable, query, 0, NULL, 0, true);
+        FCTable *table = sn->getTable(pair.first, card);
+        table->addBlock(block);
+    }
+
+    //Launch the materialization
+    sn->run();
+    Logger::setMinLevel(level);
+    return sn.get();
+}
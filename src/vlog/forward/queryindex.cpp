@@ -0,0 +1,315 @@
+#include <vlog/queryindex.h>
+
+#include <kognac/logs.h>
+#include <kognac/utils.h>
+
+#include <algorithm>
+
+struct BuildPermutations {
+    const QueryIndex *index;
+    std::vector<QueryIndex::Permutation> &permutations;
+    const std::vector<Term_t> &data;
+    const std::vector<size_t> &uniqueRows;
+
+    BuildPermutations(const QueryIndex *index,
+            std::vector<QueryIndex::Permutation> &permutations,
+            const std::vector<Term_t> &data,
+            const std::vector<size_t> &uniqueRows) : index(index),
+    permutations(permutations), data(data), uniqueRows(uniqueRows) {
+    }
+
+    void build(const size_t i) const {
+        std::vector<size_t> rowIds = uniqueRows;
+        index->sortRows(permutations[i], data, rowIds);
+        index->fill(permutations[i], data, rowIds);
+    }
+
+    void operator()(const ParallelRange& r) const {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+            build(i);
+        }
+    }
+};
+
+QueryIndex::QueryIndex(FCIterator itr, const uint8_t arity,
+        const int nthreads) : arity(arity), nrows(0) {
+    //Copy all the blocks in a single row-major vector
+    std::vector<Term_t> data;
+    while (!itr.isEmpty()) {
+        std::shared_ptr<const FCInternalTable> table = itr.getCurrentTable();
+        FCInternalTableItr *titr = table->getIterator();
+        std::vector<std::shared_ptr<Column>> columns = titr->getAllColumns();
+        const size_t n = table->getNRows();
+        const size_t offset = data.size();
+        data.resize(offset + n * arity);
+        for (uint8_t j = 0; j < arity; ++j) {
+            std::unique_ptr<ColumnReader> reader = columns[j]->getReader();
+            size_t pos = offset + j;
+            while (reader->hasNext()) {
+                data[pos] = reader->next();
+                pos += arity;
+            }
+        }
+        table->releaseIterator(titr);
+        itr.moveNextCount();
+    }
+    const size_t allRows = arity > 0 ? data.size() / arity : 0;
+
+    //The rotations of the columns: 012, 120, 201, ...
+    permutations.resize(arity);
+    for (uint8_t i = 0; i < arity; ++i) {
+        for (uint8_t j = 0; j < arity; ++j) {
+            permutations[i].fields.push_back((i + j) % arity);
+        }
+    }
+    if (arity == 0) {
+        return;
+    }
+
+    //The first rotation is also used to remove the duplicates
+    std::vector<size_t> rowIds(allRows);
+    for (size_t i = 0; i < allRows; ++i) {
+        rowIds[i] = i;
+    }
+    sortRows(permutations[0], data, rowIds);
+    auto last = std::unique(rowIds.begin(), rowIds.end(),
+            [&data, arity](const size_t a, const size_t b) {
+            return std::equal(data.begin() + a * arity,
+                    data.begin() + (a + 1) * arity, data.begin() + b * arity);
+            });
+    rowIds.erase(last, rowIds.end());
+    nrows = rowIds.size();
+    fill(permutations[0], data, rowIds);
+
+    if (arity > 1) {
+        //The other rotations only need the rows that are left
+        std::sort(rowIds.begin(), rowIds.end());
+        BuildPermutations builder(this, permutations, data, rowIds);
+        if (nthreads > 1) {
+            ParallelTasks::parallel_for(1, arity, 1, builder);
+        } else {
+            for (uint8_t i = 1; i < arity; ++i) {
+                builder.build(i);
+            }
+        }
+    }
+    LOG(DEBUGL) << "Indexed " << nrows << " rows (" << allRows - nrows <<
+        " duplicates) in " << (int) arity << " permutations";
+}
+
+void QueryIndex::sortRows(const Permutation &p,
+        const std::vector<Term_t> &data, std::vector<size_t> &rowIds) const {
+    const uint8_t arity = this->arity;
+    std::sort(rowIds.begin(), rowIds.end(),
+            [&p, &data, arity](const size_t a, const size_t b) {
+            const Term_t *ra = data.data() + a * arity;
+            const Term_t *rb = data.data() + b * arity;
+            for (const uint8_t f : p.fields) {
+                if (ra[f] != rb[f]) {
+                    return ra[f] < rb[f];
+                }
+            }
+            return false;
+            });
+}
+
+void QueryIndex::fill(Permutation &p, const std::vector<Term_t> &data,
+        const std::vector<size_t> &rowIds) const {
+    //The first field is sorted: only store its distinct values, and where
+    //they start
+    const uint8_t first = p.fields[0];
+    for (size_t i = 0; i < rowIds.size(); ++i) {
+        const Term_t v = data[rowIds[i] * arity + first];
+        if (p.keys.empty() || p.keys.back() != v) {
+            p.keys.push_back(v);
+            p.offsets.push_back(i);
+        }
+    }
+    p.offsets.push_back(rowIds.size());
+    p.keys.shrink_to_fit();
+    p.offsets.shrink_to_fit();
+
+    for (uint8_t j = 1; j < arity; ++j) {
+        std::vector<Term_t> values(rowIds.size());
+        const uint8_t f = p.fields[j];
+        for (size_t i = 0; i < rowIds.size(); ++i) {
+            values[i] = data[rowIds[i] * arity + f];
+        }
+        p.columns.push_back(ColumnWriter::getUncompressedColumn(values));
+    }
+}
+
+size_t QueryIndex::getRepresentationSize() const {
+    size_t size = 0;
+    for (const auto &p : permutations) {
+        size += p.keys.size() + p.offsets.size();
+        for (const auto &c : p.columns) {
+            size += c->getRepresentationSize();
+        }
+    }
+    return size;
+}
+
+size_t QueryIndex::getNBoundPrefix(const Permutation &p,
+        const VTuple &tuple) {
+    size_t n = 0;
+    while (n < p.fields.size() && !tuple.get(p.fields[n]).isVariable()) {
+        n++;
+    }
+    return n;
+}
+
+bool QueryIndex::isSortedBy(const Permutation &p, const VTuple &tuple,
+        const bool returnOnlyVars, const std::vector<uint8_t> &sortByFields) {
+    //Argument of the query for every field of the output
+    std::vector<uint8_t> outToQuery;
+    for (uint8_t i = 0; i < tuple.getSize(); ++i) {
+        if (!returnOnlyVars || tuple.get(i).isVariable()) {
+            outToQuery.push_back(i);
+        }
+    }
+    //The rows come sorted on the variables, in the order of p. The
+    //constants have the same value in all rows
+    std::vector<uint8_t> order;
+    for (const uint8_t f : p.fields) {
+        if (tuple.get(f).isVariable()) {
+            order.push_back(f);
+        }
+    }
+    size_t next = 0;
+    for (const uint8_t field : sortByFields) {
+        if (field >= outToQuery.size()) {
+            return false;
+        }
+        const uint8_t arg = outToQuery[field];
+        if (!tuple.get(arg).isVariable()) {
+            continue;
+        }
+        if (next >= order.size() || order[next] != arg) {
+            return false;
+        }
+        next++;
+    }
+    return true;
+}
+
+void QueryIndex::narrow(const Column &column, const Term_t v, size_t &start,
+        size_t &end) {
+    size_t lo = start;
+    size_t hi = end;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (column.getValue(mid) < v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    const size_t newStart = lo;
+    hi = end;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (column.getValue(mid) <= v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    start = newStart;
+    end = lo;
+}
+
+bool QueryIndex::query(const Literal &query, const bool returnOnlyVars,
+        const std::vector<uint8_t> *sortByFields, TupleTable *out,
+        const size_t limit) const {
+    const VTuple tuple = query.getTuple();
+    if (arity == 0 || nrows == 0) {
+        return true;
+    }
+
+    //Take the permutation with the longest bound prefix and, among those,
+    //one that returns the rows in the requested order
+    const bool sortRequested = sortByFields != NULL && !sortByFields->empty();
+    size_t best = 0;
+    size_t bestBound = 0;
+    bool bestSorted = false;
+    for (size_t i = 0; i < permutations.size(); ++i) {
+        const size_t nbound = getNBoundPrefix(permutations[i], tuple);
+        const bool sorted = sortRequested && isSortedBy(permutations[i],
+                tuple, returnOnlyVars, *sortByFields);
+        if (i == 0 || nbound > bestBound ||
+                (nbound == bestBound && sorted && !bestSorted)) {
+            best = i;
+            bestBound = nbound;
+            bestSorted = sorted;
+        }
+    }
+    const Permutation &p = permutations[best];
+
+    //Rows that match the bound prefix
+    size_t key = 0;
+    size_t start = 0;
+    size_t end = nrows;
+    if (bestBound > 0) {
+        const Term_t v = tuple.get(p.fields[0]).getValue();
+        auto itr = std::lower_bound(p.keys.begin(), p.keys.end(), v);
+        if (itr == p.keys.end() || *itr != v) {
+            return true;
+        }
+        key = itr - p.keys.begin();
+        start = p.offsets[key];
+        end = p.offsets[key + 1];
+    }
+    for (size_t j = 1; j < bestBound && start < end; ++j) {
+        narrow(*p.columns[j - 1], tuple.get(p.fields[j]).getValue(), start,
+                end);
+    }
+    LOG(DEBUGL) << "Query on " << (int) bestBound << " bound fields of " <<
+        "permutation " << best << ": " << end - start << " candidate rows";
+
+    //The limit can only be applied if the rows need not be sorted anymore
+    const size_t maxRows = !sortRequested || bestSorted ? limit : 0;
+    size_t nadded = 0;
+
+    //Check the other constants and the repeated variables
+    std::vector<std::pair<uint8_t, uint8_t>> repeated = query.getRepeatedVars();
+    std::vector<Term_t> row(arity);
+    for (size_t r = start; r < end && (maxRows == 0 || nadded < maxRows);
+            ++r) {
+        while (p.offsets[key + 1] <= r) {
+            key++;
+        }
+        row[p.fields[0]] = p.keys[key];
+        for (uint8_t j = 1; j < arity; ++j) {
+            row[p.fields[j]] = p.columns[j - 1]->getValue(r);
+        }
+        bool copy = true;
+        for (size_t j = bestBound; j < arity; ++j) {
+            const VTerm t = tuple.get(p.fields[j]);
+            if (!t.isVariable() && row[p.fields[j]] != t.getValue()) {
+                copy = false;
+                break;
+            }
+        }
+        for (int i = 0; copy && i < repeated.size(); ++i) {
+            if (row[repeated[i].first] != row[repeated[i].second]) {
+                copy = false;
+            }
+        }
+        if (!copy) {
+            continue;
+        }
+        nadded++;
+        if (out->getSizeRow() == 0) {
+            Term_t dummy = 0;
+            out->addRow(&dummy);
+        } else {
+            for (int i = 0; i < arity; ++i) {
+                if (!returnOnlyVars || tuple.get(i).isVariable()) {
+                    out->addValue(row[i]);
+                }
+            }
+        }
+    }
+    return bestSorted;
+}
@@ -262,6 +262,16 @@ std::shared_ptr<const FCInternalTable> InterTableJoinProcessor::getTable() {
     return table;
 }
 
+size_t InterTableJoinProcessor::getNBufferedRows() const {
+    size_t nrows = 0;
+    for (uint32_t i = 0; i < currentSegmentSize; ++i) {
+        if (segments[i] != NULL) {
+            nrows += segments[i]->getNRows();
+        }
+    }
+    return nrows;
+}
+
 #if USE_DUPLICATE_DETECTION
 void InterTableJoinProcessor::processResults(const int blockid, const bool unique, std::mutex *m) {
     if (! unique && rowsHash == NULL && rowCount == TMPT_THRESHOLD) {
@@ -313,6 +313,7 @@ void RuleExecutionDetails::createExecutionPlans(
         bool copyAllVars) {
     bodyLiterals.clear();
     orderExecutions.clear();
+    plansValid.valid = false;
 
     //Init
     for (auto& literal : rule.getBody()) {
@@ -339,6 +340,10 @@ void RuleExecutionDetails::createExecutionPlans(
 }
 
 void RuleExecutionDetails::createExecutionPlans(bool copyAllVars) {
+    if (plansValid.valid && plansCopyAllVars == copyAllVars) {
+        //Already created by a previous run
+        return;
+    }
     bodyLiterals.clear();
     orderExecutions.clear();
 
@@ -445,4 +450,6 @@ void RuleExecutionDetails::createExecutionPlans(bool copyAllVars) {
         }
         p->calculateJoinsCoordinates(heads, copyAllVars);
     }
+    plansValid.valid = true;
+    plansCopyAllVars = copyAllVars;
 }
@@ -2,6 +2,8 @@
 #include <vlog/segment_support.h>
 #include <vlog/support.h>
 #include <vlog/fcinttable.h>
+#include <vlog/trace.h>
+#include <vlog/metrics.h>
 
 //#include <tbb/parallel_for.h>
 
@@ -239,12 +241,22 @@ std::shared_ptr<Segment> Segment::sortBy(const std::vector<uint8_t> *fields,
             return newSeg;
         }
     } //End special case
+    TraceSpan span("sort", "sort");
+    MetricTimer timer(RuntimeMetrics::sortTime);
+    std::shared_ptr<Segment> sorted;
     if (nthreads <= 1) {
         assert(filterDupls == false);
-        return intsort(fields);
+        sorted = intsort(fields);
     } else {
-        return intsort(fields, nthreads, filterDupls);
+        sorted = intsort(fields, nthreads, filterDupls);
     }
+    if (span.isActive()) {
+        span.setRows(getNRows(), sorted == NULL ? 0 : sorted->getNRows());
+        span.set("fields", (uint64_t) (fields == NULL ? nfields :
+                    fields->size()));
+        span.set("nthreads", (uint64_t) std::max(nthreads, 1));
+    }
+    return sorted;
 }
 
 std::shared_ptr<Segment> Segment::intsort(
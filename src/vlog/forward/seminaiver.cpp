@@ -8,6 +8,15 @@
 #include <vlog/extresultjoinproc.h>
 #include <vlog/egdresultjoinproc.h>
 #include <vlog/utils.h>
+#include <vlog/exporter.h>
+#include <vlog/minichase.h>
+#include <vlog/spillmgr.h>
+#include <vlog/trace.h>
+#include <vlog/metrics.h>
+#include <vlog/queryindex.h>
+#include <vlog/checkpoint.h>
+#include <vlog/termoverflow.h>
+#include <vlog/deadline.h>
 #include <trident/model/table.h>
 #include <kognac/consts.h>
 #include <kognac/utils.h>
@@ -20,6 +29,23 @@
 #include <memory>
 #include <sstream>
 #include <unordered_set>
+#include <set>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+static Literal getMostGenericLiteral(const Predicate &pred,
+        const uint8_t arity) {
+    VTuple t(arity);
+    //Add all different variables
+    for (int i = 0; i < arity; ++i) {
+        t.set(VTerm(i + 1, 0), i);
+    }
+    return Literal(pred, t);
+}
 
 void SemiNaiver::createGraphRuleDependency(std::vector<int> &nodes,
         std::vector<std::pair<int, int>> &edges) {
@@ -90,6 +116,7 @@ SemiNaiver::SemiNaiver(EDBLayer &layer,
     sameasAlgo(sameasAlgo),
     UNA(UNA) {
 
+        snapshots = false;
         if (sameasAlgo == "AXIOM") {
             //Rewrite the rules to add the equality axioms
             program->axiomatizeEquality();
@@ -236,15 +263,43 @@ void SemiNaiver::executeRules(std::vector<RuleExecutionDetails> &edbRuleset,
         std::vector<StatIteration> &costRules,
         unsigned long *timeout) {
     bool mayHaveTimeout = timeout != NULL && *timeout != 0;
+    executingIDBRules = &ruleset;
+    executingExtIDBRules = &extruleset;
+
+    if (parallelStrata && !resuming && extEdbRuleset.empty() &&
+            canExecuteComponents(ruleset)) {
+        //The EDB rules do not read any IDB predicate: execute them once,
+        //before all components
+        for (size_t j = 0; j < edbRuleset.size(); ++j) {
+            executeRule(edbRuleset[j], iteration, 0, NULL);
+            if (mayHaveTimeout) {
+                std::chrono::duration<double> s = std::chrono::system_clock::now() - startTime;
+                if (s.count() > *timeout) {
+                    *timeout = 0;
+                    return;
+                }
+            }
+            iteration++;
+        }
+        executeComponents(ruleset, costRules, timeout);
+        return;
+    }
 
-    for (int i = 0; i < ruleset.size(); i++) {
+    for (int i = resuming ? evaluationPoint.stratum : 0; i < ruleset.size(); i++) {
         bool newDer = true;
         bool first = true;
+        //A checkpoint is always taken after the EDB rules of the stratum
+        bool resumed = resuming;
+        if (resumed) {
+            first = !evaluationPoint.firstDone;
+        }
+        evaluationPoint.stratum = i;
 
         while (newDer) {
             newDer = false;
             int limitView = 0;
-            if (first) {
+            const bool skipRules = resumed && evaluationPoint.inExtRules;
+            if (first && !resumed) {
 #if DEBUG
                 std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
 #endif
@@ -265,11 +320,15 @@ void SemiNaiver::executeRules(std::vector<RuleExecutionDetails> &edbRuleset,
 #endif
             }
         
-            if (ruleset[i].size() > 0) {
+            evaluationPoint.firstDone = !first;
+            evaluationPoint.inExtRules = false;
+            if (ruleset[i].size() > 0 && !skipRules) {
                 newDer |= executeUntilSaturation(ruleset[i], costRules, limitView,  true, timeout);
             }
 
-            if ((typeChase == TypeChase::RESTRICTED_CHASE ||
+            if (skipRules) {
+                limitView = evaluationPoint.limitView;
+            } else if ((typeChase == TypeChase::RESTRICTED_CHASE ||
                     typeChase == TypeChase::SUM_RESTRICTED_CHASE)) {
                 limitView = iteration == 0 ? 1 : iteration;
             }
@@ -288,12 +347,21 @@ void SemiNaiver::executeRules(std::vector<RuleExecutionDetails> &edbRuleset,
                 first = false;
             }
 
+            evaluationPoint.firstDone = true;
+            evaluationPoint.inExtRules = true;
+            evaluationPoint.limitView = limitView;
             if (extruleset[i].size() > 0) {
                 newDer |= executeUntilSaturation(extruleset[i], costRules, limitView, 
                         (typeChase != TypeChase::RESTRICTED_CHASE
                          && typeChase != TypeChase::SUM_RESTRICTED_CHASE),
                         timeout);
             }
+            if (resumed) {
+                //The rules may have derived something before the checkpoint
+                newDer = true;
+                resumed = false;
+                resuming = false;
+            }
             if (foundCyclicTerms && typeChase != TypeChase::SUM_RESTRICTED_CHASE) {
                 return;
             }
@@ -305,6 +373,296 @@ void SemiNaiver::executeRules(std::vector<RuleExecutionDetails> &edbRuleset,
     return;
 }
 
+size_t SemiNaiver::claimIteration() {
+    std::lock_guard<std::mutex> lock(iterationMutex);
+    return iteration++;
+}
+
+bool SemiNaiver::canExecuteComponents(
+        const std::vector<std::vector<RuleExecutionDetails>> &IDBRules) {
+    std::string reason = "";
+    if (nthreads < 2) {
+        reason = "there are less than two threads";
+    } else if (program->areExistentialRules()) {
+        //The chase management is shared by all rules
+        reason = "the program has existential rules";
+    } else if (checkCyclicTerms) {
+        reason = "cyclic terms are checked";
+    } else if (spillMgr) {
+        reason = "the derivations may be spilled";
+    }
+#ifdef WEBINTERFACE
+    //The web interface shows one current rule
+    reason = "the web interface is enabled";
+#endif
+    for (const auto &strata : IDBRules) {
+        for (const auto &r : strata) {
+            if (r.rule.isEGD()) {
+                //EGDs rewrite the derivations of other rules
+                reason = "the program has EGDs";
+            }
+        }
+    }
+    if (reason != "") {
+        LOG(WARNL) << "The strata are executed sequentially, because " << reason;
+        return false;
+    }
+    return true;
+}
+
+void SemiNaiver::executeComponents(
+        std::vector<std::vector<RuleExecutionDetails>> &IDBRules,
+        std::vector<StatIteration> &costRules,
+        unsigned long *timeout) {
+    //The nodes of the dependency graph are the predicates in the heads of
+    //the rules. All heads of a rule go in the same component
+    std::unordered_map<PredId_t, size_t> nodes;
+    std::vector<std::pair<size_t, size_t>> rules; //Stratum and position
+    for (size_t i = 0; i < IDBRules.size(); ++i) {
+        for (size_t j = 0; j < IDBRules[i].size(); ++j) {
+            rules.push_back(std::make_pair(i, j));
+            for (const auto &h : IDBRules[i][j].rule.getHeads()) {
+                const size_t id = nodes.size();
+                nodes.insert(std::make_pair(h.getPredicate().getId(), id));
+            }
+        }
+    }
+    const size_t nnodes = nodes.size();
+    std::vector<std::vector<size_t>> edges(nnodes);
+    std::vector<std::vector<size_t>> reverseEdges(nnodes);
+    for (const auto &r : rules) {
+        const Rule &rule = IDBRules[r.first][r.second].rule;
+        const size_t head = nodes[rule.getFirstHead().getPredicate().getId()];
+        for (const auto &h : rule.getHeads()) {
+            const size_t other = nodes[h.getPredicate().getId()];
+            edges[head].push_back(other);
+            reverseEdges[other].push_back(head);
+            edges[other].push_back(head);
+            reverseEdges[head].push_back(other);
+        }
+        //Negated atoms are edges as well: their predicate must be complete
+        for (const auto &b : rule.getBody()) {
+            auto el = nodes.find(b.getPredicate().getId());
+            if (el != nodes.end()) {
+                edges[el->second].push_back(head);
+                reverseEdges[head].push_back(el->second);
+            }
+        }
+    }
+
+    //Strongly connected components (Kosaraju). First order the nodes by
+    //the time the depth-first search leaves them
+    std::vector<size_t> order;
+    std::vector<bool> visited(nnodes, false);
+    for (size_t n = 0; n < nnodes; ++n) {
+        if (visited[n]) {
+            continue;
+        }
+        std::vector<std::pair<size_t, size_t>> stack; //Node and next edge
+        stack.push_back(std::make_pair(n, 0));
+        visited[n] = true;
+        while (!stack.empty()) {
+            const size_t node = stack.back().first;
+            if (stack.back().second < edges[node].size()) {
+                const size_t next = edges[node][stack.back().second++];
+                if (!visited[next]) {
+                    visited[next] = true;
+                    stack.push_back(std::make_pair(next, 0));
+                }
+            } else {
+                order.push_back(node);
+                stack.pop_back();
+            }
+        }
+    }
+    //Then collect the components on the reversed graph
+    const size_t none = (size_t) -1;
+    std::vector<size_t> componentOf(nnodes, none);
+    size_t ncomponents = 0;
+    for (auto itr = order.rbegin(); itr != order.rend(); ++itr) {
+        if (componentOf[*itr] != none) {
+            continue;
+        }
+        std::vector<size_t> stack(1, *itr);
+        componentOf[*itr] = ncomponents;
+        while (!stack.empty()) {
+            const size_t node = stack.back();
+            stack.pop_back();
+            for (const size_t prev : reverseEdges[node]) {
+                if (componentOf[prev] == none) {
+                    componentOf[prev] = ncomponents;
+                    stack.push_back(prev);
+                }
+            }
+        }
+        ncomponents++;
+    }
+
+    struct Component {
+        std::vector<std::pair<size_t, size_t>> positions;
+        std::vector<RuleExecutionDetails> rules;
+        //The predicates that the rules write
+        std::unordered_set<PredId_t> heads;
+        std::unordered_set<size_t> dependents;
+        size_t nDependencies = 0;
+        bool started = false;
+    };
+    std::vector<Component> components(ncomponents);
+    for (const auto &r : rules) {
+        const RuleExecutionDetails &details = IDBRules[r.first][r.second];
+        const size_t c = componentOf[nodes[
+            details.rule.getFirstHead().getPredicate().getId()]];
+        components[c].positions.push_back(r);
+        components[c].rules.push_back(details);
+        for (const auto &h : details.rule.getHeads()) {
+            components[c].heads.insert(h.getPredicate().getId());
+        }
+        for (const auto &b : details.rule.getBody()) {
+            const PredId_t pred = b.getPredicate().getId();
+            auto el = nodes.find(pred);
+            if (el != nodes.end() && componentOf[el->second] != c) {
+                components[componentOf[el->second]].dependents.insert(c);
+            }
+        }
+    }
+    for (const auto &c : components) {
+        for (const size_t d : c.dependents) {
+            components[d].nDependencies++;
+        }
+    }
+    const size_t nworkers = std::min((size_t) nthreads, components.size());
+    LOG(INFOL) << "Executing " << components.size() << " components of "
+        << rules.size() << " rules with " << nworkers << " threads";
+
+    //Two components never run at the same time if they write the same
+    //predicate. The predicates that a component only reads are complete
+    //(or EDB) when it starts, and several components may read them at
+    //the same time. The IDB tables merge and sort their blocks lazily, so
+    //they are prepared for the readers before: the ones that no component
+    //writes here, and the heads of every component when it finishes
+    for (const auto &r : rules) {
+        for (const auto &b : IDBRules[r.first][r.second].rule.getBody()) {
+            const PredId_t pred = b.getPredicate().getId();
+            if (!nodes.count(pred) && pred < predicatesTables.size() &&
+                    predicatesTables[pred] != NULL) {
+                predicatesTables[pred]->prepareForReaders(nthreads);
+            }
+        }
+    }
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::unordered_set<PredId_t> busyPredicates;
+    size_t nfinished = 0;
+    bool stop = false;
+    bool timedOut = false;
+    std::exception_ptr error;
+    const unsigned long maxTime = timeout != NULL ? *timeout : 0;
+
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop && nfinished < components.size()) {
+            Component *next = NULL;
+            for (auto &c : components) {
+                if (c.started || c.nDependencies > 0) {
+                    continue;
+                }
+                bool conflict = false;
+                for (const PredId_t pred : c.heads) {
+                    if (busyPredicates.count(pred)) {
+                        conflict = true;
+                        break;
+                    }
+                }
+                if (!conflict) {
+                    next = &c;
+                    break;
+                }
+            }
+            if (next == NULL) {
+                cv.wait(lock);
+                continue;
+            }
+            next->started = true;
+            busyPredicates.insert(next->heads.begin(), next->heads.end());
+            lock.unlock();
+
+            std::vector<StatIteration> componentCosts;
+            unsigned long componentTimeout = maxTime;
+            std::exception_ptr componentError;
+            try {
+                executeUntilSaturation(next->rules, componentCosts, 0, true,
+                        timeout != NULL ? &componentTimeout : NULL);
+            } catch (...) {
+                componentError = std::current_exception();
+            }
+            //No dependent has started yet, so nobody reads the heads
+            for (const PredId_t pred : next->heads) {
+                if (pred < predicatesTables.size() &&
+                        predicatesTables[pred] != NULL) {
+                    predicatesTables[pred]->prepareForReaders(1);
+                }
+            }
+            //The statistics must point to the rules that remain
+            std::unordered_map<const Rule *, const Rule *> originalRules;
+            for (size_t k = 0; k < next->rules.size(); ++k) {
+                originalRules[&next->rules[k].rule] = &IDBRules[
+                    next->positions[k].first][next->positions[k].second].rule;
+            }
+            for (auto &stat : componentCosts) {
+                stat.rule = originalRules[stat.rule];
+            }
+
+            lock.lock();
+            for (const PredId_t pred : next->heads) {
+                busyPredicates.erase(pred);
+            }
+            for (const size_t d : next->dependents) {
+                components[d].nDependencies--;
+            }
+            costRules.insert(costRules.end(), componentCosts.begin(),
+                    componentCosts.end());
+            nfinished++;
+            if (componentError) {
+                error = componentError;
+                stop = true;
+            }
+            if (maxTime != 0 && componentTimeout == 0) {
+                timedOut = true;
+                stop = true;
+            }
+            cv.notify_all();
+        }
+    };
+
+    parallelComponents = true;
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nworkers; ++i) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto &t : threads) {
+        t.join();
+    }
+    parallelComponents = false;
+
+    //The next executions of the rules continue from where these stopped
+    for (const auto &c : components) {
+        for (size_t k = 0; k < c.rules.size(); ++k) {
+            RuleExecutionDetails &details = IDBRules[c.positions[k].first][
+                c.positions[k].second];
+            details.lastExecution = c.rules[k].lastExecution;
+            details.failedBecauseEmpty = c.rules[k].failedBecauseEmpty;
+            details.atomFailure = c.rules[k].atomFailure;
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (timedOut) {
+        *timeout = 0;   // To indicate materialization was stopped because of timeout.
+    }
+}
+
 void SemiNaiver::prepare(size_t lastExecution, int singleRuleToCheck, std::vector<RuleExecutionDetails> &allrules) {
     //Prepare for the execution
 #if DEBUG
@@ -337,6 +695,7 @@ void SemiNaiver::prepare(size_t lastExecution, int singleRuleToCheck, std::vecto
         ruleExecDetails.createExecutionPlans(checkCyclicTerms);
     }
     allRulesSize += allEDBRules.size();
+    detectSharedPrefixes();
     allrules.reserve(allRulesSize);
 
     //Setup the datastructures to handle the chase
@@ -347,7 +706,7 @@ void SemiNaiver::prepare(size_t lastExecution, int singleRuleToCheck, std::vecto
     chaseMgmt = std::shared_ptr<ChaseMgmt>(new ChaseMgmt(allrules,
                 typeChase, checkCyclicTerms,
                 singleRuleToCheck,
-                predIgnoreBlock));
+                predIgnoreBlock, nthreads));
 #if DEBUG
     std::chrono::duration<double> sec = std::chrono::system_clock::now() - start;
     LOG(DEBUGL) << "Runtime ruleset optimization ms = " << sec.count() * 1000;
@@ -363,6 +722,7 @@ void SemiNaiver::run(size_t lastExecution, size_t it, unsigned long *timeout,
     running = true;
     iteration = it;
     startTime = std::chrono::system_clock::now();
+    dropQueryIndexes();
 #ifdef WEBINTERFACE
     statsLastIteration = -1;
 #endif
@@ -372,9 +732,23 @@ void SemiNaiver::run(size_t lastExecution, size_t it, unsigned long *timeout,
     // Note: allrules must be declared here, not in prepare itself, since when declared there,
     // it (and stuff inside it) will be de-allocated too early. --Ceriel
     prepare(lastExecution, singleRuleToCheck, allrules);
+    if (resumePath != "") {
+        loadCheckpoint(resumePath);
+        resumePath = "";
+    }
+    lastCheckpoint = std::chrono::system_clock::now();
+    if (snapshots) {
+        publishSnapshot();
+    }
 
     //Used for statistics
     std::vector<StatIteration> costRules;
+    //The new facts are read together with the others
+    newFactsPredicates.clear();
+    restrictedEDBRules.clear();
+    restrictedExtEDBRules.clear();
+    restrictedIDBRules.clear();
+    restrictedExtIDBRules.clear();
 
     if ((typeChase == TypeChase::RESTRICTED_CHASE ||
                 typeChase == TypeChase::SUM_RESTRICTED_CHASE)
@@ -385,36 +759,35 @@ void SemiNaiver::run(size_t lastExecution, size_t it, unsigned long *timeout,
         std::vector<std::vector<RuleExecutionDetails>> originalRuleset = allIDBRules;
 
         //Only non-existential rules
-        std::vector<RuleExecutionDetails> tmpEDBRules;
         for(auto &r : originalEDBruleset) {
             if (!r.rule.isExistential())  {
-                tmpEDBRules.push_back(r);
+                restrictedEDBRules.push_back(r);
             }
         }
-        std::vector<std::vector<RuleExecutionDetails>> tmpIDBRules(nStratificationClasses);
+        restrictedIDBRules.resize(nStratificationClasses);
         for (int k = 0; k < originalRuleset.size(); k++) {
             for(auto &r : originalRuleset[k]) {
                 if (!r.rule.isExistential()) {
-                    tmpIDBRules[k].push_back(r);
+                    restrictedIDBRules[k].push_back(r);
                 }
             }
         }
         //Only existential rules
-        std::vector<RuleExecutionDetails> tmpExtEDBRules;
         for(auto &r : originalEDBruleset) {
             if (r.rule.isExistential())  {
-                tmpExtEDBRules.push_back(r);
+                restrictedExtEDBRules.push_back(r);
             }
         }
-        std::vector<std::vector<RuleExecutionDetails>> tmpExtIDBRules(nStratificationClasses);
+        restrictedExtIDBRules.resize(nStratificationClasses);
         for (int k = 0; k < originalRuleset.size(); k++) {
             for(auto &r : originalRuleset[k]) {
                 if (r.rule.isExistential()) {
-                    tmpExtIDBRules[k].push_back(r);
+                    restrictedExtIDBRules[k].push_back(r);
                 }
             }
         }
-        executeRules(tmpEDBRules, tmpExtEDBRules, tmpIDBRules, tmpExtIDBRules, costRules, timeout);
+        executeRules(restrictedEDBRules, restrictedExtEDBRules,
+                restrictedIDBRules, restrictedExtIDBRules, costRules, timeout);
     } else {
         std::vector<RuleExecutionDetails> emptyRuleset;
         std::vector<std::vector<RuleExecutionDetails>> emptyExtIDBRules(nStratificationClasses);
@@ -422,6 +795,15 @@ void SemiNaiver::run(size_t lastExecution, size_t it, unsigned long *timeout,
     }
 
     running = false;
+    resuming = false;
+    materialized = timeout == NULL || *timeout != 0;
+    if (snapshots) {
+        //Also the blocks that the EGDs replaced
+        publishSnapshot();
+    }
+    executingIDBRules = NULL;
+    executingExtIDBRules = NULL;
+    clearSharedPrefixes();
     LOG(INFOL) << "Finished process. Iterations=" << iteration;
     LOG(INFOL) << "Triggers: " << triggers;
 
@@ -448,6 +830,713 @@ void SemiNaiver::run(size_t lastExecution, size_t it, unsigned long *timeout,
 #endif
 }
 
+size_t SemiNaiver::addFacts(const PredId_t pred,
+        const std::vector<std::vector<Term_t>> &facts) {
+    if (running) {
+        LOG(ERRORL) << "Facts cannot be added while the materialization runs";
+        throw 10;
+    }
+    if (!materialized) {
+        LOG(ERRORL) << "Facts can only be added to a completed materialization";
+        throw 10;
+    }
+    const Predicate p = program->getPredicate(pred);
+    if (p.getType() != EDB) {
+        LOG(ERRORL) << "Facts can only be added to EDB predicates";
+        throw 10;
+    }
+    const uint8_t sizeRow = p.getCardinality();
+
+    //The semi-naive evaluation cannot retract derivations, hence no rule
+    //may negate a predicate that depends on the new facts
+    std::vector<Rule> rules = program->getAllRules();
+    std::unordered_set<PredId_t> dependents;
+    dependents.insert(pred);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const auto &rule : rules) {
+            for (const auto &lit : rule.getBody()) {
+                if (!dependents.count(lit.getPredicate().getId())) {
+                    continue;
+                }
+                if (lit.isNegated()) {
+                    LOG(ERRORL) << "The rule " << rule.tostring(program, &layer)
+                        << " negates a predicate that depends on " <<
+                        program->getPredicateName(pred) <<
+                        ": the materialization must be computed again";
+                    throw 10;
+                }
+                for (const auto &head : rule.getHeads()) {
+                    if (dependents.insert(head.getPredicate().getId()).second) {
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<std::vector<Term_t>> rows(facts);
+    for (const auto &row : rows) {
+        if (row.size() != sizeRow) {
+            LOG(ERRORL) << "The facts of " << program->getPredicateName(pred)
+                << " must have " << (int) sizeRow << " terms";
+            throw 10;
+        }
+    }
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    if (rows.empty()) {
+        return 0;
+    }
+
+    //The block of the EDB layer must be there before the new one
+    const Literal literal = getMostGenericLiteral(p, sizeRow);
+    getTableFromEDBLayer(literal);
+    FCTable *table = predicatesTables[pred];
+    const size_t it = claimIteration();
+    std::shared_ptr<const FCInternalTable> t;
+    if (sizeRow == 0) {
+        t = std::shared_ptr<const FCInternalTable>(new SingletonTable(it));
+    } else {
+        std::vector<std::shared_ptr<Column>> columns;
+        for (uint8_t j = 0; j < sizeRow; ++j) {
+            std::vector<Term_t> values(rows.size());
+            for (size_t i = 0; i < rows.size(); ++i) {
+                values[i] = rows[i][j];
+            }
+            columns.push_back(ColumnWriter::getColumn(values, j == 0));
+        }
+        std::shared_ptr<const Segment> seg(new Segment(sizeRow, columns));
+        t = std::shared_ptr<const FCInternalTable>(
+                new InmemoryFCInternalTable(sizeRow, it, true, seg));
+    }
+    table->add(t, literal, 0, NULL, 0, it, true, nthreads);
+    if (newFactsPredicates.empty()) {
+        newFactsIteration = it;
+    }
+    newFactsPredicates.insert(pred);
+    if (snapshots) {
+        std::vector<PredId_t> preds(1, pred);
+        publishSnapshot(&preds);
+    }
+    LOG(DEBUGL) << "Added " << rows.size() << " facts to " <<
+        program->getPredicateName(pred) << " in iteration " << it;
+    return rows.size();
+}
+
+size_t SemiNaiver::addFacts(const PredId_t pred,
+        const std::vector<std::vector<std::string>> &facts) {
+    std::vector<std::vector<Term_t>> rows;
+    rows.reserve(facts.size());
+    for (const auto &fact : facts) {
+        std::vector<Term_t> row;
+        for (const auto &term : fact) {
+            uint64_t id;
+            layer.getOrAddDictNumber(term.c_str(), term.size(), id);
+            row.push_back(TermOverflow::encode(id));
+        }
+        rows.push_back(row);
+    }
+    return addFacts(pred, rows);
+}
+
+bool SemiNaiver::executeOnNewFacts(RuleExecutionDetails &ruleDetails) {
+    const RuleExecutionPlan &base = ruleDetails.orderExecutions[0];
+    std::vector<const Literal *> newAtoms;
+    for (const auto lit : base.plan) {
+        if (lit->getPredicate().getType() == EDB && !lit->isNegated() &&
+                newFactsPredicates.count(lit->getPredicate().getId())) {
+            newAtoms.push_back(lit);
+        }
+    }
+    if (newAtoms.empty()) {
+        return false;
+    }
+
+    //Like for the IDB atoms in the other plans: one atom reads the new
+    //blocks, the ones before it in the body only the old blocks
+    std::vector<RuleExecutionPlan> plans;
+    for (const auto atom : newAtoms) {
+        RuleExecutionPlan p = base;
+        for (size_t j = 0; j < p.plan.size(); ++j) {
+            const Literal *lit = p.plan[j];
+            if (lit == atom) {
+                p.ranges[j] = std::make_pair(1, (size_t) - 1);
+            } else if (lit < atom && std::find(newAtoms.begin(),
+                        newAtoms.end(), lit) != newAtoms.end()) {
+                p.ranges[j] = std::make_pair(0, 1);
+            } else {
+                p.ranges[j] = std::make_pair(0, (size_t) - 1);
+            }
+        }
+        plans.push_back(p);
+    }
+
+    //The new blocks point to ruleDetails, so the plans replace its own
+    //only for this execution
+    const uint32_t lastExecution = ruleDetails.lastExecution;
+    plans.swap(ruleDetails.orderExecutions);
+    ruleDetails.lastExecution = newFactsIteration;
+    ruleDetails.failedBecauseEmpty = false;
+    ruleDetails.atomFailure = NULL;
+    std::vector<Literal> heads = ruleDetails.rule.getHeads();
+    bool response;
+    try {
+        response = executeRule(ruleDetails, heads, claimIteration(), 0, NULL);
+    } catch (...) {
+        plans.swap(ruleDetails.orderExecutions);
+        ruleDetails.lastExecution = lastExecution;
+        throw;
+    }
+    plans.swap(ruleDetails.orderExecutions);
+    ruleDetails.lastExecution = lastExecution;
+    ruleDetails.failedBecauseEmpty = false;
+    ruleDetails.atomFailure = NULL;
+    return response;
+}
+
+void SemiNaiver::runIncremental(unsigned long *timeout) {
+    if (newFactsPredicates.empty()) {
+        return;
+    }
+    running = true;
+    startTime = std::chrono::system_clock::now();
+    dropQueryIndexes();
+    const size_t firstIteration = iteration;
+
+    //The rules that derived the current blocks
+    const bool restricted = !restrictedIDBRules.empty();
+    std::vector<std::vector<RuleExecutionDetails>> emptyExtIDBRules(nStratificationClasses);
+    std::vector<std::vector<RuleExecutionDetails>> &IDBRules = restricted ?
+        restrictedIDBRules : allIDBRules;
+    std::vector<std::vector<RuleExecutionDetails>> &extIDBRules = restricted ?
+        restrictedExtIDBRules : emptyExtIDBRules;
+    std::vector<RuleExecutionDetails *> rules;
+    for (auto &r : restricted ? restrictedEDBRules : allEDBRules) {
+        rules.push_back(&r);
+    }
+    for (auto &r : restrictedExtEDBRules) {
+        rules.push_back(&r);
+    }
+    for (auto *rulesets : {&IDBRules, &extIDBRules}) {
+        for (auto &strata : *rulesets) {
+            for (auto &r : strata) {
+                //An atom that was empty may have new facts now
+                r.failedBecauseEmpty = false;
+                r.atomFailure = NULL;
+                rules.push_back(&r);
+            }
+        }
+    }
+
+    //First join the new facts with all the derivations so far, then
+    //continue the semi-naive evaluation of the IDB rules from there
+    for (auto r : rules) {
+        executeOnNewFacts(*r);
+    }
+    newFactsPredicates.clear();
+    std::vector<RuleExecutionDetails> emptyRuleset;
+    std::vector<StatIteration> costRules;
+    executeRules(emptyRuleset, emptyRuleset, IDBRules, extIDBRules, costRules,
+            timeout);
+
+    running = false;
+    materialized = timeout == NULL || *timeout != 0;
+    if (snapshots) {
+        publishSnapshot();
+    }
+    executingIDBRules = NULL;
+    executingExtIDBRules = NULL;
+    clearSharedPrefixes();
+    std::chrono::duration<double> sec = std::chrono::system_clock::now() - startTime;
+    LOG(INFOL) << "Derived the consequences of the new facts in " <<
+        iteration - firstIteration << " iterations (" << sec.count() * 1000
+        << " ms). Triggers: " << triggers;
+}
+
+void SemiNaiver::enforceMemoryBudget(
+        const std::vector<RuleExecutionDetails> &ruleset) {
+    //Blocks older than what every rule of the stratum has already seen are
+    //read only by full joins and duplicate elimination
+    size_t minIteration = iteration;
+    for (const auto &r : ruleset) {
+        minIteration = std::min(minIteration, (size_t) r.lastExecution);
+    }
+    spillMgr->enforce(predicatesTables, minIteration,
+            getSharedPrefixesBytes(), [this]() {
+            clearSharedPrefixes();
+            });
+}
+
+void SemiNaiver::checkpointIfDue() {
+    std::chrono::duration<double> sec = std::chrono::system_clock::now() -
+        lastCheckpoint;
+    if (sec.count() < checkpointInterval) {
+        return;
+    }
+    storeCheckpoint(checkpointPath);
+    lastCheckpoint = std::chrono::system_clock::now();
+}
+
+void SemiNaiver::storeCheckpoint(const std::string &path) {
+    if (executingIDBRules == NULL) {
+        LOG(ERRORL) << "A checkpoint can only be taken while the rules are executed";
+        throw 10;
+    }
+    TraceSpan span("checkpoint", "checkpoint");
+    std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out) {
+        LOG(ERRORL) << "Cannot write the checkpoint " << tmpPath;
+        throw 10;
+    }
+    out.write(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE);
+    //To recognize the checkpoints of other programs
+    Checkpoint::writeInt(out, program->getNRules());
+    Checkpoint::writeInt(out, nStratificationClasses);
+    Checkpoint::writeInt(out, typeChase);
+
+    Checkpoint::writeInt(out, iteration);
+    Checkpoint::writeInt(out, triggers);
+    Checkpoint::writeInt(out, evaluationPoint.stratum);
+    Checkpoint::writeInt(out, evaluationPoint.firstDone);
+    Checkpoint::writeInt(out, evaluationPoint.inExtRules);
+    Checkpoint::writeInt(out, evaluationPoint.limitView);
+    Checkpoint::writeInt(out, evaluationPoint.rule);
+    Checkpoint::writeInt(out, evaluationPoint.rulesWithoutDerivation);
+
+    //Where the semi-naive evaluation of every rule is
+    std::vector<const RuleExecutionDetails *> rules;
+    for (const auto *rulesets : {executingIDBRules, executingExtIDBRules}) {
+        for (const auto &strata : *rulesets) {
+            for (const auto &r : strata) {
+                rules.push_back(&r);
+            }
+        }
+    }
+    Checkpoint::writeInt(out, rules.size());
+    for (const auto r : rules) {
+        Checkpoint::writeInt(out, r->ruleid);
+        Checkpoint::writeInt(out, r->lastExecution);
+    }
+
+    //The terms that were not in the EDB layer
+    std::vector<std::pair<std::string, Term_t>> terms = layer.getAddedTerms();
+    Checkpoint::writeInt(out, terms.size());
+    for (const auto &t : terms) {
+        Checkpoint::writeString(out, t.first);
+        Checkpoint::writeInt(out, t.second);
+    }
+    std::vector<uint64_t> overflow = TermOverflow::getValues();
+    Checkpoint::writeInt(out, overflow.size());
+    for (const auto v : overflow) {
+        Checkpoint::writeInt(out, v);
+    }
+
+    //The blocks of the IDB predicates, with their iterations, and the
+    //ones of addFacts
+    std::vector<PredId_t> preds;
+    for (PredId_t p = 0; p < predicatesTables.size(); ++p) {
+        if (predicatesTables[p] != NULL && !predicatesTables[p]->isEmpty()
+                && (program->getPredicate(p).getType() == IDB ||
+                    predicatesTables[p]->getMaxIteration() > 0)) {
+            preds.push_back(p);
+        }
+    }
+    Checkpoint::writeInt(out, preds.size());
+    size_t nrows = 0;
+    for (const PredId_t p : preds) {
+        FCTable *table = predicatesTables[p];
+        const uint8_t sizeRow = table->getSizeRow();
+        std::vector<const FCBlock *> blocks;
+        //The EDB layer is in the block of iteration 0
+        FCIterator itr = table->read(
+                program->getPredicate(p).getType() == EDB ? 1 : 0);
+        while (!itr.isEmpty()) {
+            blocks.push_back(itr.getCurrentBlock());
+            itr.moveNextCount();
+        }
+        Checkpoint::writeInt(out, p);
+        Checkpoint::writeInt(out, sizeRow);
+        Checkpoint::writeInt(out, blocks.size());
+        for (const auto block : blocks) {
+            Checkpoint::writeInt(out, block->iteration);
+            Checkpoint::writeInt(out, block->posQueryInRule);
+            Checkpoint::writeInt(out, block->ruleExecOrder);
+            Checkpoint::writeInt(out, block->isCompleted);
+            const VTuple tuple = block->query.getTuple();
+            for (uint8_t i = 0; i < sizeRow; ++i) {
+                const VTerm t = tuple.get(i);
+                Checkpoint::writeInt(out, t.isVariable());
+                Checkpoint::writeInt(out, t.isVariable() ? t.getId() :
+                        t.getValue());
+            }
+            Checkpoint::writeInt(out, block->table->isSorted());
+            Checkpoint::writeInt(out, block->table->getNRows());
+            if (sizeRow > 0) {
+                FCInternalTableItr *titr = block->table->getIterator();
+                std::vector<std::shared_ptr<Column>> columns =
+                    titr->getAllColumns();
+                block->table->releaseIterator(titr);
+                for (const auto &c : columns) {
+                    Checkpoint::writeColumn(out, c);
+                }
+            }
+            nrows += block->table->getNRows();
+        }
+    }
+
+    //The fresh IDs of the existential variables
+    Checkpoint::writeInt(out, chaseMgmt ? 1 : 0);
+    if (chaseMgmt) {
+        chaseMgmt->store(out);
+    }
+    out.close();
+    if (out.fail()) {
+        LOG(ERRORL) << "Cannot write the checkpoint " << tmpPath;
+        throw 10;
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        //On Windows, the destination must not exist
+        std::remove(path.c_str());
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            LOG(ERRORL) << "Cannot replace the checkpoint " << path;
+            throw 10;
+        }
+    }
+    std::chrono::duration<double> sec = std::chrono::system_clock::now() - start;
+    LOG(INFOL) << "Checkpoint of " << nrows << " rows at iteration " <<
+        iteration << " written in " << sec.count() * 1000 << " ms";
+    if (span.isActive()) {
+        span.set("iteration", (uint64_t) iteration);
+        span.set("rows", (uint64_t) nrows);
+    }
+}
+
+void SemiNaiver::loadCheckpoint(const std::string &path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in) {
+        LOG(ERRORL) << "Cannot read the checkpoint " << path;
+        throw 10;
+    }
+    char magic[CHECKPOINT_MAGIC_SIZE];
+    in.read(magic, CHECKPOINT_MAGIC_SIZE);
+    if (!in || memcmp(magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE) != 0) {
+        LOG(ERRORL) << path << " is not a checkpoint";
+        throw 10;
+    }
+    if (Checkpoint::readInt(in) != program->getNRules()
+            || Checkpoint::readInt(in) != nStratificationClasses
+            || Checkpoint::readInt(in) != typeChase) {
+        LOG(ERRORL) << "The checkpoint " << path << " was taken for another program";
+        throw 10;
+    }
+
+    iteration = Checkpoint::readInt(in);
+    triggers = Checkpoint::readInt(in);
+    evaluationPoint.stratum = Checkpoint::readInt(in);
+    evaluationPoint.firstDone = Checkpoint::readInt(in) != 0;
+    evaluationPoint.inExtRules = Checkpoint::readInt(in) != 0;
+    evaluationPoint.limitView = Checkpoint::readInt(in);
+    evaluationPoint.rule = Checkpoint::readInt(in);
+    evaluationPoint.rulesWithoutDerivation = Checkpoint::readInt(in);
+    resuming = true;
+
+    //The restricted chase copies the rules before it executes them, so
+    //they must be restored here
+    std::unordered_map<size_t, size_t> lastExecutions;
+    const uint64_t nrules = Checkpoint::readInt(in);
+    for (uint64_t i = 0; i < nrules; ++i) {
+        const size_t ruleid = Checkpoint::readInt(in);
+        lastExecutions[ruleid] = Checkpoint::readInt(in);
+    }
+    for (auto &strata : allIDBRules) {
+        for (auto &r : strata) {
+            auto el = lastExecutions.find(r.ruleid);
+            if (el != lastExecutions.end()) {
+                r.lastExecution = el->second;
+                r.failedBecauseEmpty = false;
+                r.atomFailure = NULL;
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string, Term_t>> terms;
+    const uint64_t nterms = Checkpoint::readInt(in);
+    for (uint64_t i = 0; i < nterms; ++i) {
+        std::string text = Checkpoint::readString(in);
+        terms.push_back(std::make_pair(text, (Term_t) Checkpoint::readInt(in)));
+    }
+    layer.restoreAddedTerms(terms);
+    std::vector<uint64_t> overflow(Checkpoint::readInt(in));
+    for (auto &v : overflow) {
+        v = Checkpoint::readInt(in);
+    }
+    TermOverflow::restore(overflow);
+
+    //The blocks keep no pointer to the rule that derived them, which only
+    //disables some optimizations of TableFilterer on them
+    size_t nrows = 0;
+    const uint64_t ntables = Checkpoint::readInt(in);
+    for (uint64_t i = 0; i < ntables; ++i) {
+        const PredId_t p = (PredId_t) Checkpoint::readInt(in);
+        const uint8_t sizeRow = (uint8_t) Checkpoint::readInt(in);
+        if (p >= predicatesTables.size()) {
+            LOG(ERRORL) << "The checkpoint " << path << " was taken for another program";
+            throw 10;
+        }
+        const Predicate pred = program->getPredicate(p);
+        if (pred.getType() == EDB) {
+            //The block of the EDB layer comes first
+            getTableFromEDBLayer(getMostGenericLiteral(pred, sizeRow));
+        }
+        FCTable *table = getTable(p, sizeRow);
+        if (table->getSizeRow() != sizeRow || (!table->isEmpty() &&
+                    (pred.getType() == IDB || table->getMaxIteration() > 0))) {
+            LOG(ERRORL) << "A checkpoint can only be restored in empty tables";
+            throw 10;
+        }
+        const uint64_t nblocks = Checkpoint::readInt(in);
+        for (uint64_t b = 0; b < nblocks; ++b) {
+            const size_t it = Checkpoint::readInt(in);
+            const unsigned posQueryInRule = Checkpoint::readInt(in);
+            const unsigned ruleExecOrder = Checkpoint::readInt(in);
+            const bool isCompleted = Checkpoint::readInt(in) != 0;
+            VTuple tuple(sizeRow);
+            for (uint8_t j = 0; j < sizeRow; ++j) {
+                const bool isVariable = Checkpoint::readInt(in) != 0;
+                const uint64_t v = Checkpoint::readInt(in);
+                tuple.set(isVariable ? VTerm((Var_t) v, 0) : VTerm(0, v), j);
+            }
+            const bool sorted = Checkpoint::readInt(in) != 0;
+            const size_t n = Checkpoint::readInt(in);
+            std::shared_ptr<const FCInternalTable> t;
+            if (sizeRow == 0) {
+                t = std::shared_ptr<const FCInternalTable>(new SingletonTable(it));
+            } else {
+                std::vector<std::shared_ptr<Column>> columns;
+                for (uint8_t j = 0; j < sizeRow; ++j) {
+                    columns.push_back(Checkpoint::readColumn(in));
+                    if (columns.back()->size() != n) {
+                        LOG(ERRORL) << "The checkpoint is truncated or corrupted";
+                        throw 10;
+                    }
+                }
+                std::shared_ptr<const Segment> seg(new Segment(sizeRow, columns));
+                t = std::shared_ptr<const FCInternalTable>(
+                        new InmemoryFCInternalTable(sizeRow, it, sorted, seg));
+            }
+            table->add(t, Literal(pred, tuple), posQueryInRule, NULL,
+                    ruleExecOrder, it, isCompleted, nthreads);
+            nrows += n;
+        }
+    }
+
+    if (Checkpoint::readInt(in) != 0) {
+        if (!chaseMgmt) {
+            LOG(ERRORL) << "The checkpoint " << path << " was taken for another program";
+            throw 10;
+        }
+        chaseMgmt->load(in);
+    }
+    LOG(INFOL) << "Resuming from the checkpoint " << path << ": " << nrows <<
+        " rows, iteration " << iteration << ", stratum " <<
+        evaluationPoint.stratum;
+}
+
+std::string SemiNaiver::getPrefixSignature(const RuleExecutionPlan &plan,
+        const int idx) {
+    //Variables are numbered in order of appearance, so that the same prefix
+    //gets the same signature in all rules
+    std::map<Var_t, size_t> vars;
+    std::string out;
+    for (int j = 0; j <= idx; ++j) {
+        const Literal *lit = plan.plan[j];
+        if (lit->isNegated()) {
+            out += "~";
+        }
+        out += std::to_string(lit->getPredicate().getId()) + "(";
+        for (uint8_t i = 0; i < lit->getTupleSize(); ++i) {
+            const VTerm t = lit->getTermAtPos(i);
+            if (i > 0) {
+                out += ",";
+            }
+            if (t.isVariable()) {
+                auto el = vars.find(t.getId());
+                if (el == vars.end()) {
+                    el = vars.insert(std::make_pair(t.getId(),
+                                vars.size())).first;
+                }
+                out += "v" + std::to_string(el->second);
+            } else {
+                out += std::to_string(t.getValue());
+            }
+        }
+        out += ");";
+    }
+    return out;
+}
+
+void SemiNaiver::detectSharedPrefixes() {
+    sharedPrefixSignatures.clear();
+    std::unordered_map<std::string, std::set<size_t>> rulesPerPrefix;
+    std::vector<const RuleExecutionDetails*> rules;
+    for (const auto &r : allEDBRules) {
+        rules.push_back(&r);
+    }
+    for (const auto &strata : allIDBRules) {
+        for (const auto &r : strata) {
+            rules.push_back(&r);
+        }
+    }
+    for (const auto r : rules) {
+        if (r->rule.isEGD()) {
+            //EGDs rewrite the existing derivations
+            return;
+        }
+        for (const auto &plan : r->orderExecutions) {
+            //The result of the last atom goes to the head, so it is never
+            //shared
+            for (int idx = 1; idx + 1 < (int) plan.plan.size(); ++idx) {
+                rulesPerPrefix[getPrefixSignature(plan, idx)].insert(r->ruleid);
+            }
+        }
+    }
+    for (const auto &el : rulesPerPrefix) {
+        if (el.second.size() > 1) {
+            sharedPrefixSignatures.insert(el.first);
+        }
+    }
+    LOG(DEBUGL) << "Body prefixes shared by more than one rule: " <<
+        sharedPrefixSignatures.size();
+}
+
+bool SemiNaiver::getSharedPrefixKey(const RuleExecutionDetails &ruleDetails,
+        const RuleExecutionPlan &plan, const int idx, const size_t iteration,
+        std::string &signature, std::string &key) {
+    signature = getPrefixSignature(plan, idx);
+    if (!sharedPrefixSignatures.count(signature)) {
+        return false;
+    }
+
+    //The intermediate result depends on the iterations read for every atom
+    //and on the columns kept after every join
+    std::ostringstream out;
+    for (int j = 0; j <= idx; ++j) {
+        const Literal *lit = plan.plan[j];
+        const FCTable *table = predicatesTables[lit->getPredicate().getId()];
+        if (lit->getPredicate().getType() != EDB || (table != NULL &&
+                    table->getMaxIteration() > 0)) {
+            size_t min = plan.ranges[j].first;
+            size_t max = plan.ranges[j].second;
+            if (min == 1)
+                min = ruleDetails.lastExecution;
+            if (max == 1)
+                max = ruleDetails.lastExecution - 1;
+            if (table == NULL || table->isEmpty()) {
+                out << "|e";
+            } else {
+                //Only the iterations that exist so far are read
+                max = std::min(max, table->getMaxIteration());
+                if (min > max) {
+                    out << "|e";
+                } else if (max >= iteration) {
+                    //Blocks of the current iteration may still grow
+                    return false;
+                } else {
+                    out << "|" << min << "-" << max << "-" <<
+                        table->getNCollapses();
+                }
+            }
+        }
+        out << "|" << (int) plan.sizeOutputRelation[j];
+        for (const auto &p : plan.joinCoordinates[j]) {
+            out << ",j" << (int) p.first << ":" << (int) p.second;
+        }
+        for (const auto &p : plan.posFromFirst[j]) {
+            out << ",f" << (int) p.first << ":" << (int) p.second;
+        }
+        for (const auto &p : plan.posFromSecond[j]) {
+            out << ",s" << (int) p.first << ":" << (int) p.second;
+        }
+    }
+    key = out.str();
+    return true;
+}
+
+bool SemiNaiver::getSharedPrefix(const std::string &signature,
+        const std::string &key, SharedPrefix &prefix) {
+    std::lock_guard<std::mutex> lock(sharedPrefixesMutex);
+    auto el = sharedPrefixes.find(signature);
+    if (el == sharedPrefixes.end() || el->second.key != key) {
+        return false;
+    }
+    prefix = el->second;
+    return true;
+}
+
+void SemiNaiver::addSharedPrefix(const std::string &signature,
+        const std::string &key,
+        std::shared_ptr<const FCInternalTable> table,
+        const bool nonEmptyZeroRowsize) {
+    SharedPrefix prefix;
+    prefix.key = key;
+    prefix.table = table;
+    prefix.nonEmptyZeroRowsize = nonEmptyZeroRowsize;
+    prefix.nrows = table == NULL ? 0 : table->getNRows();
+    prefix.bytes = table == NULL ? 0 :
+        prefix.nrows * table->getRowSize() * sizeof(Term_t);
+    std::lock_guard<std::mutex> lock(sharedPrefixesMutex);
+    //The result of the same prefix on other iterations is superseded
+    auto el = sharedPrefixes.find(signature);
+    if (el != sharedPrefixes.end()) {
+        sharedPrefixesRows -= el->second.nrows;
+        sharedPrefixesBytes -= el->second.bytes;
+        sharedPrefixes.erase(el);
+    }
+    if (sharedPrefixesRows + prefix.nrows > SHARED_PREFIX_MAX_ROWS) {
+        sharedPrefixes.clear();
+        sharedPrefixesRows = 0;
+        sharedPrefixesBytes = 0;
+        if (prefix.nrows > SHARED_PREFIX_MAX_ROWS) {
+            return;
+        }
+    }
+    sharedPrefixesRows += prefix.nrows;
+    sharedPrefixesBytes += prefix.bytes;
+    sharedPrefixes.insert(std::make_pair(signature, prefix));
+}
+
+void SemiNaiver::clearSharedPrefixes() {
+    std::lock_guard<std::mutex> lock(sharedPrefixesMutex);
+    sharedPrefixes.clear();
+    sharedPrefixesRows = 0;
+    sharedPrefixesBytes = 0;
+}
+
+size_t SemiNaiver::getSharedPrefixesBytes() {
+    std::lock_guard<std::mutex> lock(sharedPrefixesMutex);
+    return sharedPrefixesBytes;
+}
+
+size_t SemiNaiver::getRowsOfIteration(const std::vector<Literal> &heads,
+        const size_t iteration) {
+    size_t nrows = 0;
+    for (const auto &h : heads) {
+        FCTable *t = getTable(h.getPredicate().getId(),
+                h.getPredicate().getCardinality());
+        if (!t->isEmpty(iteration)) {
+            FCBlock block = t->getLastBlock();
+            if (block.iteration == iteration) {
+                nrows += block.table->getNRows();
+            }
+        }
+    }
+    return nrows;
+}
+
 bool SemiNaiver::executeUntilSaturation(
         std::vector<RuleExecutionDetails> &ruleset,
         std::vector<StatIteration> &costRules,
@@ -456,6 +1545,12 @@ bool SemiNaiver::executeUntilSaturation(
     size_t currentRule = 0;
     size_t roundNr = 0;
     uint32_t rulesWithoutDerivation = 0;
+    if (resuming) {
+        //Continue from the rule that was next when the checkpoint was taken
+        currentRule = evaluationPoint.rule % ruleset.size();
+        rulesWithoutDerivation = evaluationPoint.rulesWithoutDerivation;
+        resuming = false;
+    }
 
     size_t nRulesOnePass = 0;
     size_t lastIteration = 0;
@@ -463,9 +1558,18 @@ bool SemiNaiver::executeUntilSaturation(
 
     std::chrono::system_clock::time_point round_start = std::chrono::system_clock::now();
     do {
+        if (checkpointInterval > 0 && !parallelComponents) {
+            evaluationPoint.rule = currentRule;
+            evaluationPoint.rulesWithoutDerivation = rulesWithoutDerivation;
+            checkpointIfDue();
+        }
+        //Evaluations that answer a query (e.g., magic sets) stop when its
+        //deadline passes
+        QueryDeadline::check();
         std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+        const size_t ruleIteration = claimIteration();
         bool response = executeRule(ruleset[currentRule],
-                iteration,
+                ruleIteration,
                 limitView,
                 NULL);
         newDer |= response;
@@ -479,7 +1583,7 @@ bool SemiNaiver::executeUntilSaturation(
         std::chrono::duration<double> sec = std::chrono::system_clock::now() - start;
 
         StatIteration stat;
-        stat.iteration = iteration;
+        stat.iteration = ruleIteration;
         stat.rule = &ruleset[currentRule].rule;
         stat.time = sec.count() * 1000;
         stat.derived = response;
@@ -490,9 +1594,12 @@ bool SemiNaiver::executeUntilSaturation(
             ruleset[currentRule].lastExecution = limitView;
             LOG(DEBUGL) << "Setting lastExecution of this rule to " << limitView;
         } else {
-            ruleset[currentRule].lastExecution = iteration;
+            ruleset[currentRule].lastExecution = ruleIteration;
+        }
+
+        if (spillMgr) {
+            enforceMemoryBudget(ruleset);
         }
-        iteration++;
 
         if (checkCyclicTerms) {
             foundCyclicTerms = chaseMgmt->checkCyclicTerms(currentRule);
@@ -560,7 +1667,11 @@ bool SemiNaiver::executeUntilSaturation(
 
         currentRule = (currentRule + 1) % ruleset.size();
 
-        if (currentRule == 0) {
+        if (currentRule == 0 && parallelComponents) {
+            //The statistics below read the tables of the other components
+            if (!fixpoint)
+                break;
+        } else if (currentRule == 0) {
             LOG(DEBUGL) << "Round " << roundNr;
             roundNr++;
             std::chrono::duration<double> sec = std::chrono::system_clock::now() - round_start;
@@ -598,74 +1709,159 @@ bool SemiNaiver::executeUntilSaturation(
                     return newDer;
 }
 
-void SemiNaiver::storeOnFile(std::string path, const PredId_t pred, const bool decompress, const int minLevel, const bool csv) {
-    FCTable *table = predicatesTables[pred];
-    char buffer[MAX_TERM_SIZE];
+//Formats a range of rows of a table in a buffer. Every chunk of
+//EXPORT_CHUNK_ROWS rows is formatted independently, so that multiple workers
+//can process the same table while the output keeps the original order.
+struct FormatRows {
+    const std::vector<const std::vector<Term_t> *> &vectors;
+    const size_t iteration;
+    const size_t nrows;
+    const size_t firstChunk;
+    std::vector<std::string> &buffers;
+    const EDBLayer &layer;
+    std::mutex *dictMutex;
+    const bool decompress;
+    const bool csv;
+    const bool binary;
+
+    FormatRows(const std::vector<const std::vector<Term_t> *> &vectors,
+            const size_t iteration, const size_t nrows,
+            const size_t firstChunk, std::vector<std::string> &buffers,
+            const EDBLayer &layer, std::mutex *dictMutex,
+            const bool decompress, const bool csv, const bool binary) :
+        vectors(vectors), iteration(iteration), nrows(nrows),
+        firstChunk(firstChunk), buffers(buffers), layer(layer),
+        dictMutex(dictMutex), decompress(decompress), csv(csv),
+        binary(binary) {
+        }
 
-    std::ofstream streamout(path);
-    if (streamout.fail()) {
-        throw("Could not open " + path + " for writing");
+    static void appendTerm(std::string &row, TermTextCache &cache,
+            const Term_t term, const bool csv) {
+        const uint64_t v = TermOverflow::decode(term);
+        const std::string *text = cache.lookup(v);
+        std::string t;
+        if (text == NULL) {
+            t = std::to_string(v >> 40) + "_"
+                + std::to_string((v >> 32) & 0377) + "_"
+                + std::to_string(v & 0xffffffff);
+            text = &t;
+        }
+        if (csv) {
+            row += VLogUtils::csvString(*text);
+        } else {
+            row += *text;
+        }
     }
 
-    if (table != NULL && !table->isEmpty()) {
-        FCIterator itr = table->read(0);
-        if (! itr.isEmpty()) {
-            const int sizeRow = table->getSizeRow();
-            while (!itr.isEmpty()) {
-                std::shared_ptr<const FCInternalTable> t = itr.getCurrentTable();
-                FCInternalTableItr *iitr = t->getIterator();
-                while (iitr->hasNext()) {
-                    iitr->next();
-                    std::string row = "";
-                    if (! csv) {
-                        row = to_string(iitr->getCurrentIteration());
+    void format(const size_t i) const {
+        std::unique_ptr<TermTextCache> cache;
+        if (decompress || csv) {
+            cache = std::unique_ptr<TermTextCache>(
+                    new TermTextCache(layer, dictMutex));
+        }
+        const size_t chunk = firstChunk + i;
+        const size_t begin = chunk * EXPORT_CHUNK_ROWS;
+        const size_t end = std::min(nrows, begin + EXPORT_CHUNK_ROWS);
+        const size_t sizeRow = vectors.size();
+        std::string &row = buffers[i];
+        const std::string iterationText = to_string(iteration);
+        if (binary) {
+            row.reserve((end - begin) * sizeRow * sizeof(uint64_t));
+        }
+        for (size_t r = begin; r < end; ++r) {
+            if (binary) {
+                //64-bit values, whatever the width of Term_t
+                for (size_t m = 0; m < sizeRow; ++m) {
+                    const uint64_t v = TermOverflow::decode((*vectors[m])[r]);
+                    row.append((const char *) &v, sizeof(uint64_t));
+                }
+                continue;
+            }
+            if (! csv) {
+                row += iterationText;
+            }
+            for (size_t m = 0; m < sizeRow; ++m) {
+                const Term_t v = (*vectors[m])[r];
+                if (csv) {
+                    if (m > 0) {
+                        row += ",";
                     }
-                    bool first = true;
-                    for (int m = 0; m < sizeRow; ++m) {
-                        if (decompress || csv) {
-                            if (layer.getDictText(iitr->getCurrentValue(m), buffer)) {
-                                if (csv) {
-                                    if (first) {
-                                        first = false;
-                                    } else {
-                                        row += ",";
-                                    }
-                                    row += VLogUtils::csvString(std::string(buffer));
-                                } else {
-                                    row += "\t";
-                                    row += std::string(buffer);
-                                }
-                            } else {
-                                uint64_t v = iitr->getCurrentValue(m);
-                                std::string t = "" + std::to_string(v >> 40) + "_"
-                                    + std::to_string((v >> 32) & 0377) + "_"
-                                    + std::to_string(v & 0xffffffff);
-                                if (csv) {
-                                    if (first) {
-                                        first = false;
-                                    } else {
-                                        row += ",";
-                                    }
-                                    row += VLogUtils::csvString(t);
-                                } else {
-                                    row += "\t";
-                                    row += t;
-                                }
-                            }
-                        } else {
-                            row += "\t" + to_string(iitr->getCurrentValue(m));
-                        }
+                    appendTerm(row, *cache, v, true);
+                } else {
+                    row += "\t";
+                    if (decompress) {
+                        appendTerm(row, *cache, v, false);
+                    } else {
+                        row += to_string(TermOverflow::decode(v));
                     }
-                    streamout << row << std::endl;
                 }
-                t->releaseIterator(iitr);
-                itr.moveNextCount();
             }
+            row += "\n";
         }
     }
+
+    void operator()(const ParallelRange& r) const {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+            format(i);
+        }
+    }
+};
+
+void SemiNaiver::storeOnFile(std::string path, const PredId_t pred, const bool decompress, const int minLevel, const bool csv, const bool binary, int workers) {
+    std::ofstream streamout(path, binary ? std::ios::out | std::ios::binary : std::ios::out);
+    if (streamout.fail()) {
+        throw("Could not open " + path + " for writing");
+    }
+    if (workers <= 0) {
+        workers = std::max(1, nthreads);
+    }
+    storeTable(streamout, pred, decompress, csv, binary, workers);
     streamout.close();
 }
 
+void SemiNaiver::storeTable(std::ostream &streamout, const PredId_t pred,
+        const bool decompress, const bool csv, const bool binary,
+        const int workers) {
+    FCTable *table = predicatesTables[pred];
+    if (table == NULL || table->isEmpty()) {
+        return;
+    }
+
+    //The dictionary is shared by all workers, also the ones that export
+    //other tables at the same time. Each has its own cache.
+    FCIterator itr = table->read(0);
+    while (!itr.isEmpty()) {
+        std::shared_ptr<const FCInternalTable> t = itr.getCurrentTable();
+        const size_t iteration = itr.getCurrentIteration();
+        const size_t nrows = t->getNRows();
+        FCInternalTableItr *iitr = t->getIterator();
+        std::vector<const std::vector<Term_t> *> vectors =
+            iitr->getAllVectors(workers);
+
+        //Format at most "workers" chunks at the same time, then write them
+        //in order. This bounds the memory used by the buffers.
+        const size_t nchunks = (nrows + EXPORT_CHUNK_ROWS - 1) / EXPORT_CHUNK_ROWS;
+        for (size_t chunk = 0; chunk < nchunks; chunk += workers) {
+            const size_t n = std::min(nchunks - chunk, (size_t) workers);
+            std::vector<std::string> buffers(n);
+            FormatRows formatter(vectors, iteration, nrows, chunk, buffers,
+                    layer, &dictMutex, decompress, csv, binary);
+            if (n > 1) {
+                ParallelTasks::parallel_for(0, n, 1, formatter);
+            } else {
+                formatter.format(0);
+            }
+            for (const auto &buffer : buffers) {
+                streamout.write(buffer.c_str(), buffer.size());
+            }
+        }
+
+        iitr->deleteAllVectors(vectors);
+        t->releaseIterator(iitr);
+        itr.moveNextCount();
+    }
+}
+
 static std::string generateFileName(std::string name) {
     std::stringstream stream;
 
@@ -684,21 +1880,54 @@ static std::string generateFileName(std::string name) {
     return stream.str();
 }
 
-void SemiNaiver::storeOnFiles(std::string path, const bool decompress,
-        const int minLevel, const bool csv) {
-    char buffer[MAX_TERM_SIZE];
+//Writes the files of a set of small predicates. One worker per file.
+struct StoreSmallTables {
+    SemiNaiver *sn;
+    const std::vector<std::pair<std::string, PredId_t>> &files;
+    const bool decompress;
+    const bool csv;
+    const bool binary;
+
+    StoreSmallTables(SemiNaiver *sn,
+            const std::vector<std::pair<std::string, PredId_t>> &files,
+            const bool decompress, const bool csv, const bool binary) :
+        sn(sn), files(files), decompress(decompress), csv(csv),
+        binary(binary) {
+        }
 
+    void operator()(const ParallelRange& r) const {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+            sn->storeOnFile(files[i].first, files[i].second, decompress, 0,
+                    csv, binary, 1);
+        }
+    }
+};
+
+void SemiNaiver::storeOnFiles(std::string path, const bool decompress,
+        const int minLevel, const bool csv, const bool binary) {
     Utils::create_directories(path);
 
-    //I create a new file for every idb predicate
+    //I create a new file for every idb predicate. Large tables are written
+    //one after the other, each using all workers. Small ones are written
+    //concurrently, one worker per file.
+    std::vector<std::pair<std::string, PredId_t>> smallTables;
     for (PredId_t i = 0; i < program->getNPredicates(); ++i) {
         if (program->isPredicateIDB(i)) {
             FCTable *table = predicatesTables[i];
             if (table != NULL && !table->isEmpty()) {
-                storeOnFile(path + "/" + generateFileName(program->getPredicateName(i)), i, decompress, minLevel, csv);
+                std::string fileName = path + "/" + generateFileName(program->getPredicateName(i));
+                if (nthreads > 1 && table->getNAllRows() < EXPORT_CHUNK_ROWS) {
+                    smallTables.push_back(std::make_pair(fileName, i));
+                } else {
+                    storeOnFile(fileName, i, decompress, minLevel, csv, binary);
+                }
             }
         }
     }
+    if (!smallTables.empty()) {
+        ParallelTasks::parallel_for(0, smallTables.size(), 1,
+                StoreSmallTables(this, smallTables, decompress, csv, binary));
+    }
 }
 
 bool _sortCards(const std::pair<int, size_t> &v1, const std::pair<int, size_t> &v2) {
@@ -708,6 +1937,7 @@ bool _sortCards(const std::pair<int, size_t> &v1, const std::pair<int, size_t> &
 void SemiNaiver::addDataToIDBRelation(const Predicate pred,
         FCBlock block) {
     LOG(DEBUGL) << "Adding block to " << (int) pred.getId();
+    dropQueryIndex(pred.getId());
     FCTable *table = getTable(pred.getId(), pred.getCardinality());
     table->addBlock(block);
 }
@@ -843,7 +2073,8 @@ void SemiNaiver::processRuleFirstAtom(const int nBodyLiterals,
         const RuleExecutionDetails &ruleDetails,
         const int orderExecution,
         std::vector<std::pair<uint8_t, uint8_t>> *filterValueVars,
-        ResultJoinProcessor *joinOutput) {
+        ResultJoinProcessor *joinOutput,
+        uint64_t &ruleTriggers) {
     //If the rule has only one body literal, has the same bindings list of the head,
     //and the current head relation is empty, then I can simply copy the table
     FCIterator literalItr = getTable(*bodyLiteral, min, max);
@@ -876,7 +2107,7 @@ void SemiNaiver::processRuleFirstAtom(const int nBodyLiterals,
                         firstHeadLiteral, *bodyLiteral,
                         literalItr.getCurrentBlock())) {
 
-                triggers += table->getNRows();
+                ruleTriggers += table->getNRows();
                 firstEndTable->add(table->cloneWithIteration(iteration),
                         firstHeadLiteral, 0, &ruleDetails,
                         orderExecution, iteration, true, nthreads);
@@ -1224,6 +2455,16 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
     t_iter.start();
     Rule rule = ruleDetails.rule;
 
+    TraceSpan span("rule", "rule");
+    MetricTimer timer(RuntimeMetrics::ruleTime);
+    //Counted apart, since other rules may run at the same time
+    uint64_t ruleTriggers = 0;
+    if (span.isActive()) {
+        span.setName("rule " + std::to_string(ruleDetails.ruleid));
+        span.set("rule", rule.tostring(program, &layer));
+        span.set("iteration", (uint64_t) iteration);
+    }
+
 #ifdef WEBINTERFACE
     // Cannot run multithreaded in this case.
     currentRule = rule.tostring(program, &layer);
@@ -1299,22 +2540,15 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
         int optimalOrderIdx = 0;
 
         bool first = true;
+        //Can the intermediate results be shared with other rules? Only if
+        //all atoms so far were joined in sequence
+        bool sharablePrefix = !sharedPrefixSignatures.empty();
         while (optimalOrderIdx < nBodyLiterals) {
             const Literal *bodyLiteral = plan.plan[optimalOrderIdx];
 
             //This data structure is used to filter out rows where different columns
-            //lead to the same derivation
+            //lead to the same derivation. The plans do not compute it anymore
             std::vector<std::pair<uint8_t, uint8_t>> *filterValueVars = NULL;
-            if (heads.size() == 1) {
-                if (plan.matches.size() > 0) {
-                    for (int i = 0; i < plan.matches.size(); ++i) {
-                        if (plan.matches[i].posLiteralInOrder
-                                == optimalOrderIdx) {
-                            filterValueVars = &plan.matches[i].matches;
-                        }
-                    }
-                }
-            }
 
             //BEGIN -- Determine where to put the results of the query
             ResultJoinProcessor *joinOutput = NULL;
@@ -1414,6 +2648,7 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
             */
             if (min > max) {
                 optimalOrderIdx++;
+                sharablePrefix = false;
                 continue;
             }
 
@@ -1421,15 +2656,23 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
             if (bodyLiteral->isNegated()) {
                 min = 0;
                 max = ~0ul;
+                sharablePrefix = false;
             }
             LOG(DEBUGL) << "Evaluating atom " << optimalOrderIdx << " " << bodyLiteral->tostring() <<
                 " min=" << min << " max=" << max;
 
+            std::string prefixSignature, prefixKey;
+            SharedPrefix reusedPrefix;
+            std::unique_ptr<TraceSpan> joinSpan;
+            bool reused = false;
             if (first || currentResults == NULL) {
                 // Added the case "currentResults == NULL", which may occur when part of a body is processed,
                 // but this part does not contribute anything to the rest of the processing of the rule.
                 // In that case, we process the rest of the body  as if we begin a new body.
                 // --Ceriel
+                if (!first) {
+                    sharablePrefix = false;
+                }
                 if (lastLiteral
                         || plan.sizeOutputRelation[optimalOrderIdx] != 0
                         || plan.posFromFirst[optimalOrderIdx].size() > 0
@@ -1441,23 +2684,33 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
                             iteration, ruleDetails,
                             orderExecution,
                             filterValueVars,
-                            joinOutput);
+                            joinOutput,
+                            ruleTriggers);
                     durationFirstAtom += std::chrono::system_clock::now() - startFirstA;
                     first = false;
                 } else {
                     // We have an atom without variables (or none that we need further on), and we already
                     // checked that the atoms are not empty.
                     // No we did not! The estimate said it was not empty, but that is just an estimate.
+                    sharablePrefix = false;
                     if (checkEmpty(bodyLiteral)) {
                         delete joinOutput;
                         break;
                     }
                 }
+            } else if (sharablePrefix && !lastLiteral &&
+                    getSharedPrefixKey(ruleDetails, plan, optimalOrderIdx,
+                        iteration, prefixSignature, prefixKey) &&
+                    getSharedPrefix(prefixSignature, prefixKey, reusedPrefix)) {
+                //Another rule has already computed this join
+                LOG(DEBUGL) << "Reusing the shared intermediate result of atom " << optimalOrderIdx;
+                reused = true;
             } else {
                 //Perform the join
                 std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
                 HiResTimer t_join("join");
                 t_join.start();
+                joinSpan.reset(new TraceSpan("join", "join"));
                 JoinExecutor::join(this, currentResults.get(),
                         lastLiteral ? &heads: NULL,
                         *bodyLiteral, min, max, filterValueVars,
@@ -1467,7 +2720,8 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
                         plan,
                         processedTables,
                         optimalOrderIdx,
-                        multithreaded ? nthreads : -1);
+                        multithreaded ? nthreads : -1,
+                        *joinSpan);
                 std::chrono::duration<double> d =
                     std::chrono::system_clock::now() - start;
                 t_join.stop();
@@ -1479,20 +2733,63 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
             //Clean up possible duplicates
             std::chrono::system_clock::time_point startC =
                 std::chrono::system_clock::now();
-            if (! first) {
+            if (! first && ! reused) {
+                TraceSpan cspan("consolidate", "consolidate");
+                //Rows produced by the join, compared to those that are kept
+                //after the removal of the duplicates
+                const bool traced = joinSpan && joinSpan->isActive();
+                size_t rowsBefore = 0;
+                if (traced) {
+                    rowsBefore = lastLiteral ?
+                        getRowsOfIteration(heads, iteration) :
+                        ((InterTableJoinProcessor*)joinOutput)->getNBufferedRows();
+                }
                 newDerivations |= joinOutput->consolidate(true);
                 std::chrono::duration<double> d =
                     std::chrono::system_clock::now() - startC;
                 durationConsolidation += d;
                 auto t = joinOutput->getTriggers();
-                triggers += t;
+                ruleTriggers += t;
+                size_t rowsOut = 0;
+                if (!lastLiteral) {
+                    auto table = ((InterTableJoinProcessor*)joinOutput)->getTable();
+                    rowsOut = table == NULL ? 0 : table->getNRows();
+                }
+                if (cspan.isActive()) {
+                    cspan.set("atom", (uint64_t) optimalOrderIdx);
+                    if (lastLiteral) {
+                        cspan.set("triggers", (uint64_t) t);
+                    } else {
+                        cspan.set("rowsOut", (uint64_t) rowsOut);
+                    }
+                }
+                if (traced) {
+                    if (lastLiteral) {
+                        const size_t rowsAfter = getRowsOfIteration(heads,
+                                iteration);
+                        joinSpan->setOutput(t, rowsAfter - std::min(rowsAfter,
+                                    rowsBefore));
+                    } else {
+                        joinSpan->setOutput(rowsBefore, rowsOut);
+                    }
+                }
             }
+            joinSpan.reset();
 
             bool notEmptyZeroRowsize = false;
             //Prepare for the processing of the next atom (if any)
             if (!lastLiteral && !first) {
-                currentResults = ((InterTableJoinProcessor*)joinOutput)->getTable();
-                notEmptyZeroRowsize = ((InterTableJoinProcessor*)joinOutput)->getNonEmptyZeroRowsize();
+                if (reused) {
+                    currentResults = reusedPrefix.table;
+                    notEmptyZeroRowsize = reusedPrefix.nonEmptyZeroRowsize;
+                } else {
+                    currentResults = ((InterTableJoinProcessor*)joinOutput)->getTable();
+                    notEmptyZeroRowsize = ((InterTableJoinProcessor*)joinOutput)->getNonEmptyZeroRowsize();
+                    if (!prefixKey.empty()) {
+                        addSharedPrefix(prefixSignature, prefixKey,
+                                currentResults, notEmptyZeroRowsize);
+                    }
+                }
             }
             if (lastLiteral && finalResultContainer) {
                 finalResultContainer->push_back(joinOutput);
@@ -1517,6 +2814,7 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
         }
     }
 
+    size_t nLastDerivations = 0;
     for (auto &h : heads) {
         auto idHeadPredicate = h.getPredicate().getId();
         FCTable *t = getTable(idHeadPredicate, h.
@@ -1525,14 +2823,41 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
             FCBlock block = t->getLastBlock();
             if (block.iteration == iteration) {
                 block.isCompleted = true;
-                listDerivations.push_back(block);
+                nLastDerivations = block.table->getNRows();
+                {
+                    std::lock_guard<std::mutex> lock(listDerivationsMutex);
+                    listDerivations.push_back(block);
+                }
+                RuntimeMetrics::addDerivations(idHeadPredicate,
+                        block.table->getNRows());
             }
             newDerivations |= true;
         }
     }
+    if (snapshots && newDerivations) {
+        std::vector<PredId_t> headPredicates;
+        for (const auto &h : heads) {
+            headPredicates.push_back(h.getPredicate().getId());
+        }
+        publishSnapshot(&headPredicates, iteration);
+    }
 
     t_iter.stop();
 
+    RuntimeMetrics::rulesExecuted.inc();
+    triggers += ruleTriggers;
+    RuntimeMetrics::triggers.add(ruleTriggers);
+    if (newDerivations) {
+        RuntimeMetrics::rulesWithDerivations.inc();
+    }
+    if (span.isActive()) {
+        //Triggers are the rows produced by the joins, before the removal of
+        //the duplicates
+        span.setRows(ruleTriggers, newDerivations ? nLastDerivations : 0);
+        span.set("combinations", (uint64_t) orderExecution);
+        span.set("processedTables", (uint64_t) processedTables);
+    }
+
     std::chrono::duration<double> totalDuration =
         std::chrono::system_clock::now() - startRule;
     double td = totalDuration.count() * 1000;
@@ -1544,7 +2869,7 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
     if (!newDerivations) {
         stats.derivation = 0;
     } else {
-        stats.derivation = getNLastDerivationsFromList();
+        stats.derivation = nLastDerivations;
     }
     //Jacopo: td is not existing anymore...
     stats.timems = (long)td;
@@ -1563,7 +2888,7 @@ bool SemiNaiver::executeRule(RuleExecutionDetails &ruleDetails,
     }
 
     if (newDerivations) {
-        LOG(DEBUGL) << "Rule application: " << iteration << ", derived " << getNLastDerivationsFromList() << " new tuple(s) using rule " << rule.tostring(program, &layer);
+        LOG(DEBUGL) << "Rule application: " << iteration << ", derived " << nLastDerivations << " new tuple(s) using rule " << rule.tostring(program, &layer);
         LOG(DEBUGL) << "Combinations " << orderExecution << ", Processed IDB Tables=" <<
             processedTables << ", Total runtime " << stream.str()
             << ", join " << durationJoin.count() * 1000 << "ms, consolidation " <<
@@ -1703,13 +3028,8 @@ FCIterator SemiNaiver::getTableFromEDBLayer(const Literal & literal) {
     FCTable *table = predicatesTables[id];
     if (table == NULL) {
         table = SemiNaiver::getTable(id, (uint8_t) literal.getTupleSize());
-
-        VTuple t = literal.getTuple();
-        //Add all different variables
-        for (int i = 0; i < t.getSize(); ++i) {
-            t.set(VTerm(i + 1, 0), i);
-        }
-        Literal mostGenericLiteral(literal.getPredicate(), t);
+        Literal mostGenericLiteral = getMostGenericLiteral(
+                literal.getPredicate(), (uint8_t) literal.getTupleSize());
 
         std::shared_ptr<FCInternalTable> ptrTable(new EDBFCInternalTable(0,
                     mostGenericLiteral, &layer));
@@ -1727,6 +3047,11 @@ FCIterator SemiNaiver::getTable(const Literal & literal,
     //BEGIN -- Get the table that correspond to the current literal
     //std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
     if (literal.getPredicate().getType() == EDB) {
+        //The facts of addFacts are in blocks after the one of the EDB layer
+        FCTable *table = predicatesTables[literal.getPredicate().getId()];
+        if (table != NULL && (min > 0 || max < table->getMaxIteration())) {
+            return getTableFromIDBLayer(literal, min, max, filter);
+        }
         return getTableFromEDBLayer(literal);
     } else {
         /*if (currentIDBpred == 0) {
@@ -1762,6 +3087,187 @@ size_t SemiNaiver::getSizeTable(const PredId_t predid) const {
         return 0;
 }
 
+void SemiNaiver::dropQueryIndexes() {
+    std::atomic_store(&queryIndexes, std::shared_ptr<const QueryIndexes>());
+}
+
+void SemiNaiver::dropQueryIndex(const PredId_t pred) {
+    std::shared_ptr<const QueryIndexes> last = std::atomic_load(&queryIndexes);
+    if (last && last->count(pred)) {
+        std::shared_ptr<QueryIndexes> next(new QueryIndexes(*last));
+        next->erase(pred);
+        std::atomic_store(&queryIndexes,
+                std::shared_ptr<const QueryIndexes>(next));
+    }
+}
+
+void SemiNaiver::buildQueryIndexes() {
+    std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+    std::shared_ptr<QueryIndexes> indexes(new QueryIndexes());
+    size_t nrows = 0;
+    size_t size = 0;
+    for (PredId_t i = 0; i < program->getNPredicates(); ++i) {
+        FCTable *table = predicatesTables[i];
+        if (table == NULL || !program->isPredicateIDB(i) ||
+                table->getSizeRow() == 0 || table->isEmpty()) {
+            continue;
+        }
+        std::shared_ptr<const QueryIndex> index(new QueryIndex(table->read(0),
+                    table->getSizeRow(), nthreads));
+        nrows += index->getNRows();
+        size += index->getRepresentationSize();
+        (*indexes)[i] = index;
+    }
+    std::atomic_store(&queryIndexes,
+            std::shared_ptr<const QueryIndexes>(indexes));
+    std::chrono::duration<double> sec = std::chrono::system_clock::now() - start;
+    LOG(INFOL) << "Built the query indexes of " << indexes->size() <<
+        " predicates (" << nrows << " rows, " << size * sizeof(Term_t) <<
+        " bytes) in " << sec.count() * 1000 << " ms";
+}
+
+std::shared_ptr<const QueryIndex> SemiNaiver::getQueryIndex(
+        const PredId_t pred) const {
+    std::shared_ptr<const QueryIndexes> indexes =
+        std::atomic_load(&queryIndexes);
+    if (!indexes) {
+        return std::shared_ptr<const QueryIndex>();
+    }
+    auto itr = indexes->find(pred);
+    if (itr == indexes->end()) {
+        return std::shared_ptr<const QueryIndex>();
+    }
+    return itr->second;
+}
+
+//Rows of table in a segment that readers on other threads cannot change.
+//The tables merge their segments lazily, even in their const methods, so
+//this is done here by the writer
+static std::shared_ptr<const Segment> finalizeRows(const FCInternalTable *table) {
+    const InmemoryFCInternalTable *inmemory =
+        dynamic_cast<const InmemoryFCInternalTable*>(table);
+    if (inmemory != NULL) {
+        //getIterator merges the unmerged segments into the underlying one
+        inmemory->releaseIterator(inmemory->getIterator());
+        return inmemory->getUnderlyingSegment();
+    }
+    SegmentInserter inserter(table->getRowSize());
+    FCInternalTableItr *itr = table->getIterator();
+    while (itr->hasNext()) {
+        itr->next();
+        inserter.addRow(itr);
+    }
+    table->releaseIterator(itr);
+    return inserter.getSegment();
+}
+
+void SemiNaiver::publishSnapshot(const std::vector<PredId_t> *preds,
+        const size_t maxIteration) {
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    std::vector<PredId_t> allPredicates;
+    if (preds == NULL) {
+        for (PredId_t i = 0; i < predicatesTables.size(); ++i) {
+            allPredicates.push_back(i);
+        }
+        preds = &allPredicates;
+    }
+    //The snapshots of the other predicates are shared with the last epoch
+    std::shared_ptr<MaterializationSnapshots> next;
+    std::shared_ptr<const MaterializationSnapshots> last =
+        std::atomic_load(&snapshotTables);
+    if (last) {
+        next = std::make_shared<MaterializationSnapshots>(*last);
+    } else {
+        next = std::make_shared<MaterializationSnapshots>();
+    }
+    next->resize(predicatesTables.size());
+    const uint64_t epoch = ++snapshotEpoch;
+    for (const PredId_t pred : *preds) {
+        FCTable *table = predicatesTables[pred];
+        std::vector<MaterializationSnapshot::Block> blocks;
+        if (table != NULL && !table->isEmpty()) {
+            //The rows of the tables that did not change are not finalized
+            //again
+            std::unordered_map<const FCInternalTable*,
+                std::shared_ptr<const Segment>> lastRows;
+            if ((*next)[pred]) {
+                for (const auto &block : (*next)[pred]->getBlocks()) {
+                    lastRows[block.source.get()] = block.rows;
+                }
+            }
+            for (const auto &block : *table->getBlocks(maxIteration)) {
+                MaterializationSnapshot::Block b;
+                b.iteration = block.iteration;
+                b.ruleid = block.rule != NULL ? (int) block.rule->ruleid : -1;
+                b.source = block.table;
+                if (block.table->isEDB()) {
+                    //Immutable, so it is referenced and not copied
+                    b.nrows = block.table->getNRows();
+                } else {
+                    auto itr = lastRows.find(block.table.get());
+                    if (itr != lastRows.end()) {
+                        b.rows = itr->second;
+                    } else {
+                        b.rows = finalizeRows(block.table.get());
+                    }
+                    b.nrows = b.rows->getNRows();
+                }
+                blocks.push_back(b);
+            }
+        }
+        (*next)[pred] = std::shared_ptr<const MaterializationSnapshot>(
+                new MaterializationSnapshot(epoch, std::move(blocks)));
+    }
+    //The previous snapshots are freed once their last reader releases them
+    std::atomic_store(&snapshotTables,
+            std::shared_ptr<const MaterializationSnapshots>(next));
+}
+
+void SemiNaiver::enableSnapshots() {
+    if (snapshots) {
+        return;
+    }
+    //The flag is set after the first snapshots are published, so readers
+    //never see a partial state
+    publishSnapshot();
+    snapshots = true;
+}
+
+std::shared_ptr<const MaterializationSnapshots> SemiNaiver::getSnapshots() const {
+    return std::atomic_load(&snapshotTables);
+}
+
+std::shared_ptr<const MaterializationSnapshot> SemiNaiver::getSnapshot(
+        const PredId_t pred) const {
+    std::shared_ptr<const MaterializationSnapshots> all = getSnapshots();
+    std::shared_ptr<const MaterializationSnapshot> s;
+    if (all && pred < all->size()) {
+        s = (*all)[pred];
+    }
+    if (!s) {
+        s = std::shared_ptr<const MaterializationSnapshot>(
+                new MaterializationSnapshot(0,
+                    std::vector<MaterializationSnapshot::Block>()));
+    }
+    return s;
+}
+
+JoinStrategyStats SemiNaiver::getJoinStats(const size_t ruleid,
+        const PredId_t pred) {
+    std::lock_guard<std::mutex> lock(joinStatsMutex);
+    auto itr = joinStats.find(((uint64_t) ruleid << 32) + pred);
+    if (itr == joinStats.end()) {
+        return JoinStrategyStats();
+    }
+    return itr->second;
+}
+
+void SemiNaiver::setJoinStats(const size_t ruleid, const PredId_t pred,
+        const JoinStrategyStats &stats) {
+    std::lock_guard<std::mutex> lock(joinStatsMutex);
+    joinStats[((uint64_t) ruleid << 32) + pred] = stats;
+}
+
 bool SemiNaiver::isEmpty(const PredId_t predid) const {
     if (predicatesTables[predid] == NULL) {
         return true;
@@ -1770,6 +3276,71 @@ bool SemiNaiver::isEmpty(const PredId_t predid) const {
     }
 }
 
+void SemiNaiver::reset() {
+    for (int i = 0; i < predicatesTables.size(); ++i) {
+        if (predicatesTables[i] != NULL) {
+            delete predicatesTables[i];
+            predicatesTables[i] = NULL;
+        }
+    }
+    for (auto &ruleDetails : allEDBRules) {
+        ruleDetails.lastExecution = 0;
+        ruleDetails.failedBecauseEmpty = false;
+        ruleDetails.atomFailure = NULL;
+    }
+    for (auto &strata : allIDBRules) {
+        for (auto &ruleDetails : strata) {
+            ruleDetails.lastExecution = 0;
+            ruleDetails.failedBecauseEmpty = false;
+            ruleDetails.atomFailure = NULL;
+        }
+    }
+    listDerivations.clear();
+    statsRuleExecution.clear();
+    clearSharedPrefixes();
+    dropQueryIndexes();
+    {
+        std::lock_guard<std::mutex> lock(joinStatsMutex);
+        joinStats.clear();
+    }
+    restrictedEDBRules.clear();
+    restrictedExtEDBRules.clear();
+    restrictedIDBRules.clear();
+    restrictedExtIDBRules.clear();
+    newFactsPredicates.clear();
+    materialized = false;
+    iteration = 0;
+    triggers = 0;
+    foundCyclicTerms = false;
+    if (snapshots) {
+        publishSnapshot();
+    }
+}
+
+std::unique_ptr<MiniChase> SemiNaiver::acquireMiniChase(Program *p) {
+    {
+        std::lock_guard<std::mutex> lock(miniChasesMutex);
+        auto &pool = miniChases[p];
+        if (!pool.empty()) {
+            std::unique_ptr<MiniChase> chase = std::move(pool.back());
+            pool.pop_back();
+            return chase;
+        }
+    }
+    if (p == RMFC_program) {
+        return std::unique_ptr<MiniChase>(new MiniChase(layer, *(p->getKB()),
+                    true, p));
+    } else {
+        return std::unique_ptr<MiniChase>(new MiniChase(layer, layer,
+                    false, p));
+    }
+}
+
+void SemiNaiver::releaseMiniChase(std::unique_ptr<MiniChase> chase) {
+    std::lock_guard<std::mutex> lock(miniChasesMutex);
+    miniChases[chase->getProgram()].push_back(std::move(chase));
+}
+
 SemiNaiver::~SemiNaiver() {
     // Don't refer to program. It may already have been deallocated.
     for (int i = 0; i < predicatesTables.size(); ++i) {
@@ -1799,19 +3370,23 @@ size_t SemiNaiver::countAllIDBs() {
 #ifdef WEBINTERFACE
 std::vector<std::pair<string, std::vector<StatsSizeIDB>>> SemiNaiver::getSizeIDBs() {
     std::vector<std::pair<string, std::vector<StatsSizeIDB>>> out;
+    //The tables may change while they are read, so all the predicates
+    //are taken from the same snapshots
+    std::shared_ptr<const MaterializationSnapshots> all = getSnapshots();
+    if (!all) {
+        return out;
+    }
     for (PredId_t i = 0; i < program->getNPredicates(); ++i) {
-        if (predicatesTables[i] != NULL && i != currentPredicate) {
-            if (program->isPredicateIDB(i)) {
-                FCIterator itr = predicatesTables[i]->read(0);
+        if (program->isPredicateIDB(i) && i < all->size() && (*all)[i]) {
+            const MaterializationSnapshot *snapshot = (*all)[i].get();
+            if (!snapshot->getBlocks().empty()) {
                 std::vector<StatsSizeIDB> stats;
-                while (!itr.isEmpty()) {
-                    std::shared_ptr<const FCInternalTable> t = itr.getCurrentTable();
+                for (const auto &block : snapshot->getBlocks()) {
                     StatsSizeIDB s;
-                    s.iteration = itr.getCurrentIteration();
-                    s.idRule = itr.getRule()->ruleid;
-                    s.derivation = t->getNRows();
+                    s.iteration = block.iteration;
+                    s.idRule = block.ruleid;
+                    s.derivation = block.nrows;
                     stats.push_back(s);
-                    itr.moveNextCount();
                 }
 
                 if (stats.size() > 0) {
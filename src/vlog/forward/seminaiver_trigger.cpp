@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include <queue>
+#include <list>
 
 void TriggerSemiNaiver::run(std::string trigger_paths) {
     //Create all the execution plans, etc.
@@ -20,7 +21,7 @@ void TriggerSemiNaiver::run(std::string trigger_paths) {
 
     //Set up chase data structure
     chaseMgmt = std::shared_ptr<ChaseMgmt>(new ChaseMgmt(allrules,
-                typeChase, checkCyclicTerms, -1));
+                typeChase, checkCyclicTerms, -1, -1, nthreads));
 
     //Do not check for duplicates anymore
     setIgnoreDuplicatesElimination();
@@ -98,6 +99,30 @@ void TriggerSemiNaiver::run(std::string trigger_paths) {
 #endif
 }
 
+//Returns the values of column c of a table. The columns that are not
+//backed by a vector (e.g., packed or compressed) are decoded in a vector
+//that is added to decoded
+static const std::vector<Term_t> &getColumnValues(EDBLayer &layer,
+        std::shared_ptr<Column> c, std::list<std::vector<Term_t>> &decoded) {
+    std::shared_ptr<Column> column = c;
+    if (c->isEDB()) {
+        EDBColumn *c1 = ((EDBColumn*)c.get());
+        auto &literal = c1->getLiteral();
+        PredId_t predc = literal.getPredicate().getId();
+        //Consult the EDB layer to see whether we can get a vector
+        auto edbTable = layer.getEDBTable(predc);
+        if (edbTable->useSegments()) {
+            auto segment = edbTable->getSegment();
+            column = segment->getColumn(c1->posColumnInLiteral());
+        }
+    }
+    if (column->isBackedByVector()) {
+        return column->getVectorRef();
+    }
+    decoded.push_back(column->getReader()->asVector());
+    return decoded.back();
+}
+
 size_t TriggerSemiNaiver::unique_unary(std::vector<Term_t> &unaryBuffer, std::vector<std::shared_ptr<const FCInternalTable>> &tables) {
     if (tables.size() == 1) {
         //Might be already sorted and unique
@@ -136,42 +161,11 @@ size_t TriggerSemiNaiver::unique_unary(std::vector<Term_t> &unaryBuffer, std::ve
         if (columns.size() != 1) {
             LOG(ERRORL) << "This should not happen";
         }
-        auto c = columns[0];
-        bool fastCopy = false;
-        if (c->isEDB()) {
-            EDBColumn *c1 = ((EDBColumn*)c.get());
-            auto &literal = c1->getLiteral();
-            PredId_t predc = literal.getPredicate().getId();
-            //Consult the EDB layer to see whether we can get a vector
-            auto edbTable = layer.getEDBTable(predc);
-            if (edbTable->useSegments()) {
-                auto segment = edbTable->getSegment();
-                uint8_t pos = c1->posColumnInLiteral();
-                auto column = segment->getColumn(pos);
-                if (column->isBackedByVector()) {
-                    const auto &vec = column->getVectorRef();
-                    memcpy((char*)unaryBuffer.data() + sizeof(Term_t) * idx, (char*)vec.data(), sizeof(Term_t) * vec.size());
-                    fastCopy = true;
-                    idx += vec.size();
-                    //iterators.push_back(make_pair(vec.begin(), vec.end()));
-                } else {
-                    LOG(WARNL) << "Problem";
-                }
-            } else {
-                LOG(WARNL) << "Problem";
-            }
-        } else {
-            //Maybe it is still backed by a vector
-            if (c->isBackedByVector()) {
-                const auto &vec = c->getVectorRef();
-                memcpy((char*)unaryBuffer.data() + sizeof(Term_t) * idx,
-                        (char*)vec.data(), sizeof(Term_t) * vec.size());
-                fastCopy = true;
-                idx += vec.size();
-            } else {
-                LOG(WARNL) << "Problem";
-            }
-        }
+        std::list<std::vector<Term_t>> decoded;
+        const auto &vec = getColumnValues(layer, columns[0], decoded);
+        memcpy((char*)unaryBuffer.data() + sizeof(Term_t) * idx,
+                (char*)vec.data(), sizeof(Term_t) * vec.size());
+        idx += vec.size();
         t->releaseIterator(itr);
     }
     std::sort(unaryBuffer.begin(), unaryBuffer.end());
@@ -192,6 +186,8 @@ size_t TriggerSemiNaiver::unique_binary(std::vector<std::pair<Term_t, Term_t>>
     //Get vectors
     //binaryBuffer.clear();
     std::vector<std::pair<UniqueVector, UniqueVector>> vectors;
+    //The values of the columns that are not backed by a vector
+    std::list<std::vector<Term_t>> decoded;
     for (auto ctable : tables) {
         auto itr = ctable->getIterator();
         auto columns = itr->getAllColumns();
@@ -200,35 +196,9 @@ size_t TriggerSemiNaiver::unique_binary(std::vector<std::pair<Term_t, Term_t>>
         }
 
         std::vector<UniqueVector> rawColumns;
-        for (auto &c : itr->getAllColumns()) {
-            if (c->isEDB()) {
-                EDBColumn *c1 = ((EDBColumn*)c.get());
-                auto &literal = c1->getLiteral();
-                PredId_t predc = literal.getPredicate().getId();
-                //Consult the EDB layer to see whether we can get a vector
-                auto edbTable = layer.getEDBTable(predc);
-                if (edbTable->useSegments()) {
-                    auto segment = edbTable->getSegment();
-                    uint8_t pos = c1->posColumnInLiteral();
-                    auto column = segment->getColumn(pos);
-                    if (column->isBackedByVector()) {
-                        const auto &vec = column->getVectorRef();
-                        rawColumns.push_back(std::make_pair(vec.cbegin(), vec.cend()));
-                    } else {
-                        LOG(ERRORL) << "Problem";
-                    }
-                } else {
-                    LOG(ERRORL) << "Problem";
-                }
-
-            } else {
-                if (c->isBackedByVector()) {
-                    const auto &vec = c->getVectorRef();
-                    rawColumns.push_back(std::make_pair(vec.cbegin(), vec.cend()));
-                } else {
-                    LOG(ERRORL) << "Problem";
-                }
-            }
+        for (auto &c : columns) {
+            const auto &vec = getColumnValues(layer, c, decoded);
+            rawColumns.push_back(std::make_pair(vec.cbegin(), vec.cend()));
         }
         ctable->releaseIterator(itr);
         vectors.push_back(std::make_pair(rawColumns[0], rawColumns[1]));
@@ -0,0 +1,302 @@
+#include <vlog/spillmgr.h>
+#include <vlog/fctable.h>
+#include <vlog/fcinttable.h>
+
+#include <kognac/utils.h>
+#include <kognac/logs.h>
+
+#include <cstdio>
+#include <algorithm>
+
+SpillFile::~SpillFile() {
+    std::remove(path.c_str());
+}
+
+//The differences are computed modulo 2^64, so that they never overflow
+static inline uint64_t zigzagDelta(const uint64_t v, const uint64_t prev) {
+    const uint64_t d = v - prev;
+    return (d << 1) ^ (0 - (d >> 63));
+}
+
+static inline uint64_t unzigzagDelta(const uint64_t prev, const uint64_t v) {
+    return prev + ((v >> 1) ^ (0 - (v & 1)));
+}
+
+uint64_t SpilledColumn::write(ColumnReader &r, std::ostream &out,
+        Term_t &first, Term_t &last, size_t &count) {
+    char buffer[SPILL_READ_BUFFER];
+    size_t posBuffer = 0;
+    uint64_t written = 0;
+    Term_t prev = 0;
+    count = 0;
+    while (r.hasNext()) {
+        const Term_t v = r.next();
+        if (count == 0) {
+            first = v;
+        }
+        last = v;
+        count++;
+        uint64_t delta = zigzagDelta(v, prev);
+        prev = v;
+        if (posBuffer + 10 > SPILL_READ_BUFFER) {
+            out.write(buffer, posBuffer);
+            written += posBuffer;
+            posBuffer = 0;
+        }
+        while (delta >= 128) {
+            buffer[posBuffer++] = (char) ((delta & 127) | 128);
+            delta >>= 7;
+        }
+        buffer[posBuffer++] = (char) delta;
+    }
+    out.write(buffer, posBuffer);
+    written += posBuffer;
+    return written;
+}
+
+std::shared_ptr<const std::vector<Term_t>> SpilledColumn::load() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (loaded) {
+        return loaded;
+    }
+    std::ifstream in(file->getPath(), std::ios_base::in | std::ios_base::binary);
+    if (!in) {
+        LOG(ERRORL) << "Cannot open the spill file " << file->getPath();
+        throw 10;
+    }
+    std::vector<char> raw(length);
+    in.seekg(offset);
+    in.read(raw.data(), length);
+    if (!in) {
+        LOG(ERRORL) << "The spill file " << file->getPath() << " is truncated";
+        throw 10;
+    }
+
+    std::shared_ptr<std::vector<Term_t>> values(new std::vector<Term_t>());
+    values->reserve(_size);
+    Term_t prev = 0;
+    size_t pos = 0;
+    while (values->size() < _size) {
+        uint64_t delta = 0;
+        int shift = 0;
+        uint8_t b;
+        do {
+            b = (uint8_t) raw[pos++];
+            delta |= (uint64_t) (b & 127) << shift;
+            shift += 7;
+        } while (b & 128);
+        prev = (Term_t) unzigzagDelta(prev, delta);
+        values->push_back(prev);
+    }
+    loaded = values;
+    loadedValues.store(values.get(), std::memory_order_release);
+    return loaded;
+}
+
+void SpilledColumn::unload() {
+    std::lock_guard<std::mutex> lock(mutex);
+    loadedValues.store(NULL, std::memory_order_release);
+    loaded.reset();
+}
+
+size_t SpilledColumn::getLoadedBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return loaded ? _size * sizeof(Term_t) : 0;
+}
+
+std::unique_ptr<ColumnReader> SpilledColumn::getReader() const {
+    std::shared_ptr<const std::vector<Term_t>> values;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        values = loaded;
+    }
+    return std::unique_ptr<ColumnReader>(new SpilledColumnReader(*this,
+                values));
+}
+
+std::shared_ptr<Column> SpilledColumn::sort() const {
+    std::vector<Term_t> newvals = *load();
+    std::sort(newvals.begin(), newvals.end());
+    return std::shared_ptr<Column>(new InmemoryColumn(newvals, true));
+}
+
+std::shared_ptr<Column> SpilledColumn::sort(const int nthreads) const {
+    if (nthreads <= 1) {
+        return sort();
+    }
+    std::vector<Term_t> newvals = *load();
+    ParallelTasks::sort_int(newvals.begin(), newvals.end());
+    return std::shared_ptr<Column>(new InmemoryColumn(newvals, true));
+}
+
+std::shared_ptr<Column> SpilledColumn::unique() const {
+    //I assume the column is already sorted
+    std::vector<Term_t> newvals = *load();
+    auto last = std::unique(newvals.begin(), newvals.end());
+    newvals.erase(last, newvals.end());
+    newvals.shrink_to_fit();
+    return std::shared_ptr<Column>(new InmemoryColumn(newvals, true));
+}
+
+bool SpilledColumn::isIn(const Term_t t) const {
+    std::shared_ptr<const std::vector<Term_t>> values = load();
+    return std::binary_search(values->begin(), values->end(), t);
+}
+
+SpilledColumnReader::SpilledColumnReader(const SpilledColumn &col,
+        std::shared_ptr<const std::vector<Term_t>> values) : col(col),
+    values(values), posBuffer(0), endBuffer(0), toRead(0), position(0),
+    prev(0) {
+        if (!values) {
+            const SpillFile &file = col.getFile();
+            in.open(file.getPath(), std::ios_base::in | std::ios_base::binary);
+            if (!in) {
+                LOG(ERRORL) << "Cannot open the spill file " << file.getPath();
+                throw 10;
+            }
+            in.seekg(col.getOffset());
+            toRead = col.getLength();
+            buffer.resize(SPILL_READ_BUFFER);
+        }
+    }
+
+void SpilledColumnReader::fillBuffer() {
+    size_t n = std::min((uint64_t) SPILL_READ_BUFFER, toRead);
+    in.read(buffer.data(), n);
+    if (!in || n == 0) {
+        LOG(ERRORL) << "The spill file " << col.getFile().getPath() <<
+            " is truncated";
+        throw 10;
+    }
+    toRead -= n;
+    posBuffer = 0;
+    endBuffer = n;
+}
+
+Term_t SpilledColumnReader::next() {
+    if (values) {
+        return (*values)[position++];
+    }
+    uint64_t delta = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = nextByte();
+        delta |= (uint64_t) (b & 127) << shift;
+        shift += 7;
+    } while (b & 128);
+    prev = (Term_t) unzigzagDelta(prev, delta);
+    position++;
+    return prev;
+}
+
+SpillManager::SpillManager(std::string dir, size_t budgetBytes) : dir(dir),
+    budget(budgetBytes), counter(0) {
+        if (!Utils::exists(dir)) {
+            Utils::create_directories(dir);
+        }
+    }
+
+std::shared_ptr<const SpillFile> SpillManager::newFile() {
+    std::string path = dir + "/spill-" + std::to_string((uint64_t) this) +
+        "-" + std::to_string(counter++);
+    return std::shared_ptr<const SpillFile>(new SpillFile(path));
+}
+
+void SpillManager::registerColumn(std::shared_ptr<SpilledColumn> column) {
+    std::lock_guard<std::mutex> lock(mutex);
+    columns.push_back(column);
+}
+
+size_t SpillManager::getLoadedBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    std::vector<std::weak_ptr<SpilledColumn>> alive;
+    for (auto &c : columns) {
+        auto column = c.lock();
+        if (column) {
+            bytes += column->getLoadedBytes();
+            alive.push_back(c);
+        }
+    }
+    columns.swap(alive);
+    return bytes;
+}
+
+void SpillManager::unloadColumns() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &c : columns) {
+        auto column = c.lock();
+        if (column) {
+            column->unload();
+        }
+    }
+}
+
+void SpillManager::enforce(const std::vector<FCTable*> &tables,
+        const size_t minIteration, const size_t cacheBytes,
+        std::function<void()> dropCaches) {
+    std::vector<std::pair<size_t,
+        std::shared_ptr<const InmemoryFCInternalTable>>> candidates;
+    size_t resident = 0;
+    for (auto table : tables) {
+        if (table == NULL) {
+            continue;
+        }
+        FCIterator itr = table->read(0);
+        while (!itr.isEmpty()) {
+            auto t = std::dynamic_pointer_cast<const InmemoryFCInternalTable>(
+                    itr.getCurrentTable());
+            if (t) {
+                size_t bytes = t->getResidentBytes();
+                resident += bytes;
+                if (bytes > 0 && itr.getCurrentIteration() < minIteration) {
+                    candidates.push_back(std::make_pair(
+                                itr.getCurrentIteration(), t));
+                }
+            }
+            itr.moveNextCount();
+        }
+    }
+    const size_t loadedBytes = getLoadedBytes();
+    if (resident + loadedBytes + cacheBytes <= budget) {
+        return;
+    }
+
+    //First drop the spilled columns that were paged back in, and then the
+    //caches: both are cheaper to recompute than the blocks are to spill
+    unloadColumns();
+    if (resident + cacheBytes <= budget) {
+        LOG(DEBUGL) << "Unloaded " << loadedBytes << " bytes of spilled columns";
+        return;
+    }
+    if (cacheBytes > 0) {
+        dropCaches();
+        LOG(DEBUGL) << "Dropped " << cacheBytes << " bytes of cached results";
+        if (resident <= budget) {
+            return;
+        }
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(),
+            [](const std::pair<size_t,
+                std::shared_ptr<const InmemoryFCInternalTable>> &a,
+                const std::pair<size_t,
+                std::shared_ptr<const InmemoryFCInternalTable>> &b) {
+            return a.first < b.first;
+            });
+    size_t nspilled = 0;
+    size_t spilledBytes = 0;
+    for (auto &c : candidates) {
+        if (resident <= budget) {
+            break;
+        }
+        size_t freed = c.second->spill(*this);
+        resident -= std::min(resident, freed);
+        spilledBytes += freed;
+        nspilled++;
+    }
+    LOG(INFOL) << "Spilled " << nspilled << " blocks (" << spilledBytes <<
+        " bytes). Resident derivations: " << resident << " bytes, budget: "
+        << budget;
+}
@@ -553,9 +553,15 @@ std::shared_ptr<const Segment> InmemoryTable::getSortedCachedSegment(
         //and we now require sorted on fields 1, 2, then the one sorted on fields 1, 2, 3
         //meets the requirement.
         uint64_t filterByKey = __getKeyFromFields(sortBy, sortBy.size());
-        if (cachedSortedSegments.count(filterByKey)) {
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            auto cached = cachedSortedSegments.find(filterByKey);
+            if (cached != cachedSortedSegments.end()) {
+                sortedSegment = cached->second;
+            }
+        }
+        if (sortedSegment) {
             LOG(DEBUGL) << "Found sorted segment in cache";
-            sortedSegment = cachedSortedSegments[filterByKey];
         } else {
             LOG(DEBUGL) << "Did not find sorted segment in cache";
             std::vector<uint8_t> sb(sortBy);
@@ -592,6 +598,7 @@ std::shared_ptr<const Segment> InmemoryTable::getSortedCachedSegment(
             //If we are adding one in the cache that is say, sorted on fields 1, 2, 3,
             //this one is also sorted on fields 1, 2, and also sorted on field 1.
             //So, we add those to the hashtable as well.
+            std::lock_guard<std::mutex> lock(cacheMutex);
             for (int i = 0; i < sb.size(); i++) {
                 filterByKey = __getKeyFromFields(sb, i+1);
                 cachedSortedSegments[filterByKey] = sortedSegment;
@@ -681,7 +688,15 @@ EDBIterator *InmemoryTable::getSortedIterator2(const Literal &query,
                 }
             }
         }
-        if (! cacheHashes.count(keySortFields)) {
+        std::shared_ptr<HashMapEntry> entry;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            auto cached = cacheHashes.find(keySortFields);
+            if (cached != cacheHashes.end()) {
+                entry = cached->second;
+            }
+        }
+        if (! entry) {
             // Not available yet. Get the corresponding sorted segment.
             std::shared_ptr<const Segment> sortedSegment =
                 getSortedCachedSegment(segment, filterBy);
@@ -709,6 +724,7 @@ EDBIterator *InmemoryTable::getSortedIterator2(const Literal &query,
                                 currentidx - start)));
             }
             // Now put this map in the cacheHashes map, for each size.
+            std::lock_guard<std::mutex> lock(cacheMutex);
             for (int i = 1; i <= filterBy.size(); i++) {
                 if (i >= 8) {
                     break;
@@ -718,9 +734,10 @@ EDBIterator *InmemoryTable::getSortedIterator2(const Literal &query,
                     cacheHashes.insert(std::make_pair(keySortFields, map));
                 }
             }
+        }
+            entry = map;
         }
         // Now we hav the map available.
-        auto entry = cacheHashes.find(keySortFields)->second;
         Term_t constantValue = valuesConstantsToFilter[0];
         if (entry->map.count(constantValue)) {
             //Get the start and offset
@@ -13,6 +13,8 @@ public class QueryResultIterator implements Iterator<long[]>, AutoCloseable {
     private boolean hasNextCalled = false;
     private boolean hasNextValue = false;
     private final boolean filterBlanks;
+    private final long limit;
+    private long count = 0;
     private long[] saved = null;
 
     /**
@@ -26,8 +28,24 @@ public class QueryResultIterator implements Iterator<long[]>, AutoCloseable {
      *            whether results with blanks in them should be filtered out
      */
     public QueryResultIterator(long handle, boolean filterBlanks) {
+        this(handle, filterBlanks, 0);
+    }
+
+    /**
+     * Creates a query result iterator that delivers at most the specified
+     * number of results. This constructor is to be called from native code.
+     *
+     * @param handle
+     *            the handle.
+     * @param filterBlanks
+     *            whether results with blanks in them should be filtered out
+     * @param limit
+     *            the maximum number of results, or 0 for no limit
+     */
+    public QueryResultIterator(long handle, boolean filterBlanks, long limit) {
         this.handle = handle;
         this.filterBlanks = filterBlanks;
+        this.limit = limit;
     }
 
     /**
@@ -43,6 +61,10 @@ public class QueryResultIterator implements Iterator<long[]>, AutoCloseable {
             return hasNextValue;
         }
         hasNextCalled = true;
+        if (limit > 0 && count >= limit) {
+            hasNextValue = false;
+            return false;
+        }
         hasNextValue = hasNext(handle);
         if (!filterBlanks) {
             return hasNextValue;
@@ -77,10 +99,12 @@ public class QueryResultIterator implements Iterator<long[]>, AutoCloseable {
                 throw new NoSuchElementException("No more query results");
             }
             hasNextCalled = false;
+            count++;
             return v;
         }
         long[] retval = saved;
         hasNextCalled = false;
+        count++;
         saved = null;
         return retval;
     }
@@ -293,8 +293,49 @@ public class VLog {
      * @exception NonExistingPredicateException
      *                is thrown when the query predicate does not exist.
      */
-    public native QueryResultIterator query(int predicateId, long[] terms,
+    public QueryResultIterator query(int predicateId, long[] terms,
             boolean includeConstants, boolean filterBlanks)
+            throws NotStartedException, NonExistingPredicateException {
+        return nativeQuery(predicateId, terms, includeConstants, filterBlanks,
+                0);
+    }
+
+    /**
+     * Queries the current, so possibly materialized, database, and returns an
+     * iterator that delivers at most the specified number of answers, one by
+     * one. Without filtering of blanks, the limit is pushed into the
+     * evaluation of the query, which then stops early.
+     *
+     * @param predicateId
+     *            the predicate id of the query.
+     * @param terms
+     *            the constant values or variables. If the term is negative, it
+     *            is assumed to be a variable.
+     * @param includeConstants
+     *            whether to include the constants in the results.
+     * @param filterBlanks
+     *            whether results with blanks in them should be filtered out
+     * @param limit
+     *            the maximum number of answers, or 0 for no limit.
+     * @return the result iterator.
+     * @exception NotStartedException
+     *                is thrown when vlog is not started yet.
+     * @exception NonExistingPredicateException
+     *                is thrown when the query predicate does not exist.
+     */
+    public QueryResultIterator query(int predicateId, long[] terms,
+            boolean includeConstants, boolean filterBlanks, long limit)
+            throws NotStartedException, NonExistingPredicateException {
+        if (limit < 0) {
+            throw new IllegalArgumentException("negative limit");
+        }
+        return nativeQuery(predicateId, terms, includeConstants, filterBlanks,
+                limit);
+    }
+
+    private native QueryResultIterator nativeQuery(int predicateId,
+            long[] terms, boolean includeConstants, boolean filterBlanks,
+            long limit)
             throws NotStartedException, NonExistingPredicateException;
 
     /**
@@ -415,6 +456,35 @@ public class VLog {
                 query(intPred, longTerms, includeConstants, filterBlanks));
     }
 
+    /**
+     * Queries the current, so possibly materialized, database, and returns an
+     * iterator that delivers at most the specified number of answers, one by
+     * one.
+     *
+     * @param query
+     *            the query, as an atom.
+     * @param includeConstants
+     *            whether to include the constants of the query in the results.
+     * @param filterBlanks
+     *            whether results with blanks in them should be filtered out
+     * @param limit
+     *            the maximum number of answers, or 0 for no limit.
+     * @return the result iterator.
+     * @exception NotStartedException
+     *                is thrown when vlog is not started yet.
+     * @exception NonExistingPredicateException
+     *                is thrown when the query predicate does not exist.
+     */
+    public TermQueryResultIterator query(Atom query, boolean includeConstants,
+            boolean filterBlanks, long limit)
+            throws NotStartedException, NonExistingPredicateException {
+        query.checkNoBlank();
+        int intPred = getPredicateId(query.getPredicate());
+        long[] longTerms = extractTerms(query.getTerms());
+        return new TermQueryResultIterator(this, query(intPred, longTerms,
+                includeConstants, filterBlanks, limit));
+    }
+
     /**
      * Queries the current, so possibly materialized, database, and returns the
      * number of observations associated to predicate.
@@ -583,6 +653,39 @@ public class VLog {
     public native boolean materialize(boolean skolem, int timeout)
             throws NotStartedException;
 
+    /**
+     * Indexes the materialized predicates, so that queries with bound
+     * arguments do not scan all derived facts. The indexes are dropped when
+     * the database is materialized again.
+     *
+     * @exception NotStartedException
+     *                is thrown when vlog is not started yet, or materialization
+     *                has not run yet
+     */
+    public native void buildQueryIndexes() throws NotStartedException;
+
+    /**
+     * Adds facts to an EDB predicate of the materialized database, and derives
+     * their consequences without materializing again. Unlike
+     * {@link #addData(String, String[][])}, the existing data of the predicate
+     * is kept. The facts are only visible through the materialization.
+     *
+     * @param predicate
+     *            the predicate
+     * @param facts
+     *            the facts, with the arity of the predicate
+     * @exception NotStartedException
+     *                is thrown when vlog is not started yet, or materialization
+     *                has not run yet
+     * @exception NonExistingPredicateException
+     *                is thrown when the predicate does not exist
+     * @exception MaterializationException
+     *                is thrown when the facts have the wrong arity, or when
+     *                some rule negates a predicate that depends on them
+     */
+    public native void addFacts(String predicate, String[][] facts)
+            throws NotStartedException, NonExistingPredicateException;
+
     /**
      * Creates a CSV file at the specified location, for the specified
      * predicate.
@@ -6,6 +6,7 @@
 #include <vlog/cycles/checker.h>
 #include <vlog/reasoner.h>
 #include <vlog/utils.h>
+#include <vlog/termoverflow.h>
 #include <kognac/utils.h>
 #include <kognac/logs.h>
 
@@ -14,7 +15,9 @@
 #include <cstring>
 #include <cstdint>
 
-#define IS_BLANK(c) (c >= (INT64_C(1) << 40))
+// With 32-bit terms, the blanks are stored in the overflow table, so the
+// terms are decoded first.
+#define IS_BLANK(c) (TermOverflow::decode(c) >= (INT64_C(1) << 40))
 
 class VLogInfo {
 	public:
@@ -59,6 +62,7 @@ std::string jstring2string(JNIEnv *env, jstring jstr) {
 // Utility method to convert a literal id to a string.
 std::string literalToString(VLogInfo *f, uint64_t literalid) {
 
+	literalid = TermOverflow::decode(literalid);
 	std::string s = f->layer->getDictText(literalid);
 
 	if (s == std::string("")) {
@@ -538,7 +542,8 @@ extern "C" {
 		return env->NewStringUTF(s.c_str());
 	}
 
-	static TupleIterator *getQueryIter(JNIEnv *env, jobject obj, PredId_t p, jlongArray els, jboolean includeConstants) {
+	// At most limit answers are returned (0 means no limit).
+	static TupleIterator *getQueryIter(JNIEnv *env, jobject obj, PredId_t p, jlongArray els, jboolean includeConstants, size_t limit) {
 		VLogInfo *f = getVLogInfo(env, obj);
 		if (f == NULL || f->program == NULL) {
 			throwNotStartedException(env, "VLog is not started yet");
@@ -560,7 +565,8 @@ extern "C" {
 			if (v < 0) {
 				varId = (uint8_t) -v;
 			} else {
-				val = v;
+				// The results are decoded (see QueryResultIterator_next)
+				val = TermOverflow::encode(v);
 			}
 			VTerm vterm(varId, val);
 			tuple.set(vterm, i);
@@ -574,7 +580,7 @@ extern "C" {
 		if (pred.getType() == EDB) {
 			iter = r.getEDBIterator(query, NULL, NULL, *(f->layer), ! (bool) includeConstants, NULL);
 		} else if (f->sn != NULL) {
-			iter = r.getIteratorWithMaterialization(f->sn, query, ! (bool) includeConstants, NULL);
+			iter = r.getIteratorWithMaterialization(f->sn, query, ! (bool) includeConstants, NULL, limit);
 		} else {
 			// No materialization yet, but non-EDB predicate ... so, empty.
 			TupleTable *table = new TupleTable(sz);
@@ -602,22 +608,25 @@ extern "C" {
 
 	/*
 	 * Class:     karmaresearch_vlog_VLog
-	 * Method:    query
-	 * Signature: (I[JZZ)Lkarmaresearch/vlog/QueryResultIterator;
+	 * Method:    nativeQuery
+	 * Signature: (I[JZZJ)Lkarmaresearch/vlog/QueryResultIterator;
 	 */
-	JNIEXPORT jobject JNICALL Java_karmaresearch_vlog_VLog_query(JNIEnv * env, jobject obj, jint p, jlongArray els, jboolean includeConstants, jboolean filterBlanks) {
+	JNIEXPORT jobject JNICALL Java_karmaresearch_vlog_VLog_nativeQuery(JNIEnv * env, jobject obj, jint p, jlongArray els, jboolean includeConstants, jboolean filterBlanks, jlong limit) {
 		if (p == -1) {
 			throwNonExistingPredicateException(env, "Query contains non-existing predicate");
 			return NULL;
 		}
 
-		TupleIterator *iter = getQueryIter(env, obj, (PredId_t) p, els, includeConstants);
+		// Results with blanks are dropped afterwards, in Java, so the limit
+		// can only be pushed into the reasoner if none are dropped.
+		TupleIterator *iter = getQueryIter(env, obj, (PredId_t) p, els, includeConstants,
+				filterBlanks ? 0 : (size_t) limit);
 		if (iter == NULL) {
 			return NULL;
 		}
 		jclass jcls=env->FindClass("karmaresearch/vlog/QueryResultIterator");
-		jmethodID mID = env->GetMethodID(jcls, "<init>", "(JZ)V");
-		jobject jobj = env->NewObject(jcls, mID, (jlong) iter, filterBlanks);
+		jmethodID mID = env->GetMethodID(jcls, "<init>", "(JZJ)V");
+		jobject jobj = env->NewObject(jcls, mID, (jlong) iter, filterBlanks, limit);
 
 		return jobj;
 	}
@@ -651,7 +660,7 @@ JNIEXPORT jlong JNICALL Java_karmaresearch_vlog_VLog_nativeQuerySize(JNIEnv * en
             return result;
         }
     } else {
-        TupleIterator *iter = getQueryIter(env, obj, (PredId_t) p, els, (jboolean) includeConstants);
+        TupleIterator *iter = getQueryIter(env, obj, (PredId_t) p, els, (jboolean) includeConstants, 0);
         if (iter == NULL) {
             return result;
         }
@@ -840,6 +849,80 @@ JNIEXPORT jlong JNICALL Java_karmaresearch_vlog_VLog_nativeQuerySize(JNIEnv * en
 		return (jboolean) true;
 	}
 
+	/*
+	 * Class:     karmaresearch_vlog_VLog
+	 * Method:    buildQueryIndexes
+	 * Signature: ()V
+	 */
+	JNIEXPORT void JNICALL Java_karmaresearch_vlog_VLog_buildQueryIndexes(JNIEnv *env, jobject obj) {
+		VLogInfo *f = getVLogInfo(env, obj);
+		if (f == NULL || f->program == NULL) {
+			throwNotStartedException(env, "VLog is not started yet");
+			return;
+		}
+		if (f->sn == NULL) {
+			throwNotStartedException(env, "Materialization has not run yet");
+			return;
+		}
+		f->sn->buildQueryIndexes();
+	}
+
+	/*
+	 * Class:     karmaresearch_vlog_VLog
+	 * Method:    addFacts
+	 * Signature: (Ljava/lang/String;[[Ljava/lang/String;)V
+	 */
+	JNIEXPORT void JNICALL Java_karmaresearch_vlog_VLog_addFacts(JNIEnv *env, jobject obj, jstring jpred, jobjectArray data) {
+		VLogInfo *f = getVLogInfo(env, obj);
+		if (f == NULL || f->program == NULL) {
+			throwNotStartedException(env, "VLog is not started yet");
+			return;
+		}
+		if (f->sn == NULL) {
+			throwNotStartedException(env, "Materialization has not run yet");
+			return;
+		}
+		jint predId = Java_karmaresearch_vlog_VLog_getPredicateId(env, obj, jpred);
+		if (predId == -1) {
+			throwNonExistingPredicateException(env, "Non-existing predicate");
+			return;
+		}
+		if (data == NULL) {
+			throwIllegalArgumentException(env, "null data");
+			return;
+		}
+		jsize nrows = env->GetArrayLength(data);
+		std::vector<std::vector<std::string>> values;
+		for (int i = 0; i < nrows; i++) {
+			std::vector<std::string> value;
+			jobjectArray atom = (jobjectArray) env->GetObjectArrayElement(data, (jsize) i);
+			if (atom == NULL) {
+				continue;
+			}
+			jint arity = env->GetArrayLength(atom);
+			for (int j = 0; j < arity; j++) {
+				jstring v = (jstring) env->GetObjectArrayElement(atom, (jsize) j);
+				if (v == NULL) {
+					throwIllegalArgumentException(env, "null data");
+					return;
+				}
+				value.push_back(jstring2string(env, v));
+			}
+			values.push_back(value);
+		}
+
+		try {
+			f->sn->addFacts((PredId_t) predId, values);
+			f->sn->runIncremental();
+		} catch(int) {
+			throwMaterializationException(env, "Could not add the facts (see the log)");
+		} catch(std::runtime_error e) {
+			throwMaterializationException(env, e.what());
+		} catch(std::bad_alloc e) {
+			throwMaterializationException(env, e.what());
+		}
+	}
+
 	/*
 	 * Class:     karmaresearch_vlog_VLog
 	 * Method:    writePredicateToCsv
@@ -889,7 +972,7 @@ JNIEXPORT jlong JNICALL Java_karmaresearch_vlog_VLog_nativeQuerySize(JNIEnv * en
 			throwIOException(env, ("Could not open " + fn + " for writing").c_str());
 			return;
 		}
-		TupleIterator *iter = getQueryIter(env, obj, (PredId_t) pred, q, (jboolean) true);
+		TupleIterator *iter = getQueryIter(env, obj, (PredId_t) pred, q, (jboolean) true, 0);
 		if (iter == NULL) {
 			streamout.close();
 			return;
@@ -950,7 +1033,7 @@ JNIEXPORT jlong JNICALL Java_karmaresearch_vlog_VLog_nativeQuerySize(JNIEnv * en
 		iter->next();
 		jlong res[256];
 		for (int i = 0; i < sz; i++) {
-			res[i] = iter->getElementAt(i);
+			res[i] = TermOverflow::decode(iter->getElementAt(i));
 		}
 		jlongArray outJNIArray = env->NewLongArray(sz);
 		if (NULL == outJNIArray) return NULL;
@@ -3,10 +3,14 @@
 #include <vlog/seminaiver_trigger.h>
 #include <vlog/wizard.h>
 #include <vlog/reasoner.h>
+#include <vlog/deadline.h>
 #include <vlog/concepts.h>
 #include <vlog/edb.h>
 #include <vlog/qsqquery.h>
 #include <vlog/qsqr.h>
+#include <vlog/metrics.h>
+#include <vlog/queryindex.h>
+#include <vlog/fctupleitr.h>
 
 #include <trident/kb/consts.h>
 #include <trident/model/table.h>
@@ -289,6 +293,7 @@ TupleIterator *Reasoner::getIterator(Literal &query,
         std::vector<Term_t> *possibleValuesJoins,
         EDBLayer &edb, Program &program, bool returnOnlyVars,
         std::vector<uint8_t> *sortByFields) {
+    QueryDeadline::check();
     if (posJoins != NULL && possibleValuesJoins != NULL) {
         /* No, let's keep them. --Ceriel
         // Check if there are'nt too many values to check.
@@ -515,11 +520,69 @@ TupleIterator *Reasoner::getIncrReasoningIterator(Literal &query,
     }
 }
 
+std::shared_ptr<Reasoner::MagicProgram> Reasoner::getMagicProgram(
+        Literal &query1, EDBLayer &edb, Program &program) {
+    Predicate pred1 = query1.getPredicate();
+    MagicProgramKey key(program.getVersion(), edb.getId(), pred1.getId(),
+            pred1.getAdornment());
+    std::lock_guard<std::mutex> lock(magicProgramsMutex);
+    auto el = magicPrograms.find(key);
+    if (el != magicPrograms.end()) {
+        LOG(DEBUGL) << "Reusing the magic program for " << query1.tostring(&program, &edb);
+        RuntimeMetrics::magicCacheHits.inc();
+        return el->second;
+    }
+    RuntimeMetrics::magicCacheMisses.inc();
+
+    //The entries of other versions of the program or of other layers
+    //cannot be used anymore (their SemiNaivers may also refer to a layer
+    //that was deleted). Evaluations that still hold them keep them alive
+    for (auto itr = magicPrograms.begin(); itr != magicPrograms.end();) {
+        if (std::get<0>(itr->first) != std::get<0>(key) ||
+                std::get<1>(itr->first) != std::get<1>(key)) {
+            itr = magicPrograms.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+
+    std::shared_ptr<MagicProgram> magic(new MagicProgram());
+
+    //Get all adorned rules
+    std::unique_ptr<Wizard> wizard = std::unique_ptr<Wizard>(new Wizard());
+    std::shared_ptr<Program> adornedProgram = wizard->getAdornedProgram(query1, program);
+    //Print all rules
+#if DEBUG
+    LOG(DEBUGL) << "Adorned program:";
+    std::vector<Rule> newRules = adornedProgram->getAllRules();
+    for (std::vector<Rule>::iterator itr = newRules.begin(); itr != newRules.end(); ++itr) {
+        LOG(DEBUGL) << itr->tostring(adornedProgram.get(), &edb);
+    }
+#endif
+
+    //Rewrite and add the rules
+    magic->program = wizard->doMagic(query1, adornedProgram,
+            magic->inputOutputRelIDs);
+
+#if DEBUG
+    LOG(DEBUGL) << "Magic program:";
+    newRules = magic->program->getAllRules();
+    for (std::vector<Rule>::iterator itr = newRules.begin(); itr != newRules.end(); ++itr) {
+        LOG(DEBUGL) << itr->tostring(magic->program.get(), &edb);
+    }
+#endif
+
+    magic->sn = std::unique_ptr<SemiNaiver>(new SemiNaiver(
+            edb, magic->program.get(), true, false, false, -1, false, false));
+    magicPrograms[key] = magic;
+    return magic;
+}
+
 TupleIterator *Reasoner::getMagicIterator(Literal &query,
         std::vector<uint8_t> *posJoins,
         std::vector<Term_t> *possibleValuesJoins,
         EDBLayer &edb, Program &program, bool returnOnlyVars,
-        std::vector<uint8_t> *sortByFields) {
+        std::vector<uint8_t> *sortByFields, size_t limit) {
 
 
     //To use if the flag returnOnlyVars is set to false
@@ -568,33 +631,15 @@ TupleIterator *Reasoner::getMagicIterator(Literal &query,
     Predicate pred1(query.getPredicate(), Predicate::calculateAdornment(boundTuple));
     Literal query1(pred1, boundTuple);
 
-    //Get all adorned rules
-    std::unique_ptr<Wizard> wizard = std::unique_ptr<Wizard>(new Wizard());
-    std::shared_ptr<Program> adornedProgram = wizard->getAdornedProgram(query1, program);
-    //Print all rules
-#if DEBUG
-    LOG(DEBUGL) << "Adorned program:";
-    std::vector<Rule> newRules = adornedProgram->getAllRules();
-    for (std::vector<Rule>::iterator itr = newRules.begin(); itr != newRules.end(); ++itr) {
-        LOG(DEBUGL) << itr->tostring(adornedProgram.get(), &edb);
-    }
-#endif
-
-    //Rewrite and add the rules
-    std::pair<PredId_t, PredId_t> inputOutputRelIDs;
-    std::shared_ptr<Program> magicProgram = wizard->doMagic(query1, adornedProgram,
-            inputOutputRelIDs);
-
-#if DEBUG
-    LOG(DEBUGL) << "Magic program:";
-    newRules = magicProgram->getAllRules();
-    for (std::vector<Rule>::iterator itr = newRules.begin(); itr != newRules.end(); ++itr) {
-        LOG(DEBUGL) << itr->tostring(magicProgram.get(), &edb);
-    }
-#endif
-
-    SemiNaiver *naiver = new SemiNaiver(
-            edb, magicProgram.get(), true, false, false, -1, false, false) ;
+    //Get the magic program for this shape of the query
+    std::shared_ptr<MagicProgram> magic = getMagicProgram(query1, edb, program);
+    std::lock_guard<std::mutex> lock(magic->mutex);
+    std::shared_ptr<Program> magicProgram = magic->program;
+    const std::pair<PredId_t, PredId_t> &inputOutputRelIDs = magic->inputOutputRelIDs;
+    SemiNaiver *naiver = magic->sn.get();
+    //Drop the derivations of a previous evaluation that did not complete,
+    //but keep the rules and their plans
+    naiver->reset();
 
     //Add all the input tuples in the input relation
     Predicate pred = magicProgram->getPredicate(inputOutputRelIDs.first);
@@ -630,16 +675,22 @@ TupleIterator *Reasoner::getMagicIterator(Literal &query,
         finalTable = new TupleTable(query.getTupleSize());
     }
 
+    //Without sorting, the copy stops after limit rows
+    const bool toSort = sortByFields != NULL && !sortByFields->empty();
+    const size_t maxRows = toSort ? 0 : limit;
+    size_t nrows = 0;
+
     std::vector<uint8_t> posVars = outputLiteral.getPosVars();
-    while (!itr.isEmpty()) {
+    while (!itr.isEmpty() && (maxRows == 0 || nrows < maxRows)) {
         std::shared_ptr<const FCInternalTable> table = itr.getCurrentTable();
         // LOG(DEBUGL) << "table empty? " << table->isEmpty();
         FCInternalTableItr *itrTable = table->getIterator();
 
         // itrTable contains only variables.
         if (returnOnlyVars) {
-            while (itrTable->hasNext()) {
+            while (itrTable->hasNext() && (maxRows == 0 || nrows < maxRows)) {
                 itrTable->next();
+                nrows++;
                 if (finalTable->getSizeRow() == 0) {
                     Term_t row = 0;
                     finalTable->addRow(&row);
@@ -655,8 +706,9 @@ TupleIterator *Reasoner::getMagicIterator(Literal &query,
                 // TODO!
             }
         } else {
-            while (itrTable->hasNext()) {
+            while (itrTable->hasNext() && (maxRows == 0 || nrows < maxRows)) {
                 itrTable->next();
+                nrows++;
                 for (int j = 0; j < nPosToCopy; ++j) {
                     outputTuple[posToCopy[j]] = itrTable->getCurrentValue(j);
                 }
@@ -670,12 +722,13 @@ TupleIterator *Reasoner::getMagicIterator(Literal &query,
     }
 
     std::shared_ptr<TupleTable> pFinalTable(finalTable);
-    delete naiver;
+    //Free the derivations now rather than at the next evaluation
+    naiver->reset();
 
-    if (sortByFields != NULL && !sortByFields->empty()) {
+    if (toSort) {
         std::shared_ptr<TupleTable> sortTab = std::shared_ptr<TupleTable>(
                 pFinalTable->sortBy(*sortByFields));
-        return new TupleTableItr(sortTab);
+        return getLimitedIterator(sortTab, limit);
 
     } else {
         return new TupleTableItr(pFinalTable);
@@ -713,10 +766,34 @@ TupleIterator *Reasoner::getMaterializationIterator(Literal &query,
     return result;
 }
 
+TupleIterator *Reasoner::getLimitedIterator(std::shared_ptr<TupleTable> table,
+        const size_t limit) {
+    if (limit == 0 || table->getNRows() <= limit) {
+        return new TupleTableItr(table);
+    }
+    const size_t rowSize = table->getSizeRow();
+    std::shared_ptr<TupleTable> limited(new TupleTable(rowSize));
+    TupleTableItr itr(table);
+    for (size_t i = 0; i < limit && itr.hasNext(); ++i) {
+        itr.next();
+        for (size_t j = 0; j < rowSize; ++j) {
+            limited->addValue(itr.getElementAt(j));
+        }
+    }
+    return new TupleTableItr(limited);
+}
+
 TupleIterator *Reasoner::getIteratorWithMaterialization(SemiNaiver *sn, Literal &query, bool returnOnlyVars,
-        std::vector<uint8_t> *sortByFields) {
+        std::vector<uint8_t> *sortByFields, size_t limit) {
+
+    std::shared_ptr<const QueryIndex> index = sn->getQueryIndex(
+            query.getPredicate().getId());
+    if (!index && (sortByFields == NULL || sortByFields->empty())) {
+        //Nothing to sort: return the rows while the blocks are read
+        return new FCTupleItr(sn->getTable(query.getPredicate().getId()),
+                query, returnOnlyVars, limit);
+    }
 
-    FCIterator tableIt = sn->getTable(query.getPredicate().getId());
     VTuple tuple = query.getTuple();
 
     TupleTable *finalTable;
@@ -726,6 +803,17 @@ TupleIterator *Reasoner::getIteratorWithMaterialization(SemiNaiver *sn, Literal
         finalTable = new TupleTable(query.getTupleSize());
     }
 
+    //Use the indexes built after the materialization, if any
+    bool sorted = false;
+    if (index) {
+        sorted = index->query(query, returnOnlyVars, sortByFields, finalTable,
+                limit);
+    }
+
+    FCIterator tableIt;
+    if (!index) {
+        tableIt = sn->getTable(query.getPredicate().getId());
+    }
     std::vector<std::pair<uint8_t, uint8_t>> repeated = query.getRepeatedVars();
 
     while (! tableIt.isEmpty()) {
@@ -770,13 +858,13 @@ TupleIterator *Reasoner::getIteratorWithMaterialization(SemiNaiver *sn, Literal
 
     std::shared_ptr<TupleTable> pFinalTable(finalTable);
 
-    if (sortByFields != NULL && !sortByFields->empty()) {
+    if (sortByFields != NULL && !sortByFields->empty() && !sorted) {
         std::shared_ptr<TupleTable> sortTab = std::shared_ptr<TupleTable>(
                 pFinalTable->sortBy(*sortByFields));
-        return new TupleTableItr(sortTab);
+        return getLimitedIterator(sortTab, limit);
 
     } else {
-        return new TupleTableItr(pFinalTable);
+        return getLimitedIterator(pFinalTable, limit);
     }
 }
 
@@ -796,10 +884,10 @@ int Reasoner::getNumberOfIDBPredicates(Literal &query, Program &program) {
         Literal lit = queries[idxQueries];
 
         //Go through all rules and get the ones which match the query
-        std::vector<Rule> r = program.getAllRulesByPredicate(lit.getPredicate().getId());
-        for (std::vector<Rule>::iterator itr = r.begin(); itr != r.end();
-                ++itr) {
-            rules.push_back(itr->createAdornment(lit.getPredicate().getAdornment()));
+        for (const uint32_t ruleId : program.getRulesIDsByPredicate(
+                    lit.getPredicate().getId())) {
+            rules.push_back(program.getRule(ruleId).createAdornment(
+                        lit.getPredicate().getAdornment()));
         }
 
         //Go through all the new rules and get new queries to process
@@ -5,6 +5,9 @@
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
+#include <algorithm>
+#include <set>
+
 static bool curl_initialized = false;
 static int  numTables = 0;
 
@@ -37,7 +40,21 @@ SparqlTable::SparqlTable(PredId_t predid, std::string repository,
     }
 
 
-std::string SparqlTable::generateQuery(const Literal &query) {
+std::string SparqlTable::termToSparql(uint64_t value) {
+    std::string val = layer->getDictText(value);
+    // TODO: escape needed for string? And if value is not found in dictionary,
+    // what to do then?
+    // Also, the bracketing may depend on the type of the value (which we don't keep track of in VLog).
+    // Or should we add bracketing when we put stuff in the dictionary???
+    // TODO!!!
+    if (val.find('<') == 0 || val.find('"') == 0) {
+        return val;
+    }
+    return "\"" + val + "\"";
+}
+
+std::string SparqlTable::generateQuery(const Literal &query,
+        const std::string &values) {
     //Convert the literal into a sparql query
     // First, analyze query: and determine which variable goes where.
     std::vector<uint8_t> variables;
@@ -80,23 +97,13 @@ std::string SparqlTable::generateQuery(const Literal &query) {
                 }
             }
         } else {
-            std::string val = layer->getDictText(t.getValue());
-            // TODO: escape needed for string? And if value is not found in dictionary,
-            // what to do then?
-            // Also, the bracketing may depend on the type of the value (which we don't keep track of in VLog).
-            // Or should we add bracketing when we put stuff in the dictionary???
-            // TODO!!!
-            if (val.find('<') == 0 || val.find('"') == 0) {
-                binds += " BIND (" + val + " AS ?" + fieldVars[i] + ") ";
-            } else {
-                binds += " BIND (\"" + val + "\" AS ?" + fieldVars[i] + ") ";
-            }
+            binds += " BIND (" + termToSparql(t.getValue()) + " AS ?" + fieldVars[i] + ") ";
             select += " ?" + fieldVars[i];
             vars.push_back(-1);
         }
     }
 
-    std::string sparqlQuery = select + " WHERE {" + binds + wb + "}";
+    std::string sparqlQuery = select + " WHERE {" + values + binds + wb + "}";
 
     return sparqlQuery;
 }
@@ -126,13 +133,75 @@ void SparqlTable::query(QSQQuery *query, TupleTable *outputTable,
             }
             outputTable->addRow(row);
         }
+        delete iter;
         return;
     }
 
-    //TODO: could this be implemented somehow with VALUES?
+    //Push the bindings into the endpoint with VALUES
+    std::vector<json> results = launchValuesQueries(*lit, *posToFilter,
+            *valuesToFilter);
+    for (const auto &output : results) {
+        SparqlIterator iter(output, layer, *lit, fieldVars);
+        while (iter.hasNext()) {
+            iter.next();
+            for (int i = 0; i < npos; ++i) {
+                row[i] = iter.getElementAt(pos[i]);
+            }
+            outputTable->addRow(row);
+        }
+    }
+}
 
-    LOG(ERRORL) << "Not implemented yet: SparqlTable::query with posFilter";
-    throw 10;
+std::vector<json> SparqlTable::launchValuesQueries(const Literal &query,
+        const std::vector<uint8_t> &posToFilter,
+        const std::vector<Term_t> &valuesToFilter) {
+    //If a variable is repeated, the query only uses the name of its first
+    //occurrence.
+    std::string vars = "";
+    for (auto p : posToFilter) {
+        uint8_t first = p;
+        for (uint8_t j = 0; j < p; ++j) {
+            VTerm t = query.getTermAtPos(j);
+            if (t.isVariable() && t.getId() == query.getTermAtPos(p).getId()) {
+                first = j;
+                break;
+            }
+        }
+        vars += " ?" + fieldVars[first];
+    }
+
+    //The bindings may contain duplicates. They are removed first, so that
+    //the batches contain different bindings and their results are
+    //disjoint.
+    const size_t rowSize = posToFilter.size();
+    std::vector<std::vector<Term_t>> bindings;
+    for (size_t i = 0; i + rowSize <= valuesToFilter.size(); i += rowSize) {
+        bindings.push_back(std::vector<Term_t>(valuesToFilter.begin() + i,
+                    valuesToFilter.begin() + i + rowSize));
+    }
+    std::sort(bindings.begin(), bindings.end());
+    bindings.erase(std::unique(bindings.begin(), bindings.end()),
+            bindings.end());
+
+    //One query per batch of bindings
+    std::vector<std::string> queries;
+    for (size_t start = 0; start < bindings.size();
+            start += SPARQL_VALUES_BATCH) {
+        size_t end = std::min(bindings.size(), start + SPARQL_VALUES_BATCH);
+        std::string values = " VALUES (" + vars + " ) {";
+        for (size_t i = start; i < end; ++i) {
+            values += " (";
+            for (size_t j = 0; j < rowSize; ++j) {
+                values += " " + termToSparql(bindings[i][j]);
+            }
+            values += " )";
+        }
+        values += " } ";
+        queries.push_back(generateQuery(query, values));
+    }
+    LOG(DEBUGL) << "Pushing " << bindings.size() <<
+        " bindings in " << queries.size() << " queries";
+    return launchQueries(queries);
 }
 
 // TODO
@@ -170,45 +239,179 @@ size_t writeFunction(void *ptr, size_t size, size_t nmemb, std::string* data) {
     return size * nmemb;
 }
 
-json SparqlTable::launchQuery(std::string sparqlQuery) {
-
-    char errorBuffer[CURL_ERROR_SIZE];
-    std::string request = repository;
+static struct curl_slist *getHeaders() {
+    struct curl_slist *headers = NULL;
+    headers = curl_slist_append(headers, "Accept: application/sparql-results+json");
+    headers = curl_slist_append(headers, "User-Agent: VLog-v1.2.1");
+    return headers;
+}
 
-    request += "?query=" + escape(sparqlQuery);
-    LOG(DEBUGL) << "Launching the remote query " << sparqlQuery;
-    LOG(DEBUGL) << "Request = " << request;
+static void setRequestOptions(CURL *curl, const std::string &request,
+        std::string *response, struct curl_slist *headers,
+        char *errorBuffer) {
     curl_easy_setopt(curl, CURLOPT_URL, request.c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeFunction);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
     curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 50L);
     curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
-    std::string rheaders;
-    std::string response;
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &rheaders);
-    struct curl_slist *headers = NULL;
-    headers = curl_slist_append(headers, "Accept: application/sparql-results+json");
-    headers = curl_slist_append(headers, "User-Agent: VLog-v1.2.1");
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+}
 
-    CURLcode resp = curl_easy_perform(curl);
+//Returns false if the query failed. An empty result would silently drop
+//rows (e.g., a page of a paginated query), so the callers throw
+static bool parseResponse(CURLcode resp, const std::string &response,
+        const char *errorBuffer, json &output) {
     LOG(DEBUGL) << "output = " << response.substr(0, 1000) << ((response.size() > 1000) ? " ..." : "");
-    json output;
     if (resp == 0) {
         try {
             output = json::parse(response);
             output = output["results"];
             output = output["bindings"];
+            return true;
         } catch(nlohmann::detail::parse_error x) {
-            LOG(WARNL) << "Returning empty result; parse error in response";
+            LOG(ERRORL) << "Parse error in the response of the endpoint";
             LOG(DEBUGL) << "Response = " << response;
         }
     } else {
         std::string em(errorBuffer);
-        LOG(WARNL) << "Launching query failed: " << em;
+        LOG(ERRORL) << "Launching query failed: " << em;
+    }
+    return false;
+}
+
+json SparqlTable::launchQuery(std::string sparqlQuery) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+
+    char errorBuffer[CURL_ERROR_SIZE];
+    errorBuffer[0] = '\0';
+    std::string request = repository;
+
+    request += "?query=" + escape(sparqlQuery);
+    LOG(DEBUGL) << "Launching the remote query " << sparqlQuery;
+    LOG(DEBUGL) << "Request = " << request;
+    std::string response;
+    struct curl_slist *headers = getHeaders();
+    setRequestOptions(curl, request, &response, headers, errorBuffer);
+
+    CURLcode resp = curl_easy_perform(curl);
+    json output;
+    const bool ok = parseResponse(resp, response, errorBuffer, output);
+    curl_slist_free_all(headers);
+    if (!ok) {
+        throw 10;
+    }
+    return output;
+}
+
+std::vector<json> SparqlTable::launchQueries(const std::vector<std::string> &queries) {
+    std::vector<json> output(queries.size());
+    if (queries.size() <= 1) {
+        if (queries.size() == 1) {
+            output[0] = launchQuery(queries[0]);
+        }
+        return output;
+    }
+
+    //Launch the requests concurrently, with at most SPARQL_MAX_CONNECTIONS
+    //of them at the same time.
+    CURLM *multi = curl_multi_init();
+    struct curl_slist *headers = getHeaders();
+    std::vector<std::string> requests(queries.size());
+    std::vector<std::string> responses(queries.size());
+    std::vector<std::vector<char>> errorBuffers(queries.size(),
+            std::vector<char>(CURL_ERROR_SIZE, '\0'));
+    std::unordered_map<CURL *, size_t> handles;
+    size_t nextQuery = 0;
+    int inFlight = 0;
+    bool failed = false;
+    while ((!failed && nextQuery < queries.size()) || inFlight > 0) {
+        while (!failed && nextQuery < queries.size() && inFlight < SPARQL_MAX_CONNECTIONS) {
+            const size_t i = nextQuery++;
+            requests[i] = repository + "?query=" + escape(queries[i]);
+            LOG(DEBUGL) << "Launching the remote query " << queries[i];
+            CURL *handle = curl_easy_init();
+            setRequestOptions(handle, requests[i], &responses[i], headers,
+                    &errorBuffers[i][0]);
+            handles[handle] = i;
+            curl_multi_add_handle(multi, handle);
+            inFlight++;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        CURLMsg *msg;
+        int msgsLeft;
+        while ((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL *handle = msg->easy_handle;
+            const size_t i = handles[handle];
+            if (!parseResponse(msg->data.result, responses[i],
+                        &errorBuffers[i][0], output[i])) {
+                //The requests in flight are completed, no new ones start
+                failed = true;
+            }
+            responses[i].clear();
+            responses[i].shrink_to_fit();
+            curl_multi_remove_handle(multi, handle);
+            curl_easy_cleanup(handle);
+            handles.erase(handle);
+            inFlight--;
+        }
+        if (inFlight > 0) {
+            curl_multi_wait(multi, NULL, 0, 1000, NULL);
+        }
     }
     curl_slist_free_all(headers);
+    curl_multi_cleanup(multi);
+    if (failed) {
+        throw 10;
+    }
+    return output;
+}
+
+json SparqlTable::launchPaginatedQuery(const Literal &query) {
+    //Paginate with LIMIT/OFFSET. The order must be total for this to
+    //work. The rows are distinct, so all the variables are used. SPARQL
+    //does not order some pairs of terms (e.g., literals with different
+    //datatypes), so the lexical form, the language and the datatype of
+    //every variable break the ties.
+    std::string sparqlQuery = generateQuery(query);
+    std::string orderBy = " ORDER BY";
+    for (int i = 0; i < query.getTupleSize(); i++) {
+        const std::string v = "?" + fieldVars[i];
+        orderBy += " " + v + " STR(" + v + ") LANG(" + v + ") STR(DATATYPE(" +
+            v + "))";
+    }
+
+    json output = json::array();
+    size_t page = 0;
+    bool done = false;
+    while (! done) {
+        //The first page is requested alone, since most results fit in one.
+        //After that, several pages are requested at the same time.
+        std::vector<std::string> queries;
+        int npages = page == 0 ? 1 : SPARQL_MAX_CONNECTIONS;
+        for (int i = 0; i < npages; i++, page++) {
+            queries.push_back("SELECT * WHERE { { " + sparqlQuery + " } }" +
+                    orderBy + " LIMIT " + std::to_string(SPARQL_PAGE_SIZE) +
+                    " OFFSET " + std::to_string(page * SPARQL_PAGE_SIZE));
+        }
+        std::vector<json> results = launchQueries(queries);
+        for (auto &result : results) {
+            for (auto &binding : result) {
+                output.push_back(std::move(binding));
+            }
+            if (result.size() < SPARQL_PAGE_SIZE) {
+                done = true;
+                break;
+            }
+        }
+    }
     return output;
 }
 
@@ -281,16 +484,23 @@ EDBIterator *SparqlTable::getIterator(const Literal &query) {
     LOG(DEBUGL) << "GetIterator, query = " << query.tostring();
 
     size_t sz = query.getTupleSize();
+    std::lock_guard<std::recursive_mutex> lock(mutex);
 
     json output;
     if (sz == fieldVars.size()) {
         std::string key = query.tostring();
-        if (cachedTables.count(key) > 0) {
-            output = cachedTables[key];
+        auto cached = cachedTables.find(key);
+        if (cached != cachedTables.end()) {
+            output = cached->second.first;
+            cacheLRU.splice(cacheLRU.begin(), cacheLRU, cached->second.second);
         } else {
-            std::string sparqlQuery = generateQuery(query);
-            output = launchQuery(sparqlQuery);
-            cachedTables[key] = output;
+            output = launchPaginatedQuery(query);
+            if (cachedTables.size() >= SPARQL_CACHE_SIZE) {
+                cachedTables.erase(cacheLRU.back());
+                cacheLRU.pop_back();
+            }
+            cacheLRU.push_front(key);
+            cachedTables[key] = std::make_pair(output, cacheLRU.begin());
         }
     }
     return new SparqlIterator(output, layer, query, fieldVars);
@@ -316,6 +526,7 @@ EDBIterator *SparqlTable::getSortedIterator(const Literal &query,
     }
 
     LOG(DEBUGL) << "GetSortedIterator, query = " << query.tostring();
+    std::lock_guard<std::recursive_mutex> lock(mutex);
 
     uint64_t key = 0;
     if (sz <= 8 && query.getNUniqueVars() == sz) {
@@ -382,6 +593,73 @@ EDBIterator *SparqlTable::getSortedIterator(const Literal &query,
     return new InmemoryIterator(segment, predid, newFields);
 }
 
+std::vector<std::shared_ptr<Column>> SparqlTable::checkNewIn(
+        std::vector<std::shared_ptr<Column>> &checkValues,
+        const Literal &l,
+        std::vector<uint8_t> &posInL) {
+
+    LOG(DEBUGL) << "checkNewIn on SPARQL endpoint";
+    const size_t sz = checkValues.size();
+    std::vector<std::shared_ptr<Column>> output;
+    if (sz == 0 || l.getTupleSize() != fieldVars.size()) {
+        return EDBTable::checkNewIn(checkValues, l, posInL);
+    }
+
+    //Collect the (sorted) values to check. Rather than retrieving the
+    //whole relation, only these values are sent to the endpoint.
+    std::vector<std::unique_ptr<ColumnReader>> readers;
+    for (size_t i = 0; i < sz; i++) {
+        readers.push_back(checkValues[i]->getReader());
+    }
+    std::vector<Term_t> values;
+    while (readers[0]->hasNext()) {
+        for (size_t i = 0; i < sz; i++) {
+            if (! readers[i]->hasNext()) {
+                throw 10;
+            }
+            values.push_back(readers[i]->next());
+        }
+    }
+
+    std::set<std::vector<Term_t>> existing;
+    std::vector<json> results = launchValuesQueries(l, posInL, values);
+    for (const auto &result : results) {
+        SparqlIterator iter(result, layer, l, fieldVars);
+        while (iter.hasNext()) {
+            iter.next();
+            std::vector<Term_t> row(sz);
+            for (size_t i = 0; i < sz; i++) {
+                row[i] = iter.getElementAt(posInL[i]);
+            }
+            existing.insert(row);
+        }
+    }
+
+    //Keep the values that were not found, removing duplicates
+    std::vector<std::shared_ptr<ColumnWriter>> cols;
+    for (size_t i = 0; i < sz; i++) {
+        cols.push_back(std::shared_ptr<ColumnWriter>(new ColumnWriter()));
+    }
+    //The rows that are added are also put in existing, so that the
+    //duplicates are removed even if they are not consecutive
+    std::vector<Term_t> row(sz);
+    for (size_t j = 0; j < values.size(); j += sz) {
+        for (size_t i = 0; i < sz; i++) {
+            row[i] = values[j + i];
+        }
+        if (!existing.insert(row).second) {
+            continue;
+        }
+        for (size_t i = 0; i < sz; i++) {
+            cols[i]->add(row[i]);
+        }
+    }
+    for (size_t i = 0; i < sz; i++) {
+        output.push_back(cols[i]->getColumn());
+    }
+    return output;
+}
+
 bool SparqlTable::getDictNumber(const char *text, const size_t sizeText,
         uint64_t &id) {
     return false;
@@ -2,6 +2,7 @@
 #include <string>
 
 #include <launcher/vloglayer.h>
+#include <vlog/deadline.h>
 #include <cts/parser/SPARQLLexer.hpp>
 #include <cts/semana/SemanticAnalysis.hpp>
 #include <cts/plangen/PlanGen.hpp>
@@ -71,7 +72,7 @@ void VLogUtils::parseQuery(bool &success,
     return;
 }
 
-void VLogUtils::execSPARQLQuery(std::string sparqlquery,
+bool VLogUtils::execSPARQLQuery(std::string sparqlquery,
         bool explain,
         long nterms,
         DBLayer &db,
@@ -79,7 +80,8 @@ void VLogUtils::execSPARQLQuery(std::string sparqlquery,
         bool jsonoutput,
         JSON *jsonvars,
         JSON *jsonresults,
-        JSON *jsonstats) {
+        JSON *jsonstats,
+        const uint64_t timeoutMillis) {
     std::unique_ptr<QueryDict> queryDict = std::unique_ptr<QueryDict>(new QueryDict(nterms));
     bool parsingOk;
 
@@ -95,7 +97,7 @@ void VLogUtils::execSPARQLQuery(std::string sparqlquery,
         LOG(INFOL) << "Runtime query: 0ms.";
         LOG(INFOL) << "Runtime total: " << duration.count() * 1000 << "ms.";
         LOG(INFOL) << "# rows = 0";
-        return;
+        return true;
     }
 
     if (jsonvars) {
@@ -118,7 +120,7 @@ void VLogUtils::execSPARQLQuery(std::string sparqlquery,
     if (!plan) {
         cerr << "internal error plan generation failed" << endl;
         delete plangen;
-        return;
+        return true;
     }
     if (explain)
         plan->print(0);
@@ -128,6 +130,7 @@ void VLogUtils::execSPARQLQuery(std::string sparqlquery,
     Operator* operatorTree = CodeGen().translate(runtime, *queryGraph.get(), plan, false);
 
     // Execute it
+    bool timedOut = false;
     if (explain) {
         DebugPlanPrinter out(runtime, false);
         operatorTree->print(out);
@@ -146,19 +149,36 @@ void VLogUtils::execSPARQLQuery(std::string sparqlquery,
         }
 
         std::chrono::system_clock::time_point startQ = std::chrono::system_clock::now();
-        if (operatorTree->first()) {
-	    LOG(INFOL) << "Found another one";
-            while (operatorTree->next()) {
-		LOG(INFOL) << "Found another one";
-	    }
+        {
+            //The reasoner and the scans check the deadline, also while the
+            //first result is computed
+            QueryDeadline deadline(timeoutMillis);
+            try {
+                if (operatorTree->first()) {
+                    LOG(INFOL) << "Found another one";
+                    while (operatorTree->next()) {
+                        LOG(INFOL) << "Found another one";
+                    }
+                }
+            } catch (int) {
+                if (!QueryDeadline::isExpired()) {
+                    throw;
+                }
+                timedOut = true;
+            }
         }
         std::chrono::duration<double> durationQ = std::chrono::system_clock::now() - startQ;
+        if (timedOut) {
+            LOG(WARNL) << "The query was stopped after " << timeoutMillis <<
+                "ms. Its results are discarded";
+        }
         std::chrono::duration<double> duration = std::chrono::system_clock::now() - start;
         LOG(INFOL) << "Runtime query: " << durationQ.count() * 1000 << "ms.";
         LOG(INFOL) << "Runtime total: " << duration.count() * 1000 << "ms.";
         if (jsonstats) {
             jsonstats->put("runtime", to_string(durationQ.count()));
             jsonstats->put("nresults", to_string(p->getPrintedRows()));
+            jsonstats->put("timeout", std::string(timedOut ? "true" : "false"));
 
         }
         if (printstdout) {
@@ -168,4 +188,5 @@ void VLogUtils::execSPARQLQuery(std::string sparqlquery,
         delete operatorTree;
     }
     delete plangen;
+    return !timedOut;
 }
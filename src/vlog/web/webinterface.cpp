@@ -3,6 +3,7 @@
 #include <vlog/webinterface.h>
 #include <vlog/materialization.h>
 #include <vlog/seminaiver.h>
+#include <vlog/metrics.h>
 #include <vlog/ml/training.h>
 #include <vlog/utils.h>
 #include <vlog/ml/helper.h>
@@ -30,41 +31,51 @@
 
 WebInterface::WebInterface(
         ProgramArgs &vm, std::shared_ptr<SemiNaiver> sn, std::string htmlfiles,
-        std::string cmdArgs, std::string edbfile) : vm(vm), sn(sn),
+        std::string cmdArgs, std::string edbfile) : vm(vm),
+    mat(new Materialization{std::shared_ptr<EDBLayer>(),
+            std::shared_ptr<Program>(), sn}),
     dirhtmlfiles(htmlfiles), cmdArgs(cmdArgs),
-    isActive(false),
+    nActiveRequests(0),
     edbFile(edbfile),
-    nthreads(1) {
+    nthreads(vm["webthreads"].as<int>() > 0 ? vm["webthreads"].as<int>() : 1),
+    sparqlTimeout(vm["webtimeout"].as<int64_t>() > 0 ?
+            vm["webtimeout"].as<int64_t>() : 0) {
         //Setup the EDB layer
         EDBConf conf(edbFile, true);
-        edb = std::unique_ptr<EDBLayer>(new EDBLayer(conf, false));
+        edb = std::shared_ptr<EDBLayer>(new EDBLayer(conf, false));
         //If the database is a single RDF Graph, then we can query it without launching any program
-        setupTridentLayer();
+        tridentlayer = setupTridentLayer(*edb);
     }
 
-void WebInterface::setupTridentLayer() {
-    tridentlayer = std::unique_ptr<TridentLayer>();
-    if (edb) {
-        //Setup a TridentLayer (for queries without datalog)
-        PredId_t p = edb->getFirstEDBPredicate();
-        std::string typedb = edb->getTypeEDBPredicate(p);
-        tridentlayer = NULL;
-        if (typedb == "Trident") {
-            auto edbTable = edb->getEDBTable(p);
-            KB *kb = ((TridentTable*)edbTable.get())->getKB();
-            tridentlayer = std::unique_ptr<TridentLayer>(new TridentLayer(*kb));
-            tridentlayer->disableBifocalSampling();
-        }
+std::shared_ptr<TridentLayer> WebInterface::setupTridentLayer(EDBLayer &edb) {
+    //Setup a TridentLayer (for queries without datalog)
+    std::shared_ptr<TridentLayer> tridentlayer;
+    PredId_t p = edb.getFirstEDBPredicate();
+    std::string typedb = edb.getTypeEDBPredicate(p);
+    if (typedb == "Trident") {
+        auto edbTable = edb.getEDBTable(p);
+        KB *kb = ((TridentTable*)edbTable.get())->getKB();
+        tridentlayer = std::shared_ptr<TridentLayer>(new TridentLayer(*kb));
+        tridentlayer->disableBifocalSampling();
     }
+    return tridentlayer;
 }
 
 void WebInterface::processMaterialization() {
     std::unique_lock<std::mutex> lck(mtxMatRunner);
     while (true) {
         cvMatRunner.wait(lck);
-        if (!sn)
+        std::shared_ptr<const Materialization> mat = getMaterialization();
+        if (!mat->sn)
             break;
-        sn->run();
+        //The metrics of the previous program do not apply anymore
+        RuntimeMetrics::reset();
+        //The requests read the snapshots while the materialization runs
+        mat->sn->enableSnapshots();
+        mat->sn->run();
+        if (vm["queryIndexes"].as<bool>()) {
+            mat->sn->buildQueryIndexes();
+        }
     }
 }
 
@@ -86,14 +97,15 @@ void WebInterface::start(int port) {
 
 void WebInterface::stop() {
     LOG(INFOL) << "Stopping server ...";
-    while (isActive) {
+    while (nActiveRequests > 0) {
         std::this_thread::sleep_for(chrono::milliseconds(100));
     }
     LOG(INFOL) << "Done";
 }
 
 long WebInterface::getDurationExecMs() {
-    std::chrono::system_clock::time_point start = sn->getStartingTimeMs();
+    std::shared_ptr<const Materialization> mat = getMaterialization();
+    std::chrono::system_clock::time_point start = mat->sn->getStartingTimeMs();
     std::chrono::duration<double> sec = std::chrono::system_clock::now() - start;
     return std::chrono::duration_cast<std::chrono::milliseconds>(sec).count();
 }
@@ -124,31 +136,58 @@ std::string WebInterface::lookup(std::string sId, DBLayer &db) {
 }
 
 
-void WebInterface::getResultsQueryLiteral(std::string predicate, long limit, JSON &out) {
+static Term_t getResultValue(SegmentIterator *itr, const uint8_t pos) {
+    return itr->get(pos);
+}
+
+static Term_t getResultValue(FCInternalTableItr *itr, const uint8_t pos) {
+    return itr->getCurrentValue(pos);
+}
+
+template<typename I>
+static void addResultRows(I *tableItr, const uint8_t card, const long limit,
+        EDBLayer &edb, JSON &data, long &nshownresults) {
+    while (tableItr->hasNext() && (limit == -1 || nshownresults < limit)) {
+        tableItr->next();
+        JSON row;
+        for(int j = 0; j < card; ++j) {
+            auto termId = getResultValue(tableItr, j);
+            auto txtTerm = edb.getDictText(termId);
+            row.push_back(txtTerm);
+        }
+        data.push_back(row);
+        nshownresults++;
+    }
+}
+
+void WebInterface::getResultsQueryLiteral(std::string predicate, long limit,
+        Program *program, EDBLayer &edb, std::shared_ptr<SemiNaiver> sn,
+        JSON &out) {
     long nresults = 0;
     long nshownresults = 0;
     JSON data;
     if (program != NULL && sn != NULL) {
         Predicate pred = program->getPredicate(predicate);
-        nresults = sn->getSizeTable(pred.getId());
-        auto itr = sn->getTable(pred.getId());
-        while (!itr.isEmpty() && (limit == -1 || nshownresults < limit)) {
-            auto table = itr.getCurrentTable();
-            auto tableItr = table->getIterator();
-            auto card = table->getRowSize();
-            while (tableItr->hasNext() && (limit == -1 || nshownresults < limit)) {
-                tableItr->next();
-                JSON row;
-                for(int j = 0; j < card; ++j) {
-                    auto termId = tableItr->getCurrentValue(j);
-                    auto txtTerm = edb->getDictText(termId);
-                    row.push_back(txtTerm);
-                }
-                data.push_back(row);
-                nshownresults++;
+        std::shared_ptr<const MaterializationSnapshot> snapshot =
+            sn->getSnapshot(pred.getId());
+        nresults = snapshot->getNRows();
+        const auto card = pred.getCardinality();
+        for (const auto &block : snapshot->getBlocks()) {
+            if (limit != -1 && nshownresults >= limit) {
+                break;
+            }
+            if (block.rows) {
+                auto tableItr = block.rows->iterator();
+                addResultRows(tableItr.get(), card, limit, edb, data,
+                        nshownresults);
+                tableItr->clear();
+            } else {
+                //EDB tables are immutable and are read directly
+                FCInternalTableItr *tableItr = block.source->getIterator();
+                addResultRows(tableItr, card, limit, edb, data,
+                        nshownresults);
+                block.source->releaseIterator(tableItr);
             }
-            table->releaseIterator(tableItr);
-            itr.moveNextCount();
         }
     }
     out.add_child("rows", data);
@@ -160,9 +199,27 @@ void WebInterface::getResultsQueryLiteral(std::string predicate, long limit, JSO
 
 void WebInterface::processRequest(std::string req, std::string &resp) {
     setActive();
+    //The server runs several requests at the same time. Each one keeps
+    //the KB and the materialization that were there when it started, even
+    //if /setup or /launchMat replace them in the meantime
+    std::shared_ptr<EDBLayer> edb;
+    std::shared_ptr<Program> program;
+    std::shared_ptr<VLogLayer> vloglayer;
+    std::shared_ptr<TridentLayer> tridentlayer;
+    std::shared_ptr<const Materialization> mat;
+    {
+        std::lock_guard<std::mutex> lock(mtxKB);
+        edb = this->edb;
+        program = this->program;
+        vloglayer = this->vloglayer;
+        tridentlayer = this->tridentlayer;
+        mat = this->mat;
+    }
+    std::shared_ptr<SemiNaiver> sn = mat->sn;
     //Get the page
     std::string page;
     bool isjson = false;
+    bool ismetrics = false;
     int error = 0;
     if (Utils::starts_with(req, "POST")) {
         int pos = req.find("HTTP");
@@ -172,6 +229,11 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
             std::string form = req.substr(req.find("application/x-www-form-urlencoded"));
             std::string printresults = _getValueParam(form, "print");
             std::string sparqlquery = _getValueParam(form, "query");
+            std::string stimeout = _getValueParam(form, "timeout");
+            uint64_t timeout = sparqlTimeout;
+            if (stimeout != "") {
+                timeout = stoull(stimeout);
+            }
             //Decode the query
             sparqlquery = HttpClient::unescape(sparqlquery);
             std::regex e1("\\+");
@@ -192,9 +254,10 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
             JSON bindings;
             JSON stats;
             bool jsonoutput = printresults == std::string("true");
-            if (program) {
+            bool completed = true;
+            if (vloglayer) {
                 LOG(INFOL) << "Answering the SPARQL query with VLog ...";
-                VLogUtils::execSPARQLQuery(sparqlquery,
+                completed = VLogUtils::execSPARQLQuery(sparqlquery,
                         false,
                         edb->getNTerms(),
                         *(vloglayer.get()),
@@ -202,10 +265,11 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
                         jsonoutput,
                         &vars,
                         &bindings,
-                        &stats);
-            } else {
+                        &stats,
+                        timeout);
+            } else if (tridentlayer) {
                 LOG(INFOL) << "Answering the SPARQL query with Trident ...";
-                VLogUtils::execSPARQLQuery(sparqlquery,
+                completed = VLogUtils::execSPARQLQuery(sparqlquery,
                         false,
                         edb->getNTerms(),
                         *(tridentlayer.get()),
@@ -213,16 +277,26 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
                         jsonoutput,
                         &vars,
                         &bindings,
-                        &stats);
+                        &stats,
+                        timeout);
+            } else {
+                error = 1;
+            }
+            if (!completed) {
+                //The results are incomplete
+                page = "The query did not finish within " +
+                    std::to_string(timeout) + " ms";
+                error = 1;
+            } else {
+                pt.add_child("head.vars", vars);
+                pt.add_child("results.bindings", bindings);
+                pt.add_child("stats", stats);
+
+                std::ostringstream buf;
+                JSON::write(buf, pt);
+                page = buf.str();
+                isjson = true;
             }
-            pt.add_child("head.vars", vars);
-            pt.add_child("results.bindings", bindings);
-            pt.add_child("stats", stats);
-
-            std::ostringstream buf;
-            JSON::write(buf, pt);
-            page = buf.str();
-            isjson = true;
         } else if (path == "/gentq") {
             //Get all query
             string form = req.substr(req.find("application/x-www-form-urlencoded"));
@@ -412,7 +486,11 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
             if (slimit != "") {
                 limit = stoi(slimit);
             }
-            getResultsQueryLiteral(predicate, limit, pt);
+            //The predicates and terms of sn are those of the KB it was
+            //created on, which /setup may have replaced since
+            getResultsQueryLiteral(predicate, limit,
+                    sn ? sn->getProgram() : program.get(),
+                    sn ? sn->getEDBLayer() : *edb, sn, pt);
             std::ostringstream buf;
             JSON::write(buf, pt);
             page = buf.str();
@@ -453,11 +531,12 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
 
             //Cleanup and install the EDB layer
             EDBConf conf(edbFile, true);
-            edb = std::unique_ptr<EDBLayer>(new EDBLayer(conf, false));
-            setupTridentLayer();
+            edb = std::shared_ptr<EDBLayer>(new EDBLayer(conf, false));
+            tridentlayer = setupTridentLayer(*edb);
 
             //Setup the program
-            program = std::unique_ptr<Program>(new Program(edb.get()));
+            program = std::shared_ptr<Program>(new Program(edb.get()));
+            vloglayer = NULL;
             std::string s = program->readFromString(srules, vm["rewriteMultihead"].as<bool>());
             if (s != "") {
                 error = 1;
@@ -490,8 +569,17 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
                     LOG(INFOL) << "Runtime pre-materialization = " <<
                         sec.count() * 1000 << " milliseconds";
                 }
+                vloglayer = std::shared_ptr<VLogLayer>(new VLogLayer(*edb,
+                            *program, vm["reasoningThreshold"].as<int64_t>(),
+                            "TI", "TE"));
                 page = "OK!";
             }
+            //The requests that start from now on use the new KB
+            std::lock_guard<std::mutex> lock(mtxKB);
+            this->edb = edb;
+            this->program = program;
+            this->vloglayer = vloglayer;
+            this->tridentlayer = tridentlayer;
         } else {
             page = "Error!";
         }
@@ -510,17 +598,16 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
             long time = getDurationExecMs();
             pt.put("runtime", to_string(time));
             //Semi naiver details
-            if (getSemiNaiver()->isRunning())
+            if (sn->isRunning())
                 pt.put("finished", "false");
             else
                 pt.put("finished", "true");
-            size_t currentIteration = getSemiNaiver()->getCurrentIteration();
+            size_t currentIteration = sn->getCurrentIteration();
             pt.put("iteration", currentIteration);
-            pt.put("rule", getSemiNaiver()->getCurrentRule());
+            pt.put("rule", sn->getCurrentRule());
 
             std::vector<StatsRule> outputrules =
-                getSemiNaiver()->
-                getOutputNewIterations();
+                sn->getOutputNewIterations();
             std::string outrules = "";
             for (const auto &el : outputrules) {
                 outrules += to_string(el.iteration) + "," +
@@ -537,6 +624,32 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
             page = buf.str();
             isjson = true;
 
+        } else if (path == "/metrics") {
+            //Prometheus text format
+            std::ostringstream buf;
+            std::shared_ptr<SemiNaiver> naiver = sn;
+            if (naiver) {
+                std::shared_ptr<const MaterializationSnapshots> snapshots =
+                    naiver->getSnapshots();
+                RuntimeMetrics::write(buf, naiver->getProgram(),
+                        &naiver->getEDBLayer(), snapshots.get());
+            } else {
+                RuntimeMetrics::write(buf, program.get(), edb.get(), NULL);
+            }
+            buf << "# HELP vlog_memory_used_megabytes Maximum resident memory of the process.\n";
+            buf << "# TYPE vlog_memory_used_megabytes gauge\n";
+            buf << "vlog_memory_used_megabytes " << (long)Utils::get_max_mem() << "\n";
+            if (naiver) {
+                buf << "# HELP vlog_materialization_running Whether a materialization is running.\n";
+                buf << "# TYPE vlog_materialization_running gauge\n";
+                buf << "vlog_materialization_running " << (naiver->isRunning() ? 1 : 0) << "\n";
+                buf << "# HELP vlog_materialization_iteration Current iteration of the materialization.\n";
+                buf << "# TYPE vlog_materialization_iteration gauge\n";
+                buf << "vlog_materialization_iteration " << naiver->getCurrentIteration() << "\n";
+            }
+            page = buf.str();
+            ismetrics = true;
+
         } else if (path == "/refreshmem") {
             JSON pt;
             long usedmem = (long)Utils::get_max_mem(); //Already in MB
@@ -556,11 +669,11 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
             long totmem = Utils::getSystemMemory() / 1024 / 1024;
             pt.put("totmem", to_string(totmem));
             pt.put("commandline", getCommandLineArgs());
-            pt.put("nrules", (unsigned int) getSemiNaiver()->getProgram()->getNRules());
+            pt.put("nrules", (unsigned int) sn->getProgram()->getNRules());
             ////obsolete
             //pt.put("rules", getSemiNaiver()->getListAllRulesForJSONSerialization());
-            pt.put("nedbs", (unsigned int) getSemiNaiver()->getProgram()->getNEDBPredicates());
-            pt.put("nidbs", (unsigned int) getSemiNaiver()->getProgram()->getNIDBPredicates());
+            pt.put("nedbs", (unsigned int) sn->getProgram()->getNEDBPredicates());
+            pt.put("nidbs", (unsigned int) sn->getProgram()->getNIDBPredicates());
             std::ostringstream buf;
             JSON::write(buf, pt);
             //write_json(buf, pt, false);
@@ -631,9 +744,10 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
         } else if (path == "/launchMat") {
             //Start a materialization
             if (program) {
-                if (!sn || !sn->isRunning()) {
+                std::unique_lock<std::mutex> lock(mtxKB);
+                if (!this->mat->sn || !this->mat->sn->isRunning()) {
                     bool multithreaded = vm["multithreaded"].as<bool>();
-                    sn = Reasoner::getSemiNaiver(*edb.get(),
+                    std::shared_ptr<SemiNaiver> newsn = Reasoner::getSemiNaiver(*edb.get(),
                             program.get(), ! vm["no-intersect"].as<bool>(),
                             ! vm["no-filtering"].as<bool>(),
                             multithreaded,
@@ -642,6 +756,9 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
                             multithreaded ? vm["nthreads"].as<int>() : -1,
                             multithreaded ? vm["interRuleThreads"].as<int>() : 0,
                             vm["shufflerules"].as<bool>());
+                    this->mat = std::shared_ptr<const Materialization>(
+                            new Materialization{edb, program, newsn});
+                    lock.unlock();
                     cvMatRunner.notify_one(); //start the computation
                     page = getPage("/mat/infobox.html");
                 } else {
@@ -655,7 +772,7 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
 
         } else if (path == "/sizeidbs") {
             JSON pt;
-            std::vector<std::pair<string, std::vector<StatsSizeIDB>>> sizeIDBs = getSemiNaiver()->getSizeIDBs();
+            std::vector<std::pair<string, std::vector<StatsSizeIDB>>> sizeIDBs = sn->getSizeIDBs();
             //Construct the string
             std::string flat = "";
             for (auto el : sizeIDBs) {
@@ -695,6 +812,8 @@ void WebInterface::processRequest(std::string req, std::string &resp) {
 
     if (isjson) {
         resp = "HTTP/1.1 " + code + "\r\nContent-Type: application/json\nContent-Length: " + to_string(page.size()) + "\r\n\r\n" + page;
+    } else if (ismetrics) {
+        resp = "HTTP/1.1 " + code + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + to_string(page.size()) + "\r\n\r\n" + page;
     } else {
         resp = "HTTP/1.1 " + code + "\r\nContent-Length: " + to_string(page.size()) + "\r\n\r\n" + page;
     }
@@ -706,8 +825,11 @@ std::string WebInterface::getDefaultPage() {
 }
 
 std::string WebInterface::getPage(std::string f) {
-    if (cachehtml.count(f)) {
-        return cachehtml.find(f)->second;
+    {
+        std::lock_guard<std::mutex> lock(mtxCache);
+        if (cachehtml.count(f)) {
+            return cachehtml.find(f)->second;
+        }
     }
 
     //Read the file (if any) and return it to the user
@@ -725,6 +847,7 @@ std::string WebInterface::getPage(std::string f) {
         if (index != std::string::npos)
             contentFile.replace(index, 8, to_string(webport));
 
+        std::lock_guard<std::mutex> lock(mtxCache);
         cachehtml.insert(make_pair(f, contentFile));
         return contentFile;
     }